@@ -4,6 +4,7 @@
 #ifndef AKTUALIZR_LITE_API_H_
 #define AKTUALIZR_LITE_API_H_
 
+#include <functional>
 #include <string>
 
 #include <boost/filesystem.hpp>
@@ -119,6 +120,18 @@ class DownloadResult {
 std::ostream &operator<<(std::ostream &os, const InstallResult &res);
 std::ostream &operator<<(std::ostream &os, const DownloadResult &res);
 
+/**
+ * Progress of an App blob download, reported while InstallContext::Download() is in progress
+ */
+struct DownloadProgress {
+  std::string app;
+  std::string blob;
+  uint64_t bytes_done{0};
+  uint64_t bytes_total{0};
+  // the current download throughput
+  uint64_t bytes_per_second{0};
+};
+
 /**
  * The installation mode to be applied. Specified during InstallContext context initialization.
  */
@@ -161,6 +174,21 @@ class InstallContext {
 
   virtual void QueueEvent(std::string ecu_serial, SecondaryEvent event, std::string details) = 0;
 
+  using DownloadProgressCb = std::function<void(const DownloadProgress &)>;
+  /**
+   * Sets a callback to receive the download progress of Target Apps during the subsequent Download() calls.
+   * The callback is invoked from the downloading threads, one invocation at a time, and it should return quickly.
+   * The default implementation ignores the callback.
+   */
+  virtual void SetDownloadProgressCb(DownloadProgressCb cb) { (void)cb; }
+
+  /**
+   * Marks the subsequent Download() calls as a background prefetch. Their transfers are paused while a download or
+   * installation that is not a background one is in progress, e.g. a user-initiated install, and resumed afterwards.
+   * The default implementation ignores the call.
+   */
+  virtual void SetBackground(bool background) { (void)background; }
+
  protected:
   InstallContext() = default;
 };
@@ -22,6 +22,7 @@
 #include "composeapp/appengine.h"
 #include "composeappmanager.h"
 #include "docker/restorableappengine.h"
+#include "downloadscheduler.h"
 #include "ostree/repo.h"
 #include "tuf/akhttpsreposource.h"
 #include "tuf/akrepo.h"
@@ -667,6 +668,8 @@ class LiteInstall : public InstallContext {
       : client_(std::move(client)), target_(std::move(t)), reason_(reason), mode_{install_mode} {}
 
   InstallResult Install() override {
+    // the prefetches in progress are paused until the installation completes
+    DownloadScheduler::Session session{DownloadScheduler::instance(), false};
     client_->logTarget("Installing: ", *target_);
 
     // Call appsInSync to update applications list inside the package manager
@@ -722,7 +725,8 @@ class LiteInstall : public InstallContext {
 
     client_->logTarget("Downloading: ", *target_);
 
-    auto download_res{client_->download(*target_, reason)};
+    DownloadScheduler::Session session{DownloadScheduler::instance(), background_};
+    auto download_res{client_->download(*target_, reason, getProgressHandler())};
     if (!download_res) {
       return DownloadResult{download_res.status, download_res.description, download_res.destination_path,
                             download_res.stat};
@@ -739,6 +743,10 @@ class LiteInstall : public InstallContext {
 
   std::string GetCorrelationId() override { return target_->correlation_id(); }
 
+  void SetDownloadProgressCb(DownloadProgressCb cb) override { progress_cb_ = std::move(cb); }
+
+  void SetBackground(bool background) override { background_ = background; }
+
   void QueueEvent(std::string ecu_serial, SecondaryEvent event, std::string details) override {
     Uptane::EcuSerial serial(ecu_serial);
     std::unique_ptr<ReportEvent> e;
@@ -770,10 +778,21 @@ class LiteInstall : public InstallContext {
   }
 
  protected:
+  AppEngine::PullProgressHandler getProgressHandler() const {
+    if (!progress_cb_) {
+      return nullptr;
+    }
+    return [this](const AppEngine::PullProgress& progress) {
+      progress_cb_(DownloadProgress{progress.app, progress.blob, progress.done, progress.total, progress.rate});
+    };
+  }
+
   std::shared_ptr<LiteClient> client_;
   std::unique_ptr<Uptane::Target> target_;
   std::string reason_;
   InstallMode mode_;
+  DownloadProgressCb progress_cb_;
+  bool background_{false};
 };
 
 class BaseHttpClient : public HttpInterface {
@@ -812,14 +831,10 @@ class BaseHttpClient : public HttpInterface {
   std::future<HttpResponse> downloadAsync(const std::string& url, curl_write_callback write_cb,
                                           curl_xferinfo_callback progress_cb, void* userp, curl_off_t from,
                                           CurlHandler* easyp) override {
-    (void)url;
-    (void)write_cb;
-    (void)progress_cb;
-    (void)userp;
-    (void)from;
     (void)easyp;
+    // the derived clients serve local data, so the download completes right away
     std::promise<HttpResponse> resp_promise;
-    resp_promise.set_value(HttpResponse("", 501, CURLE_OK, ""));
+    resp_promise.set_value(download(url, write_cb, progress_cb, userp, from));
     return resp_promise.get_future();
   }
   void setCerts(const std::string& ca, CryptoSource ca_source, const std::string& cert, CryptoSource cert_source,
@@ -943,6 +958,16 @@ class LocalLiteInstall : public LiteInstall {
     client_->logTarget("Copying: ", *target_);
 
     auto downloader = createOfflineDownloader();
+    auto* compose_downloader{dynamic_cast<ComposeAppManager*>(downloader.get())};
+    if (compose_downloader != nullptr) {
+      compose_downloader->setPullProgressHandler(
+          [this, progress_handler = getProgressHandler()](const AppEngine::PullProgress& progress) {
+            if (progress_handler) {
+              progress_handler(progress);
+            }
+            client_->notifyDownloadProgress(*target_, progress);
+          });
+    }
     client_->notifyDownloadStarted(*target_, reason);
     auto dr{downloader->Download(Target::toTufTarget(*target_))};
     client_->notifyDownloadFinished(*target_, dr, dr.description);
@@ -4,3 +4,31 @@
 bool operator&(const AppEngine::Apps& apps, const AppEngine::App& app) {
   return apps.end() != std::find(apps.begin(), apps.end(), app);
 }
+
+AppEngine::AppsStatus AppEngine::getAppsStatus(const Apps& apps) const {
+  AppsStatus statuses;
+  for (const auto& app : apps) {
+    auto& status{statuses[app.name]};
+    status.running = isRunning(app);
+    // the running App is installed, otherwise an engine doesn't tell whether the App is installed partially or at all
+    status.installed = status.running;
+    if (!status.running) {
+      // the App is updated anyway, no need in the costly check whether it's fetched
+      continue;
+    }
+    status.fetched = isFetched(app);
+  }
+  return statuses;
+}
+
+void AppEngine::setPullProgressHandler(PullProgressHandler handler) {
+  std::lock_guard<std::mutex> lock{pull_progress_mutex_};
+  pull_progress_handler_ = std::move(handler);
+}
+
+void AppEngine::notifyPullProgress(const PullProgress& progress) const {
+  std::lock_guard<std::mutex> lock{pull_progress_mutex_};
+  if (pull_progress_handler_) {
+    pull_progress_handler_(progress);
+  }
+}
@@ -1,10 +1,13 @@
 #ifndef AKTUALIZR_LITE_APP_ENGINE_H_
 #define AKTUALIZR_LITE_APP_ENGINE_H_
 
+#include <atomic>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
+#include <unordered_map>
 
 #include "json/json.h"
 
@@ -50,6 +53,7 @@ class AppEngine {
       Failed,
       InsufficientSpace,
       ImagePullFailure,
+      Cancelled,
     };
     // NOLINTNEXTLINE(google-explicit-constructor, hicpp-explicit-conversions)
     Result(bool var, std::string errMsg = "") : status{var ? ID::OK : ID::Failed}, err{std::move(errMsg)} {}
@@ -60,13 +64,31 @@ class AppEngine {
     operator bool() const { return status == ID::OK; }
     bool noSpace() const { return status == ID::InsufficientSpace; }
     bool imagePullFailure() const { return status == ID::ImagePullFailure; }
+    bool cancelled() const { return status == ID::Cancelled; }
 
     ID status;
     std::string err;
     storage::Volume::UsageInfo stat{.err = "undefined"};
   };
 
+  struct AppStatus {
+    bool fetched{false};
+    bool installed{false};
+    bool running{false};
+  };
+
+  // Progress of a single blob pull, `rate` is the current throughput in bytes per second
+  struct PullProgress {
+    std::string app;
+    std::string blob;
+    uint64_t done{0};
+    uint64_t total{0};
+    uint64_t rate{0};
+  };
+  using PullProgressHandler = std::function<void(const PullProgress&)>;
+
   using Apps = std::vector<App>;
+  using AppsStatus = std::unordered_map<std::string, AppStatus>;
   using Ptr = std::shared_ptr<AppEngine>;
 
   virtual Result fetch(const App& app) = 0;
@@ -80,6 +102,25 @@ class AppEngine {
   virtual Apps getInstalledApps() const = 0;
   virtual Json::Value getRunningAppsInfo() const = 0;
   virtual void prune(const Apps& app_shortlist) = 0;
+  // Returns the status of each of the given Apps, mapped by App name. The default implementation queries Apps one by
+  // one, an engine that can check many Apps at once should override it. Whether an App is fetched is checked only if
+  // it's running, otherwise the App is updated anyway and `fetched` is false.
+  virtual AppsStatus getAppsStatus(const Apps& apps) const;
+  // Interrupts fetches that are in progress in other threads, they fail soon after, and makes the fetches started
+  // afterwards fail at once, until resumeFetches() is called. The cancelled fetches return Result::ID::Cancelled.
+  // The default implementation doesn't interrupt the fetches in progress, they just run to completion.
+  virtual void cancelFetches() { fetches_cancelled_ = true; }
+  void resumeFetches() { fetches_cancelled_ = false; }
+  // Checks whether the stores have room for all the given Apps fetched together, counting the blobs shared by the Apps
+  // just once, so an update that cannot fit is rejected before any download starts. The default implementation does
+  // nothing, each App fetch checks the storage for itself.
+  virtual Result checkUpdateSize(const Apps& apps) {
+    (void)apps;
+    return true;
+  }
+  // Sets the handler of progress events reported by fetches, nullptr resets it. The handler is invoked from the
+  // fetching threads, the invocations are serialized. An engine that cannot track progress never invokes it.
+  void setPullProgressHandler(PullProgressHandler handler);
 
   virtual ~AppEngine() = default;
   AppEngine(const AppEngine&&) = delete;
@@ -89,6 +130,13 @@ class AppEngine {
 
  protected:
   AppEngine() = default;
+  void notifyPullProgress(const PullProgress& progress) const;
+  bool fetchesCancelled() const { return fetches_cancelled_; }
+
+ private:
+  mutable std::mutex pull_progress_mutex_;
+  PullProgressHandler pull_progress_handler_;
+  std::atomic_bool fetches_cancelled_{false};
 };
 
 bool operator&(const AppEngine::Apps& apps, const AppEngine::App& app);
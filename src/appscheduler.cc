@@ -0,0 +1,182 @@
+#include "appscheduler.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <boost/algorithm/string.hpp>
+
+#include "logging/logging.h"
+
+AppScheduler::AppScheduler(int parallelism, Deps deps, bool fail_fast)
+    : parallelism_{parallelism}, deps_{std::move(deps)}, fail_fast_{fail_fast} {
+  if (parallelism_ < 1) {
+    throw std::invalid_argument("App scheduler parallelism must be greater than 0, got " +
+                                std::to_string(parallelism_));
+  }
+}
+
+std::vector<AppScheduler::AppResult> AppScheduler::run(const AppEngine::Apps& apps, const Action& action) const {
+  enum class State { Pending, Running, Succeeded, Failed, Skipped };
+
+  std::vector<AppResult> results;
+  std::vector<State> states(apps.size(), State::Pending);
+  std::unordered_map<std::string, std::size_t> app_indexes;
+  for (std::size_t ii = 0; ii < apps.size(); ++ii) {
+    results.push_back({apps[ii], AppEngine::Result{false}, false, std::chrono::milliseconds{0}});
+    app_indexes.emplace(apps[ii].name, ii);
+  }
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::size_t running{0};
+  bool failed{false};
+
+  const auto skip{[&](std::size_t indx, const std::string& reason) {
+    LOG_WARNING << apps[indx].name << " is skipped; " << reason;
+    states[indx] = State::Skipped;
+    results[indx].result = AppEngine::Result{false, reason};
+  }};
+
+  // Returns the index of the App to process next, or apps.size() if there is nothing left to do; expects the lock
+  const auto next{[&](std::unique_lock<std::mutex>& lock) {
+    while (true) {
+      bool pending{false};
+      bool skipped{false};
+      for (std::size_t ii = 0; ii < apps.size(); ++ii) {
+        if (states[ii] != State::Pending) {
+          continue;
+        }
+        if (failed && fail_fast_) {
+          skip(ii, "another App has failed");
+          continue;
+        }
+        bool ready{true};
+        std::string failed_dep;
+        const auto deps_it{deps_.find(apps[ii].name)};
+        if (deps_it != deps_.end()) {
+          for (const auto& dep : deps_it->second) {
+            const auto dep_it{app_indexes.find(dep)};
+            if (dep_it == app_indexes.end()) {
+              continue;
+            }
+            const auto dep_state{states[dep_it->second]};
+            if (dep_state == State::Failed || dep_state == State::Skipped) {
+              failed_dep = dep;
+              break;
+            }
+            if (dep_state != State::Succeeded) {
+              ready = false;
+            }
+          }
+        }
+        if (!failed_dep.empty()) {
+          skip(ii, "the App it depends on has not succeeded: " + failed_dep);
+          skipped = true;
+          continue;
+        }
+        if (ready) {
+          return ii;
+        }
+        pending = true;
+      }
+      if (skipped) {
+        // Apps checked before the skipped one might depend on it
+        continue;
+      }
+      if (!pending) {
+        return apps.size();
+      }
+      if (running == 0) {
+        // there are pending Apps, but none of them is ready and nothing is running to make them ready
+        for (std::size_t ii = 0; ii < apps.size(); ++ii) {
+          if (states[ii] == State::Pending) {
+            skip(ii, "cyclic App dependency");
+          }
+        }
+        return apps.size();
+      }
+      cv.wait(lock);
+    }
+  }};
+
+  const auto work{[&]() {
+    std::unique_lock<std::mutex> lock{mutex};
+    while (true) {
+      const auto indx{next(lock)};
+      if (indx == apps.size()) {
+        cv.notify_all();
+        return;
+      }
+      states[indx] = State::Running;
+      ++running;
+      lock.unlock();
+
+      const auto started_at{std::chrono::steady_clock::now()};
+      AppEngine::Result res{false};
+      try {
+        res = action(apps[indx]);
+      } catch (const std::exception& exc) {
+        res = {false, exc.what()};
+      }
+      const auto duration{
+          std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started_at)};
+      LOG_INFO << apps[indx].name << (res ? " has succeeded" : " has failed") << " in " << duration.count() << " ms";
+
+      lock.lock();
+      --running;
+      states[indx] = res ? State::Succeeded : State::Failed;
+      failed = failed || !res;
+      results[indx] = {apps[indx], res, true, duration};
+      cv.notify_all();
+    }
+  }};
+
+  const auto started_at{std::chrono::steady_clock::now()};
+  const auto threads_number{std::min(static_cast<std::size_t>(parallelism_), apps.size())};
+  if (threads_number <= 1) {
+    work();
+  } else {
+    std::vector<std::thread> threads;
+    for (std::size_t ii = 0; ii < threads_number; ++ii) {
+      threads.emplace_back(work);
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  }
+  if (!apps.empty()) {
+    LOG_INFO << "Processed " << apps.size() << " Apps in "
+             << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started_at)
+                    .count()
+             << " ms";
+  }
+  return results;
+}
+
+AppScheduler::Deps AppScheduler::parseDeps(const std::string& deps_str) {
+  Deps deps;
+  std::vector<std::string> entries;
+  const auto trimmed{boost::trim_copy(deps_str)};
+  if (trimmed.empty()) {
+    return deps;
+  }
+  boost::split(entries, trimmed, boost::is_space(), boost::token_compress_on);
+  for (const auto& entry : entries) {
+    const auto colon_pos{entry.find(':')};
+    if (colon_pos == std::string::npos || colon_pos == 0 || colon_pos == entry.size() - 1) {
+      throw std::invalid_argument("Invalid App dependency declaration, expected <app>:<app>[,<app>...], got " +
+                                  entry);
+    }
+    std::vector<std::string> app_deps;
+    boost::split(app_deps, entry.substr(colon_pos + 1), boost::is_any_of(","), boost::token_compress_on);
+    auto& dst{deps[entry.substr(0, colon_pos)]};
+    for (const auto& dep : app_deps) {
+      if (!dep.empty()) {
+        dst.push_back(dep);
+      }
+    }
+  }
+  return deps;
+}
@@ -0,0 +1,47 @@
+#ifndef AKTUALIZR_LITE_APP_SCHEDULER_H_
+#define AKTUALIZR_LITE_APP_SCHEDULER_H_
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "appengine.h"
+
+/**
+ * @brief AppScheduler, runs an App engine action (install, run) for many Apps concurrently
+ *
+ * Up to `parallelism` Apps are processed at the same time. An App can depend on other Apps, in this case the action is
+ * not started for the App until it succeeds for all its dependencies. The App is skipped if one of its dependencies
+ * fails or is skipped itself. A dependency that is not among the Apps being processed is considered satisfied, e.g.
+ * it is an App that is not updated and keeps running.
+ */
+class AppScheduler {
+ public:
+  // App name -> names of Apps it depends on
+  using Deps = std::unordered_map<std::string, std::vector<std::string>>;
+  using Action = std::function<AppEngine::Result(const AppEngine::App&)>;
+
+  struct AppResult {
+    AppEngine::App app;
+    AppEngine::Result result;
+    bool started;
+    std::chrono::milliseconds duration;
+  };
+
+  explicit AppScheduler(int parallelism = 1, Deps deps = {}, bool fail_fast = false);
+
+  // Returns the results in the order of the given Apps
+  std::vector<AppResult> run(const AppEngine::Apps& apps, const Action& action) const;
+
+  // Parses a declaration of App dependencies, e.g. "app-02:app-01 app-03:app-01,app-02"
+  static Deps parseDeps(const std::string& deps_str);
+
+ private:
+  const int parallelism_;
+  const Deps deps_;
+  const bool fail_fast_;
+};
+
+#endif  // AKTUALIZR_LITE_APP_SCHEDULER_H_
@@ -1,9 +1,11 @@
 #include "appengine.h"
 
+#include <boost/algorithm/string/join.hpp>
 #include <boost/format.hpp>
 
 #include "aktualizr-lite/storage/stat.h"
 #include "exec.h"
+#include "pullprogress.h"
 
 namespace composeapp {
 enum class ExitCode { ExitCodeInsufficientSpace = 100 };
@@ -13,51 +15,71 @@ static bool checkAppInstallationStatus(const AppEngine::App& app, const Json::Va
 static bool isNullOrEmptyOrUnset(const Json::Value& val, const std::string& field);
 
 AppEngine::Result AppEngine::fetch(const App& app) {
+  if (fetchesCancelled()) {
+    return {Result::ID::Cancelled, "the App fetch has been cancelled"};
+  }
   Result res{false};
+  const FetchInProgress fetch_in_progress{this};
   try {
     // If a given app was fetched before, then don't consider it as a fetched app if a caller tries to fetch it again
     // for one reason or another - hence remove it from the set of fetched apps.
-    fetched_apps_.erase(app.uri);
-    if (local_source_path_.empty()) {
-      exec(boost::format{"%s --store %s pull -p %s --storage-usage-watermark %d"} % composectl_cmd_ % storeRoot() %
-               app.uri % storage_watermark_,
-           "failed to pull compose app", "", nullptr, "4h", true);
-    } else {
-      exec(boost::format{"%s --store %s pull -p %s -l %s --storage-usage-watermark %d"} % composectl_cmd_ %
-               storeRoot() % app.uri % local_source_path_ % storage_watermark_,
-           "failed to pull compose app", "", nullptr, "4h", true);
+    setAppFetched(app, false);
+    const auto storage_reservation{reserveStorage(app)};
+    // The pull progress is printed as before, and its stdout is also parsed into events for the pull progress handler
+    PullProgressParser progress_parser{app.name,
+                                       [this](const PullProgress& progress) { notifyPullProgress(progress); }};
+    const auto output_handler{
+        [&progress_parser](const char* data, std::size_t size) { progress_parser.feed(data, size); }};
+    // The pull runs in the fetch pool so it can be interrupted by cancelFetches()
+    const auto pull_cmd{local_source_path_.empty()
+                            ? boost::str(boost::format{"%s --store %s pull -p %s --storage-usage-watermark %d"} %
+                                         composectl_cmd_ % storeRoot().string() % app.uri % storage_watermark_)
+                            : boost::str(boost::format{"%s --store %s pull -p %s -l %s --storage-usage-watermark %d"} %
+                                         composectl_cmd_ % storeRoot().string() % app.uri % local_source_path_ %
+                                         storage_watermark_)};
+    auto job{fetch_pool_->submit(pull_cmd, "failed to pull compose app", "", "4h", true, output_handler)};
+    if (fetchesCancelled()) {
+      // the fetches have been cancelled while the pull was being submitted
+      job.cancel();
     }
+    job.get();
     res = true;
-    fetched_apps_.insert(app.uri);
+    setAppFetched(app, true);
+  } catch (const Docker::InsufficientSpaceError& exc) {
+    res = {Result::ID::InsufficientSpace, exc.what(), exc.stat};
   } catch (const ExecError& exc) {
     if (exc.ExitCode == static_cast<int>(ExitCode::ExitCodeInsufficientSpace)) {
       const auto usage_stat{Utils::parseJSON(exc.StdErr)};
       auto usage_info{storageSpaceFunc()(usage_stat["path"].asString())};
       res = {Result::ID::InsufficientSpace, exc.what(), usage_info.withRequired(usage_stat["required"].asUInt64())};
     } else {
-      res = {false, exc.what()};
+      res = {fetchesCancelled() ? Result::ID::Cancelled : Result::ID::Failed, exc.what()};
     }
   } catch (const std::exception& exc) {
-    res = {false, exc.what()};
+    res = {fetchesCancelled() ? Result::ID::Cancelled : Result::ID::Failed, exc.what()};
+  }
+  if (!res) {
+    // A failed pull might have added some blobs, it doesn't affect the Apps that are already fetched
+    saveFetchIndex();
   }
   return res;
 }
 
 void AppEngine::remove(const App& app) {
   try {
-    fetched_apps_.erase(app.uri);
+    setAppFetched(app, false);
     // "App removal" in this context refers to deleting app images from the Docker store
     // and removing the app compose project (app uninstall).
     // Unused app blobs will be removed from the blob store via the prune() method,
     // provided they are not utilized by any other app(s).
     // Note: Ensure the app is stopped before attempting to uninstall it.
 
-    exec(boost::format{"%s --store %s --compose %s stop %s"} % composectl_cmd_ % storeRoot() % installRoot() % app.name,
-         "failed to stop app");
+    runComposectl({"--store", storeRoot().string(), "--compose", installRoot().string(), "stop", app.name},
+                  "failed to stop app");
     // Uninstall app, it only removes the app compose/project directory, docker store pruning is in the `prune` call
-    exec(boost::format{"%s --store %s --compose %s uninstall --ignore-non-installed %s"} % composectl_cmd_ %
-             storeRoot() % installRoot() % app.name,
-         "failed to uninstall app");
+    runComposectl({"--store", storeRoot().string(), "--compose", installRoot().string(), "uninstall",
+                   "--ignore-non-installed", app.name},
+                  "failed to uninstall app");
   } catch (const std::exception& exc) {
     LOG_WARNING << "App: " << app.name << ", failed to remove: " << exc.what();
   }
@@ -67,9 +89,9 @@ bool AppEngine::isRunning(const App& app) const {
   bool res{false};
   try {
     std::string output;
-    exec(boost::format{"%s --store %s --compose %s ps %s --format json"} % composectl_cmd_ % storeRoot() %
-             installRoot() % app.uri,
-         "", "", &output);
+    runComposectl(
+        {"--store", storeRoot().string(), "--compose", installRoot().string(), "ps", app.uri, "--format", "json"}, "",
+        &output);
     const auto app_status{Utils::parseJSON(output)};
     // Make sure app images and bundle are properly installed
     res = checkAppInstallationStatus(app, app_status);
@@ -87,7 +109,7 @@ Json::Value AppEngine::getRunningAppsInfo() const {
   Json::Value app_statuses;
   try {
     std::string output;
-    exec(boost::format{"%s --store %s ps --format json"} % composectl_cmd_ % storeRoot(), "", "", &output);
+    runComposectl({"--store", storeRoot().string(), "ps", "--format", "json"}, "", &output);
     app_statuses = Utils::parseJSON(output);
   } catch (const std::exception& exc) {
     LOG_WARNING << "Failed to get an info about running containers: " << exc.what();
@@ -100,8 +122,7 @@ void AppEngine::prune(const Apps& app_shortlist) {
   try {
     // Remove apps that are not in the shortlist
     std::string output;
-    exec(boost::format{"%s --store %s ls --format json"} % composectl_cmd_ % storeRoot(), "failed to list apps", "",
-         &output);
+    runComposectl({"--store", storeRoot().string(), "ls", "--format", "json"}, "failed to list apps", &output);
     const auto app_list{Utils::parseJSON(output)};
 
     Apps apps_to_prune;
@@ -123,9 +144,9 @@ void AppEngine::prune(const Apps& app_shortlist) {
       }
     }
     for (const auto& app : apps_to_prune) {
-      fetched_apps_.erase(app.uri);
-      exec(boost::format{"%s --store %s rm %s --prune=false --quiet"} % composectl_cmd_ % storeRoot() % app.uri,
-           "failed to remove app");
+      setAppFetched(app, false);
+      runComposectl({"--store", storeRoot().string(), "rm", app.uri, "--prune=false", "--quiet"},
+                    "failed to remove app");
     }
   } catch (const std::exception& exc) {
     LOG_WARNING << "Failed to remove unused apps: " << exc.what();
@@ -133,13 +154,14 @@ void AppEngine::prune(const Apps& app_shortlist) {
   try {
     // Pruning unused store blobs
     std::string output;
-    exec(boost::format{"%s --store %s prune --format=json"} % composectl_cmd_ % storeRoot(),
-         "failed to prune app blobs", "", &output);
+    runComposectl({"--store", storeRoot().string(), "prune", "--format=json"}, "failed to prune app blobs", &output);
     const auto pruned_blobs{Utils::parseJSON(output)};
 
     // If at least one blob was pruned then the docker store needs to be pruned too to remove corresponding blobs
     // from the docker store
     if (!pruned_blobs.isNull() && !pruned_blobs.empty()) {
+      // Only the blobs not referenced by the remaining Apps are pruned, so the fetched ones stay intact
+      saveFetchIndex();
       LOG_INFO << "Pruning unused docker containers";
       dockerClient()->pruneContainers();
       LOG_INFO << "Pruning unused docker images";
@@ -150,20 +172,112 @@ void AppEngine::prune(const Apps& app_shortlist) {
   }
 }
 
+AppEngine::AppsStatus AppEngine::getAppsStatus(const Apps& apps) const {
+  AppsStatus statuses;
+  if (apps.empty()) {
+    return statuses;
+  }
+
+  // Installation and run status of all Apps by a single `ps` call
+  try {
+    std::vector<std::string> args{"--store", storeRoot().string(), "--compose", installRoot().string(), "ps"};
+    for (const auto& app : apps) {
+      args.emplace_back(app.uri);
+    }
+    args.insert(args.end(), {"--format", "json"});
+    std::string output;
+    runComposectl(args, "failed to get apps status", &output);
+    const auto apps_status{Utils::parseJSON(output)};
+    for (const auto& app : apps) {
+      auto& status{statuses[app.name]};
+      status.installed = checkAppInstallationStatus(app, apps_status);
+      status.running = status.installed && checkAppStatus(app, apps_status);
+    }
+  } catch (const std::exception& exc) {
+    LOG_WARNING << "Failed to get status of all apps at once, checking them one by one; err: " << exc.what();
+    return Docker::RestorableAppEngine::getAppsStatus(apps);
+  }
+
+  // Fetch status of the running Apps that are not known to be fetched by a single `check` call, the not running
+  // ones are updated anyway
+  Apps apps_to_check;
+  {
+    std::lock_guard<std::mutex> lock{fetched_apps_mutex_};
+    for (const auto& app : apps) {
+      if (!statuses[app.name].running) {
+        continue;
+      }
+      if (fetched_apps_.count(app.uri) > 0) {
+        statuses[app.name].fetched = true;
+      } else {
+        apps_to_check.push_back(app);
+      }
+    }
+  }
+  // Most of the time the Apps are fetched, which is confirmed by reading the store, the rest is checked by composectl
+  apps_to_check.erase(std::remove_if(apps_to_check.begin(), apps_to_check.end(),
+                                     [this, &statuses](const App& app) {
+                                       if (!checkStore(app)) {
+                                         return false;
+                                       }
+                                       statuses[app.name].fetched = true;
+                                       return true;
+                                     }),
+                      apps_to_check.end());
+  if (apps_to_check.empty()) {
+    return statuses;
+  }
+  if (apps_to_check.size() == 1) {
+    statuses[apps_to_check.front().name].fetched = isFetched(apps_to_check.front());
+    return statuses;
+  }
+
+  bool all_fetched{false};
+  try {
+    std::vector<std::string> args{"--store", storeRoot().string(), "check"};
+    for (const auto& app : apps_to_check) {
+      args.emplace_back(app.uri);
+    }
+    args.insert(args.end(), {"--local", "--format", "json"});
+    std::string output;
+    runComposectl(args, "", &output);
+    const auto fetch_status{Utils::parseJSON(output)};
+    all_fetched = fetch_status.isMember("fetch_check") && fetch_status["fetch_check"].isMember("missing_blobs") &&
+                  fetch_status["fetch_check"]["missing_blobs"].empty();
+  } catch (const std::exception& exc) {
+    LOG_DEBUG << "not all apps are fully fetched; status: " << exc.what();
+  }
+  for (const auto& app : apps_to_check) {
+    if (all_fetched) {
+      setAppFetched(app, true);
+      statuses[app.name].fetched = true;
+    } else {
+      // The missing blob list is common for all checked Apps, so find out which of them are not fully fetched
+      statuses[app.name].fetched = isFetched(app);
+    }
+  }
+  return statuses;
+}
+
 bool AppEngine::isAppFetched(const App& app) const {
   bool res{false};
-  if (fetched_apps_.count(app.uri) > 0) {
+  {
+    std::lock_guard<std::mutex> lock{fetched_apps_mutex_};
+    if (fetched_apps_.count(app.uri) > 0) {
+      return true;
+    }
+  }
+  if (checkStore(app)) {
     return true;
   }
   try {
     std::string output;
-    exec(boost::format{"%s --store %s check %s --local --format json"} % composectl_cmd_ % storeRoot() % app.uri, "",
-         "", &output);
+    runComposectl({"--store", storeRoot().string(), "check", app.uri, "--local", "--format", "json"}, "", &output);
     const auto app_fetch_status{Utils::parseJSON(output)};
     if (app_fetch_status.isMember("fetch_check") && app_fetch_status["fetch_check"].isMember("missing_blobs") &&
         app_fetch_status["fetch_check"]["missing_blobs"].empty()) {
       res = true;
-      fetched_apps_.insert(app.uri);
+      setAppFetched(app, true);
     }
   } catch (const ExecError& exc) {
     LOG_DEBUG << "app is not fully fetched; app: " << app.name << ", status: " << exc.what();
@@ -178,9 +292,8 @@ bool AppEngine::isAppInstalled(const App& app) const {
   bool res{false};
   try {
     std::string output;
-    exec(boost::format{"%s --store %s check %s --local --install --format json"} % composectl_cmd_ % storeRoot() %
-             app.uri,
-         "", "", &output);
+    runComposectl({"--store", storeRoot().string(), "check", app.uri, "--local", "--install", "--format", "json"}, "",
+                  &output);
     const auto app_fetch_status{Utils::parseJSON(output)};
     if (app_fetch_status.isMember("install_check") && app_fetch_status["install_check"].isMember(app.uri) &&
         app_fetch_status["install_check"][app.uri].isMember("missing_images") &&
@@ -198,11 +311,94 @@ bool AppEngine::isAppInstalled(const App& app) const {
 }
 
 void AppEngine::installAppAndImages(const App& app) {
-  exec(boost::format{"%s --store %s --compose %s --host %s install %s"} % composectl_cmd_ % storeRoot() %
-           installRoot() % dockerHost() % app.uri,
+  exec(boost::format{"%s --store %s --compose %s --host %s install %s"} % composectl_cmd_ % storeRoot().string() %
+           installRoot().string() % dockerHost() % app.uri,
        "failed to install compose app", "", nullptr, "4h", true);
 }
 
+bool AppEngine::checkStore(const App& app) const {
+  try {
+    const auto res{store_checker_.check(app.uri, dockerClient()->arch())};
+    if (res.fetched()) {
+      setAppFetched(app, true);
+      return true;
+    }
+    LOG_DEBUG << "app is not fully fetched; app: " << app.name << ", missing blobs: " << res.missing_blobs.size();
+  } catch (const std::exception& exc) {
+    LOG_DEBUG << "failed to check app blobs in the store; app: " << app.name << ", err: " << exc.what();
+  }
+  return false;
+}
+
+void AppEngine::setAppFetched(const App& app, bool fetched) const {
+  std::lock_guard<std::mutex> lock{fetched_apps_mutex_};
+  const bool changed{fetched ? fetched_apps_.insert(app.uri).second : fetched_apps_.erase(app.uri) > 0};
+  if (changed) {
+    fetch_index_.save(fetched_apps_);
+  }
+}
+
+void AppEngine::saveFetchIndex() const {
+  std::lock_guard<std::mutex> lock{fetched_apps_mutex_};
+  fetch_index_.save(fetched_apps_);
+}
+
+void AppEngine::cancelFetches() {
+  // the base class sets the cancel flag first, so the pulls submitted from now on are cancelled too
+  Docker::RestorableAppEngine::cancelFetches();
+  fetch_pool_->cancelAll();
+}
+
+Docker::RestorableAppEngine::StorageReservation AppEngine::reserveStorage(const App& app) const {
+  if (!reserve_storage_ || !local_source_path_.empty()) {
+    // `composectl pull` checks the available storage by itself, it's enough unless the pulls run concurrently
+    return {};
+  }
+  uint64_t required_storage{0};
+  try {
+    std::string output;
+    runComposectl({"--store", storeRoot().string(), "check", app.uri, "--format", "json"}, "", &output);
+    const auto fetch_status{Utils::parseJSON(output)};
+    for (const auto& blob : fetch_status["fetch_check"]["missing_blobs"]) {
+      const auto& size{blob.isMember("descriptor") ? blob["descriptor"]["size"] : blob["size"]};
+      required_storage += size.isIntegral() ? size.asUInt64() : 0;
+    }
+  } catch (const std::exception& exc) {
+    LOG_WARNING << "Failed to get size of app blobs to be pulled, app: " << app.name << ", err: " << exc.what();
+    return {};
+  }
+  return checkAvailableStorageInStores(app.name, required_storage, 0);
+}
+
+void AppEngine::runComposectl(const std::vector<std::string>& args, const std::string& err_msg,
+                              std::string* output) const {
+  std::shared_ptr<Session> session;
+  {
+    std::lock_guard<std::mutex> lock{session_mutex_};
+    session = session_;
+  }
+  if (session) {
+    try {
+      const auto resp{session->run(args)};
+      if (resp.exit_code != EXIT_SUCCESS) {
+        throw ExecError(err_msg, composectl_cmd_ + " " + boost::algorithm::join(args, " "),
+                        resp.err.empty() ? resp.out : resp.err, resp.exit_code);
+      }
+      if (output != nullptr) {
+        *output = resp.out;
+      }
+      return;
+    } catch (const Session::StartError& exc) {
+      LOG_WARNING << exc.what() << "; falling back to running composectl per request";
+      std::lock_guard<std::mutex> lock{session_mutex_};
+      session_.reset();
+    }
+  }
+  std::vector<std::string> cmd{composectl_cmd_};
+  cmd.insert(cmd.end(), args.begin(), args.end());
+  exec(cmd, err_msg, "", output);
+}
+
 static bool checkAppStatus(const AppEngine::App& app, const Json::Value& status) {
   if (!status.isMember(app.uri)) {
     LOG_ERROR << "could not get app status; uri: " << app.uri;
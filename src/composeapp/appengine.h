@@ -1,6 +1,13 @@
 #ifndef AKTUALIZR_LITE_COMPOSEAPP_APP_ENGINE_H
 #define AKTUALIZR_LITE_COMPOSEAPP_APP_ENGINE_H
 
+#include <algorithm>
+#include <memory>
+#include <mutex>
+
+#include "composeapp/fetchindex.h"
+#include "composeapp/session.h"
+#include "composeapp/storechecker.h"
 #include "docker/restorableappengine.h"
 
 namespace composeapp {
@@ -14,30 +21,65 @@ class AppEngine : public Docker::RestorableAppEngine {
             int storage_watermark = 80,
             StorageSpaceFunc storage_space_func = RestorableAppEngine::GetDefStorageSpaceFunc(),
             ClientImageSrcFunc client_image_src_func = nullptr, bool create_containers_if_install = true,
-            const std::string& local_source_path = "")
+            const std::string& local_source_path = "", bool use_worker = false, int max_parallel_fetches = 1,
+            const boost::filesystem::path& state_root = "")
       : Docker::RestorableAppEngine(
             std::move(store_root), std::move(install_root), std::move(docker_root), std::move(registry_client),
             std::move(docker_client), "", std::move(docker_host), std::move(compose_cmd), std::move(storage_space_func),
             std::move(client_image_src_func), create_containers_if_install, !local_source_path.empty()),
         composectl_cmd_{std::move(composectl_cmd)},
         storage_watermark_{storage_watermark},
-        local_source_path_{local_source_path} {}
+        local_source_path_{local_source_path},
+        session_{use_worker ? std::make_shared<Session>(composectl_cmd_) : nullptr},
+        fetch_pool_{std::make_shared<ExecPool>(static_cast<std::size_t>(std::max(max_parallel_fetches, 1)))},
+        reserve_storage_{max_parallel_fetches > 1},
+        fetch_index_{storeRoot(),
+                     (state_root.empty() ? GetDefStateRoot(storeRoot()) : state_root) / FetchIndex::FileName},
+        store_checker_{storeRoot()} {
+    // Apps verified as fetched before a restart don't need to be checked again if the store hasn't changed since then
+    fetched_apps_ = fetch_index_.load();
+  }
 
   Result fetch(const App& app) override;
   void remove(const App& app) override;
   bool isRunning(const App& app) const override;
   Json::Value getRunningAppsInfo() const override;
   void prune(const Apps& app_shortlist) override;
+  AppsStatus getAppsStatus(const Apps& apps) const override;
+  void cancelFetches() override;
+  // The store blobs are managed by composectl, so each App fetch checks the storage for itself
+  Result checkUpdateSize(const Apps& apps) override { return ::AppEngine::checkUpdateSize(apps); }
 
  private:
   bool isAppFetched(const App& app) const override;
   bool isAppInstalled(const App& app) const override;
   void installAppAndImages(const App& app) override;
 
+  // Runs a short-lived composectl query, either through the worker session if it's enabled or by spawning composectl
+  void runComposectl(const std::vector<std::string>& args, const std::string& err_msg,
+                     std::string* output = nullptr) const;
+  // Reserves the space required to pull the App's missing blobs, so the concurrent pulls count it in
+  StorageReservation reserveStorage(const App& app) const;
+  // Checks whether the App is fetched by reading the store in-process. Only a positive result is conclusive, since
+  // the check might not know about some detail of the store layout, then composectl should have the final say.
+  bool checkStore(const App& app) const;
+  // Updates the set of Apps known to be fetched and persists it
+  void setAppFetched(const App& app, bool fetched) const;
+  // Persists the set of Apps known to be fetched along with the current store stamp
+  void saveFetchIndex() const;
+
   const std::string composectl_cmd_;
   const int storage_watermark_;
   const std::string local_source_path_;
+  mutable std::mutex fetched_apps_mutex_;
   mutable std::set<std::string> fetched_apps_;
+  // the concurrent fetches run queries too, the session is held by each query, so it can be dropped by any of them
+  mutable std::mutex session_mutex_;
+  mutable std::shared_ptr<Session> session_;
+  ExecPool::Ptr fetch_pool_;
+  const bool reserve_storage_;
+  const FetchIndex fetch_index_;
+  const StoreChecker store_checker_;
 };
 
 }  // namespace composeapp
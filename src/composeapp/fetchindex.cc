@@ -0,0 +1,106 @@
+#include "fetchindex.h"
+
+#include <sys/stat.h>
+
+#include <iterator>
+
+#include <boost/range/iterator_range_core.hpp>
+
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+namespace composeapp {
+
+FetchIndex::FetchIndex(boost::filesystem::path store_root, boost::filesystem::path path)
+    : store_root_{std::move(store_root)}, path_{std::move(path)} {}
+
+std::set<std::string> FetchIndex::load() const {
+  std::set<std::string> app_uris;
+  if (!boost::filesystem::exists(path_)) {
+    return app_uris;
+  }
+  try {
+    const auto index{Utils::parseJSONFile(path_)};
+    const auto stamp{getStoreStamp(store_root_)};
+    if (stamp.empty() || index["stamp"].asString() != stamp) {
+      LOG_DEBUG << "The store has been changed since the fetched apps index was saved, ignoring the index";
+      return app_uris;
+    }
+    for (const auto& uri : index["apps"]) {
+      app_uris.insert(uri.asString());
+    }
+  } catch (const std::exception& exc) {
+    LOG_WARNING << "Failed to load the fetched apps index, ignoring it; path: " << path_ << ", err: " << exc.what();
+  }
+  return app_uris;
+}
+
+void FetchIndex::save(const std::set<std::string>& app_uris) const {
+  try {
+    const auto stamp{getStoreStamp(store_root_)};
+    if (stamp.empty()) {
+      return;
+    }
+    Json::Value index;
+    index["stamp"] = stamp;
+    index["apps"] = Json::arrayValue;
+    for (const auto& uri : app_uris) {
+      index["apps"].append(uri);
+    }
+    // write and rename, so a power cut cannot leave a truncated index behind
+    const auto tmp_path{path_.string() + ".tmp"};
+    Utils::writeFile(tmp_path, Utils::jsonToCanonicalStr(index), true);
+    boost::filesystem::rename(tmp_path, path_);
+  } catch (const std::exception& exc) {
+    LOG_WARNING << "Failed to save the fetched apps index; path: " << path_ << ", err: " << exc.what();
+  }
+}
+
+// Returns false if the directory doesn't exist
+static bool getDirStamp(const boost::filesystem::path& dir, std::string& stamp) {
+  struct stat st {};
+  if (stat(dir.c_str(), &st) != 0) {
+    return false;
+  }
+  stamp += std::to_string(st.st_ino) + ":" + std::to_string(st.st_mtim.tv_sec) + "." +
+           std::to_string(st.st_mtim.tv_nsec) + ";";
+  return true;
+}
+
+std::string FetchIndex::getStoreStamp(const boost::filesystem::path& store_root) {
+  // A directory's mtime changes whenever an entry is added, removed or renamed in it, and the blob store is
+  // flat, so it reflects any blob change made by a fetch or prune. The inode catches the directory re-creation.
+  // The App versions are kept in apps/<name>/<hash>, so the mtime of each App's directory is taken too.
+  // The mtime granularity is a kernel tick, so the number of blobs and App versions is added in case of a change
+  // within one tick.
+  const auto blobs_dir{store_root / "blobs" / "sha256"};
+  const auto apps_dir{store_root / "apps"};
+  std::string stamp;
+  if (!getDirStamp(blobs_dir, stamp) || !getDirStamp(apps_dir, stamp)) {
+    return "";
+  }
+  boost::system::error_code ec;
+  const auto blob_number{std::distance(boost::filesystem::directory_iterator(blobs_dir, ec), {})};
+  if (ec) {
+    return "";
+  }
+
+  // the directory listing order is not defined, so the App directories are sorted
+  std::set<boost::filesystem::path> app_dirs;
+  for (const auto& entry : boost::make_iterator_range(boost::filesystem::directory_iterator(apps_dir), {})) {
+    if (boost::filesystem::is_directory(entry)) {
+      app_dirs.insert(entry.path());
+    }
+  }
+  std::size_t app_version_number{0};
+  for (const auto& app_dir : app_dirs) {
+    stamp += app_dir.filename().string() + "=";
+    if (!getDirStamp(app_dir, stamp)) {
+      return "";
+    }
+    app_version_number += std::distance(boost::filesystem::directory_iterator(app_dir), {});
+  }
+  return stamp + std::to_string(blob_number) + ";" + std::to_string(app_version_number);
+}
+
+}  // namespace composeapp
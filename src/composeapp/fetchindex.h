@@ -0,0 +1,41 @@
+#ifndef AKTUALIZR_LITE_COMPOSEAPP_FETCH_INDEX_H
+#define AKTUALIZR_LITE_COMPOSEAPP_FETCH_INDEX_H
+
+#include <set>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+namespace composeapp {
+
+/**
+ * @brief FetchIndex, a persisted set of URIs of the Apps known to be completely fetched to the store
+ *
+ * The index is saved along with a stamp of the store's blob and App directories, which changes whenever a blob or an
+ * App version is added to or removed from the store. The index is loaded only if the stamp still matches, otherwise the
+ * store might have been modified by someone else, e.g. `composectl prune`, and the Apps must be verified again.
+ * The stamp doesn't cover the blob content, so a blob corrupted in place is not detected until the App is fetched
+ * again. The index is kept out of the store, the store is owned by composectl.
+ */
+class FetchIndex {
+ public:
+  static constexpr const char* const FileName{"aklite-fetched-apps.json"};
+
+  FetchIndex(boost::filesystem::path store_root, boost::filesystem::path path);
+
+  // Returns an empty set if there is no index or it is outdated
+  std::set<std::string> load() const;
+  // Saves the given App URIs along with the current stamp of the store, the error is logged and ignored
+  void save(const std::set<std::string>& app_uris) const;
+
+  // Returns an empty string if the store doesn't exist, throws std::exception if it cannot be read
+  static std::string getStoreStamp(const boost::filesystem::path& store_root);
+
+ private:
+  const boost::filesystem::path store_root_;
+  const boost::filesystem::path path_;
+};
+
+}  // namespace composeapp
+
+#endif  // AKTUALIZR_LITE_COMPOSEAPP_FETCH_INDEX_H
@@ -0,0 +1,184 @@
+#include "session.h"
+
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <array>
+#include <cstring>
+#include <thread>
+
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+extern char** environ;
+
+namespace composeapp {
+
+// The worker has gone away (crashed, killed, closed its end of the socket), it's fine to respawn it
+struct WorkerGoneError : std::runtime_error {
+  explicit WorkerGoneError(const std::string& err) : std::runtime_error(err) {}
+};
+
+Session::Session(std::string composectl_cmd, std::chrono::seconds timeout)
+    : cmd_{std::move(composectl_cmd)}, timeout_{timeout} {}
+
+Session::~Session() { stop(); }
+
+Session::Response Session::run(const std::vector<std::string>& args) {
+  std::lock_guard<std::mutex> lock{mutex_};
+
+  Json::Value req;
+  for (const auto& arg : args) {
+    req["args"].append(arg);
+  }
+
+  for (int attempt = 0;; ++attempt) {
+    if (pid_ == -1) {
+      start();
+    }
+    try {
+      req["id"] = Json::UInt64(++req_id_);
+      send(Utils::jsonToCanonicalStr(req));
+      const auto resp{Utils::parseJSON(receive())};
+      if (!resp.isObject() || resp["id"].asUInt64() != req_id_) {
+        throw WorkerGoneError("unexpected response from the composectl worker: " + Utils::jsonToCanonicalStr(resp));
+      }
+      return {resp["exit_code"].asInt(), resp["stdout"].asString(), resp["stderr"].asString()};
+    } catch (const WorkerGoneError& exc) {
+      LOG_WARNING << "composectl worker has gone away, restarting it; pid: " << pid_ << ", err: " << exc.what();
+      stop();
+      if (attempt > 0) {
+        throw std::runtime_error(std::string("composectl worker request failed: ") + exc.what());
+      }
+    } catch (const std::exception&) {
+      // don't leave the worker in an unknown state, e.g. with a half-read response in the socket
+      stop();
+      throw;
+    }
+  }
+}
+
+void Session::start() {
+  std::array<int, 2> sv{-1, -1};
+  if (-1 == socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv.data())) {
+    throw StartError(std::string("socketpair() failed: ") + std::strerror(errno));
+  }
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, sv[1], STDIN_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, sv[1], STDOUT_FILENO);
+
+  std::vector<char*> argv{const_cast<char*>(cmd_.c_str()), const_cast<char*>(ServeCmd), nullptr};
+  pid_t pid{-1};
+  const int err{posix_spawnp(&pid, cmd_.c_str(), &actions, nullptr, argv.data(), environ)};
+  posix_spawn_file_actions_destroy(&actions);
+  close(sv[1]);
+  if (err != 0) {
+    close(sv[0]);
+    throw StartError(cmd_ + ": " + std::strerror(err));
+  }
+
+  pid_ = pid;
+  fd_ = sv[0];
+  buffer_.clear();
+  try {
+    const auto hello{Utils::parseJSON(receive())};
+    if (!hello.isObject() || hello["version"].asInt() != ProtocolVersion) {
+      throw StartError("unsupported protocol: " + Utils::jsonToCanonicalStr(hello));
+    }
+  } catch (const StartError&) {
+    stop();
+    throw;
+  } catch (const std::exception& exc) {
+    stop();
+    throw StartError(exc.what());
+  }
+  LOG_DEBUG << "composectl worker has been started; pid: " << pid_;
+}
+
+void Session::stop() {
+  if (fd_ != -1) {
+    // the worker is supposed to exit on EOF
+    close(fd_);
+    fd_ = -1;
+  }
+  if (pid_ != -1) {
+    kill(pid_, SIGTERM);
+    // a hung worker must not hang the caller, e.g. the shutdown, so it's killed if it doesn't exit in time
+    const auto deadline{std::chrono::steady_clock::now() + StopGracePeriod};
+    pid_t res;
+    while (0 == (res = waitpid(pid_, nullptr, WNOHANG)) || (res == -1 && errno == EINTR)) {
+      if (std::chrono::steady_clock::now() >= deadline) {
+        LOG_WARNING << "composectl worker hasn't exited on SIGTERM, killing it; pid: " << pid_;
+        kill(pid_, SIGKILL);
+        while (-1 == waitpid(pid_, nullptr, 0) && errno == EINTR) {
+        }
+        break;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    pid_ = -1;
+  }
+  buffer_.clear();
+}
+
+void Session::send(const std::string& line) const {
+  const std::string data{line + '\n'};
+  std::size_t sent{0};
+  while (sent < data.size()) {
+    const auto res{::send(fd_, data.data() + sent, data.size() - sent, MSG_NOSIGNAL)};
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw WorkerGoneError(std::string("failed to send a request: ") + std::strerror(errno));
+    }
+    sent += static_cast<std::size_t>(res);
+  }
+}
+
+std::string Session::receive() {
+  const auto deadline{std::chrono::steady_clock::now() + timeout_};
+  std::array<char, 65536> chunk{};
+
+  std::size_t eol_pos;
+  while (std::string::npos == (eol_pos = buffer_.find('\n'))) {
+    const auto left{std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now())};
+    if (left.count() <= 0) {
+      throw std::runtime_error("timeout occurred while waiting for a response from the composectl worker");
+    }
+    pollfd pfd{fd_, POLLIN, 0};
+    const int poll_res{poll(&pfd, 1, static_cast<int>(left.count()))};
+    if (poll_res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error(std::string("poll() failed: ") + std::strerror(errno));
+    }
+    if (poll_res == 0) {
+      continue;
+    }
+    const auto read_res{read(fd_, chunk.data(), chunk.size())};
+    if (read_res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw WorkerGoneError(std::string("failed to read a response: ") + std::strerror(errno));
+    }
+    if (read_res == 0) {
+      throw WorkerGoneError("the worker has closed the connection");
+    }
+    buffer_.append(chunk.data(), static_cast<std::size_t>(read_res));
+  }
+
+  std::string line{buffer_.substr(0, eol_pos)};
+  buffer_.erase(0, eol_pos + 1);
+  return line;
+}
+
+}  // namespace composeapp
@@ -0,0 +1,75 @@
+#ifndef AKTUALIZR_LITE_COMPOSEAPP_SESSION_H
+#define AKTUALIZR_LITE_COMPOSEAPP_SESSION_H
+
+#include <sys/types.h>
+
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace composeapp {
+
+/**
+ * @brief Session, a client of a long-lived `composectl` worker process
+ *
+ * Instead of spawning a new `composectl` process per query, the session starts `<composectl> serve` once and sends
+ * it requests over a unix socket connected to the worker's stdin and stdout. The protocol is line-delimited JSON:
+ *
+ *  worker -> client, once on startup:  {"version": 1}
+ *  client -> worker, request:          {"id": <n>, "args": ["--store", "<path>", "ps", "--format", "json"]}
+ *  worker -> client, response:         {"id": <n>, "exit_code": <int>, "stdout": "<str>", "stderr": "<str>"}
+ *
+ * The `args` value is the same list of arguments that would be passed to the `composectl` binary on the command line.
+ * The worker's stderr is inherited, so its diagnostic output ends up in the aklite log.
+ *
+ * If the worker dies (e.g. crashes or is killed), it is respawned and the interrupted request is retried once.
+ */
+class Session {
+ public:
+  static constexpr const int ProtocolVersion{1};
+  static constexpr const char* const ServeCmd{"serve"};
+  // The time given to a worker to exit on SIGTERM before it is killed
+  static constexpr const std::chrono::seconds StopGracePeriod{10};
+
+  struct Response {
+    int exit_code;
+    std::string out;
+    std::string err;
+  };
+
+  // Thrown if a worker cannot be started or does not speak the expected protocol
+  struct StartError : std::runtime_error {
+    explicit StartError(const std::string& err) : std::runtime_error("failed to start composectl worker: " + err) {}
+  };
+
+  explicit Session(std::string composectl_cmd, std::chrono::seconds timeout = std::chrono::seconds(900));
+  ~Session();
+  Session(const Session&) = delete;
+  Session(Session&&) = delete;
+  Session& operator=(const Session&) = delete;
+  Session& operator=(Session&&) = delete;
+
+  Response run(const std::vector<std::string>& args);
+  pid_t pid() const { return pid_; }
+
+ private:
+  void start();
+  void stop();
+  void send(const std::string& line) const;
+  std::string receive();
+
+  const std::string cmd_;
+  const std::chrono::seconds timeout_;
+
+  std::mutex mutex_;
+  pid_t pid_{-1};
+  int fd_{-1};
+  std::string buffer_;
+  uint64_t req_id_{0};
+};
+
+}  // namespace composeapp
+
+#endif  // AKTUALIZR_LITE_COMPOSEAPP_SESSION_H
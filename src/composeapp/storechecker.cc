@@ -0,0 +1,129 @@
+#include "storechecker.h"
+
+#include <fstream>
+
+#include "docker/composeinfo.h"
+#include "docker/docker.h"
+#include "utilities/utils.h"
+
+namespace composeapp {
+
+StoreChecker::StoreChecker(boost::filesystem::path store_root)
+    : blobs_root_{std::move(store_root) / "blobs" / "sha256"} {}
+
+StoreChecker::Result StoreChecker::check(const std::string& app_uri, const std::string& arch) const {
+  Result res;
+  const auto uri{Docker::Uri::parseUri(app_uri)};
+  if (!checkBlob(uri.digest(), 0, res)) {
+    return res;
+  }
+  const auto manifest{Utils::parseJSON(readBlob(uri.digest()))};
+  const auto& layers{manifest["layers"]};
+  if (!layers.isArray() || layers.empty()) {
+    throw std::runtime_error("invalid app manifest, no layers: " + app_uri);
+  }
+  for (const auto& layer : layers) {
+    checkBlob(layer["digest"].asString(), layer["size"].asUInt64(), res);
+  }
+  if (!res.fetched()) {
+    // the bundle is missing, so the images are unknown
+    return res;
+  }
+
+  // The first layer is the App bundle, the compose file is extracted from it without reading the whole bundle into RAM
+  std::ifstream bundle{blobPath(verifyBlob(layers[0]["digest"].asString())).string(), std::ios::binary};
+  const auto compose{Utils::readFileFromArchive(bundle, ComposeFile)};
+  for (const auto& image : getComposeImages(compose)) {
+    checkImage(image, arch, res);
+  }
+  return res;
+}
+
+std::vector<std::string> StoreChecker::getComposeImages(const std::string& compose) {
+  // The compose file is parsed as a YAML document, as the App engine does it. An image missed by the check would make
+  // an App that is not fully fetched look fetched, so each service must have an image pinned to a digest.
+  TemporaryFile compose_file{ComposeFile};
+  compose_file.PutContents(compose);
+  const Docker::ComposeInfo compose_info{compose_file.PathString()};
+  const auto services{compose_info.getServices()};
+  std::vector<std::string> images;
+  for (const auto& service : services) {
+    const auto image{compose_info.getImage(service)};
+    if (image.empty()) {
+      continue;
+    }
+    if (image.find('@') == std::string::npos) {
+      throw std::runtime_error("image is not pinned to a digest: " + image);
+    }
+    images.emplace_back(image);
+  }
+  if (images.size() != services.size()) {
+    throw std::runtime_error("the number of images doesn't match the number of services: " +
+                             std::to_string(images.size()) + " != " + std::to_string(services.size()));
+  }
+  return images;
+}
+
+bool StoreChecker::checkBlob(const std::string& digest, uint64_t size, Result& res) const {
+  const auto path{blobPath(Docker::HashedDigest(digest).hash())};
+  boost::system::error_code ec;
+  const auto actual_size{boost::filesystem::file_size(path, ec)};
+  if (ec || (size != 0 && actual_size != size)) {
+    res.missing_blobs.push_back({digest, size});
+    return false;
+  }
+  return true;
+}
+
+std::string StoreChecker::verifyBlob(const std::string& digest) const {
+  const Docker::HashedDigest hashed_digest{digest};
+  const auto hash{Docker::getFileHash(blobPath(hashed_digest.hash()))};
+  if (hash != hashed_digest.hash()) {
+    throw std::runtime_error("blob hash mismatch; blob: " + digest + ", actual hash: " + hash);
+  }
+  return hash;
+}
+
+std::string StoreChecker::readBlob(const std::string& digest) const {
+  return Utils::readFile(blobPath(verifyBlob(digest)));
+}
+
+void StoreChecker::checkImage(const std::string& image, const std::string& arch, Result& res) const {
+  const auto uri{Docker::Uri::parseUri(image, false)};
+  if (!checkBlob(uri.digest(), 0, res)) {
+    return;
+  }
+  auto manifest{Utils::parseJSON(readBlob(uri.digest()))};
+  if (manifest.isMember("manifests")) {
+    // an image index, find the manifest of the given architecture
+    std::string manifest_digest;
+    uint64_t manifest_size{0};
+    for (const auto& descr : manifest["manifests"]) {
+      if (descr["platform"]["architecture"].asString() == arch) {
+        manifest_digest = descr["digest"].asString();
+        manifest_size = descr["size"].asUInt64();
+        break;
+      }
+    }
+    if (manifest_digest.empty()) {
+      throw std::runtime_error("no image manifest for " + arch + " in the image index: " + image);
+    }
+    if (!checkBlob(manifest_digest, manifest_size, res)) {
+      return;
+    }
+    manifest = Utils::parseJSON(readBlob(manifest_digest));
+  }
+
+  if (!manifest.isMember("config") || !manifest["layers"].isArray()) {
+    throw std::runtime_error("invalid image manifest: " + image);
+  }
+  const auto& config{manifest["config"]};
+  if (checkBlob(config["digest"].asString(), config["size"].asUInt64(), res)) {
+    verifyBlob(config["digest"].asString());
+  }
+  for (const auto& layer : manifest["layers"]) {
+    checkBlob(layer["digest"].asString(), layer["size"].asUInt64(), res);
+  }
+}
+
+}  // namespace composeapp
@@ -0,0 +1,64 @@
+#ifndef AKTUALIZR_LITE_COMPOSEAPP_STORE_CHECKER_H
+#define AKTUALIZR_LITE_COMPOSEAPP_STORE_CHECKER_H
+
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "json/json.h"
+
+namespace composeapp {
+
+/**
+ * @brief StoreChecker, an in-process reader of the composectl blob store that tells whether an App is fetched
+ *
+ * The store keeps all blobs by their digest in <store>/blobs/sha256/. The App's blob tree is walked the same way
+ * `composectl check --local` does it:
+ *  - the App manifest, its layers, i.e. the App bundle, and the bundle's compose file;
+ *  - the index (if any) and the manifest of each image referred by the compose file;
+ *  - the image config and layers.
+ * The hash of each manifest, config and the bundle is verified, while the layers are just checked for presence and
+ * size.
+ */
+class StoreChecker {
+ public:
+  static constexpr const char* const ComposeFile{"docker-compose.yml"};
+
+  struct Blob {
+    std::string digest;
+    // zero if the blob size is not known, e.g. the App manifest
+    uint64_t size;
+  };
+
+  struct Result {
+    std::vector<Blob> missing_blobs;
+    bool fetched() const { return missing_blobs.empty(); }
+  };
+
+  explicit StoreChecker(boost::filesystem::path store_root);
+
+  // Throws std::runtime_error if the App's blob tree cannot be walked, e.g. a stored manifest is invalid,
+  // so the caller can fall back to composectl
+  Result check(const std::string& app_uri, const std::string& arch) const;
+
+  // Returns the pinned image references, e.g. hub.io/factory/image@sha256:<hash>, of the compose file's services.
+  // Throws std::runtime_error if a service has no image or its image is not pinned to a digest.
+  static std::vector<std::string> getComposeImages(const std::string& compose);
+
+ private:
+  boost::filesystem::path blobPath(const std::string& hash) const { return blobs_root_ / hash; }
+  // Returns false and adds the blob to the missing ones if it's not present or its size doesn't match
+  bool checkBlob(const std::string& digest, uint64_t size, Result& res) const;
+  // Verifies the blob hash without reading the blob into RAM, returns the hash
+  std::string verifyBlob(const std::string& digest) const;
+  // Reads a blob and verifies its hash
+  std::string readBlob(const std::string& digest) const;
+  void checkImage(const std::string& image, const std::string& arch, Result& res) const;
+
+  const boost::filesystem::path blobs_root_;
+};
+
+}  // namespace composeapp
+
+#endif  // AKTUALIZR_LITE_COMPOSEAPP_STORE_CHECKER_H
@@ -1,5 +1,7 @@
 #include "composeappmanager.h"
 
+#include <atomic>
+#include <mutex>
 #include <set>
 
 #include <boost/algorithm/string.hpp>
@@ -8,6 +10,7 @@
 
 #include "bootloader/bootloaderlite.h"
 #include "docker/restorableappengine.h"
+#include "parallelfor.h"
 #include "target.h"
 #ifdef USE_COMPOSEAPP_ENGINE
 #include "composeapp/appengine.h"
@@ -41,6 +44,11 @@ ComposeAppManager::Config::Config(const PackageConfig& pconfig) {
   if (raw.count("reset_apps_root") == 1) {
     reset_apps_root = raw.at("reset_apps_root");
   }
+  if (raw.count("reset_apps_state_root") == 1) {
+    reset_apps_state_root = raw.at("reset_apps_state_root");
+  } else {
+    reset_apps_state_root = Docker::RestorableAppEngine::GetDefStateRoot(reset_apps_root);
+  }
   if (raw.count("compose_apps_tree") == 1) {
     apps_tree = raw.at("compose_apps_tree");
   }
@@ -59,10 +67,31 @@ ComposeAppManager::Config::Config(const PackageConfig& pconfig) {
   if (raw.count("skopeo_bin") == 1) {
     skopeo_bin = raw.at("skopeo_bin");
   }
+#ifndef USE_COMPOSEAPP_ENGINE
+  if (raw.count("native_image_pull") > 0) {
+    native_image_pull = boost::lexical_cast<bool>(raw.at("native_image_pull"));
+  }
+  if (raw.count("load_images_on_fetch") > 0) {
+    load_images_on_fetch = boost::lexical_cast<bool>(raw.at("load_images_on_fetch"));
+  }
+  if (raw.count("reset_apps_prune_budget_ms") > 0) {
+    const std::string prune_budget_str{raw.at("reset_apps_prune_budget_ms")};
+    try {
+      reset_apps_prune_budget_ms = std::stoi(prune_budget_str);
+    } catch (const std::exception& exc) {
+      LOG_ERROR << "Invalid sota.toml:pacman:reset_apps_prune_budget_ms value, should be an integer, got "
+                << prune_budget_str << ", err: " << exc.what();
+      throw;
+    }
+  }
+#endif  // USE_COMPOSEAPP_ENGINE
 #ifdef USE_COMPOSEAPP_ENGINE
   if (raw.count("composectl_bin") == 1) {
     composectl_bin = raw.at("composectl_bin");
   }
+  if (raw.count("composectl_worker") > 0) {
+    composectl_worker = boost::lexical_cast<bool>(raw.at("composectl_worker"));
+  }
 #endif  // USE_COMPOSEAPP_ENGINE
 
   if (raw.count("docker_prune") == 1) {
@@ -79,6 +108,10 @@ ComposeAppManager::Config::Config(const PackageConfig& pconfig) {
     hub_auth_creds_endpoint = raw.at("hub_auth_creds_endpoint");
   }
 
+  if (raw.count("blob_direct_io") > 0) {
+    blob_direct_io = boost::lexical_cast<bool>(raw.at("blob_direct_io"));
+  }
+
   if (raw.count("create_containers_before_reboot") > 0) {
     create_containers_before_reboot = boost::lexical_cast<bool>(raw.at("create_containers_before_reboot"));
   }
@@ -107,6 +140,42 @@ ComposeAppManager::Config::Config(const PackageConfig& pconfig) {
       throw;
     }
   }
+
+  if (raw.count("apps_fetch_parallelism") > 0) {
+    const std::string apps_fetch_parallelism_str{raw.at("apps_fetch_parallelism")};
+    try {
+      apps_fetch_parallelism = std::stoi(apps_fetch_parallelism_str);
+    } catch (const std::exception& exc) {
+      LOG_ERROR << "Invalid sota.toml:pacman:apps_fetch_parallelism value, should be an integer, got "
+                << apps_fetch_parallelism_str << ", err: " << exc.what();
+      throw;
+    }
+    if (apps_fetch_parallelism < 1) {
+      throw std::invalid_argument(
+          "Invalid sota.toml:pacman:apps_fetch_parallelism value, should be greater than 0, got " +
+          apps_fetch_parallelism_str);
+    }
+  }
+
+  if (raw.count("apps_start_parallelism") > 0) {
+    const std::string apps_start_parallelism_str{raw.at("apps_start_parallelism")};
+    try {
+      apps_start_parallelism = std::stoi(apps_start_parallelism_str);
+    } catch (const std::exception& exc) {
+      LOG_ERROR << "Invalid sota.toml:pacman:apps_start_parallelism value, should be an integer, got "
+                << apps_start_parallelism_str << ", err: " << exc.what();
+      throw;
+    }
+    if (apps_start_parallelism < 1) {
+      throw std::invalid_argument(
+          "Invalid sota.toml:pacman:apps_start_parallelism value, should be greater than 0, got " +
+          apps_start_parallelism_str);
+    }
+  }
+
+  if (raw.count("apps_start_deps") > 0) {
+    apps_start_deps = AppScheduler::parseDeps(raw.at("apps_start_deps"));
+  }
 }
 
 ComposeAppManager::ComposeAppManager(const PackageConfig& pconfig, const BootloaderConfig& bconfig,
@@ -118,7 +187,13 @@ ComposeAppManager::ComposeAppManager(const PackageConfig& pconfig, const Bootloa
       cfg_{pconfig},
       app_engine_{std::move(app_engine)} {
   if (!app_engine_) {
-    auto registry_client{std::make_shared<Docker::RegistryClient>(http, cfg_.hub_auth_creds_endpoint)};
+    // the blob downloads interrupted by a failure or a restart are resumed from the data kept beside the reset-apps
+    // store, composectl owns the store itself
+    auto registry_client{std::make_shared<Docker::RegistryClient>(
+        http, cfg_.hub_auth_creds_endpoint, Docker::RegistryClient::DefaultHttpClientFactory,
+        Docker::RangeDownloadConfig(),
+        !!cfg_.reset_apps ? cfg_.reset_apps_state_root / "partial-blobs" : boost::filesystem::path(),
+        cfg_.blob_direct_io)};
     std::string compose_cmd{boost::filesystem::canonical(cfg_.compose_bin).string() + " "};
 
     if (cfg_.compose_bin.filename().compare("docker") == 0) {
@@ -148,13 +223,16 @@ ComposeAppManager::ComposeAppManager(const PackageConfig& pconfig, const Bootloa
       app_engine_ = std::make_shared<composeapp::AppEngine>(
           cfg_.reset_apps_root, cfg_.apps_root, cfg_.images_data_root, registry_client,
           std::make_shared<Docker::DockerClient>(), docker_host, compose_cmd, composectl_cmd, cfg_.storage_watermark,
-          Docker::RestorableAppEngine::GetDefStorageSpaceFunc(cfg_.storage_watermark));
+          Docker::RestorableAppEngine::GetDefStorageSpaceFunc(cfg_.storage_watermark), nullptr, true, "",
+          cfg_.composectl_worker, cfg_.apps_fetch_parallelism, cfg_.reset_apps_state_root);
 #else
       const std::string skopeo_cmd{boost::filesystem::canonical(cfg_.skopeo_bin).string()};
       app_engine_ = std::make_shared<Docker::RestorableAppEngine>(
           cfg_.reset_apps_root, cfg_.apps_root, cfg_.images_data_root, registry_client,
           std::make_shared<Docker::DockerClient>(), skopeo_cmd, docker_host, compose_cmd,
-          Docker::RestorableAppEngine::GetDefStorageSpaceFunc(cfg_.storage_watermark));
+          Docker::RestorableAppEngine::GetDefStorageSpaceFunc(cfg_.storage_watermark),
+          Docker::RestorableAppEngine::DefClientImageSrcFunc, true, false, cfg_.native_image_pull,
+          cfg_.load_images_on_fetch, std::chrono::milliseconds(std::max(cfg_.reset_apps_prune_budget_ms, 0)));
 #endif  // USE_COMPOSEAPP_ENGINE
       is_restorable_engine_ = true;
     } else {
@@ -205,6 +283,7 @@ ComposeAppManager::AppsContainer ComposeAppManager::getAppsToUpdate(const Uptane
 
   auto currently_installed_target_apps = Target::appsJson(OstreeManager::getCurrent());
   auto new_target_apps = getApps(t);  // intersection of apps specified in Target and the configuration
+  AppEngine::Apps apps_to_check;
 
   for (const auto& app_pair : new_target_apps) {
     const auto& app_name = app_pair.first;
@@ -226,21 +305,33 @@ ComposeAppManager::AppsContainer ComposeAppManager::getAppsToUpdate(const Uptane
       continue;
     }
 
-    LOG_DEBUG << app_name << " performing full status check";
-    if (!app_engine_->isRunning({app_name, app_pair.second})) {
+    apps_to_check.push_back({app_name, app_pair.second});
+  }
+
+  if (apps_to_check.empty()) {
+    return apps_to_update;
+  }
+
+  // Check the status of all installed Apps in one go rather than querying an App engine per App
+  LOG_DEBUG << "Performing full status check of " << apps_to_check.size() << " Apps";
+  const auto apps_status{app_engine_->getAppsStatus(apps_to_check)};
+  for (const auto& app : apps_to_check) {
+    const auto status_it{apps_status.find(app.name)};
+    const AppEngine::AppStatus status{status_it != apps_status.end() ? status_it->second : AppEngine::AppStatus{}};
+    if (!status.running) {
       // an App that is supposed to be running is not running or is not fully installed
-      apps_to_update.insert(app_pair);
-      apps_and_reasons[app_pair.first] = "not running";
+      apps_to_update.emplace(app.name, app.uri);
+      apps_and_reasons[app.name] = "not running";
       continue;
     }
-    if (!app_engine_->isFetched({app_name, app_pair.second})) {
+    if (!status.fetched) {
       // an App that is supposed to be installed is not fully fetched
-      apps_to_update.insert(app_pair);
-      apps_and_reasons[app_pair.first] = "not fetched";
-      LOG_INFO << app_name << " is not fully fetched; missing blobs will be fetched";
+      apps_to_update.emplace(app.name, app.uri);
+      apps_and_reasons[app.name] = "not fetched";
+      LOG_INFO << app.name << " is not fully fetched; missing blobs will be fetched";
       continue;
     }
-    fetched_apps.insert(app_name);
+    fetched_apps.insert(app.name);
   }
 
   return apps_to_update;
@@ -299,21 +390,32 @@ DownloadResult ComposeAppManager::Download(const TufTarget& target) {
     stat_msg << res.description << "\nbefore apps pull: " << pre_pull_fs_usage;
     LOG_INFO << "Pre Apps pull storage usage info; " << pre_pull_fs_usage;
   }
-  for (const auto& pair : all_apps_to_fetch) {
-    LOG_INFO << "Fetching " << pair.first << " -> " << pair.second;
-    const auto fetch_res{app_engine_->fetch({pair.first, pair.second})};
-    if (!fetch_res) {
-      const std::string err_desc{boost::str(boost::format("failed to fetch App; app: %s; uri: %s; %s") % pair.first %
-                                            pair.second % fetch_res.err)};
-      LOG_ERROR << err_desc;
-      stat_msg << "\n" << err_desc;
-      if (fetch_res.noSpace()) {
-        res = {DownloadResult::Status::DownloadFailed_NoSpace, stat_msg.str(), fetch_res.stat.path, fetch_res.stat};
-      } else {
-        res = {DownloadResult::Status::DownloadFailed, ""};
-      }
-      break;
+  const auto failed_fetches{fetchApps(all_apps_to_fetch)};
+  const AppEngine::Result* no_space_res{nullptr};
+  for (const auto& failed_fetch : failed_fetches) {
+    const auto& app{failed_fetch.first};
+    const auto& fetch_res{failed_fetch.second};
+    if (fetch_res.cancelled()) {
+      // interrupted because of another App fetch failure, which is reported by itself
+      const std::string cancel_desc{
+          boost::str(boost::format("App fetch cancelled; app: %s; uri: %s") % app.name % app.uri)};
+      LOG_INFO << cancel_desc;
+      stat_msg << "\n" << cancel_desc;
+      continue;
     }
+    const std::string err_desc{
+        boost::str(boost::format("failed to fetch App; app: %s; uri: %s; %s") % app.name % app.uri % fetch_res.err)};
+    LOG_ERROR << err_desc;
+    stat_msg << "\n" << err_desc;
+    if (fetch_res.noSpace() && no_space_res == nullptr) {
+      no_space_res = &fetch_res;
+    }
+  }
+  if (no_space_res != nullptr) {
+    res = {DownloadResult::Status::DownloadFailed_NoSpace, stat_msg.str(), no_space_res->stat.path,
+           no_space_res->stat};
+  } else if (!failed_fetches.empty()) {
+    res = {DownloadResult::Status::DownloadFailed, ""};
   }
 
   if (!all_apps_to_fetch.empty() && !res.noSpace()) {
@@ -327,6 +429,64 @@ DownloadResult ComposeAppManager::Download(const TufTarget& target) {
   return res;
 }
 
+std::vector<std::pair<AppEngine::App, AppEngine::Result>> ComposeAppManager::fetchApps(
+    const AppsContainer& apps) const {
+  const std::vector<AppEngine::App> apps_to_fetch{[&apps]() {
+    std::vector<AppEngine::App> res;
+    for (const auto& pair : apps) {
+      res.push_back({pair.first, pair.second});
+    }
+    return res;
+  }()};
+
+  std::vector<std::pair<AppEngine::App, AppEngine::Result>> failed_fetches;
+  if (apps_to_fetch.size() > 1 && cfg_.apps_fetch_parallelism > 1) {
+    // the concurrently fetched Apps may share new layers, so their update size is checked as a whole before any of
+    // them is downloaded; the serially fetched ones are checked one by one, each counting the layers fetched before it
+    const auto check_res{app_engine_->checkUpdateSize(apps_to_fetch)};
+    if (check_res.noSpace()) {
+      for (const auto& app : apps_to_fetch) {
+        failed_fetches.emplace_back(app, check_res);
+      }
+      return failed_fetches;
+    }
+    if (!check_res) {
+      // each App fetch checks its update size anyway
+      LOG_WARNING << "Failed to check the Apps update size: " << check_res.err;
+    }
+  }
+
+  // the fetches could have been cancelled by the previous fetchApps() call
+  app_engine_->resumeFetches();
+  std::mutex mutex;
+  std::atomic<bool> failed{false};
+
+  const auto threads_number{
+      std::min(static_cast<std::size_t>(std::max(cfg_.apps_fetch_parallelism, 1)), apps_to_fetch.size())};
+  if (threads_number > 1) {
+    LOG_INFO << "Fetching " << apps_to_fetch.size() << " Apps by " << threads_number << " concurrent fetches";
+  }
+  parallelFor(
+      apps_to_fetch.size(), threads_number,
+      [&](std::size_t indx) {
+        const auto& app{apps_to_fetch[indx]};
+        LOG_INFO << "Fetching " << app.name << " -> " << app.uri;
+        auto fetch_res{app_engine_->fetch(app)};
+        if (fetch_res) {
+          return;
+        }
+        std::lock_guard<std::mutex> lock{mutex};
+        if (!failed) {
+          failed = true;
+          // fail fast, interrupt fetches that are in progress, the subsequent ones won't be started
+          app_engine_->cancelFetches();
+        }
+        failed_fetches.emplace_back(app, std::move(fetch_res));
+      },
+      [&failed]() { return failed.load(); });
+  return failed_fetches;
+}
+
 bool ComposeAppManager::fetchTarget(const Uptane::Target& target, Uptane::Fetcher& fetcher, const KeyManager& keys,
                                     const FetcherProgressCb& progress_cb, const api::FlowControlToken* token) {
   (void)target;
@@ -411,24 +571,31 @@ data::InstallationResult ComposeAppManager::install(const Uptane::Target& target
       res.description += "\n# Apps installed:";
     }
 
+    AppEngine::Apps apps_to_install;
     for (const auto& pair : cur_apps_to_fetch_and_update_) {
       LOG_INFO << "Installing " << pair.first << " -> " << pair.second;
-      // I have no idea via the package manager interface method install() is const which is not a const
-      // method by its definition/nature
-      auto& non_const_app_engine = (const_cast<ComposeAppManager*>(this))->app_engine_;
-      const AppEngine::Result run_res = just_install ? non_const_app_engine->install({pair.first, pair.second})
-                                                     : non_const_app_engine->run({pair.first, pair.second});
-
+      apps_to_install.emplace_back(AppEngine::App{pair.first, pair.second});
+    }
+    // I have no idea via the package manager interface method install() is const which is not a const
+    // method by its definition/nature
+    auto& non_const_app_engine = (const_cast<ComposeAppManager*>(this))->app_engine_;
+    const AppScheduler scheduler{cfg_.apps_start_parallelism, cfg_.apps_start_deps};
+    const auto results{scheduler.run(apps_to_install, [&non_const_app_engine, just_install](const AppEngine::App& app) {
+      return just_install ? non_const_app_engine->install(app) : non_const_app_engine->run(app);
+    })};
+
+    for (const auto& app_res : results) {
+      const auto& run_res{app_res.result};
       if (!run_res) {
         const std::string err_desc{boost::str(boost::format("failed to install App; app: %s; uri: %s; err: %s") %
-                                              pair.first % pair.second % run_res.err)};
+                                              app_res.app.name % app_res.app.uri % run_res.err)};
         LOG_ERROR << err_desc;
 
         res = data::InstallationResult(run_res.imagePullFailure() ? data::ResultCode::Numeric::kDownloadFailed
                                                                   : data::ResultCode::Numeric::kInstallFailed,
                                        err_desc);
       } else {
-        res.description += "\n" + pair.second;
+        res.description += "\n" + app_res.app.uri;
       }
     }
 
@@ -483,6 +650,7 @@ data::InstallationResult ComposeAppManager::finalizeInstall(const Uptane::Target
     const auto install_context{target.custom_data().get("install-context", Json::nullValue)};
     std::string newly_enabled_apps_msg;
     // "finalize" (run) Apps that were pulled and created before reboot
+    AppEngine::Apps apps_to_run;
     for (const auto& app_pair : getApps(target)) {
       if (!install_context.empty() && install_context.isMember("apps")) {
         if (!(install_context["apps"].isMember(app_pair.first) &&
@@ -498,26 +666,39 @@ data::InstallationResult ComposeAppManager::finalizeInstall(const Uptane::Target
           continue;
         }
       }
+      apps_to_run.emplace_back(AppEngine::App{app_pair.first, app_pair.second});
+    }
+
+    // Stop starting Apps after the first failure, the same as if they were started one by one
+    const AppScheduler scheduler{cfg_.apps_start_parallelism, cfg_.apps_start_deps, true};
+    const auto results{
+        scheduler.run(apps_to_run, [this](const AppEngine::App& app) { return app_engine_->run(app); })};
+    // Report the App that has actually failed rather than the ones skipped because of its failure
+    auto failed_app{std::find_if(results.cbegin(), results.cend(),
+                                 [](const AppScheduler::AppResult& r) { return r.started && !r.result; })};
+    if (failed_app == results.cend()) {
+      failed_app = std::find_if(results.cbegin(), results.cend(),
+                                [](const AppScheduler::AppResult& r) { return !r.result; });
+    }
+    if (failed_app != results.cend()) {
+      const auto& app_res{*failed_app};
+      const auto& run_res{app_res.result};
+      const std::string err_desc{boost::str(
+          boost::format("failed to start App after booting on a new sysroot version; app: %s; uri: %s; err: %s") %
+          app_res.app.name % app_res.app.uri % run_res.err)};
 
-      const AppEngine::Result run_res = app_engine_->run({app_pair.first, app_pair.second});
-      if (!run_res) {
-        const std::string err_desc{boost::str(
-            boost::format("failed to start App after booting on a new sysroot version; app: %s; uri: %s; err: %s") %
-            app_pair.first % app_pair.second % run_res.err)};
-
-        LOG_ERROR << err_desc;
-        // Do we need to set some flag for the uboot and trigger a system reboot in order to boot on a previous
-        // ostree version, hence a proper/full rollback happens???
-        ir.description += ", however " + err_desc;
-        ir.description += newly_enabled_apps_msg;
-        ir.description += "\n# Apps running:\n" + getRunningAppsInfoForReport();
-        // this is a hack to distinguish between ostree install (rollback) and App start failures.
-        // data::ResultCode::Numeric::kInstallFailed - boot on a new ostree version failed (rollback at boot)
-        // data::ResultCode::Numeric::kCustomError - boot on a new version was successful but new App failed to start
-        return data::InstallationResult(run_res.imagePullFailure() ? data::ResultCode::Numeric::kDownloadFailed
-                                                                   : data::ResultCode::Numeric::kCustomError,
-                                        ir.description);
-      }
+      LOG_ERROR << err_desc;
+      // Do we need to set some flag for the uboot and trigger a system reboot in order to boot on a previous
+      // ostree version, hence a proper/full rollback happens???
+      ir.description += ", however " + err_desc;
+      ir.description += newly_enabled_apps_msg;
+      ir.description += "\n# Apps running:\n" + getRunningAppsInfoForReport();
+      // this is a hack to distinguish between ostree install (rollback) and App start failures.
+      // data::ResultCode::Numeric::kInstallFailed - boot on a new ostree version failed (rollback at boot)
+      // data::ResultCode::Numeric::kCustomError - boot on a new version was successful but new App failed to start
+      return data::InstallationResult(run_res.imagePullFailure() ? data::ResultCode::Numeric::kDownloadFailed
+                                                                 : data::ResultCode::Numeric::kCustomError,
+                                      ir.description);
     }
     handleRemovedApps(target);
     if (cfg_.docker_prune) {
@@ -5,7 +5,10 @@
 #include <memory>
 #include <set>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
+#include "appscheduler.h"
 #include "docker/composeappengine.h"
 #include "docker/docker.h"
 #include "ostree/sysroot.h"
@@ -23,10 +26,17 @@ class ComposeAppManager : public RootfsTreeManager {
     boost::optional<std::vector<std::string>> reset_apps;
     boost::filesystem::path apps_root{"/var/sota/compose-apps"};
     boost::filesystem::path reset_apps_root{"/var/sota/reset-apps"};
+    boost::filesystem::path reset_apps_state_root;
     boost::filesystem::path compose_bin{"/usr/bin/docker"};
     boost::filesystem::path skopeo_bin{"/sbin/skopeo"};
+#ifndef USE_COMPOSEAPP_ENGINE
+    bool native_image_pull{false};
+    bool load_images_on_fetch{false};
+    int reset_apps_prune_budget_ms{0};
+#endif  // USE_COMPOSEAPP_ENGINE
 #ifdef USE_COMPOSEAPP_ENGINE
     boost::filesystem::path composectl_bin{"/usr/bin/composectl"};
+    bool composectl_worker{false};
 #endif  // USE_COMPOSEAPP_ENGINE
     bool docker_prune{true};
     bool force_update{false};
@@ -35,9 +45,13 @@ class ComposeAppManager : public RootfsTreeManager {
     boost::filesystem::path images_data_root{"/var/lib/docker"};
     std::string docker_images_reload_cmd{"systemctl reload docker"};
     std::string hub_auth_creds_endpoint{Docker::RegistryClient::DefAuthCredsEndpoint};
+    bool blob_direct_io{false};
     bool create_containers_before_reboot{true};
     bool stop_apps_before_update{true};
     int storage_watermark{80};
+    int apps_fetch_parallelism{1};
+    int apps_start_parallelism{1};
+    AppScheduler::Deps apps_start_deps;
   };
 
   using AppsContainer = std::unordered_map<std::string, std::string>;
@@ -66,6 +80,9 @@ class ComposeAppManager : public RootfsTreeManager {
   bool isAppRunning(const AppEngine::App& app);
   AppsSyncReason checkForAppsToUpdate(const Uptane::Target& target);
   void setAppsNotChecked() { are_apps_checked_ = false; }
+  void setPullProgressHandler(AppEngine::PullProgressHandler handler) {
+    app_engine_->setPullProgressHandler(std::move(handler));
+  }
   void handleRemovedApps(const Uptane::Target& target) const;
   Json::Value getAppsState() const;
   static bool compareAppsStates(const Json::Value& left, const Json::Value& right);
@@ -84,6 +101,10 @@ class ComposeAppManager : public RootfsTreeManager {
   void forEachRemovedApp(const Uptane::Target& target,
                          const std::function<void(AppEngine::Ptr&, const std::string&)>& action) const;
   std::string getAppsFsUsageInfo() const;
+  // Fetches the given Apps by up to `apps_fetch_parallelism` threads and returns the results of failed fetches.
+  // No new fetch is started after the first failure and the ones in progress are cancelled, their results are
+  // Result::ID::Cancelled.
+  std::vector<std::pair<AppEngine::App, AppEngine::Result>> fetchApps(const AppsContainer& apps) const;
 
   Config cfg_;
   mutable AppsContainer cur_apps_to_fetch_and_update_;
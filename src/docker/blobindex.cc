@@ -0,0 +1,157 @@
+#include "blobindex.h"
+
+#include <sys/stat.h>
+
+#include <ctime>
+
+#include "docker/docker.h"
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+namespace Docker {
+
+VerifiedBlobIndex::VerifiedBlobIndex(boost::filesystem::path path, std::chrono::seconds racy_window)
+    : path_{std::move(path)},
+      root_{path_.has_parent_path() ? path_.parent_path().string() + "/" : ""},
+      racy_window_{std::chrono::duration_cast<std::chrono::nanoseconds>(racy_window).count()} {
+  load();
+}
+
+std::string VerifiedBlobIndex::getHash(const boost::filesystem::path& file) {
+  Entry current;
+  Entry found;
+  if (stat(file, current) && find(file, current, found) && !isRacy(found)) {
+    return found.hash;
+  }
+  current.hash = getFileHash(file);
+  // don't record the hash if the file has been modified while being hashed
+  Entry after;
+  if (stat(file, after) && isSameFile(current, after)) {
+    record(file, current);
+  }
+  return current.hash;
+}
+
+void VerifiedBlobIndex::add(const boost::filesystem::path& file, const std::string& hash) {
+  Entry entry;
+  if (stat(file, entry)) {
+    entry.hash = hash;
+    record(file, entry);
+  }
+}
+
+bool VerifiedBlobIndex::isUnchanged(const boost::filesystem::path& file) {
+  Entry current;
+  Entry found;
+  if (!stat(file, current) || !find(file, current, found)) {
+    return false;
+  }
+  // the racy entry is confirmed by hashing the file, and it's recorded again, so it's likely not racy anymore
+  return !isRacy(found) || getHash(file) == found.hash;
+}
+
+void VerifiedBlobIndex::prune() {
+  std::lock_guard<std::mutex> lock{mutex_};
+  for (auto entry = entries_.begin(); entry != entries_.end();) {
+    Entry current;
+    if (stat(entry->first, current)) {
+      ++entry;
+      continue;
+    }
+    entry = entries_.erase(entry);
+    changed_ = true;
+  }
+}
+
+void VerifiedBlobIndex::save() {
+  std::lock_guard<std::mutex> lock{mutex_};
+  if (!changed_) {
+    return;
+  }
+  try {
+    Json::Value index;
+    index["blobs"] = Json::objectValue;
+    for (const auto& entry : entries_) {
+      auto& value{index["blobs"][entry.first]};
+      value["hash"] = entry.second.hash;
+      value["size"] = static_cast<Json::UInt64>(entry.second.size);
+      value["ino"] = static_cast<Json::UInt64>(entry.second.ino);
+      value["mtime"] = static_cast<Json::Int64>(entry.second.mtime);
+      value["ctime"] = static_cast<Json::Int64>(entry.second.ctime);
+      value["verified_at"] = static_cast<Json::Int64>(entry.second.verified_at);
+    }
+    // write and rename, so a power cut cannot leave a truncated index behind
+    const auto tmp_path{path_.string() + ".tmp"};
+    Utils::writeFile(tmp_path, Utils::jsonToCanonicalStr(index), false);
+    boost::filesystem::rename(tmp_path, path_);
+    changed_ = false;
+  } catch (const std::exception& exc) {
+    LOG_WARNING << "Failed to save the verified blob index; path: " << path_ << ", err: " << exc.what();
+  }
+}
+
+bool VerifiedBlobIndex::find(const boost::filesystem::path& file, const Entry& current, Entry& found) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  const auto entry{entries_.find(file.string())};
+  if (entry == entries_.end() || !isSameFile(entry->second, current)) {
+    return false;
+  }
+  found = entry->second;
+  return true;
+}
+
+bool VerifiedBlobIndex::stat(const boost::filesystem::path& file, Entry& entry) {
+  struct stat st {};
+  if (::stat(file.c_str(), &st) != 0) {
+    return false;
+  }
+  entry.size = static_cast<uint64_t>(st.st_size);
+  entry.ino = st.st_ino;
+  entry.mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+  entry.ctime = static_cast<int64_t>(st.st_ctim.tv_sec) * 1000000000 + st.st_ctim.tv_nsec;
+  return true;
+}
+
+void VerifiedBlobIndex::load() {
+  if (!boost::filesystem::exists(path_)) {
+    return;
+  }
+  try {
+    const auto index{Utils::parseJSONFile(path_)};
+    const auto& blobs{index["blobs"]};
+    for (auto ii = blobs.begin(); ii != blobs.end(); ++ii) {
+      Entry entry;
+      entry.hash = (*ii)["hash"].asString();
+      entry.size = (*ii)["size"].asUInt64();
+      entry.ino = (*ii)["ino"].asUInt64();
+      entry.mtime = (*ii)["mtime"].asInt64();
+      entry.ctime = (*ii)["ctime"].asInt64();
+      entry.verified_at = (*ii)["verified_at"].asInt64();
+      // drop the entries of the files removed or changed since the last run, e.g. by prune, so the index doesn't grow
+      Entry current;
+      if (entry.hash.empty() || !isInStore(ii.name()) || !stat(ii.name(), current) || !isSameFile(entry, current)) {
+        changed_ = true;
+        continue;
+      }
+      entries_.emplace(ii.name(), entry);
+    }
+  } catch (const std::exception& exc) {
+    LOG_WARNING << "Failed to load the verified blob index, ignoring it; path: " << path_ << ", err: " << exc.what();
+    entries_.clear();
+  }
+}
+
+void VerifiedBlobIndex::record(const boost::filesystem::path& file, const Entry& entry) {
+  if (!isInStore(file.string())) {
+    return;
+  }
+  struct timespec now {};
+  clock_gettime(CLOCK_REALTIME, &now);
+  std::lock_guard<std::mutex> lock{mutex_};
+  auto& recorded{entries_[file.string()]};
+  recorded = entry;
+  recorded.verified_at = static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+  changed_ = true;
+}
+
+}  // namespace Docker
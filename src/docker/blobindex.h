@@ -0,0 +1,82 @@
+#ifndef AKTUALIZR_LITE_DOCKER_BLOB_INDEX_H_
+#define AKTUALIZR_LITE_DOCKER_BLOB_INDEX_H_
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <boost/filesystem.hpp>
+
+namespace Docker {
+
+/**
+ * @brief VerifiedBlobIndex, a persisted record of the content hashes of the store files
+ *
+ * Each entry maps a file path to its hash along with the file's size, inode, mtime and ctime taken when the hash was
+ * calculated. The hash is trusted as long as the file's stat still matches the recorded one, so the file content is
+ * read and hashed again only if the file has been changed or replaced since then. The ctime cannot be set from user
+ * space, so a rewrite that restores the size and the mtime of the file is still detected.
+ *
+ * The file timestamps are as coarse as the kernel tick, so a file changed within the same tick after being hashed may
+ * look unchanged. Therefore, like git does it for its index, an entry recorded within `racy_window` after the file
+ * change is not trusted as is, the file content is hashed again to confirm it.
+ *
+ * Just the files under the index's directory, i.e. the store, are recorded, the other ones are hashed on each call.
+ */
+class VerifiedBlobIndex {
+ public:
+  static constexpr const char* const FileName{"aklite-verified-blobs.json"};
+
+  explicit VerifiedBlobIndex(boost::filesystem::path path, std::chrono::seconds racy_window = std::chrono::seconds(2));
+
+  // Returns the lower-case hex sha256 hash of the file content, the file is hashed only if it isn't in the index or
+  // has been changed since it was hashed. Throws std::runtime_error if the file cannot be read.
+  std::string getHash(const boost::filesystem::path& file);
+  // Records the hash of a file that has just been written by the caller
+  void add(const boost::filesystem::path& file, const std::string& hash);
+  // Returns true if the file is in the index and hasn't been changed since it was recorded
+  bool isUnchanged(const boost::filesystem::path& file);
+  // Drops the entries of the files removed from the store, e.g. by an App prune
+  void prune();
+  // Persists the index if it has been changed since the last save, the error is logged and ignored
+  void save();
+
+ private:
+  struct Entry {
+    std::string hash;
+    uint64_t size{0};
+    uint64_t ino{0};
+    int64_t mtime{0};
+    int64_t ctime{0};
+    // nanoseconds since epoch, like the file timestamps
+    int64_t verified_at{0};
+  };
+
+  // Returns false if the file doesn't exist
+  static bool stat(const boost::filesystem::path& file, Entry& entry);
+  static bool isSameFile(const Entry& lhs, const Entry& rhs) {
+    return lhs.size == rhs.size && lhs.ino == rhs.ino && lhs.mtime == rhs.mtime && lhs.ctime == rhs.ctime;
+  }
+  bool isRacy(const Entry& entry) const {
+    return entry.verified_at - std::max(entry.mtime, entry.ctime) < racy_window_;
+  }
+  // Returns the recorded entry if its file stat matches the given one
+  bool find(const boost::filesystem::path& file, const Entry& current, Entry& found);
+  bool isInStore(const std::string& file) const { return file.compare(0, root_.size(), root_) == 0; }
+  void load();
+  void record(const boost::filesystem::path& file, const Entry& entry);
+
+  const boost::filesystem::path path_;
+  // the index's directory with the trailing separator
+  const std::string root_;
+  const int64_t racy_window_;
+  std::mutex mutex_;
+  std::unordered_map<std::string, Entry> entries_;
+  bool changed_{false};
+};
+
+}  // namespace Docker
+
+#endif  // AKTUALIZR_LITE_DOCKER_BLOB_INDEX_H_
@@ -0,0 +1,231 @@
+#include "blobrefs.h"
+
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+namespace Docker {
+
+BlobRefTable::BlobRefTable(boost::filesystem::path path) : path_{std::move(path)} { load(); }
+
+bool BlobRefTable::hasApp(const std::string& app) const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  return apps_.count(app) > 0;
+}
+
+std::vector<std::string> BlobRefTable::getApps() const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  std::vector<std::string> apps;
+  apps.reserve(apps_.size());
+  for (const auto& app : apps_) {
+    apps.push_back(app.first);
+  }
+  return apps;
+}
+
+void BlobRefTable::setAppBlobs(const std::string& app, const Blobs& blobs) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  auto& app_blobs{apps_[app]};
+  if (app_blobs == blobs) {
+    return;
+  }
+  // add the new references first, so the blobs kept by the App version don't become garbage in between
+  addRefs(blobs);
+  dropRefs(app_blobs);
+  app_blobs = blobs;
+  changed_ = true;
+}
+
+void BlobRefTable::removeApp(const std::string& app) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  const auto found{apps_.find(app)};
+  if (found == apps_.end()) {
+    return;
+  }
+  dropRefs(found->second);
+  apps_.erase(found);
+  changed_ = true;
+}
+
+bool BlobRefTable::isReferenced(const std::string& blob) const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  return refs_.count(blob) > 0;
+}
+
+void BlobRefTable::startFetch(const std::string& app) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  fetches_.insert(app);
+  changed_ = true;
+}
+
+void BlobRefTable::finishFetch(const std::string& app, bool succeeded) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  const auto found{fetches_.find(app)};
+  if (found != fetches_.end()) {
+    fetches_.erase(found);
+    changed_ = true;
+  }
+  if (!succeeded && !rescan_) {
+    rescan_ = true;
+    changed_ = true;
+  }
+}
+
+void BlobRefTable::requestRescan() {
+  std::lock_guard<std::mutex> lock{mutex_};
+  if (!rescan_) {
+    rescan_ = true;
+    changed_ = true;
+  }
+}
+
+bool BlobRefTable::isRescanRequested() const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  return rescan_;
+}
+
+void BlobRefTable::rescan(const boost::filesystem::path& blob_dir) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  std::size_t found{0};
+  if (boost::filesystem::exists(blob_dir)) {
+    for (const auto& entry : boost::filesystem::directory_iterator(blob_dir)) {
+      if (boost::filesystem::is_directory(entry)) {
+        continue;
+      }
+      const auto blob{entry.path().filename().string()};
+      if (refs_.count(blob) == 0 && garbage_.insert(blob).second) {
+        ++found;
+      }
+    }
+  }
+  LOG_DEBUG << "Found " << found << " unreferenced blobs in " << blob_dir;
+  rescan_ = false;
+  changed_ = true;
+}
+
+std::size_t BlobRefTable::sweep(const boost::filesystem::path& blob_dir, std::chrono::milliseconds budget) {
+  const auto deadline{std::chrono::steady_clock::now() + budget};
+  std::lock_guard<std::mutex> lock{mutex_};
+  std::size_t removed{0};
+  for (auto blob = garbage_.begin(); blob != garbage_.end();) {
+    if (budget.count() > 0 && std::chrono::steady_clock::now() >= deadline) {
+      LOG_INFO << "The blob prune time budget is exhausted, " << garbage_.size()
+               << " unused blobs are left to be removed by the next prune";
+      break;
+    }
+    const auto blob_path{blob_dir / *blob};
+    boost::system::error_code ec;
+    if (boost::filesystem::remove(blob_path, ec)) {
+      LOG_INFO << "Removing blob: " << blob_path;
+      ++removed;
+    } else if (ec) {
+      // keep it in the garbage, so the removal is retried by the next sweep
+      LOG_WARNING << "Failed to remove blob: " << blob_path << ", err: " << ec.message();
+      ++blob;
+      continue;
+    }
+    blob = garbage_.erase(blob);
+    changed_ = true;
+  }
+  return removed;
+}
+
+std::size_t BlobRefTable::garbageSize() const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  return garbage_.size();
+}
+
+void BlobRefTable::save() {
+  std::lock_guard<std::mutex> lock{mutex_};
+  if (!changed_) {
+    return;
+  }
+  try {
+    Json::Value table;
+    table["apps"] = Json::objectValue;
+    for (const auto& app : apps_) {
+      auto& blobs{table["apps"][app.first]};
+      blobs = Json::arrayValue;
+      for (const auto& blob : app.second) {
+        blobs.append(blob);
+      }
+    }
+    table["garbage"] = Json::arrayValue;
+    for (const auto& blob : garbage_) {
+      table["garbage"].append(blob);
+    }
+    table["fetches"] = Json::arrayValue;
+    for (const auto& app : fetches_) {
+      table["fetches"].append(app);
+    }
+    table["rescan"] = rescan_;
+    // write and rename, so a power cut cannot leave a truncated table behind
+    const auto tmp_path{path_.string() + ".tmp"};
+    Utils::writeFile(tmp_path, Utils::jsonToCanonicalStr(table), false);
+    boost::filesystem::rename(tmp_path, path_);
+    changed_ = false;
+  } catch (const std::exception& exc) {
+    LOG_WARNING << "Failed to save the blob reference table; path: " << path_ << ", err: " << exc.what();
+  }
+}
+
+void BlobRefTable::load() {
+  if (!boost::filesystem::exists(path_)) {
+    // the store may have been populated without the table, e.g. by an older version
+    rescan_ = true;
+    return;
+  }
+  try {
+    const auto table{Utils::parseJSONFile(path_)};
+    const auto& apps{table["apps"]};
+    if (!apps.isObject()) {
+      throw std::runtime_error("invalid format");
+    }
+    for (auto app = apps.begin(); app != apps.end(); ++app) {
+      Blobs blobs;
+      for (const auto& blob : *app) {
+        blobs.insert(blob.asString());
+      }
+      addRefs(blobs);
+      apps_.emplace(app.name(), std::move(blobs));
+    }
+    for (const auto& blob : table["garbage"]) {
+      if (refs_.count(blob.asString()) == 0) {
+        garbage_.insert(blob.asString());
+      }
+    }
+    rescan_ = table["rescan"].asBool();
+    if (!table["fetches"].empty()) {
+      // the blobs downloaded by the fetches interrupted before they completed are not referenced by any App
+      LOG_INFO << "Found " << table["fetches"].size() << " interrupted App fetches, the blob store will be rescanned";
+      rescan_ = true;
+      changed_ = true;
+    }
+  } catch (const std::exception& exc) {
+    LOG_WARNING << "Failed to load the blob reference table, it will be rebuilt; path: " << path_
+                << ", err: " << exc.what();
+    apps_.clear();
+    refs_.clear();
+    garbage_.clear();
+    rescan_ = true;
+  }
+}
+
+void BlobRefTable::addRefs(const Blobs& blobs) {
+  for (const auto& blob : blobs) {
+    if (++refs_[blob] == 1) {
+      garbage_.erase(blob);
+    }
+  }
+}
+
+void BlobRefTable::dropRefs(const Blobs& blobs) {
+  for (const auto& blob : blobs) {
+    const auto ref{refs_.find(blob)};
+    if (ref != refs_.end() && --ref->second == 0) {
+      refs_.erase(ref);
+      garbage_.insert(blob);
+    }
+  }
+}
+
+}  // namespace Docker
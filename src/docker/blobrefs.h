@@ -0,0 +1,81 @@
+#ifndef AKTUALIZR_LITE_DOCKER_BLOB_REFS_H_
+#define AKTUALIZR_LITE_DOCKER_BLOB_REFS_H_
+
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+namespace Docker {
+
+/**
+ * @brief BlobRefTable, a persisted reference count of the reset-apps store blobs
+ *
+ * The table records the blobs referred to by each App version kept in the store, a blob's reference count is the
+ * number of App versions referring to it. Once the last reference to a blob is dropped, the blob becomes garbage and is
+ * queued for removal. So, the store prune doesn't need to walk the App dirs and parse their manifests to find unused
+ * blobs, it just drops the App versions that are not needed anymore and unlinks the garbage.
+ *
+ * The garbage is unlinked by `sweep()`, which can be given a time budget, then the blobs left over are persisted and
+ * removed by the following sweeps. The blobs that have never been referenced, e.g. the ones downloaded by a fetch that
+ * failed afterwards, are found by a rescan of the blob dir. A rescan is requested if the table doesn't exist yet. The
+ * App versions being fetched are persisted too, so the blobs left behind by a fetch interrupted by a crash or a power
+ * cut are found by a rescan as well.
+ */
+class BlobRefTable {
+ public:
+  static constexpr const char* const FileName{"aklite-blob-refs.json"};
+  using Blobs = std::set<std::string>;
+
+  explicit BlobRefTable(boost::filesystem::path path);
+
+  bool hasApp(const std::string& app) const;
+  std::vector<std::string> getApps() const;
+  // Sets the blobs referred to by the given App version, the blobs not referred to by any App version become garbage
+  void setAppBlobs(const std::string& app, const Blobs& blobs);
+  void removeApp(const std::string& app);
+  bool isReferenced(const std::string& blob) const;
+
+  // Records the App version whose fetch is about to download blobs, the record has to be saved before the download
+  // starts. If the table is loaded with the record still in place, the fetch has been interrupted and a rescan is
+  // requested.
+  void startFetch(const std::string& app);
+  // Drops the record of the App version fetch, a failed fetch requests a rescan. The blobs of the App version fetched
+  // successfully have to be set before.
+  void finishFetch(const std::string& app, bool succeeded);
+  // Requests the blob dir rescan for the blobs not known to the table, e.g. after a failed fetch
+  void requestRescan();
+  bool isRescanRequested() const;
+  // Adds the unreferenced blobs found in the given dir to the garbage
+  void rescan(const boost::filesystem::path& blob_dir);
+  // Unlinks the garbage blobs from the given dir until the time budget is exhausted, zero budget means no limit.
+  // Returns the number of blobs removed.
+  std::size_t sweep(const boost::filesystem::path& blob_dir,
+                    std::chrono::milliseconds budget = std::chrono::milliseconds::zero());
+  std::size_t garbageSize() const;
+  // Persists the table if it has been changed since the last save, the error is logged and ignored
+  void save();
+
+ private:
+  void load();
+  // both expect the mutex to be locked
+  void addRefs(const Blobs& blobs);
+  void dropRefs(const Blobs& blobs);
+
+  const boost::filesystem::path path_;
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, Blobs> apps_;
+  std::unordered_map<std::string, int> refs_;
+  std::set<std::string> garbage_;
+  std::multiset<std::string> fetches_;
+  bool rescan_{false};
+  bool changed_{false};
+};
+
+}  // namespace Docker
+
+#endif  // AKTUALIZR_LITE_DOCKER_BLOB_REFS_H_
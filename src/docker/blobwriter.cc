@@ -0,0 +1,155 @@
+#include "blobwriter.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "logging/logging.h"
+
+namespace Docker {
+
+BlobWriter::BlobWriter(boost::filesystem::path path, std::size_t expected_size, std::size_t offset, bool direct_io,
+                       std::size_t buffer_size)
+    : path_{std::move(path)},
+      expected_size_{expected_size},
+      buffer_size_{buffer_size > Alignment ? (buffer_size + Alignment - 1) / Alignment * Alignment : Alignment},
+      direct_io_{direct_io},
+      offset_{offset} {
+  fd_ = open(path_.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (offset_ == 0 ? O_TRUNC : 0), 0644);
+  if (fd_ == -1) {
+    throw std::runtime_error("Failed to open a file: " + path_.string() + ", err: " + std::strerror(errno));
+  }
+  void* buffer{nullptr};
+  if (posix_memalign(&buffer, Alignment, buffer_size_) != 0) {
+    ::close(fd_);
+    throw std::bad_alloc();
+  }
+  buffer_.reset(static_cast<char*>(buffer));
+  try {
+    allocate();
+  } catch (...) {
+    ::close(fd_);
+    throw;
+  }
+}
+
+BlobWriter::~BlobWriter() {
+  try {
+    close();
+  } catch (const std::exception& exc) {
+    LOG_WARNING << "Failed to write a blob: " << exc.what();
+  }
+}
+
+void BlobWriter::write(const char* data, std::size_t size) {
+  while (size > 0) {
+    // the first buffer is cut at the alignment boundary, so the following buffers are aligned even if resumed
+    const auto capacity{buffer_size_ - offset_ % Alignment};
+    const auto copy_size{std::min(size, capacity - buffered_)};
+    std::memcpy(buffer_.get() + buffered_, data, copy_size);
+    buffered_ += copy_size;
+    data += copy_size;
+    size -= copy_size;
+    if (buffered_ == capacity) {
+      flush();
+    }
+  }
+}
+
+void BlobWriter::reset(std::size_t offset) {
+  if (offset > size()) {
+    throw std::invalid_argument("Cannot reset a blob writer beyond the data written: " + std::to_string(offset) +
+                                " > " + std::to_string(size()));
+  }
+  // the data before the offset may still be buffered
+  flush();
+  offset_ = offset;
+  if (ftruncate(fd_, static_cast<off_t>(offset)) != 0) {
+    throw std::runtime_error("Failed to truncate a file: " + path_.string() + ", err: " + std::strerror(errno));
+  }
+  // the truncation releases the allocated storage too
+  allocate();
+}
+
+void BlobWriter::sync() {
+  flush();
+  if (fdatasync(fd_) != 0) {
+    throw std::runtime_error("Failed to sync a file: " + path_.string() + ", err: " + std::strerror(errno));
+  }
+  ::close(fd_);
+  fd_ = -1;
+}
+
+void BlobWriter::close() {
+  if (fd_ == -1) {
+    return;
+  }
+  try {
+    flush();
+  } catch (...) {
+    ::close(fd_);
+    fd_ = -1;
+    throw;
+  }
+  ::close(fd_);
+  fd_ = -1;
+}
+
+void BlobWriter::allocate() {
+  // the file size is kept, so it still tells how much of the blob has been written if the download is interrupted
+  if (expected_size_ > 0 && fallocate(fd_, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(expected_size_)) != 0 &&
+      errno != EOPNOTSUPP && errno != ENOSYS) {
+    throw std::runtime_error("Failed to allocate " + std::to_string(expected_size_) +
+                             " bytes for a blob: " + path_.string() + ", err: " + std::strerror(errno));
+  }
+}
+
+void BlobWriter::flush() {
+  if (buffered_ == 0) {
+    return;
+  }
+  // just the beginning of a resumed blob and the end of a blob may be unaligned, they are written through the cache
+  setDirectIo(direct_io_ && offset_ % Alignment == 0 && buffered_ % Alignment == 0);
+  std::size_t written{0};
+  while (written < buffered_) {
+    const auto res{pwrite(fd_, buffer_.get() + written, buffered_ - written, static_cast<off_t>(offset_ + written))};
+    if (res == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EINVAL && direct_io_on_) {
+        // the file system accepts the direct I/O flag but not the direct writes
+        LOG_DEBUG << "The direct I/O is not supported for " << path_;
+        direct_io_ = false;
+        setDirectIo(false);
+        continue;
+      }
+      throw std::runtime_error("Failed to write to a file: " + path_.string() + ", err: " + std::strerror(errno));
+    }
+    written += static_cast<std::size_t>(res);
+  }
+  offset_ += buffered_;
+  buffered_ = 0;
+}
+
+void BlobWriter::setDirectIo(bool on) {
+  if (on == direct_io_on_) {
+    return;
+  }
+  const auto flags{fcntl(fd_, F_GETFL)};
+  if (flags == -1 || fcntl(fd_, F_SETFL, on ? (flags | O_DIRECT) : (flags & ~O_DIRECT)) != 0) {
+    if (on) {
+      // e.g. tmpfs
+      LOG_DEBUG << "The direct I/O is not supported for " << path_ << ", err: " << std::strerror(errno);
+      direct_io_ = false;
+      return;
+    }
+    throw std::runtime_error("Failed to turn the direct I/O off for " + path_.string() +
+                             ", err: " + std::strerror(errno));
+  }
+  direct_io_on_ = on;
+}
+
+}  // namespace Docker
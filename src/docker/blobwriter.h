@@ -0,0 +1,67 @@
+#ifndef AKTUALIZR_LITE_DOCKER_BLOB_WRITER_H_
+#define AKTUALIZR_LITE_DOCKER_BLOB_WRITER_H_
+
+#include <cstdlib>
+#include <memory>
+
+#include <boost/filesystem.hpp>
+
+namespace Docker {
+
+/**
+ * @brief BlobWriter, writes the data of a blob being downloaded to its file
+ *
+ * The storage for the whole blob is allocated when the file is opened, so a download that cannot fit fails before
+ * receiving anything rather than when the storage runs out, and the blob file is not fragmented by the small writes.
+ * The received chunks are gathered in a buffer and written by a single `pwrite()` of the buffer size. If the direct
+ * I/O is requested and the file system supports it, the buffer writes bypass the page cache, so a large blob doesn't
+ * evict the pages of the running Apps. The data is synced to the storage just once, when the blob is complete.
+ */
+class BlobWriter {
+ public:
+  static const std::size_t DefBufferSize{1024 * 1024};
+  // The alignment of the buffer, file offsets and sizes of the direct writes, the logical block size of most storages
+  static const std::size_t Alignment{4096};
+
+  // The writes start from the given offset, the data before it is kept, e.g. the data of an interrupted download
+  BlobWriter(boost::filesystem::path path, std::size_t expected_size, std::size_t offset = 0, bool direct_io = false,
+             std::size_t buffer_size = DefBufferSize);
+  ~BlobWriter();
+  BlobWriter(const BlobWriter&) = delete;
+  BlobWriter& operator=(const BlobWriter&) = delete;
+  BlobWriter(BlobWriter&&) = delete;
+  BlobWriter& operator=(BlobWriter&&) = delete;
+
+  void write(const char* data, std::size_t size);
+  // Drops the data written after the given offset, the next writes start from it
+  void reset(std::size_t offset = 0);
+  // Writes out the buffered data and syncs the file, nothing can be written afterwards
+  void sync();
+  // Writes out the buffered data and closes the file without syncing it, e.g. to keep the data of a failed download
+  void close();
+
+  const boost::filesystem::path& path() const { return path_; }
+  // The size of the blob data, including the data before the offset the writer was opened at
+  std::size_t size() const { return offset_ + buffered_; }
+
+ private:
+  void allocate();
+  void flush();
+  void setDirectIo(bool on);
+
+  const boost::filesystem::path path_;
+  const std::size_t expected_size_;
+  const std::size_t buffer_size_;
+  // turned off if the file system doesn't support it
+  bool direct_io_;
+  bool direct_io_on_{false};
+  int fd_{-1};
+  std::unique_ptr<char, decltype(&std::free)> buffer_{nullptr, &std::free};
+  std::size_t buffered_{0};
+  // the file offset of the buffer beginning
+  std::size_t offset_;
+};
+
+}  // namespace Docker
+
+#endif  // AKTUALIZR_LITE_DOCKER_BLOB_WRITER_H_
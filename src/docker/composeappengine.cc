@@ -20,6 +20,9 @@ ComposeAppEngine::ComposeAppEngine(boost::filesystem::path root_dir, std::string
       registry_client_{std::move(registry_client)} {}
 
 AppEngine::Result ComposeAppEngine::fetch(const App& app) {
+  if (fetchesCancelled()) {
+    return {Result::ID::Cancelled, "the App fetch has been cancelled"};
+  }
   boost::filesystem::create_directories(appRoot(app) / MetaDir);
 
   Result result{false};
@@ -1,5 +1,17 @@
 #include "docker.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <fstream>
+#include <functional>
+#include <future>
+#include <list>
+#include <mutex>
 
 #include <boost/algorithm/hex.hpp>
 #include <boost/algorithm/string/case_conv.hpp>
@@ -9,7 +21,12 @@
 #include <boost/algorithm/string/trim.hpp>
 
 #include "crypto/crypto.h"
-#include "http/httpclient.h"
+#include "docker/blobwriter.h"
+#include "docker/httpclientpool.h"
+#include "downloadscheduler.h"
+#include "logging/logging.h"
+#include "parallelfor.h"
+#include "utilities/utils.h"
 
 namespace Docker {
 
@@ -71,6 +88,41 @@ HashedDigest::HashedDigest(const std::string& hash_digest) : digest_{boost::algo
   short_hash_ = hash_.substr(0, 7);
 }
 
+// Feeds the file content to the hasher
+static void hashFile(const boost::filesystem::path& path, MultiPartHasher& hasher) {
+  static const std::size_t BufferSize{64 * 1024};
+
+  const int fd{open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+  if (fd == -1) {
+    throw std::runtime_error("Failed to open a file to hash; path: " + path.string() +
+                             ", err: " + std::strerror(errno));
+  }
+  // the file is read just once from its beginning to end
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  std::vector<unsigned char> buffer(BufferSize);
+  ssize_t read_size;
+  while ((read_size = read(fd, buffer.data(), buffer.size())) != 0) {
+    if (read_size == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      const auto err{errno};
+      close(fd);
+      throw std::runtime_error("Failed to read a file to hash; path: " + path.string() +
+                               ", err: " + std::strerror(err));
+    }
+    hasher.update(buffer.data(), static_cast<uint64_t>(read_size));
+  }
+  close(fd);
+}
+
+std::string getFileHash(const boost::filesystem::path& path) {
+  MultiPartSHA256Hasher hasher;
+  hashFile(path, hasher);
+  return boost::algorithm::to_lower_copy(hasher.getHexDigest());
+}
+
 ImageManifest::ImageManifest(const Json::Value& value) : Json::Value(value) {
   static const std::array<std::string, 4> required_fields = {"mediaType", "schemaVersion", "config", "layers"};
   for (const auto& f : required_fields) {
@@ -114,7 +166,9 @@ Json::Value ImageManifest::toLoadManifest(const std::string& blobs_dir, const st
 
 const RegistryClient::HttpClientFactory RegistryClient::DefaultHttpClientFactory =
     [](const std::vector<std::string>* headers, const std::set<std::string>* response_header_names) {
-      return std::make_shared<HttpClient>(headers, response_header_names);
+      // all Registry requests of the process reuse the connections
+      static const auto pool{HttpClientPool::create()};
+      return pool->createClient(headers, response_header_names);
     };
 
 const std::string RegistryClient::ManifestEndpoint{"/manifests/"};
@@ -190,10 +244,14 @@ RegistryClient::BearerAuth::BearerAuth(const std::string& auth_header_value) {
 }
 
 RegistryClient::RegistryClient(std::shared_ptr<HttpInterface> ota_lite_client, std::string auth_creds_endpoint,
-                               HttpClientFactory http_client_factory)
+                               HttpClientFactory http_client_factory, RangeDownloadConfig range_download_cfg,
+                               boost::filesystem::path partial_blobs_dir, bool direct_io)
     : auth_creds_endpoint_{std::move(auth_creds_endpoint)},
       ota_lite_client_{std::move(ota_lite_client)},
-      http_client_factory_{std::move(http_client_factory)} {}
+      http_client_factory_{std::move(http_client_factory)},
+      range_download_cfg_{range_download_cfg},
+      partial_blobs_dir_{std::move(partial_blobs_dir)},
+      direct_io_{direct_io} {}
 
 std::string RegistryClient::getAppManifest(const Uri& uri, const std::string& format,
                                            boost::optional<std::int64_t> manifest_size) const {
@@ -254,12 +312,14 @@ std::string RegistryClient::getAppManifest(const Uri& uri, const std::string& fo
 }
 
 struct DownloadCtx {
-  DownloadCtx(std::ostream& out_stream_in, MultiPartHasher& hasher_in, std::size_t expected_size_in)
-      : out_stream{out_stream_in}, hasher{hasher_in}, expected_size{expected_size_in} {}
+  DownloadCtx(BlobWriter& writer_in, MultiPartHasher& hasher_in, std::size_t expected_size_in)
+      : writer{writer_in}, hasher{hasher_in}, expected_size{expected_size_in}, written_size{writer_in.size()} {}
 
-  std::ostream& out_stream;
+  BlobWriter& writer;
   MultiPartHasher& hasher;
   std::size_t expected_size;
+  DownloadScheduler::Transfer transfer{DownloadScheduler::instance(), DownloadScheduler::Class::AppBlob};
+  DownloadScheduler::CurlPause pause{transfer};
 
   std::size_t written_size{0};
   std::size_t received_size{0};
@@ -267,31 +327,47 @@ struct DownloadCtx {
   std::size_t write(const char* data, std::size_t size) {
     assert(data);
 
+    if (pause.pause()) {
+      return CURL_WRITEFUNC_PAUSE;
+    }
     received_size = written_size + size;
     if (received_size > expected_size) {
       LOG_ERROR << "!!! Received data size exceeds the expected size: " << received_size << " != " << expected_size;
       return (size + 1);  // returning value that is not equal to received data size will make curl fail
     }
 
-    if (!out_stream.good()) {
-      LOG_ERROR << "Output stream is at a bad state: " << out_stream.rdstate();
+    transfer.consume(size);
+    try {
+      writer.write(data, size);
+    } catch (const std::exception& exc) {
+      LOG_ERROR << exc.what();
       return (size + 1);  // returning value that is not equal to received data size will make curl fail
     }
 
-    auto start_pos = out_stream.tellp();
-    out_stream.write(data, size);
-    auto end_pos = out_stream.tellp();
-
-    written_size += (end_pos - start_pos);
+    written_size += size;
     hasher.update(reinterpret_cast<const unsigned char*>(data), size);
-    return (end_pos - start_pos);
+    return size;
   }
   void reset() {
-    out_stream.seekp(std::ios_base::beg);
+    writer.reset();
     hasher.reset();
     written_size = 0;
     received_size = 0;
   }
+  // Discards the body of an error response received after the given offset, e.g. a 401 response to a resumed
+  // download, so the blob can be requested again from the offset
+  void discard(std::size_t offset) {
+    if (written_size == offset) {
+      return;
+    }
+    transfer.refund(written_size - offset);
+    writer.reset(offset);
+    // the hasher state is restored as on the download resume
+    hasher.reset();
+    hashFile(writer.path(), hasher);
+    written_size = offset;
+    received_size = offset;
+  }
 };
 
 static size_t DownloadHandler(char* data, size_t buf_size, size_t buf_numb, void* user_ctx) {
@@ -301,48 +377,366 @@ static size_t DownloadHandler(char* data, size_t buf_size, size_t buf_numb, void
   return download_ctx->write(data, (buf_size * buf_numb));
 }
 
+// Resumes the download paused by its write handler once the scheduler lets it through
+template <typename Ctx>
+static int ResumeHandler(void* user_ctx, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
+  assert(user_ctx);
+  (void)dltotal;
+  (void)dlnow;
+  (void)ultotal;
+  (void)ulnow;
+
+  reinterpret_cast<Ctx*>(user_ctx)->pause.resume();
+  return 0;
+}
+
+// Writes a byte range of a blob to its place in the blob file, so the ranges can be written concurrently
+struct RangeDownloadCtx {
+  RangeDownloadCtx(DownloadScheduler::Transfer& transfer_in, int fd_in, std::size_t offset_in, std::size_t size_in)
+      : transfer{transfer_in}, fd{fd_in}, offset{offset_in}, size{size_in} {}
+
+  // shared by the ranges of the blob
+  DownloadScheduler::Transfer& transfer;
+  DownloadScheduler::CurlPause pause{transfer};
+  const int fd;
+  const std::size_t offset;
+  const std::size_t size;
+
+  std::size_t written_size{0};
+
+  std::size_t write(const char* data, std::size_t data_size) {
+    assert(data);
+
+    if (pause.pause()) {
+      return CURL_WRITEFUNC_PAUSE;
+    }
+    if (written_size + data_size > size) {
+      // also the case of a registry that ignores the Range header and sends the whole blob
+      LOG_DEBUG << "Received data size exceeds the requested range size: " << written_size + data_size << " > "
+                << size;
+      return (data_size + 1);  // returning value that is not equal to received data size will make curl fail
+    }
+    transfer.consume(data_size);
+    std::size_t data_written{0};
+    while (data_written < data_size) {
+      const auto res{pwrite(fd, data + data_written, data_size - data_written,
+                            static_cast<off_t>(offset + written_size + data_written))};
+      if (res == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        LOG_ERROR << "Failed to write a blob range: " << std::strerror(errno);
+        return (data_size + 1);
+      }
+      data_written += static_cast<std::size_t>(res);
+    }
+    written_size += data_size;
+    return data_size;
+  }
+  // Discards the data received so far, e.g. the body of a 401 response, so the range can be requested again
+  void reset() {
+    transfer.refund(written_size);
+    written_size = 0;
+  }
+};
+
+static size_t RangeDownloadHandler(char* data, size_t buf_size, size_t buf_numb, void* user_ctx) {
+  assert(user_ctx);
+
+  auto* download_ctx = reinterpret_cast<RangeDownloadCtx*>(user_ctx);
+  return download_ctx->write(data, (buf_size * buf_numb));
+}
+
 void RegistryClient::downloadBlob(const Uri& uri, const boost::filesystem::path& filepath, size_t expected_size) const {
-  auto compose_app_blob_url{composeBlobUrl(uri)};
+  const auto& hash{uri.digest.hash()};
+  acquirePartialBlob(hash);
+  const auto part_path{getPartialBlobPath(uri, filepath)};
+  try {
+    if (!isRangeDownloadable(uri, expected_size) || !downloadBlobByRanges(uri, part_path, expected_size)) {
+      downloadBlobByStream(uri, part_path, expected_size);
+    }
+    commitPartialBlob(part_path, filepath);
+  } catch (...) {
+    discardPartialBlob(part_path);
+    releasePartialBlob(hash);
+    throw;
+  }
+  releasePartialBlob(hash);
+}
 
-  LOG_DEBUG << "Downloading App blob: " << compose_app_blob_url;
+void RegistryClient::downloadBlobs(const std::vector<BlobDownload>& blobs, int parallelism) const {
+  // a blob listed more than once is downloaded once and then copied
+  std::vector<const BlobDownload*> unique_blobs;
+  std::vector<std::pair<const BlobDownload*, const BlobDownload*>> copies;
+  {
+    std::unordered_map<std::string, const BlobDownload*> hashes;
+    for (const auto& blob : blobs) {
+      const auto found{hashes.emplace(blob.uri.digest.hash(), &blob)};
+      if (found.second) {
+        unique_blobs.push_back(&blob);
+      } else {
+        copies.emplace_back(found.first->second, &blob);
+      }
+    }
+  }
+
+  struct Transfer {
+    const BlobDownload* blob;
+    boost::filesystem::path part_path;
+    MultiPartSHA256Hasher hasher;
+    std::unique_ptr<BlobWriter> writer;
+    std::unique_ptr<DownloadCtx> ctx;
+    std::size_t offset{0};
+    std::vector<std::string> headers;
+    bool authorized{false};
+    // kept until the response is received, it refers to the headers
+    std::shared_ptr<HttpInterface> client;
+    std::future<HttpResponse> resp;
+    // the range downloads are delegated to `downloadBlob()` run in another thread
+    bool delegated{false};
+  };
+  const std::set<std::string> header_to_get{BearerAuth::Header};
 
-  std::ofstream output_file{filepath.string(), std::ios_base::out | std::ios_base::binary};
-  if (!output_file.is_open()) {
-    throw std::runtime_error("Failed to open a file: " + filepath.string());
+  // the transfers whose responses are ready, in the order they complete, so the transfers are not polled
+  std::mutex done_mutex;
+  std::condition_variable done_cv;
+  std::deque<Transfer*> done_transfers;
+  auto notify{[&](Transfer* transfer) {
+    std::lock_guard<std::mutex> lock{done_mutex};
+    done_transfers.push_back(transfer);
+    done_cv.notify_one();
+  }};
+  // runs the given function in another thread and queues the transfer once it returns or throws
+  auto watch{[&](Transfer& transfer, std::function<HttpResponse()> func) {
+    transfer.resp = std::async(std::launch::async, [&notify, &transfer, func{std::move(func)}]() {
+      try {
+        auto resp{func()};
+        notify(&transfer);
+        return resp;
+      } catch (...) {
+        notify(&transfer);
+        throw;
+      }
+    });
+  }};
+
+  auto restart{[](Transfer& transfer) {
+    transfer.ctx->reset();
+    transfer.offset = 0;
+  }};
+  auto request{[&](Transfer& transfer) {
+    transfer.client = http_client_factory_(&transfer.headers, &header_to_get);
+    auto resp{std::make_shared<std::future<HttpResponse>>(
+        transfer.client->downloadAsync(composeBlobUrl(transfer.blob->uri), DownloadHandler, ResumeHandler<DownloadCtx>,
+                                       transfer.ctx.get(), static_cast<curl_off_t>(transfer.offset),
+                                       transfer.ctx->pause.handle()))};
+    watch(transfer, [resp]() { return resp->get(); });
+  }};
+  auto start{[&](Transfer& transfer) {
+    const auto& blob{*transfer.blob};
+    if (isRangeDownloadable(blob.uri, blob.size)) {
+      transfer.delegated = true;
+      watch(transfer, [this, &blob]() {
+        downloadBlob(blob.uri, blob.path, blob.size);
+        return HttpResponse("", 200, CURLE_OK, "");
+      });
+      return;
+    }
+    acquirePartialBlob(blob.uri.digest.hash());
+    transfer.part_path = getPartialBlobPath(blob.uri, blob.path);
+    transfer.offset = resumePartialBlob(blob.uri, transfer.part_path, blob.size, transfer.hasher);
+    LOG_DEBUG << "Downloading App blob: " << composeBlobUrl(blob.uri);
+    transfer.writer = std::make_unique<BlobWriter>(transfer.part_path, blob.size, transfer.offset, direct_io_);
+    transfer.ctx = std::make_unique<DownloadCtx>(*transfer.writer, transfer.hasher, blob.size);
+    if (transfer.offset < blob.size) {
+      request(transfer);
+    } else {
+      std::promise<HttpResponse> done;
+      done.set_value(HttpResponse("", 200, CURLE_OK, ""));
+      transfer.resp = done.get_future();
+      notify(&transfer);
+    }
+  }};
+  // returns true if the transfer is complete, false if it has been requested again
+  auto complete{[&](Transfer& transfer) {
+    auto resp{transfer.resp.get()};
+    if (transfer.delegated) {
+      return true;
+    }
+    const auto& blob{*transfer.blob};
+    if (resp.http_status_code == 401 && !transfer.authorized) {
+      if (resp.headers.empty() || resp.headers.count(BearerAuth::Header) == 0) {
+        throw std::runtime_error("No `" + BearerAuth::Header + "` header found in the 401 response");
+      }
+      transfer.headers.push_back(getBearerAuthHeader(BearerAuth(resp.headers[BearerAuth::Header])));
+      transfer.authorized = true;
+      // the body of the error response has been received as the blob data
+      transfer.ctx->discard(transfer.offset);
+      request(transfer);
+      return false;
+    }
+    if (transfer.offset > 0 && resp.http_status_code == 200) {
+      LOG_INFO << "Registry " << blob.uri.registryHostname << " cannot resume the blob download, starting it over";
+      restart(transfer);
+      request(transfer);
+      return false;
+    }
+    if (transfer.offset < blob.size && !resp.isOk()) {
+      // the received data is kept if the download can be resumed
+      if (resp.http_status_code != 200 && resp.http_status_code != 206) {
+        transfer.ctx->discard(transfer.offset);
+      }
+      throw std::runtime_error("Failed to download App blob: " + resp.getStatusStr());
+    }
+    transfer.writer->sync();
+    verifyBlob(blob.uri, transfer.part_path, transfer.ctx->written_size, blob.size, transfer.hasher);
+    commitPartialBlob(transfer.part_path, blob.path);
+    return true;
+  }};
+
+  const auto max_transfers{static_cast<std::size_t>(std::max(parallelism, 1))};
+  std::list<Transfer> transfers;
+  std::size_t next_blob{0};
+  std::exception_ptr err;
+  auto finish{[&](std::list<Transfer>::iterator transfer) {
+    if (!transfer->delegated) {
+      // the data received so far is written out before the partial blob can be taken by another download
+      transfer->ctx.reset();
+      transfer->writer.reset();
+      discardPartialBlob(transfer->part_path);
+      releasePartialBlob(transfer->blob->uri.digest.hash());
+    }
+    return transfers.erase(transfer);
+  }};
+  while (!transfers.empty() || (!err && next_blob < unique_blobs.size())) {
+    // the next blobs are not started after a failure, the transfers in progress cannot be stopped though
+    while (!err && next_blob < unique_blobs.size() && transfers.size() < max_transfers) {
+      transfers.emplace_back();
+      transfers.back().blob = unique_blobs[next_blob++];
+      try {
+        start(transfers.back());
+      } catch (...) {
+        err = std::current_exception();
+        finish(std::prev(transfers.end()));
+      }
+    }
+    if (transfers.empty()) {
+      continue;
+    }
+    Transfer* done_transfer;
+    {
+      std::unique_lock<std::mutex> lock{done_mutex};
+      done_cv.wait(lock, [&done_transfers]() { return !done_transfers.empty(); });
+      done_transfer = done_transfers.front();
+      done_transfers.pop_front();
+    }
+    const auto transfer{std::find_if(transfers.begin(), transfers.end(),
+                                     [done_transfer](const Transfer& item) { return &item == done_transfer; })};
+    try {
+      if (!complete(*transfer)) {
+        continue;
+      }
+    } catch (...) {
+      if (!err) {
+        err = std::current_exception();
+      }
+    }
+    finish(transfer);
+  }
+  if (err) {
+    std::rethrow_exception(err);
   }
+  for (const auto& copy : copies) {
+    boost::filesystem::copy_file(copy.first->path, copy.second->path,
+                                 boost::filesystem::copy_option::overwrite_if_exists);
+  }
+}
+
+void RegistryClient::downloadBlobByStream(const Uri& uri, const boost::filesystem::path& filepath,
+                                          size_t expected_size) const {
+  auto compose_app_blob_url{composeBlobUrl(uri)};
+
   MultiPartSHA256Hasher hasher;
-  DownloadCtx download_ctx{output_file, hasher, expected_size};
+  std::size_t offset{resumePartialBlob(uri, filepath, expected_size, hasher)};
+  LOG_DEBUG << "Downloading App blob: " << compose_app_blob_url;
+
+  BlobWriter writer{filepath, expected_size, offset, direct_io_};
+  DownloadCtx download_ctx{writer, hasher, expected_size};
 
   const std::set<std::string> header_to_get{BearerAuth::Header};
   std::vector<std::string> registry_repo_request_headers;
   std::function<HttpResponse()> doDownloadBlobRequest = [&]() {
     auto registry_repo_client{http_client_factory_(&registry_repo_request_headers, &header_to_get)};
-    return registry_repo_client->download(compose_app_blob_url, DownloadHandler, nullptr, &download_ctx, 0);
+    // started by `downloadAsync()` for its handle, so the download can be paused by the scheduler
+    return registry_repo_client
+        ->downloadAsync(compose_app_blob_url, DownloadHandler, ResumeHandler<DownloadCtx>, &download_ctx,
+                        static_cast<curl_off_t>(offset), download_ctx.pause.handle())
+        .get();
   };
-
-  auto get_blob_resp = doDownloadBlobRequest();
-  if (get_blob_resp.http_status_code == 401) {
-    if (get_blob_resp.headers.empty() || get_blob_resp.headers.count(BearerAuth::Header) == 0) {
-      throw std::runtime_error("No `" + BearerAuth::Header + "` header found in the 401 response");
-    }
-    auto auth_header{getBearerAuthHeader(BearerAuth(get_blob_resp.headers[BearerAuth::Header]))};
-    registry_repo_request_headers.push_back(auth_header);
+  auto restartDownload{[&]() {
+    offset = 0;
     download_ctx.reset();
+  }};
+
+  HttpResponse get_blob_resp;
+  if (offset < expected_size) {
     get_blob_resp = doDownloadBlobRequest();
-  }
-  if (!get_blob_resp.isOk()) {
-    throw std::runtime_error("Failed to download App blob: " + get_blob_resp.getStatusStr());
+    if (get_blob_resp.http_status_code == 401) {
+      if (get_blob_resp.headers.empty() || get_blob_resp.headers.count(BearerAuth::Header) == 0) {
+        throw std::runtime_error("No `" + BearerAuth::Header + "` header found in the 401 response");
+      }
+      auto auth_header{getBearerAuthHeader(BearerAuth(get_blob_resp.headers[BearerAuth::Header]))};
+      registry_repo_request_headers.push_back(auth_header);
+      // the body of the error response has been received as the blob data
+      download_ctx.discard(offset);
+      get_blob_resp = doDownloadBlobRequest();
+    }
+    if (offset > 0 && get_blob_resp.http_status_code == 200) {
+      // the registry has ignored the Range header and sent the blob from its beginning
+      LOG_INFO << "Registry " << uri.registryHostname << " cannot resume the blob download, starting it over";
+      restartDownload();
+      get_blob_resp = doDownloadBlobRequest();
+    }
+    if (!get_blob_resp.isOk()) {
+      // the received data is kept if the download can be resumed
+      if (get_blob_resp.http_status_code != 200 && get_blob_resp.http_status_code != 206) {
+        download_ctx.discard(offset);
+      }
+      throw std::runtime_error("Failed to download App blob: " + get_blob_resp.getStatusStr());
+    }
   }
 
-  output_file.close();
-  std::size_t recv_blob_file_size{download_ctx.written_size};
+  writer.sync();
+  verifyBlob(uri, filepath, download_ctx.written_size, expected_size, hasher);
+}
+
+std::size_t RegistryClient::resumePartialBlob(const Uri& uri, const boost::filesystem::path& filepath,
+                                              size_t expected_size, MultiPartHasher& hasher) const {
+  if (partial_blobs_dir_.empty() || !boost::filesystem::exists(filepath)) {
+    return 0;
+  }
+  const auto ranges_path{getRangesPath(filepath)};
+  const auto size{boost::filesystem::file_size(filepath)};
+  if (boost::filesystem::exists(ranges_path) || size > expected_size) {
+    // the file is not a contiguous beginning of the blob
+    boost::filesystem::remove(ranges_path);
+    return 0;
+  }
+  // the hasher state is restored by hashing the data received so far, reading it is much cheaper than receiving
+  hashFile(filepath, hasher);
+  LOG_INFO << "Resuming download of App blob: " << composeBlobUrl(uri) << " from " << size << " of "
+           << expected_size << " bytes";
+  return size;
+}
 
-  if (recv_blob_file_size != expected_size) {
+void RegistryClient::verifyBlob(const Uri& uri, const boost::filesystem::path& filepath, size_t received_size,
+                                size_t expected_size, MultiPartHasher& hasher) {
+  if (received_size != expected_size) {
     std::remove(filepath.c_str());
     throw std::runtime_error(
         "Size of downloaded App blob does not equal to "
         "the expected one: " +
-        std::to_string(recv_blob_file_size) + " != " + std::to_string(expected_size));
+        std::to_string(received_size) + " != " + std::to_string(expected_size));
   }
 
   auto recv_blob_hash{boost::algorithm::to_lower_copy(hasher.getHexDigest())};
@@ -356,12 +750,284 @@ void RegistryClient::downloadBlob(const Uri& uri, const boost::filesystem::path&
   }
 }
 
+bool RegistryClient::downloadBlobByRanges(const Uri& uri, const boost::filesystem::path& filepath,
+                                          size_t expected_size) const {
+  const auto blob_url{composeBlobUrl(uri)};
+  const bool resumable{!partial_blobs_dir_.empty()};
+  const auto ranges_path{getRangesPath(filepath)};
+
+  // the blob ranges received by the previous attempts, as `<offset> <size>` lines
+  std::vector<std::pair<std::size_t, std::size_t>> received_ranges;
+  if (resumable && boost::filesystem::exists(filepath) && boost::filesystem::exists(ranges_path) &&
+      boost::filesystem::file_size(filepath) == expected_size) {
+    std::ifstream ranges_file{ranges_path.string()};
+    std::size_t offset;
+    std::size_t size;
+    while (ranges_file >> offset >> size) {
+      if (offset + size <= expected_size) {
+        received_ranges.emplace_back(offset, size);
+      }
+    }
+    std::sort(received_ranges.begin(), received_ranges.end());
+  } else {
+    boost::filesystem::remove(ranges_path);
+  }
+  // the blob ranges to download
+  std::vector<std::pair<std::size_t, std::size_t>> missing_ranges;
+  std::size_t missing_offset{0};
+  for (const auto& range : received_ranges) {
+    if (range.first > missing_offset) {
+      missing_ranges.emplace_back(missing_offset, range.first - missing_offset);
+    }
+    missing_offset = std::max(missing_offset, range.first + range.second);
+  }
+  if (missing_offset < expected_size) {
+    missing_ranges.emplace_back(missing_offset, expected_size - missing_offset);
+  }
+  if (!received_ranges.empty()) {
+    LOG_INFO << "Resuming download of App blob: " << blob_url << ", " << missing_ranges.size()
+             << " byte ranges are missing";
+  }
+
+  const int fd{open(filepath.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (received_ranges.empty() ? O_TRUNC : 0), 0644)};
+  if (fd == -1) {
+    throw std::runtime_error("Failed to open a file: " + filepath.string() + ", err: " + std::strerror(errno));
+  }
+  // the ranges are written to their place in the file, so the whole file is allocated up front
+  const auto alloc_err{posix_fallocate(fd, 0, static_cast<off_t>(expected_size))};
+  if (alloc_err != 0 && (alloc_err != EOPNOTSUPP || ftruncate(fd, static_cast<off_t>(expected_size)) != 0)) {
+    close(fd);
+    std::remove(filepath.c_str());
+    boost::filesystem::remove(ranges_path);
+    throw std::runtime_error("Failed to allocate " + std::to_string(expected_size) +
+                             " bytes for a blob: " + filepath.string() + ", err: " + std::strerror(alloc_err));
+  }
+
+  DownloadScheduler::Transfer transfer{DownloadScheduler::instance(), DownloadScheduler::Class::AppBlob};
+  const std::set<std::string> header_to_get{BearerAuth::Header};
+  // shared by the ranges, it is replaced once the registry rejects it, e.g. the token expires in the middle of a blob
+  std::mutex auth_header_mutex;
+  std::string auth_header;
+  auto request_range{[&](RangeDownloadCtx& ctx, const std::string& auth) {
+    std::vector<std::string> headers;
+    if (!auth.empty()) {
+      headers.push_back(auth);
+    }
+    headers.emplace_back("range: bytes=" + std::to_string(ctx.offset) + "-" +
+                         std::to_string(ctx.offset + ctx.size - 1));
+    auto registry_repo_client{http_client_factory_(&headers, &header_to_get)};
+    return registry_repo_client
+        ->downloadAsync(blob_url, RangeDownloadHandler, ResumeHandler<RangeDownloadCtx>, &ctx, 0, ctx.pause.handle())
+        .get();
+  }};
+  // the range is requested again, once, if its authorization is challenged
+  auto download_range{[&](RangeDownloadCtx& ctx) {
+    std::string auth;
+    {
+      std::lock_guard<std::mutex> lock{auth_header_mutex};
+      auth = auth_header;
+    }
+    auto resp{request_range(ctx, auth)};
+    if (resp.http_status_code != 401) {
+      return resp;
+    }
+    if (resp.headers.empty() || resp.headers.count(BearerAuth::Header) == 0) {
+      throw std::runtime_error("No `" + BearerAuth::Header + "` header found in the 401 response");
+    }
+    auth = getBearerAuthHeader(BearerAuth(resp.headers[BearerAuth::Header]), auth);
+    {
+      std::lock_guard<std::mutex> lock{auth_header_mutex};
+      auth_header = auth;
+    }
+    // the body of the 401 response has been written to the range's place, it is overwritten by the range data
+    ctx.reset();
+    return request_range(ctx, auth);
+  }};
+  std::mutex ranges_file_mutex;
+  std::ofstream ranges_file;
+  if (resumable) {
+    ranges_file.open(ranges_path.string(), std::ios_base::out | std::ios_base::app);
+  }
+  auto record_range{[&](const RangeDownloadCtx& ctx) {
+    if (!resumable) {
+      return;
+    }
+    // the range is recorded only after its data is on disk, so a power cut cannot leave a hole recorded as received
+    fdatasync(fd);
+    std::lock_guard<std::mutex> lock{ranges_file_mutex};
+    ranges_file << ctx.offset << " " << ctx.size << std::endl;
+  }};
+  auto discard_blob{[&]() {
+    close(fd);
+    ranges_file.close();
+    std::remove(filepath.c_str());
+    boost::filesystem::remove(ranges_path);
+  }};
+
+  try {
+    if (!missing_ranges.empty()) {
+      // the first range is downloaded alone, it tells whether the registry supports ranges and how fast the link is
+      RangeDownloadCtx first_range{transfer, fd, missing_ranges.front().first,
+                                   std::min(range_download_cfg_.min_range_size, missing_ranges.front().second)};
+      const auto started_at{std::chrono::steady_clock::now()};
+      const auto resp{download_range(first_range)};
+      if (resp.http_status_code == 200) {
+        LOG_INFO << "Registry " << uri.registryHostname
+                 << " doesn't support Range requests, downloading blobs by one";
+        {
+          std::lock_guard<std::mutex> lock{mutex_};
+          no_range_registries_.insert(uri.registryHostname);
+        }
+        discard_blob();
+        return false;
+      }
+      if (!resp.isOk() || resp.http_status_code != 206 || first_range.written_size != first_range.size) {
+        throw std::runtime_error("Failed to download App blob range: " + resp.getStatusStr());
+      }
+      record_range(first_range);
+      missing_ranges.front().first += first_range.size;
+      missing_ranges.front().second -= first_range.size;
+
+      // each range is to take about `range_time` to download at the speed of the first one
+      const auto elapsed_ms{std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() -
+                                                                                  started_at)
+                                .count()};
+      const double bytes_per_ms{static_cast<double>(first_range.size) / std::max<double>(elapsed_ms, 1)};
+      const auto range_size{
+          std::min(std::max(static_cast<std::size_t>(bytes_per_ms * range_download_cfg_.range_time.count()),
+                            range_download_cfg_.min_range_size),
+                   range_download_cfg_.max_range_size)};
+      std::vector<RangeDownloadCtx> ranges;
+      for (const auto& missing : missing_ranges) {
+        for (std::size_t offset = missing.first; offset < missing.first + missing.second; offset += range_size) {
+          ranges.emplace_back(transfer, fd, offset, std::min(range_size, missing.first + missing.second - offset));
+        }
+      }
+      LOG_DEBUG << "Downloading App blob: " << blob_url << " by " << ranges.size() + 1 << " ranges of " << range_size
+                << " bytes";
+
+      parallelFor(ranges.size(), static_cast<std::size_t>(range_download_cfg_.max_parallel_ranges),
+                  [&](std::size_t indx) {
+                    auto& range{ranges[indx]};
+                    const auto range_resp{download_range(range)};
+                    if (!range_resp.isOk() || range_resp.http_status_code != 206 ||
+                        range.written_size != range.size) {
+                      throw std::runtime_error("Failed to download App blob range: " + range_resp.getStatusStr());
+                    }
+                    record_range(range);
+                  });
+    }
+  } catch (...) {
+    if (resumable) {
+      // the ranges received so far are kept, so the next attempt downloads just the missing ones
+      close(fd);
+    } else {
+      discard_blob();
+    }
+    throw;
+  }
+  if (!resumable) {
+    // the resumable blob's ranges have been synced as they were recorded
+    fdatasync(fd);
+  }
+  close(fd);
+  ranges_file.close();
+  boost::filesystem::remove(ranges_path);
+
+  // the ranges are received out of order, so the blob is hashed once it's complete
+  const auto recv_blob_hash{getFileHash(filepath)};
+  if (recv_blob_hash != uri.digest.hash()) {
+    std::remove(filepath.c_str());
+    throw std::runtime_error(
+        "Hash of downloaded App blob does not equal to "
+        "the expected one: " +
+        recv_blob_hash + " != " + uri.digest.hash());
+  }
+  return true;
+}
+
+bool RegistryClient::areRangesSupported(const std::string& registry_hostname) const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  return no_range_registries_.count(registry_hostname) == 0;
+}
+
+void RegistryClient::acquirePartialBlob(const std::string& hash) const {
+  // the partial blob file is shared by the downloads of the same blob, so they have to be serialized
+  std::unique_lock<std::mutex> lock{mutex_};
+  cv_.wait(lock, [this, &hash]() { return partial_blobs_in_use_.count(hash) == 0; });
+  partial_blobs_in_use_.insert(hash);
+}
+
+void RegistryClient::releasePartialBlob(const std::string& hash) const {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    partial_blobs_in_use_.erase(hash);
+  }
+  cv_.notify_all();
+}
+
+void RegistryClient::commitPartialBlob(const boost::filesystem::path& part_path,
+                                       const boost::filesystem::path& filepath) {
+  if (part_path == filepath) {
+    return;
+  }
+  boost::system::error_code ec;
+  boost::filesystem::rename(part_path, filepath, ec);
+  if (ec) {
+    // the partial blobs dir is on another volume
+    boost::filesystem::copy_file(part_path, filepath, boost::filesystem::copy_option::overwrite_if_exists);
+    boost::filesystem::remove(part_path);
+  }
+}
+
+void RegistryClient::discardPartialBlob(const boost::filesystem::path& part_path) const {
+  // the data received so far is kept just if the download can be resumed from it
+  if (partial_blobs_dir_.empty() && !part_path.empty()) {
+    boost::system::error_code ec;
+    boost::filesystem::remove(part_path, ec);
+  }
+}
+
+bool RegistryClient::isRangeDownloadable(const Uri& uri, size_t expected_size) const {
+  return range_download_cfg_.max_parallel_ranges > 1 && expected_size >= range_download_cfg_.min_blob_size &&
+         areRangesSupported(uri.registryHostname);
+}
+
+void RegistryClient::removePartialBlobs() const {
+  if (partial_blobs_dir_.empty() || !boost::filesystem::exists(partial_blobs_dir_)) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock{mutex_};
+  for (const auto& entry : boost::filesystem::directory_iterator(partial_blobs_dir_)) {
+    // <hash>.part or <hash>.part.ranges
+    const auto name{entry.path().filename().string()};
+    if (partial_blobs_in_use_.count(name.substr(0, name.find('.'))) == 0) {
+      LOG_DEBUG << "Removing partially downloaded blob: " << entry.path();
+      boost::system::error_code ec;
+      boost::filesystem::remove(entry.path(), ec);
+    }
+  }
+}
+
+boost::filesystem::path RegistryClient::getPartialBlobPath(const Uri& uri,
+                                                           const boost::filesystem::path& filepath) const {
+  if (partial_blobs_dir_.empty()) {
+    // the blob is renamed once complete and verified, so the blob file is never seen partially written
+    return filepath.string() + ".part";
+  }
+  boost::filesystem::create_directories(partial_blobs_dir_);
+  return partial_blobs_dir_ / (uri.digest.hash() + ".part");
+}
+
 std::string RegistryClient::getBasicAuthHeader() const {
   // TODO: to make it working against any Registry, not just FIO's one
   // we will need to make use of the Docker's mechanisms for it,
   // specifically in docker/config.json there should defined an auth material and/or credHelpers
   // for a given registry. If auth material is defined then just use it if not then try to invoke
   // a script/executbale defined in credHelpers  that is supposed to return an auth material
+  if (!basic_auth_header_.empty()) {
+    return basic_auth_header_;
+  }
   LOG_DEBUG << "Getting Docker Registry credentials from " << auth_creds_endpoint_;
 
   auto creds_resp = ota_lite_client_->get(auth_creds_endpoint_, AuthMaterialMaxSize);
@@ -383,28 +1049,59 @@ std::string RegistryClient::getBasicAuthHeader() const {
   auto encoded_auth_secret = Utils::toBase64(auth_secret_str);
 
   LOG_DEBUG << "Got Docker Registry credentials, username: " << username;
-  return "authorization: basic " + encoded_auth_secret;
+  basic_auth_header_ = "authorization: basic " + encoded_auth_secret;
+  return basic_auth_header_;
 }
 
-std::string RegistryClient::getBearerAuthHeader(const BearerAuth& bearer) const {
+std::string RegistryClient::fetchBearerAuthHeader(const BearerAuth& bearer, CachedToken& token) const {
   LOG_DEBUG << "Getting Docker Registry token from " << bearer.Realm;
 
   std::vector<std::string> auth_header = {getBasicAuthHeader()};
   auto registry_client{http_client_factory_(&auth_header, nullptr)};
   auto token_resp = registry_client->get(bearer.uri(), AuthMaterialMaxSize);
+  if (token_resp.http_status_code == 401 || token_resp.http_status_code == 403) {
+    // the cached credentials have been rotated or revoked
+    LOG_DEBUG << "Docker Registry credentials have been rejected, getting new ones";
+    basic_auth_header_.clear();
+    auth_header = {getBasicAuthHeader()};
+    registry_client = http_client_factory_(&auth_header, nullptr);
+    token_resp = registry_client->get(bearer.uri(), AuthMaterialMaxSize);
+  }
 
   if (!token_resp.isOk()) {
     throw std::runtime_error("Failed to get Auth Token at Docker Registry " + bearer.Realm +
                              "; error: " + token_resp.getStatusStr());
   }
 
-  auto token = token_resp.getJson()["token"].asString();
-  if (token.empty()) {
+  const auto token_json{token_resp.getJson()};
+  auto token_value = token_json["token"].asString();
+  if (token_value.empty()) {
     throw std::runtime_error("Got invalid token from Docker Registry: " + token_resp.body);
   }
+  std::chrono::seconds lifetime{DefTokenLifetime};
+  if (token_json["expires_in"].isIntegral()) {
+    lifetime = std::chrono::seconds{token_json["expires_in"].asInt64()};
+  }
+
+  LOG_DEBUG << "Got Docker Registry token: " << token_value << ", expires in " << lifetime.count() << "s";
+  token.auth_header = "authorization: bearer " + token_value;
+  token.expires_at = std::chrono::steady_clock::now() + lifetime - TokenExpiryMargin;
+  return token.auth_header;
+}
 
-  LOG_DEBUG << "Got Docker Registry token: " << token;
-  return "authorization: bearer " + token;
+std::string RegistryClient::getBearerAuthHeader(const BearerAuth& bearer, const std::string& rejected_header) const {
+  std::lock_guard<std::mutex> lock{auth_mutex_};
+  auto& token{tokens_[bearer.uri()]};
+  if (!token.auth_header.empty() && token.auth_header != rejected_header &&
+      std::chrono::steady_clock::now() < token.expires_at) {
+    return token.auth_header;
+  }
+  try {
+    return fetchBearerAuthHeader(bearer, token);
+  } catch (...) {
+    tokens_.erase(bearer.uri());
+    throw;
+  }
 }
 
 }  // namespace Docker
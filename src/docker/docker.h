@@ -1,14 +1,21 @@
 #ifndef AKTUALIZR_LITE_DOCKER_H_
 #define AKTUALIZR_LITE_DOCKER_H_
 
+#include <chrono>
+#include <condition_variable>
 #include <limits>
+#include <mutex>
 #include <set>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include <boost/optional.hpp>
 
 #include <http/httpinterface.h>
 
+class MultiPartHasher;
+
 namespace Docker {
 
 struct HashedDigest {
@@ -26,6 +33,10 @@ struct HashedDigest {
   std::string short_hash_;
 };
 
+// Returns the lower-case hex sha256 hash of the file content. The file is read in fixed-size chunks, so the memory
+// usage doesn't depend on the file size, which can be large in the case of an App archive or an image layer.
+std::string getFileHash(const boost::filesystem::path& path);
+
 struct Uri {
   static Uri parseUri(const std::string& uri, bool factory_app = true);
   Uri createUri(const HashedDigest& digest_in) const;
@@ -149,12 +160,37 @@ struct ImageManifest : Json::Value {
   Json::Value toLoadManifest(const std::string& blobs_dir, const std::vector<std::string>& refs) const;
 };
 
+// Large blobs are split into byte ranges downloaded concurrently by HTTP Range requests, if the registry supports them.
+// The first range is downloaded alone to measure the link speed, the size of the other ranges is set so each of them
+// takes about `range_time` to download.
+struct RangeDownloadConfig {
+  // blobs smaller than it are downloaded by a single request
+  std::size_t min_blob_size{32 * 1024 * 1024};
+  std::size_t min_range_size{4 * 1024 * 1024};
+  std::size_t max_range_size{64 * 1024 * 1024};
+  std::chrono::milliseconds range_time{2000};
+  // the maximum number of ranges downloaded concurrently, 1 turns the range download off
+  int max_parallel_ranges{4};
+};
+
+// A blob to be downloaded by `RegistryClient::downloadBlobs()`
+struct BlobDownload {
+  Uri uri;
+  boost::filesystem::path path;
+  size_t size;
+};
+
 class RegistryClient {
  public:
   static constexpr const char* const DefAuthCredsEndpoint{"https://ota-lite.foundries.io:8443/hub-creds/"};
   static const int AuthMaterialMaxSize{1024};
   static const int DefManifestMaxSize{16384};
   static const size_t MaxBlobSize{std::numeric_limits<int>::max()};
+  static const int DefBlobsParallelism{4};
+  // The token lifetime if the token response doesn't specify it, as the Docker Registry token spec defines
+  static constexpr std::chrono::seconds DefTokenLifetime{60};
+  // A cached token is not used anymore this time before its expiry, so it doesn't expire while a request is in flight
+  static constexpr std::chrono::seconds TokenExpiryMargin{10};
 
   static const std::string ManifestEndpoint;
   static const std::string BlobEndpoint;
@@ -179,15 +215,53 @@ class RegistryClient {
 
   explicit RegistryClient(std::shared_ptr<HttpInterface> ota_lite_client,
                           std::string auth_creds_endpoint = DefAuthCredsEndpoint,
-                          HttpClientFactory http_client_factory = RegistryClient::DefaultHttpClientFactory);
+                          HttpClientFactory http_client_factory = RegistryClient::DefaultHttpClientFactory,
+                          RangeDownloadConfig range_download_cfg = RangeDownloadConfig(),
+                          boost::filesystem::path partial_blobs_dir = "", bool direct_io = false);
 
   std::string getAppManifest(const Uri& uri, const std::string& format,
                              boost::optional<std::int64_t> manifest_size = boost::none) const;
+  // Downloads the blob to the file. If the partial blobs dir is set, the data received before a failure is kept there,
+  // so the next download of the blob, even after a restart, resumes from where the failed one stopped.
   void downloadBlob(const Uri& uri, const boost::filesystem::path& filepath, size_t expected_size) const;
+  // Downloads the blobs concurrently, up to the given number at a time. Each blob is received through its own hasher
+  // and verified as soon as it is complete, the blobs large enough to be downloaded by ranges are delegated to
+  // `downloadBlob()`. Throws on the first failure, the next blobs are not started then.
+  void downloadBlobs(const std::vector<BlobDownload>& blobs, int parallelism = DefBlobsParallelism) const;
+  // Removes the partially downloaded blobs, except the ones being downloaded
+  void removePartialBlobs() const;
 
  private:
+  struct CachedToken {
+    std::string auth_header;
+    std::chrono::steady_clock::time_point expires_at;
+  };
+
+  // Both expect the auth mutex to be locked, the credentials and tokens are cached for all requests of the client
   std::string getBasicAuthHeader() const;
-  std::string getBearerAuthHeader(const BearerAuth& bearer) const;
+  std::string fetchBearerAuthHeader(const BearerAuth& bearer, CachedToken& token) const;
+  // A cached token equal to the rejected one, e.g. expired earlier than it was told, is fetched anew
+  std::string getBearerAuthHeader(const BearerAuth& bearer, const std::string& rejected_header = "") const;
+  void downloadBlobByStream(const Uri& uri, const boost::filesystem::path& filepath, size_t expected_size) const;
+  // Returns the size of the partial blob the download can be resumed from, the hasher is fed with its data
+  std::size_t resumePartialBlob(const Uri& uri, const boost::filesystem::path& filepath, size_t expected_size,
+                                MultiPartHasher& hasher) const;
+  // Removes the blob file if its size or hash doesn't match
+  static void verifyBlob(const Uri& uri, const boost::filesystem::path& filepath, size_t received_size,
+                         size_t expected_size, MultiPartHasher& hasher);
+  void acquirePartialBlob(const std::string& hash) const;
+  void releasePartialBlob(const std::string& hash) const;
+  static void commitPartialBlob(const boost::filesystem::path& part_path, const boost::filesystem::path& filepath);
+  void discardPartialBlob(const boost::filesystem::path& part_path) const;
+  bool isRangeDownloadable(const Uri& uri, size_t expected_size) const;
+  // Returns false if the registry doesn't support Range requests, the blob has to be downloaded by a single one then
+  bool downloadBlobByRanges(const Uri& uri, const boost::filesystem::path& filepath, size_t expected_size) const;
+  bool areRangesSupported(const std::string& registry_hostname) const;
+  boost::filesystem::path getPartialBlobPath(const Uri& uri, const boost::filesystem::path& filepath) const;
+  // The byte ranges of a blob downloaded by ranges that have been received so far
+  static boost::filesystem::path getRangesPath(const boost::filesystem::path& filepath) {
+    return filepath.string() + ".ranges";
+  }
 
   static std::string composeManifestUrl(const Uri& uri) {
     return "https://" + uri.registryHostname + SupportedRegistryVersion + uri.repo + ManifestEndpoint + uri.digest();
@@ -200,6 +274,21 @@ class RegistryClient {
   const std::string auth_creds_endpoint_;
   std::shared_ptr<HttpInterface> ota_lite_client_;
   HttpClientFactory http_client_factory_;
+  const RangeDownloadConfig range_download_cfg_;
+  const boost::filesystem::path partial_blobs_dir_;
+  // the blobs are written bypassing the page cache
+  const bool direct_io_;
+  mutable std::mutex mutex_;
+  mutable std::condition_variable cv_;
+  // the blobs being downloaded, by their hash
+  mutable std::set<std::string> partial_blobs_in_use_;
+  // the registries that ignore Range requests, so their blobs are not split anymore
+  mutable std::set<std::string> no_range_registries_;
+  // serializes the token requests, so the concurrent requests challenged for the same scope get just one token
+  mutable std::mutex auth_mutex_;
+  mutable std::string basic_auth_header_;
+  // by the challenge's realm, service and scope
+  mutable std::unordered_map<std::string, CachedToken> tokens_;
 };
 
 }  // namespace Docker
@@ -43,14 +43,16 @@ const DockerClient::HttpClientFactory DockerClient::DefaultHttpClientFactory = [
   return c;
 };
 
-DockerClient::DockerClient(std::shared_ptr<HttpInterface> http_client)
+DockerClient::DockerClient(std::shared_ptr<HttpInterface> http_client, std::shared_ptr<HttpInterface> load_http_client)
     : http_client_{std::move(http_client)},
+      load_http_client_{load_http_client ? std::move(load_http_client) : http_client_},
       engine_info_{getEngineInfo()},
       arch_{engine_info_.get("Arch", Json::Value()).asString()} {}
 
 void DockerClient::getContainers(Json::Value& root) {
   // curl --unix-socket /var/run/docker.sock http://localhost/containers/json?all=1
   const std::string cmd{"http://localhost/containers/json?all=1"};
+  std::lock_guard<std::mutex> lock{http_mutex_};
   auto resp = http_client_->get(cmd, HttpInterface::kNoLimit);
   if (resp.isOk()) {
     root = resp.getJson();
@@ -80,6 +82,7 @@ std::tuple<bool, std::string> DockerClient::getContainerState(const Json::Value&
 
 Json::Value DockerClient::getContainerInfo(const std::string& id) {
   const std::string cmd{"http://localhost/containers/" + id + "/json"};
+  std::lock_guard<std::mutex> lock{http_mutex_};
   auto resp = http_client_->get(cmd, HttpInterface::kNoLimit);
   if (!resp.isOk()) {
     throw std::runtime_error("Request to dockerd has failed: " + cmd);
@@ -89,6 +92,7 @@ Json::Value DockerClient::getContainerInfo(const std::string& id) {
 
 std::string DockerClient::getContainerLogs(const std::string& id, int tail) {
   const std::string cmd{"http://localhost/containers/" + id + "/logs?stderr=1&tail=" + std::to_string(tail)};
+  std::lock_guard<std::mutex> lock{http_mutex_};
   auto resp = http_client_->get(cmd, HttpInterface::kNoLimit);
   if (!resp.isOk()) {
     throw std::runtime_error("Request to dockerd has failed: " + cmd);
@@ -151,6 +155,7 @@ void DockerClient::pruneImages() {
       "http://localhost/images/"
       "prune?filters=%7B%22dangling%22%3A%7B%22false%22%3Atrue%7D%2C%22label%21%22%3A%7B%22aktualizr-no-prune%22%"
       "3Atrue%7D%7D"};
+  std::lock_guard<std::mutex> lock{http_mutex_};
   auto resp = http_client_->post(cmd, Json::nullValue);
   if (!resp.isOk()) {
     throw std::runtime_error("Failed to prune unused images: " + resp.getStatusStr());
@@ -162,6 +167,7 @@ void DockerClient::pruneContainers() {
   // filters=%7B%22label%21%22%3A%7B%22aktualizr-no-prune%22%3Atrue%7D%7D
   const std::string cmd{
       "http://localhost/containers/prune?filters=%7B%22label%21%22%3A%7B%22aktualizr-no-prune%22%3Atrue%7D%7D"};
+  std::lock_guard<std::mutex> lock{http_mutex_};
   auto resp = http_client_->post(cmd, Json::nullValue);
   if (!resp.isOk()) {
     throw std::runtime_error("Failed to prune unused containers: " + resp.getStatusStr());
@@ -182,7 +188,9 @@ void DockerClient::loadImage(const std::string& image_uri, const Json::Value& lo
   // The httpclient doesn't support a HTTP response streaming and it will require some effort to implement it.
   // The code that handle the request is located in https://github.com/moby/moby/blob/master/image/tarexport/load.go.
   const std::string cmd{"http://localhost/images/load?quiet=1"};
-  auto resp = http_client_->post(cmd, "application/x-tar", tarred_manifest);
+  // the loads are serialized by their own mutex unless they share the client with the other requests
+  std::lock_guard<std::mutex> lock{load_http_client_ == http_client_ ? http_mutex_ : load_mutex_};
+  auto resp = load_http_client_->post(cmd, "application/x-tar", tarred_manifest);
   if (!resp.isOk()) {
     throw std::runtime_error("Failed to load image: " + resp.getStatusStr());
   }
@@ -201,6 +209,7 @@ void DockerClient::loadImage(const std::string& image_uri, const Json::Value& lo
 Json::Value DockerClient::getEngineInfo() {
   Json::Value info;
   const std::string cmd{"http://localhost/version"};
+  std::lock_guard<std::mutex> lock{http_mutex_};
   auto resp = http_client_->get(cmd, HttpInterface::kNoLimit);
   if (resp.isOk()) {
     info = resp.getJson();
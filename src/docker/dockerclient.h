@@ -2,6 +2,7 @@
 #define AKTUALIZR_LITE_DOCKER_CLIENT_H
 #include <json/json.h>
 #include <functional>
+#include <mutex>
 #include <string>
 
 #include "appengine.h"
@@ -15,8 +16,13 @@ class DockerClient : public AppEngine::Client {
   using HttpClientFactory = std::function<std::shared_ptr<HttpInterface>(const std::string& docker_host)>;
   static const HttpClientFactory DefaultHttpClientFactory;
 
-  explicit DockerClient(
-      std::shared_ptr<HttpInterface> http_client = DefaultHttpClientFactory("unix:///var/run/docker.sock"));
+  DockerClient()
+      : DockerClient(DefaultHttpClientFactory("unix:///var/run/docker.sock"),
+                     DefaultHttpClientFactory("unix:///var/run/docker.sock")) {}
+  // Images are loaded through `load_http_client`, so a long image load doesn't hold the other requests back.
+  // The loads are sent through `http_client` if it's not set.
+  explicit DockerClient(std::shared_ptr<HttpInterface> http_client,
+                        std::shared_ptr<HttpInterface> load_http_client = nullptr);
 
   void getContainers(Json::Value& root) override;
   std::tuple<bool, std::string> getContainerState(const Json::Value& root, const std::string& app,
@@ -35,6 +41,10 @@ class DockerClient : public AppEngine::Client {
   Json::Value getContainerInfo(const std::string& id);
 
   std::shared_ptr<HttpInterface> http_client_;
+  // HttpClient is not thread-safe, while Apps may be started concurrently
+  std::mutex http_mutex_;
+  std::shared_ptr<HttpInterface> load_http_client_;
+  std::mutex load_mutex_;
   const Json::Value engine_info_;
   const std::string arch_;
 };
@@ -0,0 +1,297 @@
+#include "httpclientpool.h"
+
+#include <algorithm>
+#include <cstring>
+#include <future>
+
+#include <boost/algorithm/string.hpp>
+
+#include "utilities/utils.h"
+
+namespace Docker {
+
+namespace {
+
+class PooledHttpClient : public HttpInterface, public std::enable_shared_from_this<PooledHttpClient> {
+ public:
+  PooledHttpClient(HttpClientPool::Ptr pool, const std::vector<std::string>* headers,
+                   const std::set<std::string>* response_header_names)
+      : pool_{std::move(pool)}, headers_{headers}, response_header_names_{response_header_names} {}
+
+  HttpResponse get(const std::string& url, int64_t maxsize) override {
+    BodyCtx ctx{maxsize};
+    auto resp{perform(url, BodyHandler, &ctx, nullptr, 0)};
+    resp.body = std::move(ctx.body);
+    return resp;
+  }
+
+  HttpResponse download(const std::string& url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                        void* userp, curl_off_t from) override {
+    return perform(url, write_cb, userp, progress_cb, from);
+  }
+
+  // The handle is set before the transfer starts, so the transfer can be paused by its callbacks. It is owned by the
+  // pool and taken by another request once the transfer completes.
+  std::future<HttpResponse> downloadAsync(const std::string& url, curl_write_callback write_cb,
+                                          curl_xferinfo_callback progress_cb, void* userp, curl_off_t from,
+                                          CurlHandler* easyp) override {
+    const auto host{getHost(url)};
+    CURL* handle{pool_->acquire(host)};
+    if (easyp != nullptr) {
+      *easyp = CurlHandler(handle, [](CURL*) {});
+    }
+    auto self{shared_from_this()};
+    try {
+      return std::async(std::launch::async, [self, url, write_cb, progress_cb, userp, from, handle]() {
+        return self->perform(url, write_cb, userp, progress_cb, from, nullptr, handle);
+      });
+    } catch (...) {
+      pool_->release(host, handle);
+      throw;
+    }
+  }
+
+  HttpResponse post(const std::string& url, const std::string& content_type, const std::string& data) override {
+    return send(url, {"POST", content_type, data});
+  }
+  HttpResponse post(const std::string& url, const Json::Value& data) override {
+    return send(url, {"POST", "application/json", Utils::jsonToStr(data)});
+  }
+  HttpResponse put(const std::string& url, const std::string& content_type, const std::string& data) override {
+    return send(url, {"PUT", content_type, data});
+  }
+  HttpResponse put(const std::string& url, const Json::Value& data) override {
+    return send(url, {"PUT", "application/json", Utils::jsonToStr(data)});
+  }
+
+  // Takes the PEM content of the CA, the client certificate and its key, as HttpClient does. An empty one is not used.
+  void setCerts(const std::string& ca, CryptoSource ca_source, const std::string& cert, CryptoSource cert_source,
+                const std::string& pkey, CryptoSource pkey_source) override {
+    // the handles are shared by the clients, so the material is passed to them with each request
+    if (ca_source != CryptoSource::kFile || cert_source != CryptoSource::kFile || pkey_source != CryptoSource::kFile) {
+      throw std::invalid_argument("Just the file crypto source is supported by the Registry HTTP client");
+    }
+    ca_ = ca;
+    cert_ = cert;
+    pkey_ = pkey;
+  }
+
+ private:
+  struct Upload {
+    const char* method;
+    std::string content_type;
+    std::string data;
+  };
+  struct BodyCtx {
+    explicit BodyCtx(int64_t maxsize_in) : maxsize{maxsize_in} {}
+    int64_t maxsize;
+    std::string body;
+  };
+
+  struct HeaderCtx {
+    const std::set<std::string>* names;
+    decltype(HttpResponse::headers) headers;
+  };
+
+  static size_t BodyHandler(char* data, size_t buf_size, size_t buf_numb, void* user_ctx) {
+    auto* ctx{reinterpret_cast<BodyCtx*>(user_ctx)};
+    const auto size{buf_size * buf_numb};
+    if (ctx->maxsize != HttpInterface::kNoLimit &&
+        ctx->body.size() + size > static_cast<std::size_t>(ctx->maxsize)) {
+      return size + 1;  // returning value that is not equal to received data size will make curl fail
+    }
+    ctx->body.append(data, size);
+    return size;
+  }
+
+  static size_t HeaderHandler(char* data, size_t buf_size, size_t buf_numb, void* user_ctx) {
+    auto* ctx{reinterpret_cast<HeaderCtx*>(user_ctx)};
+    const auto size{buf_size * buf_numb};
+    const std::string line{data, size};
+    if (boost::starts_with(line, "HTTP/")) {
+      // the status line of the next response, e.g. after a redirect
+      ctx->headers.clear();
+      return size;
+    }
+    const auto colon_pos{line.find(':')};
+    if (colon_pos == std::string::npos) {
+      return size;
+    }
+    auto name{boost::algorithm::to_lower_copy(line.substr(0, colon_pos))};
+    boost::trim(name);
+    if (ctx->names->count(name) > 0) {
+      ctx->headers[name] = boost::trim_copy(line.substr(colon_pos + 1));
+    }
+    return size;
+  }
+
+  HttpResponse send(const std::string& url, const Upload& upload) {
+    BodyCtx ctx{HttpInterface::kNoLimit};
+    auto resp{perform(url, BodyHandler, &ctx, nullptr, 0, &upload)};
+    resp.body = std::move(ctx.body);
+    return resp;
+  }
+
+  static void setBlob(CURL* handle, CURLoption option, const std::string& data) {
+    if (!data.empty()) {
+      curl_blob blob{const_cast<char*>(data.data()), data.size(), CURL_BLOB_COPY};
+      curl_easy_setopt(handle, option, &blob);
+    }
+  }
+
+  static std::string getHost(const std::string& url) {
+    const auto host_begin{url.find("://")};
+    return url.substr(0, url.find('/', host_begin == std::string::npos ? 0 : host_begin + 3));
+  }
+
+  // Makes the request by the given handle of the url's host, or by one acquired from the pool if it is null
+  HttpResponse perform(const std::string& url, curl_write_callback write_cb, void* userp,
+                       curl_xferinfo_callback progress_cb, curl_off_t from, const Upload* upload = nullptr,
+                       CURL* handle = nullptr) {
+    const auto host{getHost(url)};
+    if (handle == nullptr) {
+      handle = pool_->acquire(host);
+    }
+
+    curl_slist* headers{nullptr};
+    if (headers_ != nullptr) {
+      for (const auto& header : *headers_) {
+        headers = curl_slist_append(headers, header.c_str());
+      }
+    }
+    if (upload != nullptr) {
+      headers = curl_slist_append(headers, ("Content-Type: " + upload->content_type).c_str());
+    }
+    HeaderCtx header_ctx{response_header_names_, {}};
+    char err_buf[CURL_ERROR_SIZE]{};
+
+    curl_easy_setopt(handle, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, write_cb);
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, userp);
+    if (response_header_names_ != nullptr && !response_header_names_->empty()) {
+      curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, HeaderHandler);
+      curl_easy_setopt(handle, CURLOPT_HEADERDATA, &header_ctx);
+    }
+    if (progress_cb != nullptr) {
+      curl_easy_setopt(handle, CURLOPT_NOPROGRESS, 0L);
+      curl_easy_setopt(handle, CURLOPT_XFERINFOFUNCTION, progress_cb);
+      curl_easy_setopt(handle, CURLOPT_XFERINFODATA, userp);
+    }
+    if (from > 0) {
+      curl_easy_setopt(handle, CURLOPT_RESUME_FROM_LARGE, from);
+    }
+    if (upload != nullptr) {
+      // the post fields make it a POST, another method is set explicitly, so it's not changed by a redirect either
+      if (std::strcmp(upload->method, "POST") != 0) {
+        curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, upload->method);
+      }
+      curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(upload->data.size()));
+      curl_easy_setopt(handle, CURLOPT_POSTFIELDS, upload->data.c_str());
+    }
+    setBlob(handle, CURLOPT_CAINFO_BLOB, ca_);
+    setBlob(handle, CURLOPT_SSLCERT_BLOB, cert_);
+    setBlob(handle, CURLOPT_SSLKEY_BLOB, pkey_);
+    curl_easy_setopt(handle, CURLOPT_ERRORBUFFER, err_buf);
+
+    const auto curl_code{curl_easy_perform(handle)};
+    long status{0};
+    curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &status);
+    std::string err{curl_code == CURLE_OK ? "" : (err_buf[0] != '\0' ? err_buf : curl_easy_strerror(curl_code))};
+
+    pool_->release(host, handle);
+    curl_slist_free_all(headers);
+    return HttpResponse("", status, curl_code, std::move(err), std::move(header_ctx.headers));
+  }
+
+  HttpClientPool::Ptr pool_;
+  const std::vector<std::string>* headers_;
+  const std::set<std::string>* response_header_names_;
+  std::string ca_;
+  std::string cert_;
+  std::string pkey_;
+};
+
+}  // namespace
+
+HttpClientPool::HttpClientPool() : share_{curl_share_init()} {
+  if (share_ == nullptr) {
+    throw std::runtime_error("Failed to create a curl share handle");
+  }
+  curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, lockShare);
+  curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, unlockShare);
+  curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+  curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+}
+
+HttpClientPool::~HttpClientPool() {
+  for (auto& host : idle_handles_) {
+    for (auto* handle : host.second) {
+      curl_easy_cleanup(handle);
+    }
+  }
+  curl_share_cleanup(share_);
+}
+
+std::shared_ptr<HttpInterface> HttpClientPool::createClient(const std::vector<std::string>* headers,
+                                                            const std::set<std::string>* response_header_names) {
+  return std::make_shared<PooledHttpClient>(shared_from_this(), headers, response_header_names);
+}
+
+CURL* HttpClientPool::acquire(const std::string& host) {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    auto& handles{idle_handles_[host]};
+    if (!handles.empty()) {
+      // the most recently used handle is the most likely to have its connection still open
+      auto* handle{handles.back()};
+      handles.pop_back();
+      return handle;
+    }
+  }
+  CURL* handle{curl_easy_init()};
+  if (handle == nullptr) {
+    throw std::runtime_error("Failed to create a curl handle");
+  }
+  setDefaultOptions(handle);
+  return handle;
+}
+
+void HttpClientPool::release(const std::string& host, CURL* handle) {
+  // keeps the open connections, drops the options of the completed request
+  curl_easy_reset(handle);
+  setDefaultOptions(handle);
+  std::lock_guard<std::mutex> lock{mutex_};
+  auto& handles{idle_handles_[host]};
+  if (handles.size() >= MaxIdleHandles) {
+    curl_easy_cleanup(handle);
+    return;
+  }
+  handles.push_back(handle);
+}
+
+void HttpClientPool::setDefaultOptions(CURL* handle) const {
+  curl_easy_setopt(handle, CURLOPT_SHARE, share_);
+  curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+  // the Registries redirect the blob requests to their storage
+  curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT, 60L);
+  // a stalled transfer is aborted, the link may be slow but not silent for a minute
+  curl_easy_setopt(handle, CURLOPT_LOW_SPEED_LIMIT, 1L);
+  curl_easy_setopt(handle, CURLOPT_LOW_SPEED_TIME, 60L);
+  curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+}
+
+void HttpClientPool::lockShare(CURL* handle, curl_lock_data data, curl_lock_access access, void* userp) {
+  (void)handle;
+  (void)access;
+  reinterpret_cast<HttpClientPool*>(userp)->share_mutexes_[data].lock();
+}
+
+void HttpClientPool::unlockShare(CURL* handle, curl_lock_data data, void* userp) {
+  (void)handle;
+  reinterpret_cast<HttpClientPool*>(userp)->share_mutexes_[data].unlock();
+}
+
+}  // namespace Docker
@@ -0,0 +1,61 @@
+#ifndef AKTUALIZR_LITE_DOCKER_HTTP_CLIENT_POOL_H_
+#define AKTUALIZR_LITE_DOCKER_HTTP_CLIENT_POOL_H_
+
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <curl/curl.h>
+
+#include "http/httpinterface.h"
+
+namespace Docker {
+
+/**
+ * @brief HttpClientPool, keeps the curl handles of the finished Registry requests for the following ones
+ *
+ * A curl easy handle keeps the connections it has opened alive after a request completes, so a request made by
+ * a handle that has already talked to the host skips the TCP and TLS handshakes. The idle handles are kept by host,
+ * a request takes one of the host's idle handles or creates a new one, and puts it back once completed. The handles
+ * also share the DNS cache and TLS sessions, so even a new connection to a known host resumes the TLS session.
+ * The clients implement the whole HttpInterface, so they can stand in for HttpClient, except for the PKCS#11 keys.
+ */
+class HttpClientPool : public std::enable_shared_from_this<HttpClientPool> {
+ public:
+  // The maximum number of idle handles kept per host, each request in flight takes its own handle
+  static const std::size_t MaxIdleHandles{8};
+  using Ptr = std::shared_ptr<HttpClientPool>;
+
+  static Ptr create() { return Ptr{new HttpClientPool()}; }
+  ~HttpClientPool();
+  HttpClientPool(const HttpClientPool&) = delete;
+  HttpClientPool& operator=(const HttpClientPool&) = delete;
+  HttpClientPool(HttpClientPool&&) = delete;
+  HttpClientPool& operator=(HttpClientPool&&) = delete;
+
+  // Returns a client making requests with the given headers by the pooled handles, both pointers may be null.
+  // The headers are read at each request, so they can be changed between the requests.
+  std::shared_ptr<HttpInterface> createClient(const std::vector<std::string>* headers,
+                                              const std::set<std::string>* response_header_names);
+
+  CURL* acquire(const std::string& host);
+  void release(const std::string& host, CURL* handle);
+
+ private:
+  HttpClientPool();
+  void setDefaultOptions(CURL* handle) const;
+  static void lockShare(CURL* handle, curl_lock_data data, curl_lock_access access, void* userp);
+  static void unlockShare(CURL* handle, curl_lock_data data, void* userp);
+
+  CURLSH* share_;
+  std::mutex share_mutexes_[CURL_LOCK_DATA_LAST];
+  std::mutex mutex_;
+  std::unordered_map<std::string, std::vector<CURL*>> idle_handles_;
+};
+
+}  // namespace Docker
+
+#endif  // AKTUALIZR_LITE_DOCKER_HTTP_CLIENT_POOL_H_
@@ -0,0 +1,197 @@
+#include "imagepuller.h"
+
+#include "logging/logging.h"
+#include "parallelfor.h"
+#include "utilities/utils.h"
+
+namespace Docker {
+
+ImagePuller::ImagePuller(RegistryClient::Ptr registry_client, boost::filesystem::path blobs_dir, std::string arch,
+                         int parallelism)
+    : registry_client_{std::move(registry_client)},
+      blobs_dir_{std::move(blobs_dir)},
+      arch_{std::move(arch)},
+      parallelism_{std::max(parallelism, 1)} {}
+
+void ImagePuller::pull(const std::vector<Image>& images, const ImagePulledHandler& on_image_pulled) {
+  if (images.empty()) {
+    return;
+  }
+  const int generation{cancel_generation_};
+  boost::filesystem::create_directories(blobs_dir_ / "sha256");
+
+  std::vector<Blob> blobs;
+  std::vector<Json::Value> manifest_descs;
+  // the blobs of each image that are not in the store yet
+  std::vector<std::set<std::string>> missing_blobs(images.size());
+  std::vector<std::size_t> image_blobs_end;
+  for (const auto& image : images) {
+    boost::filesystem::create_directories(image.dir);
+    manifest_descs.emplace_back(fetchManifest(image, blobs));
+    image_blobs_end.push_back(blobs.size());
+  }
+
+  // images of one App usually share base layers, download each blob just once
+  std::set<std::string> unique_blobs;
+  std::vector<Blob> blobs_to_download;
+  for (std::size_t ii = 0, image = 0; ii < blobs.size(); ++ii) {
+    while (ii == image_blobs_end[image]) {
+      ++image;
+    }
+    const auto& blob{blobs[ii]};
+    if (isBlobFetched(blob)) {
+      continue;
+    }
+    missing_blobs[image].insert(blob.uri.digest());
+    if (unique_blobs.emplace(blob.uri.digest()).second) {
+      blobs_to_download.emplace_back(blob);
+    }
+  }
+  LOG_INFO << "Downloading " << blobs_to_download.size() << " blobs of " << images.size() << " images";
+
+  // the OCI layout of an image is written only after all its blobs are in place, so an interrupted pull doesn't look
+  // complete
+  std::mutex images_mutex;
+  auto complete_images{[&](const std::string& downloaded_blob) {
+    std::vector<std::size_t> pulled;
+    {
+      std::lock_guard<std::mutex> lock{images_mutex};
+      for (std::size_t ii = 0; ii < images.size(); ++ii) {
+        if (missing_blobs[ii].erase(downloaded_blob) > 0 && missing_blobs[ii].empty()) {
+          pulled.push_back(ii);
+        }
+      }
+    }
+    for (const auto ii : pulled) {
+      writeImageLayout(images[ii], manifest_descs[ii]);
+      if (on_image_pulled) {
+        on_image_pulled(images[ii]);
+      }
+    }
+  }};
+  for (std::size_t ii = 0; ii < images.size(); ++ii) {
+    if (missing_blobs[ii].empty()) {
+      writeImageLayout(images[ii], manifest_descs[ii]);
+      if (on_image_pulled) {
+        on_image_pulled(images[ii]);
+      }
+    }
+  }
+
+  // the tmp files are created in the image dir just like skopeo does it, so the leftovers are removed at startup
+  downloadBlobs(blobs_to_download, images.front().dir, generation,
+                [&complete_images](const Blob& blob) { complete_images(blob.uri.digest()); });
+}
+
+Json::Value ImagePuller::fetchManifest(const Image& image, std::vector<Blob>& blobs) const {
+  static const std::string AcceptedFormats{std::string(ImageManifest::Format) + "," + Manifest::IndexFormat + "," +
+                                           "application/vnd.docker.distribution.manifest.list.v2+json"};
+
+  auto manifest_str{registry_client_->getAppManifest(image.uri, AcceptedFormats)};
+  auto manifest{Utils::parseJSON(manifest_str)};
+  HashedDigest manifest_digest{image.uri.digest};
+  if (manifest.isMember("manifests")) {
+    // an image index, aka a manifest list
+    Json::Value manifest_desc;
+    for (const auto& desc : manifest["manifests"]) {
+      if (desc["platform"]["architecture"].asString() == arch_) {
+        manifest_desc = desc;
+        break;
+      }
+    }
+    if (manifest_desc.isNull()) {
+      throw std::runtime_error("No image manifest for " + arch_ + " in the image index: " + image.uri.digest());
+    }
+    manifest_digest = HashedDigest{manifest_desc["digest"].asString()};
+    manifest_str = registry_client_->getAppManifest(image.uri.createUri(manifest_digest), AcceptedFormats,
+                                                    manifest_desc["size"].asInt64());
+    manifest = Utils::parseJSON(manifest_str);
+  }
+  // throws if the manifest is not a docker v2s2 one
+  const ImageManifest image_manifest{manifest};
+
+  const auto manifest_path{blobPath(manifest_digest)};
+  if (!boost::filesystem::exists(manifest_path)) {
+    const auto tmp_path{image.dir / ("oci-put-blob" + Utils::randomUuid())};
+    Utils::writeFile(tmp_path, manifest_str, false);
+    boost::filesystem::rename(tmp_path, manifest_path);
+  }
+
+  const auto config{image_manifest.config()};
+  blobs.push_back({image.uri.createUri(config.digest), static_cast<std::size_t>(config.size)});
+  for (const auto& layer : image_manifest.layers()) {
+    blobs.push_back({image.uri.createUri(layer.digest), static_cast<std::size_t>(layer.size)});
+  }
+
+  Json::Value desc;
+  desc["mediaType"] = ImageManifest::Format;
+  desc["digest"] = manifest_digest();
+  desc["size"] = static_cast<Json::UInt64>(manifest_str.size());
+  return desc;
+}
+
+void ImagePuller::downloadBlobs(const std::vector<Blob>& blobs, const boost::filesystem::path& tmp_dir,
+                                int generation, const std::function<void(const Blob&)>& on_blob_downloaded) {
+  parallelFor(
+      blobs.size(), static_cast<std::size_t>(parallelism_),
+      [&](std::size_t indx) {
+        downloadBlob(blobs[indx], tmp_dir);
+        on_blob_downloaded(blobs[indx]);
+      },
+      [this, generation]() { return cancel_generation_ != generation; });
+  if (cancel_generation_ != generation) {
+    throw std::runtime_error("Image pull has been cancelled");
+  }
+}
+
+void ImagePuller::downloadBlob(const Blob& blob, const boost::filesystem::path& tmp_dir) {
+  const auto& digest{blob.uri.digest()};
+  {
+    std::unique_lock<std::mutex> lock{mutex_};
+    cv_.wait(lock, [this, &digest]() { return in_flight_.count(digest) == 0; });
+    if (isBlobFetched(blob)) {
+      // downloaded by a concurrent pull
+      return;
+    }
+    in_flight_.insert(digest);
+  }
+  auto release{[this, &digest]() {
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      in_flight_.erase(digest);
+    }
+    cv_.notify_all();
+  }};
+
+  const auto tmp_path{tmp_dir / ("oci-put-blob" + Utils::randomUuid())};
+  try {
+    LOG_DEBUG << "Downloading image blob: " << digest << ", size: " << blob.size;
+    registry_client_->downloadBlob(blob.uri, tmp_path, blob.size);
+    boost::filesystem::rename(tmp_path, blobPath(blob.uri.digest));
+  } catch (...) {
+    boost::system::error_code ec;
+    boost::filesystem::remove(tmp_path, ec);
+    release();
+    throw;
+  }
+  release();
+}
+
+bool ImagePuller::isBlobFetched(const Blob& blob) const {
+  boost::system::error_code ec;
+  const auto size{boost::filesystem::file_size(blobPath(blob.uri.digest), ec)};
+  return !ec && size == blob.size;
+}
+
+void ImagePuller::writeImageLayout(const Image& image, const Json::Value& manifest_desc) {
+  Json::Value layout;
+  layout["imageLayoutVersion"] = "1.0.0";
+  Utils::writeFile(image.dir / "oci-layout", Utils::jsonToCanonicalStr(layout));
+
+  Json::Value index;
+  index["schemaVersion"] = 2;
+  index["manifests"][0] = manifest_desc;
+  Utils::writeFile(image.dir / "index.json", Utils::jsonToCanonicalStr(index));
+}
+
+}  // namespace Docker
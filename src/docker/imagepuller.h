@@ -0,0 +1,80 @@
+#ifndef AKTUALIZR_LITE_DOCKER_IMAGE_PULLER_H_
+#define AKTUALIZR_LITE_DOCKER_IMAGE_PULLER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "docker/docker.h"
+
+namespace Docker {
+
+/**
+ * @brief ImagePuller, pulls App images from Registries to the reset-apps store without spawning `skopeo copy`
+ *
+ * Each image is stored in the same way `skopeo copy --dest-shared-blob-dir <blobs> <src> oci:<image-dir>` does it:
+ * the image manifest, config and layers go to <blobs>/sha256/, and <image-dir> gets the OCI layout files, i.e.
+ * `oci-layout` and `index.json` that refers to the image manifest.
+ *
+ * The image index (if any) is resolved to the manifest of the given architecture, only the docker v2s2 manifests are
+ * supported since it's the format the images are loaded to the docker store in. All blobs of the given images are
+ * downloaded by one pool of workers, each blob just once, even if it's shared by the images or is being downloaded by a
+ * concurrent pull. All requests go through the one RegistryClient.
+ */
+class ImagePuller {
+ public:
+  static const int DefaultParallelism{4};
+
+  struct Image {
+    Uri uri;
+    boost::filesystem::path dir;
+  };
+
+  // Invoked as soon as all blobs of the image are in the store, from one of the downloading threads
+  using ImagePulledHandler = std::function<void(const Image&)>;
+
+  ImagePuller(RegistryClient::Ptr registry_client, boost::filesystem::path blobs_dir, std::string arch,
+              int parallelism = DefaultParallelism);
+
+  // Throws std::runtime_error on the first failure, the other downloads are stopped then. The blobs are downloaded
+  // image by image, so the images pulled first can be consumed while the others are still being downloaded.
+  void pull(const std::vector<Image>& images, const ImagePulledHandler& on_image_pulled = nullptr);
+  // Stops the pulls in progress, the blobs that are being downloaded are completed though
+  void cancel() { ++cancel_generation_; }
+
+ private:
+  struct Blob {
+    Uri uri;
+    std::size_t size;
+  };
+
+  // Returns the image manifest descriptor to be put to the image's index.json
+  Json::Value fetchManifest(const Image& image, std::vector<Blob>& blobs) const;
+  void downloadBlobs(const std::vector<Blob>& blobs, const boost::filesystem::path& tmp_dir, int generation,
+                     const std::function<void(const Blob&)>& on_blob_downloaded);
+  void downloadBlob(const Blob& blob, const boost::filesystem::path& tmp_dir);
+  boost::filesystem::path blobPath(const HashedDigest& digest) const { return blobs_dir_ / "sha256" / digest.hash(); }
+  bool isBlobFetched(const Blob& blob) const;
+  static void writeImageLayout(const Image& image, const Json::Value& manifest_desc);
+
+  RegistryClient::Ptr registry_client_;
+  const boost::filesystem::path blobs_dir_;
+  const std::string arch_;
+  const int parallelism_;
+  std::atomic<int> cancel_generation_{0};
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // the blobs being downloaded by any of the concurrent pulls
+  std::set<std::string> in_flight_;
+};
+
+}  // namespace Docker
+
+#endif  // AKTUALIZR_LITE_DOCKER_IMAGE_PULLER_H_
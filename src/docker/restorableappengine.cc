@@ -1,8 +1,12 @@
 #include "restorableappengine.h"
 
 #include <sys/statvfs.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
 #include <limits>
+#include <mutex>
 #include <unordered_set>
 
 #include <boost/algorithm/hex.hpp>
@@ -16,20 +20,15 @@
 #include "docker/composeappengine.h"
 #include "docker/composeinfo.h"
 #include "exec.h"
+#include "parallelfor.h"
 
 namespace fs = std::filesystem;
 
 namespace Docker {
 
-class InsufficientSpaceError : public std::runtime_error {
- public:
-  InsufficientSpaceError(const std::string& store, const storage::Volume::UsageInfo& usage_info)
-      : std::runtime_error("Insufficient storage available; store: " + store + "; " + usage_info.str()),
-        stat{usage_info} {}
-  storage::Volume::UsageInfo stat;
-};
-
 const std::string RestorableAppEngine::ComposeFile{"docker-compose.yml"};
+const RestorableAppEngine::ClientImageSrcFunc RestorableAppEngine::DefClientImageSrcFunc{
+    [](const Docker::Uri& /* app_uri */, const std::string& image_uri) { return "docker://" + image_uri; }};
 
 RestorableAppEngine::StorageSpaceFunc RestorableAppEngine::GetDefStorageSpaceFunc(int watermark) {
   const int low_watermark_limit{LowWatermarkLimit};
@@ -52,13 +51,21 @@ RestorableAppEngine::StorageSpaceFunc RestorableAppEngine::GetDefStorageSpaceFun
   };
 }
 
+boost::filesystem::path RestorableAppEngine::GetDefStateRoot(const boost::filesystem::path& store_root) {
+  // beside the store, so the data can be moved to the store by a rename
+  auto root{store_root};
+  root.remove_trailing_separator();
+  return root.parent_path() / (root.filename().string() + "-state");
+}
+
 RestorableAppEngine::RestorableAppEngine(boost::filesystem::path store_root, boost::filesystem::path install_root,
                                          boost::filesystem::path docker_root,
                                          Docker::RegistryClient::Ptr registry_client,
                                          Docker::DockerClient::Ptr docker_client, std::string client,
                                          std::string docker_host, std::string compose_cmd,
                                          StorageSpaceFunc storage_space_func, ClientImageSrcFunc client_image_src_func,
-                                         bool create_containers_if_install, bool offline)
+                                         bool create_containers_if_install, bool offline, bool native_image_pull,
+                                         bool load_images_on_fetch, std::chrono::milliseconds prune_time_budget)
     : store_root_{std::move(store_root)},
       install_root_{std::move(install_root)},
       docker_root_{std::move(docker_root)},
@@ -71,7 +78,9 @@ RestorableAppEngine::RestorableAppEngine(boost::filesystem::path store_root, boo
       storage_space_func_{std::move(storage_space_func)},
       client_image_src_func_{std::move(client_image_src_func)},
       create_containers_if_install_{create_containers_if_install},
-      offline_{offline} {
+      offline_{offline},
+      load_images_on_fetch_{load_images_on_fetch},
+      prune_time_budget_{prune_time_budget} {
   boost::filesystem::create_directories(apps_root_);
   boost::filesystem::create_directories(blobs_root_);
 
@@ -96,14 +105,55 @@ RestorableAppEngine::RestorableAppEngine(boost::filesystem::path store_root, boo
                 << "; err: " << cast_err.what();
     }
   }
+
+  // The number of images (`skopeo copy` processes) pulled concurrently, all App images are pulled serially by default
+  int max_parallel_image_pulls{1};
+  if (const char* max_par_image_pulls_str = std::getenv("MAX_PARALLEL_IMAGE_PULLS")) {
+    try {
+      max_parallel_image_pulls = boost::lexical_cast<int>(max_par_image_pulls_str);
+      if (max_parallel_image_pulls > MaxParallelImagePullsHighLimit) {
+        LOG_WARNING << "Value of MAX_PARALLEL_IMAGE_PULLS env variable exceeds the maximum allowed; value: "
+                    << max_par_image_pulls_str << "; the maximum allowed: " << MaxParallelImagePullsHighLimit;
+        max_parallel_image_pulls = MaxParallelImagePullsHighLimit;
+      }
+      if (max_parallel_image_pulls < 1) {
+        LOG_WARNING << "Value of MAX_PARALLEL_IMAGE_PULLS env variable is lower than the minimum allowed; value: "
+                    << max_par_image_pulls_str << "; the minimum allowed: 1";
+        max_parallel_image_pulls = 1;
+      }
+      LOG_DEBUG << "Up to " << max_parallel_image_pulls << " images will be pulled concurrently";
+    } catch (const boost::bad_lexical_cast& cast_err) {
+      LOG_ERROR << "Invalid value of MAX_PARALLEL_IMAGE_PULLS env variable; value: " << max_par_image_pulls_str
+                << "; err: " << cast_err.what();
+    }
+  }
+  // The pool is shared by the concurrent App fetches, so it bounds their image pulls as a whole
+  exec_pool_ = std::make_shared<ExecPool>(static_cast<std::size_t>(max_parallel_image_pulls));
+
+  if (native_image_pull) {
+    // the blobs of all App images are downloaded by one pool, so its size is bound by the skopeo's per image limit
+    image_puller_ = std::make_unique<ImagePuller>(
+        registry_client_, blobs_root_, docker_client_->arch(),
+        max_parallel_pulls_ > 0 ? max_parallel_pulls_ : ImagePuller::DefaultParallelism);
+    LOG_INFO << "App images are pulled by the native image puller";
+  }
 }
 
 AppEngine::Result RestorableAppEngine::fetch(const App& app) {
+  if (fetchesCancelled()) {
+    return {Result::ID::Cancelled, "the App fetch has been cancelled"};
+  }
   Result res{false};
   boost::filesystem::path app_dir;
+  std::string app_ref;
+  const FetchInProgress fetch_in_progress{this};
   try {
     const Uri uri{Uri::parseUri(app.uri)};
     app_dir = apps_root_ / uri.app / uri.digest.hash();
+    // persisted before any blob is downloaded, so the blobs are found by a rescan if the fetch doesn't complete
+    app_ref = getAppRef(uri);
+    blob_refs_.startFetch(app_ref);
+    blob_refs_.save();
     const auto app_compose_file{app_dir / ComposeFile};
 
     if (!isAppFetched(app)) {
@@ -113,25 +163,34 @@ AppEngine::Result RestorableAppEngine::fetch(const App& app) {
       LOG_INFO << app.name << ": App already fetched: " << app_dir;
     }
 
-    // check App size
-    checkAppUpdateSize(uri, app_dir);
+    // check App size and reserve the space required for its update until the fetch is completed
+    const auto storage_reservation{checkAppUpdateSize(uri, app_dir)};
 
     // Invoke download of App images unconditionally because `skopeo` is supposed
     // to skip already downloaded image blobs internally while performing `copy` command
     const auto images_dir{app_dir / "images"};
     LOG_DEBUG << app.name << ": downloading App images from Registry(ies): " << app.uri << " --> " << images_dir;
     pullAppImages(uri, app_compose_file, images_dir);
+    blob_refs_.setAppBlobs(app_ref, getAppBlobs(uri, app_dir));
+    blob_refs_.finishFetch(app_ref, true);
+    blob_refs_.save();
     res = true;
   } catch (const InsufficientSpaceError& exc) {
     res = {Result::ID::InsufficientSpace, exc.what(), exc.stat};
   } catch (const std::exception& exc) {
-    res = {false, exc.what()};
+    // a fetch interrupted by cancelFetches() fails with the error of the interrupted pull
+    res = {fetchesCancelled() ? Result::ID::Cancelled : Result::ID::Failed, exc.what()};
   }
 
   if (!res) {
     if (boost::filesystem::exists(app_dir)) {
       boost::filesystem::remove_all(app_dir);
     }
+    // the blobs pulled before the failure are not referenced by any App, so the next prune has to look for them
+    if (!app_ref.empty()) {
+      blob_refs_.finishFetch(app_ref, false);
+      blob_refs_.save();
+    }
   }
   return res;
 }
@@ -285,8 +344,8 @@ Json::Value RestorableAppEngine::getRunningAppsInfo() const {
 }
 
 void RestorableAppEngine::prune(const Apps& app_shortlist) {
-  std::unordered_set<std::string> blob_shortlist;
   bool prune_docker_store{false};
+  std::unordered_set<std::string> store_apps;
 
   for (const auto& entry : boost::make_iterator_range(boost::filesystem::directory_iterator(apps_root_), {})) {
     if (!boost::filesystem::is_directory(entry)) {
@@ -324,91 +383,41 @@ void RestorableAppEngine::prune(const Apps& app_shortlist) {
         continue;
       }
 
-      if (boost::filesystem::exists(entry.path() / Manifest::Filename)) {
-        // add app manifest to the blob shortlist
-        blob_shortlist.emplace(uri.digest.hash());
-        // add blobs of the shortlisted app's manifest to the blob shortlist
-        try {
-          const Manifest app_manifest{Utils::parseJSONFile(entry.path() / Manifest::Filename)};
-          for (const auto& element : std::vector<std::string>{"manifests", "layers"}) {
-            if (!app_manifest.isNull() && app_manifest.isMember(element) && app_manifest[element].isArray()) {
-              for (const auto& b : app_manifest[element]) {
-                if (!b.isNull() && b.isMember("digest")) {
-                  blob_shortlist.emplace(HashedDigest{b["digest"].asString()}.hash());
-                }
-              }
-            }
-          }
-        } catch (const std::exception& exc) {
-          LOG_WARNING << "Found invalid app manifest in the store, its blobs will be pruned; app: " << app.name
-                      << "err: " << exc.what();
-        }
-      }
-
-      // add blobs of each image of the shortlisted app to the blob shortlist
-      ComposeInfo compose{(entry.path() / ComposeFile).string()};
-      for (const auto& service : compose.getServices()) {
-        const auto image = compose.getImage(service);
-        const Uri image_uri{Uri::parseUri(image, false)};
-        // add image manifest to the blob shortlist
-        blob_shortlist.emplace(image_uri.digest.hash());
-        const auto image_root{app_dir / app_version_dir / "images" / image_uri.registryHostname / image_uri.repo /
-                              image_uri.digest.hash()};
-
-        // Make sure the image root element (index or manifest) is not removed.
-        // We need it for backward compatibility with the composeapp utility.
-        blob_shortlist.emplace(image_uri.digest.hash());
-        const auto index_manifest{image_root / "index.json"};
-        if (!boost::filesystem::exists(index_manifest)) {
-          LOG_WARNING << "Failed to find an index manifest of App image: " << image << ", removing its directory";
-          boost::filesystem::remove_all(image_root);
-          continue;
-        }
-
-        try {
-          const auto image_manifest_desc{Utils::parseJSONFile(index_manifest)};
-          HashedDigest image_digest{image_manifest_desc["manifests"][0]["digest"].asString()};
-          blob_shortlist.emplace(image_digest.hash());
-
-          const auto image_manifest{Utils::parseJSONFile(blobs_root_ / "sha256" / image_digest.hash())};
-          blob_shortlist.emplace(HashedDigest(image_manifest["config"]["digest"].asString()).hash());
-
-          const auto image_layers{image_manifest["layers"]};
-          for (Json::ValueConstIterator ii = image_layers.begin(); ii != image_layers.end(); ++ii) {
-            if ((*ii).isObject() && (*ii).isMember("digest")) {
-              const auto layer_digest{HashedDigest{(*ii)["digest"].asString()}};
-              blob_shortlist.emplace(layer_digest.hash());
-            } else {
-              LOG_ERROR << "Invalid image manifest: " << ii.key().asString() << " -> " << *ii;
-            }
-          }
-        } catch (const std::exception& exc) {
-          LOG_WARNING << "Found invalid app image manifest in the store, its blobs will be pruned; image: " << image
-                      << "err: " << exc.what();
-          boost::filesystem::remove_all(image_root);
-        }
+      // the blobs of the App versions fetched before the reference table was introduced are collected just once
+      const auto app_ref{getAppRef(uri)};
+      store_apps.emplace(app_ref);
+      if (!blob_refs_.hasApp(app_ref)) {
+        blob_refs_.setAppBlobs(app_ref, getAppBlobs(uri, entry.path()));
       }
     }
   }
 
-  // prune blobs
-  if (!boost::filesystem::exists(blobs_root_ / "sha256")) {
-    return;
-  }
-
-  for (const auto& entry :
-       boost::make_iterator_range(boost::filesystem::directory_iterator(blobs_root_ / "sha256"), {})) {
-    if (boost::filesystem::is_directory(entry)) {
-      continue;
+  // drop the references of the App versions removed from the store, their blobs not used by others become garbage
+  for (const auto& app_ref : blob_refs_.getApps()) {
+    if (store_apps.count(app_ref) == 0) {
+      blob_refs_.removeApp(app_ref);
     }
+  }
 
-    const std::string blob_sha = entry.path().filename().native();
-    if (blob_shortlist.end() == blob_shortlist.find(blob_sha)) {
-      LOG_INFO << "Removing blob: " << entry.path();
-      boost::filesystem::remove_all(entry.path());
-      prune_docker_store = true;
+  // prune blobs
+  const auto blob_dir{blobs_root_ / "sha256"};
+  if (blob_refs_.isRescanRequested()) {
+    // the blob being downloaded by a fetch in progress isn't referenced yet, so the rescan is postponed until then
+    std::lock_guard<std::mutex> lock{fetch_mutex_};
+    if (fetches_in_progress_ == 0) {
+      blob_refs_.rescan(blob_dir);
     }
   }
+  if (blob_refs_.sweep(blob_dir, prune_time_budget_) > 0) {
+    prune_docker_store = true;
+  }
+  blob_refs_.save();
+  blob_index_.prune();
+  blob_index_.save();
+  // the blobs of the shortlisted Apps are in the store, so the partial downloads left over are not needed anymore
+  if (registry_client_) {
+    registry_client_->removePartialBlobs();
+  }
 
   // prune docker store
   if (prune_docker_store) {
@@ -435,40 +444,132 @@ void RestorableAppEngine::pullApp(const Uri& uri, const boost::filesystem::path&
     }
   }
 
-  registry_client_->downloadBlob(archive_uri, archive_full_path, manifest.archiveSize());
+  // the layers metadata is needed right after the pull to check the App update size, so it's downloaded along with
+  // the archive
+  std::vector<BlobDownload> blobs{{archive_uri, archive_full_path, static_cast<size_t>(manifest.archiveSize())}};
+  const auto layers_meta_desc{manifest.layersMetaDescr()};
+  if (layers_meta_desc) {
+    blobs.push_back({uri.createUri(layers_meta_desc.digest), app_dir / layers_meta_desc.digest.hash(),
+                     static_cast<size_t>(layers_meta_desc.size)});
+  }
+  try {
+    registry_client_->downloadBlobs(blobs);
+  } catch (const std::exception& exc) {
+    if (blobs.size() == 1) {
+      throw;
+    }
+    // the layers metadata is optional, so its failure doesn't fail the App pull
+    LOG_WARNING << "Failed to download App blobs: " << exc.what() << ", downloading just the App archive";
+    boost::system::error_code ec;
+    // the blob file of the expected size is in place only after its hash is verified
+    if (boost::filesystem::file_size(archive_full_path, ec) != static_cast<std::uintmax_t>(manifest.archiveSize()) ||
+        ec) {
+      registry_client_->downloadBlob(archive_uri, archive_full_path, manifest.archiveSize());
+    }
+  }
   Utils::writeFile(app_dir / Manifest::Filename, manifest_str);
   Utils::writeFile(app_dir / "uri", uri.registryHostname + "/" + uri.repo + "@" + uri.digest());
   // Extract docker-compose.yml and safely persist it so the follow-up functionality doesn't need to do it again.
   const auto compose{extractComposeFile(archive_full_path)};
   Utils::writeFile(app_dir / ComposeFile, compose);
+  // the manifest and archive hashes have been verified by the registry client
+  blob_index_.add(app_dir / Manifest::Filename, uri.digest.hash());
+  blob_index_.add(archive_full_path, HashedDigest(manifest.archiveDigest()).hash());
+  blob_index_.add(app_dir / ComposeFile, getComposeFileHash(compose));
 }
 
-void RestorableAppEngine::checkAppUpdateSize(const Uri& uri, const boost::filesystem::path& app_dir) const {
+RestorableAppEngine::StorageReservation RestorableAppEngine::checkAppUpdateSize(
+    const Uri& uri, const boost::filesystem::path& app_dir) const {
   const Manifest manifest{Utils::parseJSONFile(app_dir / Manifest::Filename)};
+  const auto update_blobs{getMissingAppBlobs(uri, manifest, app_dir)};
+  if (!update_blobs) {
+    return {};
+  }
+
+  LOG_INFO << "Checking if there is sufficient amount of storage available for App update...";
+  return reserveBlobsStorage(uri.app, *update_blobs);
+}
+
+AppEngine::Result RestorableAppEngine::checkUpdateSize(const Apps& apps) {
+  Result res{true};
+  try {
+    std::vector<Manifest> manifests;
+    std::vector<BlobDownload> layers_metas;
+    for (const auto& app : apps) {
+      const Uri uri{Uri::parseUri(app.uri)};
+      const auto app_dir{apps_root_ / uri.app / uri.digest.hash()};
+      const auto manifest_file{app_dir / Manifest::Filename};
+      manifests.emplace_back(boost::filesystem::exists(manifest_file)
+                                 ? Utils::parseJSONFile(manifest_file)
+                                 : Utils::parseJSON(registry_client_->getAppManifest(uri, Manifest::Format)));
+      // the layers metadata downloaded and verified here are kept in the App dir for the following App fetch
+      boost::filesystem::create_directories(app_dir);
+      const auto layers_meta_desc{manifests.back().layersMetaDescr()};
+      if (layers_meta_desc) {
+        layers_metas.push_back({uri.createUri(layers_meta_desc.digest), app_dir / layers_meta_desc.digest.hash(),
+                                static_cast<size_t>(layers_meta_desc.size)});
+      }
+    }
+    // the layers metadata of all Apps are downloaded concurrently, the ones failed are retried per App
+    try {
+      registry_client_->downloadBlobs(layers_metas);
+    } catch (const std::exception& exc) {
+      LOG_WARNING << "Failed to download App layers metadata: " << exc.what();
+    }
+
+    // the blobs shared by the Apps are counted once
+    UpdateBlobs update_blobs;
+    for (std::size_t ii = 0; ii < apps.size(); ++ii) {
+      const auto& app{apps[ii]};
+      const Uri uri{Uri::parseUri(app.uri)};
+      const auto app_dir{apps_root_ / uri.app / uri.digest.hash()};
+      const auto app_update_blobs{getMissingAppBlobs(uri, manifests[ii], app_dir)};
+      if (!app_update_blobs) {
+        LOG_WARNING << app.name << ": cannot determine the App update size, the Apps update size is checked per App";
+        update_blobs.clear();
+        break;
+      }
+      update_blobs.insert(app_update_blobs->begin(), app_update_blobs->end());
+    }
+    if (!update_blobs.empty()) {
+      LOG_INFO << "Checking if there is sufficient amount of storage available for " << apps.size()
+               << " Apps update...";
+      // the space is reserved just for the time of the check, each App fetch reserves the space it needs
+      reserveBlobsStorage("Apps", update_blobs);
+    }
+  } catch (const InsufficientSpaceError& exc) {
+    res = {Result::ID::InsufficientSpace, exc.what(), exc.stat};
+  } catch (const std::exception& exc) {
+    res = {false, exc.what()};
+  }
+  return res;
+}
+
+boost::optional<RestorableAppEngine::UpdateBlobs> RestorableAppEngine::getMissingAppBlobs(
+    const Uri& uri, const Manifest& manifest, const boost::filesystem::path& app_dir) const {
   const auto arch{docker_client_->arch()};
   if (arch.empty()) {
     LOG_WARNING << "Failed to get an info about a system architecture";
-    return;
+    return boost::none;
   }
 
-  uint64_t skopeo_total_update_size;
-  uint64_t docker_total_update_size;
-  bool fallback_to_estimated_update_size_calculation{true};
-
   const auto layers_meta_desc{manifest.layersMetaDescr()};
   if (layers_meta_desc) {
     try {
       const Docker::Uri layers_meta_uri{uri.createUri(layers_meta_desc.digest)};
       const auto layers_meta_path{app_dir / layers_meta_desc.digest.hash()};
-      registry_client_->downloadBlob(layers_meta_uri, layers_meta_path, layers_meta_desc.size);
+      boost::system::error_code ec;
+      // it has been downloaded along with the App archive or by the Apps update size check, and verified then
+      if (boost::filesystem::file_size(layers_meta_path, ec) != static_cast<std::uintmax_t>(layers_meta_desc.size) ||
+          ec) {
+        registry_client_->downloadBlob(layers_meta_uri, layers_meta_path, layers_meta_desc.size);
+      }
       const auto layers_meta{Utils::parseJSONFile(layers_meta_path)};
       if (!layers_meta.isMember(arch)) {
         throw std::runtime_error("No layers metadata for the given arch: " + arch);
       }
       LOG_INFO << "Checking for App's layers to be pulled...";
-      std::tie(skopeo_total_update_size, docker_total_update_size) =
-          getPreciseAppUpdateSize(layers_meta[arch]["layers"], blobs_root_ / "sha256");
-      fallback_to_estimated_update_size_calculation = false;
+      return getPreciseAppUpdateBlobs(layers_meta[arch]["layers"], blobs_root_ / "sha256");
     } catch (const std::exception& exc) {
       LOG_ERROR << "Failed to retrieve or utilize App layers metadata containing precise disk usage: " << exc.what();
     }
@@ -476,37 +577,30 @@ void RestorableAppEngine::checkAppUpdateSize(const Uri& uri, const boost::filesy
     LOG_INFO << "No App layers metadata with precise disk usage has been found";
   }
 
-  if (fallback_to_estimated_update_size_calculation) {
-    LOG_INFO << "Falling back to the approximate estimation of the app update size....";
-    const auto layers_manifest{manifest.layersManifest(arch)};
-    if (!layers_manifest.isObject()) {
-      LOG_WARNING << "App layers' manifest is missing, skip checking an App update size";
-      return;
-    }
-
-    if (!(layers_manifest.isMember("digest") && layers_manifest["digest"].isString())) {
-      throw std::invalid_argument("Got invalid layers manifest, missing or incorrect `digest` field");
-    }
+  LOG_INFO << "Falling back to the approximate estimation of the app update size....";
+  const auto layers_manifest{manifest.layersManifest(arch)};
+  if (!layers_manifest.isObject()) {
+    LOG_WARNING << "App layers' manifest is missing, skip checking an App update size";
+    return boost::none;
+  }
 
-    if (!(layers_manifest.isMember("size") && layers_manifest["size"].isInt64())) {
-      throw std::invalid_argument("Got invalid layers manifest, missing or incorrect `size` field");
-    }
+  if (!(layers_manifest.isMember("digest") && layers_manifest["digest"].isString())) {
+    throw std::invalid_argument("Got invalid layers manifest, missing or incorrect `digest` field");
+  }
 
-    const Docker::Uri layers_manifest_uri{uri.createUri(HashedDigest(layers_manifest["digest"].asString()))};
-    const std::int64_t layers_manifest_size{layers_manifest["size"].asInt64()};
+  if (!(layers_manifest.isMember("size") && layers_manifest["size"].isInt64())) {
+    throw std::invalid_argument("Got invalid layers manifest, missing or incorrect `size` field");
+  }
 
-    const std::string man_str{
-        registry_client_->getAppManifest(layers_manifest_uri, Manifest::IndexFormat, layers_manifest_size)};
-    const auto man{Utils::parseJSON(man_str)};
+  const Docker::Uri layers_manifest_uri{uri.createUri(HashedDigest(layers_manifest["digest"].asString()))};
+  const std::int64_t layers_manifest_size{layers_manifest["size"].asInt64()};
 
-    LOG_INFO << "Checking for App's new layers...";
-    skopeo_total_update_size = getAppUpdateSize(man["layers"], blobs_root_ / "sha256");
-    const uint32_t average_compression_ratio{5} /* gzip layer compression ratio */;
-    docker_total_update_size = getDockerStoreSizeForAppUpdate(skopeo_total_update_size, average_compression_ratio);
-  }
+  const std::string man_str{
+      registry_client_->getAppManifest(layers_manifest_uri, Manifest::IndexFormat, layers_manifest_size)};
+  const auto man{Utils::parseJSON(man_str)};
 
-  LOG_INFO << "Checking if there is sufficient amount of storage available for App update...";
-  checkAvailableStorageInStores(uri.app, skopeo_total_update_size, docker_total_update_size);
+  LOG_INFO << "Checking for App's new layers...";
+  return getAppUpdateBlobs(man["layers"], blobs_root_ / "sha256");
 }
 
 void RestorableAppEngine::pullAppImages(const Uri& app_uri, const boost::filesystem::path& app_compose_file,
@@ -525,16 +619,173 @@ void RestorableAppEngine::pullAppImages(const Uri& app_uri, const boost::filesys
   boost::filesystem::create_directories(dst_dir);
 
   const auto compose{ComposeInfo(app_compose_file.string())};
+  std::vector<ExecPool::Job> jobs;
+  std::vector<std::pair<boost::filesystem::path, std::string>> pulled_images;
+  // the indices of the completed pull jobs in the order they complete
+  std::mutex done_mutex;
+  std::condition_variable done_cv;
+  std::deque<std::size_t> done_jobs;
+  std::vector<ImagePuller::Image> images;
+  std::unique_ptr<ImageLoadQueue> load_queue;
+  if (load_images_on_fetch_) {
+    load_queue = std::make_unique<ImageLoadQueue>(this);
+  }
+  try {
+    for (const auto& service : compose.getServices()) {
+      const auto image_uri = compose.getImage(service);
+
+      const Uri uri{Uri::parseUri(image_uri, false)};
+      const auto image_dir{dst_dir / uri.registryHostname / uri.repo / uri.digest.hash()};
+
+      LOG_INFO << uri.app << ": downloading image from Registry if missing: " << image_uri << " --> " << image_dir;
+      if (image_puller_) {
+        images.push_back({uri, image_dir});
+        continue;
+      }
+      const std::string image_src{client_image_src_func_(app_uri, image_uri)};
+      boost::filesystem::create_directories(image_dir);
+      const auto indx{jobs.size()};
+      jobs.emplace_back(exec_pool_->submit(
+          getPullImageCmd(client_, image_src, image_dir, blobs_root_, max_parallel_pulls_), "failed to pull image", "",
+          "900s", false, nullptr, [&done_mutex, &done_cv, &done_jobs, indx]() {
+            // notified under the lock, so the waiting thread cannot return and destroy the condition variable before
+            std::lock_guard<std::mutex> lock{done_mutex};
+            done_jobs.push_back(indx);
+            done_cv.notify_one();
+          }));
+      pulled_images.emplace_back(image_dir, image_uri);
+    }
+  } catch (...) {
+    // the submitted pulls refer to the completion queue, so they are awaited before it goes out of scope
+    for (auto& job : jobs) {
+      job.cancel();
+    }
+    std::unique_lock<std::mutex> lock{done_mutex};
+    done_cv.wait(lock, [&done_jobs, &jobs]() { return done_jobs.size() == jobs.size(); });
+    throw;
+  }
+
+  std::exception_ptr err;
+  if (fetchesCancelled()) {
+    // the fetches have been cancelled while the pulls were being submitted
+    for (auto& job : jobs) {
+      job.cancel();
+    }
+  }
+  if (image_puller_) {
+    try {
+      if (fetchesCancelled()) {
+        throw std::runtime_error("Image pull has been cancelled");
+      }
+      image_puller_->pull(images, [&load_queue](const ImagePuller::Image& image) {
+        if (load_queue) {
+          load_queue->push(image.dir, image.uri.registryHostname + "/" + image.uri.repo + "@" + image.uri.digest());
+        }
+      });
+    } catch (...) {
+      err = std::current_exception();
+    }
+  } else {
+    // Wait for all pulls in the order they complete, so an image is loaded as soon as it's pulled regardless of the
+    // pulls submitted before it. If one of them fails then cancel the rest and report the first error.
+    for (std::size_t done = 0; done < jobs.size(); ++done) {
+      std::size_t ii;
+      {
+        std::unique_lock<std::mutex> lock{done_mutex};
+        done_cv.wait(lock, [&done_jobs]() { return !done_jobs.empty(); });
+        ii = done_jobs.front();
+        done_jobs.pop_front();
+      }
+      try {
+        jobs[ii].get();
+        if (load_queue && !err) {
+          load_queue->push(pulled_images[ii].first, pulled_images[ii].second);
+        }
+      } catch (...) {
+        if (!err) {
+          err = std::current_exception();
+          for (auto& job_to_cancel : jobs) {
+            job_to_cancel.cancel();
+          }
+        }
+      }
+    }
+  }
+  if (load_queue) {
+    load_queue->finish(static_cast<bool>(err));
+  }
+  if (err) {
+    std::rethrow_exception(err);
+  }
+}
+
+BlobRefTable::Blobs RestorableAppEngine::getAppBlobs(const Uri& uri, const boost::filesystem::path& app_dir) const {
+  BlobRefTable::Blobs blobs;
+  if (boost::filesystem::exists(app_dir / Manifest::Filename)) {
+    // add app manifest to the App blobs
+    blobs.emplace(uri.digest.hash());
+    // add blobs of the app's manifest to the App blobs
+    try {
+      const Manifest app_manifest{Utils::parseJSONFile(app_dir / Manifest::Filename)};
+      for (const auto& element : std::vector<std::string>{"manifests", "layers"}) {
+        if (!app_manifest.isNull() && app_manifest.isMember(element) && app_manifest[element].isArray()) {
+          for (const auto& b : app_manifest[element]) {
+            if (!b.isNull() && b.isMember("digest")) {
+              blobs.emplace(HashedDigest{b["digest"].asString()}.hash());
+            }
+          }
+        }
+      }
+    } catch (const std::exception& exc) {
+      LOG_WARNING << "Found invalid app manifest in the store, its blobs will be pruned; app: " << uri.app
+                  << "err: " << exc.what();
+    }
+  }
+
+  // the App dir holds just the layers metadata if the App update size has been checked but the App isn't fetched yet
+  if (!boost::filesystem::exists(app_dir / ComposeFile)) {
+    return blobs;
+  }
+  // add blobs of each image of the app to the App blobs
+  ComposeInfo compose{(app_dir / ComposeFile).string()};
   for (const auto& service : compose.getServices()) {
-    const auto image_uri = compose.getImage(service);
+    const auto image = compose.getImage(service);
+    const Uri image_uri{Uri::parseUri(image, false)};
+    // Make sure the image root element (index or manifest) is not removed.
+    // We need it for backward compatibility with the composeapp utility.
+    blobs.emplace(image_uri.digest.hash());
+    const auto image_root{app_dir / "images" / image_uri.registryHostname / image_uri.repo / image_uri.digest.hash()};
+    const auto index_manifest{image_root / "index.json"};
+    if (!boost::filesystem::exists(index_manifest)) {
+      LOG_WARNING << "Failed to find an index manifest of App image: " << image << ", removing its directory";
+      boost::filesystem::remove_all(image_root);
+      continue;
+    }
 
-    const Uri uri{Uri::parseUri(image_uri, false)};
-    const auto image_dir{dst_dir / uri.registryHostname / uri.repo / uri.digest.hash()};
+    try {
+      const auto image_manifest_desc{Utils::parseJSONFile(index_manifest)};
+      HashedDigest image_digest{image_manifest_desc["manifests"][0]["digest"].asString()};
+      blobs.emplace(image_digest.hash());
+
+      const auto image_manifest{Utils::parseJSONFile(blobs_root_ / "sha256" / image_digest.hash())};
+      blobs.emplace(HashedDigest(image_manifest["config"]["digest"].asString()).hash());
 
-    LOG_INFO << uri.app << ": downloading image from Registry if missing: " << image_uri << " --> " << image_dir;
-    const std::string image_src{client_image_src_func_(app_uri, image_uri)};
-    pullImage(client_, image_src, image_dir, blobs_root_, max_parallel_pulls_);
+      const auto image_layers{image_manifest["layers"]};
+      for (Json::ValueConstIterator ii = image_layers.begin(); ii != image_layers.end(); ++ii) {
+        if ((*ii).isObject() && (*ii).isMember("digest")) {
+          const auto layer_digest{HashedDigest{(*ii)["digest"].asString()}};
+          blobs.emplace(layer_digest.hash());
+        } else {
+          LOG_ERROR << "Invalid image manifest: " << ii.key().asString() << " -> " << *ii;
+        }
+      }
+    } catch (const std::exception& exc) {
+      LOG_WARNING << "Found invalid app image manifest in the store, its blobs will be pruned; image: " << image
+                  << "err: " << exc.what();
+      boost::filesystem::remove_all(image_root);
+    }
   }
+  return blobs;
 }
 
 void RestorableAppEngine::installAppAndImages(const App& app) {
@@ -551,10 +802,81 @@ void RestorableAppEngine::installAppAndImages(const App& app) {
 
 void RestorableAppEngine::installApp(const boost::filesystem::path& app_dir, const boost::filesystem::path& dst_dir) {
   const Manifest manifest{Utils::parseJSONFile(app_dir / Manifest::Filename)};
-  const auto archive_full_path{app_dir / (HashedDigest(manifest.archiveDigest()).hash() + Manifest::ArchiveExt)};
+  const auto archive_hash{HashedDigest(manifest.archiveDigest()).hash()};
+  const auto archive_full_path{app_dir / (archive_hash + Manifest::ArchiveExt)};
+  const auto app_tree_dir{app_dir / (archive_hash + ".d")};
 
   boost::filesystem::create_directories(dst_dir);
-  exec(boost::format{"tar --overwrite -xzf %s"} % archive_full_path.string(), "failed to install Compose App", dst_dir);
+  // If the App files can be cloned from the store to the install dir, the archive is extracted to the store just once
+  // and each install shares the file data with the extracted tree instead of writing it again, so the tree takes no
+  // more space than the former extraction to the install dir. Otherwise, the tree would just double the space taken
+  // by the App files, then the archive is extracted right to the install dir.
+  if (!tree_installer_.canClone(app_dir, dst_dir)) {
+    boost::filesystem::remove_all(app_tree_dir);
+    boost::filesystem::remove(getAppTreeManifestPath(app_tree_dir));
+    exec(boost::format{"tar --overwrite -xzf %s"} % archive_full_path.string(), "failed to install Compose App",
+         dst_dir);
+    return;
+  }
+  if (!isAppTreeIntact(app_tree_dir)) {
+    extractAppTree(archive_full_path, app_tree_dir);
+  }
+  tree_installer_.install(app_tree_dir, dst_dir);
+}
+
+boost::filesystem::path RestorableAppEngine::getAppTreeManifestPath(const boost::filesystem::path& tree_dir) {
+  return tree_dir.string() + ".json";
+}
+
+Json::Value RestorableAppEngine::getAppTreeContent(const boost::filesystem::path& tree_dir) const {
+  // the hashes of the files that haven't been changed since they were recorded are taken from the blob index
+  Json::Value content{Json::objectValue};
+  for (boost::filesystem::recursive_directory_iterator it{tree_dir}, end; it != end; ++it) {
+    const auto status{it->symlink_status()};
+    const auto rel_path{it->path().lexically_relative(tree_dir).string()};
+    if (boost::filesystem::is_symlink(status)) {
+      content[rel_path] = "-> " + boost::filesystem::read_symlink(it->path()).string();
+    } else if (boost::filesystem::is_regular_file(status)) {
+      content[rel_path] = blob_index_.getHash(it->path());
+    }
+  }
+  return content;
+}
+
+bool RestorableAppEngine::isAppTreeIntact(const boost::filesystem::path& tree_dir) const {
+  const auto manifest_path{getAppTreeManifestPath(tree_dir)};
+  if (!boost::filesystem::exists(tree_dir) || !boost::filesystem::exists(manifest_path)) {
+    return false;
+  }
+  try {
+    if (Utils::parseJSONFile(manifest_path) == getAppTreeContent(tree_dir)) {
+      return true;
+    }
+    LOG_WARNING << "The extracted App tree has been changed, extracting the App archive again; tree: " << tree_dir;
+  } catch (const std::exception& exc) {
+    LOG_WARNING << "Failed to check the extracted App tree, extracting the App archive again; tree: " << tree_dir
+                << ", err: " << exc.what();
+  }
+  return false;
+}
+
+void RestorableAppEngine::extractAppTree(const boost::filesystem::path& archive_path,
+                                         const boost::filesystem::path& tree_dir) {
+  const auto manifest_path{getAppTreeManifestPath(tree_dir)};
+  boost::filesystem::remove(manifest_path);
+  boost::filesystem::remove_all(tree_dir);
+  // the extracted tree is complete only once it's renamed to its final name
+  const boost::filesystem::path tmp_dir{tree_dir.string() + ".tmp"};
+  boost::filesystem::remove_all(tmp_dir);
+  boost::filesystem::create_directories(tmp_dir);
+  exec(boost::format{"tar -xzf %s"} % archive_path.string(), "failed to extract Compose App", tmp_dir);
+  boost::filesystem::rename(tmp_dir, tree_dir);
+  // the tree content is recorded after the rename since the blob index records the files by their path, the tree is
+  // not trusted until its manifest is in place
+  const auto tmp_manifest_path{manifest_path.string() + ".tmp"};
+  Utils::writeFile(tmp_manifest_path, Utils::jsonToCanonicalStr(getAppTreeContent(tree_dir)), false);
+  boost::filesystem::rename(tmp_manifest_path, manifest_path);
+  blob_index_.save();
 }
 
 void RestorableAppEngine::installAppImages(const boost::filesystem::path& app_dir) {
@@ -591,7 +913,7 @@ bool RestorableAppEngine::isAppFetched(const App& app) const {
       break;
     }
 
-    const auto manifest_hash{getContentHash(manifest_file)};
+    const auto manifest_hash{blob_index_.getHash(manifest_file)};
     if (manifest_hash != uri.digest.hash()) {
       LOG_DEBUG << app.name << ": App manifest hash mismatch; actual: " << manifest_hash
                 << "; expected: " << uri.digest.hash();
@@ -608,19 +930,15 @@ bool RestorableAppEngine::isAppFetched(const App& app) const {
       break;
     }
 
-    // we assume that a compose App blob is relatively small so we can just read it all into RAM
-    const auto app_arch_hash{getContentHash(archive_full_path)};
+    const auto app_arch_hash{blob_index_.getHash(archive_full_path)};
     if (app_arch_hash != archive_manifest_hash) {
       LOG_DEBUG << app.name << ": App archive hash mismatch; actual: " << app_arch_hash
                 << "; defined in manifest: " << archive_manifest_hash;
       break;
     }
 
-    // Extract docker-compose.yml from the verified App archive regardless whether it has been extracted and stored on a
-    // file system before. We do it to make sure that the compose file from the verified archive is used by the
-    // follow-up functionality.
-    const auto compose{extractComposeFile(archive_full_path)};
-    Utils::writeFile(app_dir / ComposeFile, compose);
+    // Make sure that the compose file from the verified archive is used by the follow-up functionality.
+    extractVerifiedComposeFile(app_dir, archive_manifest_hash);
 
     // No need to check hashes of a Merkle tree of each App image since skopeo does it internally within in the `skopeo
     // copy` command. While the above statement is true there is still a need in traversing App's merkle tree at the
@@ -631,19 +949,67 @@ bool RestorableAppEngine::isAppFetched(const App& app) const {
     res = areAppImagesFetched(app);
   } while (false);
 
+  blob_index_.save();
   return res;
 }
 
+std::string RestorableAppEngine::extractVerifiedComposeFile(const boost::filesystem::path& app_dir,
+                                                            const std::string& archive_hash) const {
+  // The App dir is addressed by the App manifest digest that pins the archive digest, so the compose file in it can
+  // only come from the archive of the given hash, and it's up-to-date as long as both files are intact.
+  const auto archive_path{app_dir / (archive_hash + Manifest::ArchiveExt)};
+  const auto compose_file{app_dir / ComposeFile};
+  const auto actual_archive_hash{blob_index_.getHash(archive_path)};
+  if (actual_archive_hash != archive_hash) {
+    throw std::runtime_error("App archive hash mismatch; actual: " + actual_archive_hash +
+                             "; expected: " + archive_hash);
+  }
+  if (blob_index_.isUnchanged(compose_file)) {
+    return blob_index_.getHash(compose_file);
+  }
+  const auto compose{extractComposeFile(archive_path)};
+  const auto compose_hash{getComposeFileHash(compose)};
+  // The file is likely intact if it's just missing in the index, e.g. the index has been lost, so it's rewritten only
+  // if its content differs, then it's recorded by getHash()
+  if (!boost::filesystem::exists(compose_file) || blob_index_.getHash(compose_file) != compose_hash) {
+    Utils::writeFile(compose_file, compose);
+    blob_index_.add(compose_file, compose_hash);
+  }
+  return compose_hash;
+}
+
 bool RestorableAppEngine::areAppImagesFetched(const App& app) const {
   const Uri uri{Uri::parseUri(app.uri)};
   const auto app_dir{apps_root_ / uri.app / uri.digest.hash()};
   const auto compose_file{app_dir / ComposeFile};
 
   ComposeInfo compose{compose_file.string()};
+  std::vector<std::string> images;
   for (const auto& service : compose.getServices()) {
-    const auto image = compose.getImage(service);
+    images.emplace_back(compose.getImage(service));
+  }
+
+  // Images are checked concurrently, one image per worker, and the check is stopped as soon as any image is found
+  // missing, so the App check takes about as long as the check of its biggest image
+  std::atomic<bool> missing{false};
+  parallelFor(
+      images.size(), MaxParallelImageChecks,
+      [&](std::size_t indx) {
+        if (!isAppImageFetched(app, app_dir, images[indx])) {
+          missing = true;
+        }
+      },
+      [&missing]() { return missing.load(); });
+  return !missing;
+}
+
+bool RestorableAppEngine::isAppImageFetched(const App& app, const boost::filesystem::path& app_dir,
+                                            const std::string& image) const {
+  // a failure to check the image means that the image is not fetched, so no exception escapes the check
+  boost::filesystem::path image_root;
+  try {
     const Uri image_uri{Uri::parseUri(image, false)};
-    const auto image_root{app_dir / "images" / image_uri.registryHostname / image_uri.repo / image_uri.digest.hash()};
+    image_root = app_dir / "images" / image_uri.registryHostname / image_uri.repo / image_uri.digest.hash();
 
     const auto index_manifest{image_root / "index.json"};
     if (!boost::filesystem::exists(index_manifest)) {
@@ -651,88 +1017,89 @@ bool RestorableAppEngine::areAppImagesFetched(const App& app) const {
                 << "; index: " << index_manifest;
       return false;
     }
-    try {
-      // Unfortunately `skopeo` trims an index/list image manifest by removing from it each image manifests that
-      // doesn't match the current architecture. Therefore, it's not possible or doesn't make sense to compare
-      // the image digest (image_uri.digest.hash()) with a hash of actual content of index.json.
-      // TODO: consider patching skopeo or adding cli param to make it store an intact image index manifest.
-
-      const auto manifest_desc{Utils::parseJSONFile(index_manifest)};
-      if (manifest_desc.isNull() || manifest_desc.empty() || !manifest_desc.isObject() ||
-          !manifest_desc.isMember("manifests")) {
-        LOG_DEBUG << app.name << ": invalid index manifest of App image; image: " << image
-                  << "; index: " << index_manifest;
-        boost::filesystem::remove(index_manifest);
-        return false;
-      }
-      HashedDigest manifest_digest{manifest_desc["manifests"][0]["digest"].asString()};
 
-      const auto manifest_file{blobs_root_ / "sha256" / manifest_digest.hash()};
-      if (!boost::filesystem::exists(manifest_file)) {
-        LOG_DEBUG << app.name << ": missing App image manifest; image: " << image << "; manifest: " << manifest_file;
-        return false;
-      }
+    // Unfortunately `skopeo` trims an index/list image manifest by removing from it each image manifests that
+    // doesn't match the current architecture. Therefore, it's not possible or doesn't make sense to compare
+    // the image digest (image_uri.digest.hash()) with a hash of actual content of index.json.
+    // TODO: consider patching skopeo or adding cli param to make it store an intact image index manifest.
 
-      const auto manifest_hash{getContentHash(manifest_file)};
-      if (manifest_hash != manifest_digest.hash()) {
-        LOG_DEBUG << app.name << ": App image manifest hash mismatch; actual: " << manifest_hash
-                  << "; expected: " << manifest_digest.hash();
-        return false;
-      }
+    const auto manifest_desc{Utils::parseJSONFile(index_manifest)};
+    if (manifest_desc.isNull() || manifest_desc.empty() || !manifest_desc.isObject() ||
+        !manifest_desc.isMember("manifests")) {
+      LOG_DEBUG << app.name << ": invalid index manifest of App image; image: " << image
+                << "; index: " << index_manifest;
+      boost::filesystem::remove(index_manifest);
+      return false;
+    }
+    HashedDigest manifest_digest{manifest_desc["manifests"][0]["digest"].asString()};
 
-      const auto manifest{Utils::parseJSONFile(blobs_root_ / "sha256" / manifest_digest.hash())};
+    const auto manifest_file{blobs_root_ / "sha256" / manifest_digest.hash()};
+    if (!boost::filesystem::exists(manifest_file)) {
+      LOG_DEBUG << app.name << ": missing App image manifest; image: " << image << "; manifest: " << manifest_file;
+      return false;
+    }
 
-      // check image config file/blob
-      const auto config_digest{HashedDigest(manifest["config"]["digest"].asString())};
-      const auto config_file{blobs_root_ / "sha256" / config_digest.hash()};
+    const auto manifest_hash{blob_index_.getHash(manifest_file)};
+    if (manifest_hash != manifest_digest.hash()) {
+      LOG_DEBUG << app.name << ": App image manifest hash mismatch; actual: " << manifest_hash
+                << "; expected: " << manifest_digest.hash();
+      return false;
+    }
 
-      if (!boost::filesystem::exists(config_file)) {
-        LOG_DEBUG << app.name << ": missing App image config file; image: " << image << "; manifest: " << config_file;
-        return false;
-      }
+    const auto manifest{Utils::parseJSONFile(blobs_root_ / "sha256" / manifest_digest.hash())};
 
-      const auto config_hash{getContentHash(config_file)};
-      if (config_hash != config_digest.hash()) {
-        LOG_DEBUG << app.name << ": App image config hash mismatch; actual: " << config_hash
-                  << "; expected: " << config_digest.hash();
-        return false;
-      }
+    // check image config file/blob
+    const auto config_digest{HashedDigest(manifest["config"]["digest"].asString())};
+    const auto config_file{blobs_root_ / "sha256" / config_digest.hash()};
 
-      // check layers, just check blobs' size since generation of their hashes might consumes
-      // too much CPU for a given device ???
-      const auto layers{manifest["layers"]};
-      for (Json::ValueConstIterator ii = layers.begin(); ii != layers.end(); ++ii) {
-        if ((*ii).isObject() && (*ii).isMember("digest") && (*ii).isMember("size")) {
-          const auto layer_digest{HashedDigest{(*ii)["digest"].asString()}};
-          const auto layer_size{(*ii)["size"].asInt64()};
-          const auto blob_path{blobs_root_ / "sha256" / layer_digest.hash()};
-          if (!boost::filesystem::exists(blob_path)) {
-            LOG_DEBUG << app.name << ": missing App image blob; image: " << image << "; blob: " << blob_path;
-            return false;
-          }
-          const auto blob_size{boost::filesystem::file_size(blob_path)};
-          if (blob_size != layer_size) {
-            LOG_DEBUG << app.name << ": App image blob size mismatch; blob: " << blob_path << "; actual: " << blob_size
-                      << "; expected: " << layer_size;
-            // `skopeo copy` gets crazy if one or more blobs are invalid/altered/broken, it just simply fails
-            // instead of refetching it (another candidate for patching),
-            // so, we just remove the broken blob.
-            boost::filesystem::remove(blob_path);
-            return false;
-          }
+    if (!boost::filesystem::exists(config_file)) {
+      LOG_DEBUG << app.name << ": missing App image config file; image: " << image << "; manifest: " << config_file;
+      return false;
+    }
 
-        } else {
-          LOG_ERROR << app.name << ": invalid image manifest: " << ii.key().asString() << " -> " << *ii;
+    const auto config_hash{blob_index_.getHash(config_file)};
+    if (config_hash != config_digest.hash()) {
+      LOG_DEBUG << app.name << ": App image config hash mismatch; actual: " << config_hash
+                << "; expected: " << config_digest.hash();
+      return false;
+    }
+
+    // check layers, just check blobs' size since generation of their hashes might consumes
+    // too much CPU for a given device ???
+    const auto layers{manifest["layers"]};
+    for (Json::ValueConstIterator ii = layers.begin(); ii != layers.end(); ++ii) {
+      if ((*ii).isObject() && (*ii).isMember("digest") && (*ii).isMember("size")) {
+        const auto layer_digest{HashedDigest{(*ii)["digest"].asString()}};
+        const auto layer_size{(*ii)["size"].asInt64()};
+        const auto blob_path{blobs_root_ / "sha256" / layer_digest.hash()};
+        if (!boost::filesystem::exists(blob_path)) {
+          LOG_DEBUG << app.name << ": missing App image blob; image: " << image << "; blob: " << blob_path;
+          return false;
+        }
+        const auto blob_size{boost::filesystem::file_size(blob_path)};
+        if (blob_size != layer_size) {
+          LOG_DEBUG << app.name << ": App image blob size mismatch; blob: " << blob_path << "; actual: " << blob_size
+                    << "; expected: " << layer_size;
+          // `skopeo copy` gets crazy if one or more blobs are invalid/altered/broken, it just simply fails
+          // instead of refetching it (another candidate for patching),
+          // so, we just remove the broken blob.
+          boost::filesystem::remove(blob_path);
           return false;
         }
+
+      } else {
+        LOG_ERROR << app.name << ": invalid image manifest: " << ii.key().asString() << " -> " << *ii;
+        return false;
       }
-    } catch (const std::exception& exc) {
-      LOG_WARNING << app.name
-                  << ": failed to check whether app image is fetched, consider it as a non-fetched; image: " << image
-                  << ", err: " << exc.what();
-      boost::filesystem::remove_all(image_root);
-      return false;
     }
+  } catch (const std::exception& exc) {
+    LOG_WARNING << app.name << ": failed to check whether app image is fetched, consider it as a non-fetched; image: "
+                << image << ", err: " << exc.what();
+    if (!image_root.empty()) {
+      boost::system::error_code ec;
+      boost::filesystem::remove_all(image_root, ec);
+    }
+    return false;
   }
 
   return true;
@@ -747,14 +1114,8 @@ bool RestorableAppEngine::isAppInstalled(const App& app) const {
   do {
     const auto manifest_file{app_dir / Manifest::Filename};
     const Manifest manifest{Utils::parseJSONFile(manifest_file)};
-    const auto archive_manifest_hash{HashedDigest(manifest.archiveDigest()).hash()};
-    const auto archive_full_path{app_dir / (archive_manifest_hash + Manifest::ArchiveExt)};
-    const auto compose_file_str{extractComposeFile(archive_full_path)};
-    const auto compose_file_hash =
-        boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(compose_file_str)));
-    const auto installed_compose_file_str = Utils::readFile(app_install_dir / ComposeFile);
-    const auto installed_compose_file_hash =
-        boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(installed_compose_file_str)));
+    const auto compose_file_hash{extractVerifiedComposeFile(app_dir, HashedDigest(manifest.archiveDigest()).hash())};
+    const auto installed_compose_file_hash{blob_index_.getHash(app_install_dir / ComposeFile)};
 
     if (compose_file_hash != installed_compose_file_hash) {
       LOG_DEBUG << app.name << "; a compose file hash mismatch; installed: " << installed_compose_file_hash
@@ -766,6 +1127,7 @@ bool RestorableAppEngine::isAppInstalled(const App& app) const {
     res = true;
   } while (false);
 
+  blob_index_.save();
   return res;
 }
 
@@ -810,20 +1172,16 @@ bool RestorableAppEngine::checkAppContainers(const App& app, const std::string&
 
 // static methods to manage image data and Compose App
 
-void RestorableAppEngine::pullImage(const std::string& client, const std::string& src,
-                                    const boost::filesystem::path& dst_dir,
-                                    const boost::filesystem::path& shared_blob_dir, int max_parallel_pulls,
-                                    const std::string& format) {
-  boost::filesystem::create_directories(dst_dir);
+std::string RestorableAppEngine::getPullImageCmd(const std::string& client, const std::string& src,
+                                                 const boost::filesystem::path& dst_dir,
+                                                 const boost::filesystem::path& shared_blob_dir,
+                                                 int max_parallel_pulls, const std::string& format) {
   if (-1 == max_parallel_pulls) {
-    exec(boost::format{"%s copy -f %s --dest-shared-blob-dir %s %s oci:%s"} % client % format %
-             shared_blob_dir.string() % src % dst_dir.string(),
-         "failed to pull image");
-  } else {
-    exec(boost::format{"%s copy --max-parallel-pulls %d -f %s --dest-shared-blob-dir %s %s oci:%s"} % client %
-             max_parallel_pulls % format % shared_blob_dir.string() % src % dst_dir.string(),
-         "failed to pull image");
+    return boost::str(boost::format{"%s copy -f %s --dest-shared-blob-dir %s %s oci:%s"} % client % format %
+                      shared_blob_dir.string() % src % dst_dir.string());
   }
+  return boost::str(boost::format{"%s copy --max-parallel-pulls %d -f %s --dest-shared-blob-dir %s %s oci:%s"} %
+                    client % max_parallel_pulls % format % shared_blob_dir.string() % src % dst_dir.string());
 }
 
 void RestorableAppEngine::installImage(const std::string& client, const boost::filesystem::path& image_dir,
@@ -867,12 +1225,12 @@ void RestorableAppEngine::stopComposeApp(const std::string& compose_cmd, const b
   }
 }
 
-std::string RestorableAppEngine::getContentHash(const boost::filesystem::path& path) {
-  const auto content{Utils::readFile(path)};
-  return boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(content)));
+std::string RestorableAppEngine::getComposeFileHash(const std::string& compose) {
+  return boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(compose)));
 }
 
-uint64_t RestorableAppEngine::getAppUpdateSize(const Json::Value& app_layers, const boost::filesystem::path& blob_dir) {
+RestorableAppEngine::UpdateBlobs RestorableAppEngine::getAppUpdateBlobs(const Json::Value& app_layers,
+                                                                        const boost::filesystem::path& blob_dir) {
   std::unordered_set<std::string> store_blobs;
 
   if (boost::filesystem::exists(blob_dir)) {
@@ -889,7 +1247,8 @@ uint64_t RestorableAppEngine::getAppUpdateSize(const Json::Value& app_layers, co
   // are stored on storage, thus we need to make sure that underlying storage can accommodate the sum of the Apps'
   // layers set/list.
 
-  uint64_t skopeo_total_update_size{0};
+  UpdateBlobs update_blobs;
+  const uint32_t average_compression_ratio{5} /* gzip layer compression ratio */;
 
   for (Json::ValueConstIterator ii = app_layers.begin(); ii != app_layers.end(); ++ii) {
     const HashedDigest digest{(*ii)["digest"].asString()};
@@ -898,7 +1257,7 @@ uint64_t RestorableAppEngine::getAppUpdateSize(const Json::Value& app_layers, co
       // https://github.com/opencontainers/image-spec/blob/main/descriptor.md#properties
       const auto size_obj{(*ii)["size"]};
       if (!size_obj.isInt64()) {
-        throw std::range_error("Invalid value of a layer size, must be int64, got: " + size_obj.asString());
+        throw std::range_error("Invalid value of a layer size, must be int64, got: " + Utils::jsonToStr(size_obj));
       }
 
       const std::int64_t size{size_obj.asInt64()};
@@ -906,19 +1265,14 @@ uint64_t RestorableAppEngine::getAppUpdateSize(const Json::Value& app_layers, co
         throw std::range_error("Invalid value of a layer size, must be > 0, got: " + std::to_string(size));
       }
 
-      const uint64_t new_total_update_size = skopeo_total_update_size + size;
-      if (new_total_update_size < skopeo_total_update_size || new_total_update_size < size) {
-        throw std::overflow_error("Sum of layer sizes exceeded the maximum allowed value: " +
-                                  std::to_string(std::numeric_limits<uint64_t>::max()));
-      }
-
       LOG_INFO << "\t" << digest.hash() << " -> missing; to be downloaded; size: " << size;
-      skopeo_total_update_size = new_total_update_size;
+      update_blobs[digest.hash()] = {static_cast<uint64_t>(size),
+                                     getDockerStoreSizeForAppUpdate(size, average_compression_ratio)};
     } else {
       LOG_INFO << "\t" << digest.hash() << " -> exists";
     }
   }
-  return skopeo_total_update_size;
+  return update_blobs;
 }
 
 uint64_t RestorableAppEngine::getDockerStoreSizeForAppUpdate(const uint64_t& compressed_update_size,
@@ -933,8 +1287,8 @@ uint64_t RestorableAppEngine::getDockerStoreSizeForAppUpdate(const uint64_t& com
   return docker_total_update_size;
 }
 
-std::tuple<uint64_t, uint64_t> RestorableAppEngine::getPreciseAppUpdateSize(const Json::Value& app_layers,
-                                                                            const boost::filesystem::path& blob_dir) {
+RestorableAppEngine::UpdateBlobs RestorableAppEngine::getPreciseAppUpdateBlobs(
+    const Json::Value& app_layers, const boost::filesystem::path& blob_dir) {
   std::unordered_set<std::string> store_blobs;
 
   if (boost::filesystem::exists(blob_dir)) {
@@ -951,8 +1305,7 @@ std::tuple<uint64_t, uint64_t> RestorableAppEngine::getPreciseAppUpdateSize(cons
   // are stored on storage, thus we need to make sure that underlying storage can accommodate the sum of the Apps'
   // layers set/list.
 
-  uint64_t skopeo_total_update_size{0};
-  uint64_t docker_total_update_size{0};
+  UpdateBlobs update_blobs;
 
   for (Json::ValueConstIterator ii = app_layers.begin(); ii != app_layers.end(); ++ii) {
     const HashedDigest digest{ii.key().asString()};
@@ -961,57 +1314,87 @@ std::tuple<uint64_t, uint64_t> RestorableAppEngine::getPreciseAppUpdateSize(cons
       continue;
     }
     if (!(*ii).isMember("usage")) {
-      throw std::range_error("Invalid layers metadata; `usage` field is missing: " + (*ii).asString());
+      throw std::range_error("Invalid layers metadata; `usage` field is missing: " + Utils::jsonToStr(*ii));
     }
     if (!(*ii)["usage"].isInt64()) {
-      throw std::range_error("Invalid value of a layer usage, must be int64, got: " + (*ii)["usage"].asString());
+      throw std::range_error("Invalid value of a layer usage, must be int64, got: " + Utils::jsonToStr((*ii)["usage"]));
     }
     const std::int64_t size{(*ii)["size"].asInt64()};
     const std::int64_t usage{(*ii)["usage"].asInt64()};
     const std::int64_t archive_size{(*ii)["archive_size"].asInt64()};
 
-    const uint64_t new_skopeo_total_update_size = skopeo_total_update_size + archive_size;
-    if (new_skopeo_total_update_size < skopeo_total_update_size || new_skopeo_total_update_size < archive_size) {
-      throw std::overflow_error("Sum of layer sizes exceeded the maximum allowed value: " +
-                                std::to_string(std::numeric_limits<uint64_t>::max()));
+    if (usage < 0 || archive_size < 0) {
+      throw std::range_error("Invalid layers metadata; negative `usage` or `archive_size`: " + Utils::jsonToStr(*ii));
     }
 
-    const uint64_t new_docker_total_update_size = docker_total_update_size + usage;
-    if (new_docker_total_update_size < docker_total_update_size || new_docker_total_update_size < usage) {
+    LOG_INFO << "\t" << digest.hash() << " -> missing; to be downloaded; blob size: " << archive_size
+             << ", diff size: " << size << ", disk usage: " << usage;
+    update_blobs[digest.hash()] = {static_cast<uint64_t>(archive_size), static_cast<uint64_t>(usage)};
+  }
+  return update_blobs;
+}
+
+RestorableAppEngine::StorageReservation RestorableAppEngine::checkAvailableStorageInStores(
+    const std::string& app_name, const uint64_t& skopeo_required_storage,
+    const uint64_t& docker_required_storage) const {
+  // Serialize checks so concurrent fetches cannot each pass the check and then overrun the storage together
+  std::lock_guard<std::mutex> lock{fetch_mutex_};
+  return reserveStorageLocked(app_name, skopeo_required_storage, docker_required_storage, {});
+}
+
+RestorableAppEngine::StorageReservation RestorableAppEngine::reserveBlobsStorage(const std::string& app_name,
+                                                                            const UpdateBlobs& update_blobs) const {
+  std::lock_guard<std::mutex> lock{fetch_mutex_};
+  uint64_t skopeo_required_storage{0};
+  uint64_t docker_required_storage{0};
+  std::vector<std::string> blobs;
+  for (const auto& blob : update_blobs) {
+    // the blob is going to be stored by another fetch in progress, its space is already reserved
+    if (reserved_blobs_.count(blob.first) > 0) {
+      LOG_INFO << "\t" << blob.first << " -> being downloaded by another fetch";
+      continue;
+    }
+    if (__builtin_add_overflow(skopeo_required_storage, blob.second.store, &skopeo_required_storage) ||
+        __builtin_add_overflow(docker_required_storage, blob.second.docker, &docker_required_storage)) {
       throw std::overflow_error("Sum of layer sizes exceeded the maximum allowed value: " +
                                 std::to_string(std::numeric_limits<uint64_t>::max()));
     }
-
-    LOG_INFO << "\t" << digest.hash() << " -> missing; to be downloaded; blob size: " << archive_size
-             << ", diff size: " << size << ", disk usage: " << usage;
-    skopeo_total_update_size = new_skopeo_total_update_size;
-    docker_total_update_size = new_docker_total_update_size;
+    blobs.emplace_back(blob.first);
   }
-  return {skopeo_total_update_size, docker_total_update_size};
+  return reserveStorageLocked(app_name, skopeo_required_storage, docker_required_storage, std::move(blobs));
 }
 
-void RestorableAppEngine::checkAvailableStorageInStores(const std::string& app_name,
-                                                        const uint64_t& skopeo_required_storage,
-                                                        const uint64_t& docker_required_storage) const {
+RestorableAppEngine::StorageReservation RestorableAppEngine::reserveStorageLocked(
+    const std::string& app_name, const uint64_t& skopeo_required_storage, const uint64_t& docker_required_storage,
+    std::vector<std::string> blobs) const {
+  // skopeo's tmp files belong to pulls in progress if other fetches are running
+  const bool can_remove_tmp_files{fetches_in_progress_ <= 1};
+
   auto checkRoomInStore = [&](const std::string& store_name, const uint64_t& required_storage,
-                              const boost::filesystem::path& store_path) {
+                              const uint64_t& reserved_storage, const boost::filesystem::path& store_path) {
     storage::Volume::UsageInfo usage_info{storage_space_func_(store_path)};
     LOG_INFO << app_name << " -> " << store_name
              << " store total update size: " << usage_info.withRequired(required_storage);
-    if (required_storage > usage_info.available.first) {
-      throw InsufficientSpaceError(store_name, usage_info.withRequired(required_storage));
+    if (reserved_storage > 0) {
+      LOG_INFO << app_name << " -> " << store_name << " store space reserved by other fetches: " << reserved_storage;
+    }
+    if (required_storage + reserved_storage > usage_info.available.first) {
+      throw InsufficientSpaceError(store_name, usage_info.withRequired(required_storage + reserved_storage));
     }
   };
 
   try {
-    checkRoomInStore("skopeo", skopeo_required_storage, store_root_);
+    checkRoomInStore("skopeo", skopeo_required_storage, reserved_store_storage_, store_root_);
   } catch (const InsufficientSpaceError& exc) {
+    if (!can_remove_tmp_files) {
+      throw;
+    }
     // maybe the skopeo store is filled with the tmp files, let's remove them and try again
     removeTmpFiles(apps_root_);
-    checkRoomInStore("skopeo", skopeo_required_storage, store_root_);
+    checkRoomInStore("skopeo", skopeo_required_storage, reserved_store_storage_, store_root_);
   }
 
-  checkRoomInStore("docker", docker_required_storage, docker_root_);
+  checkRoomInStore("docker", docker_required_storage, reserved_docker_storage_, docker_root_);
 
   if (docker_and_skopeo_same_volume_) {
     const uint64_t combined_total_required_size{skopeo_required_storage + docker_required_storage};
@@ -1021,14 +1404,107 @@ void RestorableAppEngine::checkAvailableStorageInStores(const std::string& app_n
                                 std::to_string(std::numeric_limits<uint64_t>::max()));
     }
 
+    const uint64_t combined_reserved_size{reserved_store_storage_ + reserved_docker_storage_};
     try {
-      checkRoomInStore("skopeo & docker", combined_total_required_size, store_root_);
+      checkRoomInStore("skopeo & docker", combined_total_required_size, combined_reserved_size, store_root_);
     } catch (const InsufficientSpaceError& exc) {
+      if (!can_remove_tmp_files) {
+        throw;
+      }
       // maybe the skopeo store is filled with the tmp files, let's remove them and try again
       removeTmpFiles(apps_root_);
-      checkRoomInStore("skopeo & docker", combined_total_required_size, store_root_);
+      checkRoomInStore("skopeo & docker", combined_total_required_size, combined_reserved_size, store_root_);
     }
   }
+
+  reserved_store_storage_ += skopeo_required_storage;
+  reserved_docker_storage_ += docker_required_storage;
+  for (const auto& blob : blobs) {
+    ++reserved_blobs_[blob];
+  }
+  return {this, skopeo_required_storage, docker_required_storage, std::move(blobs)};
+}
+
+RestorableAppEngine::StorageReservation::~StorageReservation() {
+  if (engine_ != nullptr) {
+    std::lock_guard<std::mutex> lock{engine_->fetch_mutex_};
+    engine_->reserved_store_storage_ -= store_size_;
+    engine_->reserved_docker_storage_ -= docker_size_;
+    for (const auto& blob : blobs_) {
+      if (--engine_->reserved_blobs_[blob] == 0) {
+        engine_->reserved_blobs_.erase(blob);
+      }
+    }
+  }
+}
+
+RestorableAppEngine::FetchInProgress::FetchInProgress(const RestorableAppEngine* engine) : engine_{engine} {
+  std::lock_guard<std::mutex> lock{engine_->fetch_mutex_};
+  ++engine_->fetches_in_progress_;
+}
+
+RestorableAppEngine::FetchInProgress::~FetchInProgress() {
+  std::lock_guard<std::mutex> lock{engine_->fetch_mutex_};
+  --engine_->fetches_in_progress_;
+}
+
+RestorableAppEngine::ImageLoadQueue::ImageLoadQueue(RestorableAppEngine* engine)
+    : engine_{engine}, worker_{[this]() { work(); }} {}
+
+RestorableAppEngine::ImageLoadQueue::~ImageLoadQueue() { finish(true); }
+
+void RestorableAppEngine::ImageLoadQueue::push(const boost::filesystem::path& image_dir, const std::string& image_uri) {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    queue_.emplace_back(image_dir, image_uri);
+  }
+  cv_.notify_one();
+}
+
+void RestorableAppEngine::ImageLoadQueue::finish(bool discard) {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (discard) {
+      queue_.clear();
+    }
+    finished_ = true;
+  }
+  cv_.notify_one();
+  if (worker_.joinable()) {
+    worker_.join();
+  }
+}
+
+void RestorableAppEngine::ImageLoadQueue::work() {
+  while (true) {
+    std::pair<boost::filesystem::path, std::string> image;
+    {
+      std::unique_lock<std::mutex> lock{mutex_};
+      cv_.wait(lock, [this]() { return finished_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        return;
+      }
+      image = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    const Uri uri{Uri::parseUri(image.second, false)};
+    const std::string tag{uri.registryHostname + '/' + uri.repo + ':' + uri.digest.shortHash()};
+    try {
+      loadImageToDockerStore(engine_->docker_client_, engine_->blobs_root_, image.first, image.second, tag);
+    } catch (const std::exception& exc) {
+      LOG_WARNING << "Failed to load image to docker store while fetching, it will be loaded at App install; image: "
+                  << image.second << ", err: " << exc.what();
+    }
+  }
+}
+
+void RestorableAppEngine::cancelFetches() {
+  // the fetches are marked cancelled first, so the pulls submitted after the cancellation are cancelled by the fetches
+  ::AppEngine::cancelFetches();
+  exec_pool_->cancelAll();
+  if (image_puller_) {
+    image_puller_->cancel();
+  }
 }
 
 bool RestorableAppEngine::areDockerAndSkopeoOnTheSameVolume(const boost::filesystem::path& skopeo_path,
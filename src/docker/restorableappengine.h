@@ -3,14 +3,34 @@
 
 #include "appengine.h"
 
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include "aktualizr-lite/storage/stat.h"
+#include "docker/blobindex.h"
+#include "docker/blobrefs.h"
 #include "docker/docker.h"
 #include "docker/dockerclient.h"
+#include "docker/imagepuller.h"
+#include "docker/treeinstaller.h"
+#include "exec.h"
 
 namespace Docker {
 
+class InsufficientSpaceError : public std::runtime_error {
+ public:
+  InsufficientSpaceError(const std::string& store, const storage::Volume::UsageInfo& usage_info)
+      : std::runtime_error("Insufficient storage available; store: " + store + "; " + usage_info.str()),
+        stat{usage_info} {}
+  storage::Volume::UsageInfo stat;
+};
+
 /**
  * @brief RestorableAppEngine, implementation of App Engine that can reset or restore Apps in case of docker engine
  * failure
@@ -81,8 +101,15 @@ class RestorableAppEngine : public AppEngine {
   static const int LowWatermarkLimit{20};
   static const int HighWatermarkLimit{95};
   static StorageSpaceFunc GetDefStorageSpaceFunc(int watermark = 80);
+  // The directory of the aklite's own data related to the App store, it's kept out of the store since the store might
+  // be owned by composectl
+  static boost::filesystem::path GetDefStateRoot(const boost::filesystem::path& store_root);
+  static const ClientImageSrcFunc DefClientImageSrcFunc;
   static const int SkopeoMaxParallelPullsHighLimit{10};
   static const int SkopeoMaxParallelPullsLowLimit{1};
+  static const int MaxParallelImagePullsHighLimit{8};
+  // The number of App images verified concurrently by the fetch check
+  static const int MaxParallelImageChecks{4};
 
   RestorableAppEngine(
       boost::filesystem::path store_root, boost::filesystem::path install_root, boost::filesystem::path docker_root,
@@ -90,9 +117,10 @@ class RestorableAppEngine : public AppEngine {
       std::string client = "/sbin/skopeo", std::string docker_host = "unix:///var/run/docker.sock",
       std::string compose_cmd = "/usr/bin/docker-compose",
       StorageSpaceFunc storage_space_func = RestorableAppEngine::GetDefStorageSpaceFunc(),
-      ClientImageSrcFunc client_image_src_func = [](const Docker::Uri& /* app_uri */,
-                                                    const std::string& image_uri) { return "docker://" + image_uri; },
-      bool create_containers_if_install = true, bool offline = false);
+      ClientImageSrcFunc client_image_src_func = RestorableAppEngine::DefClientImageSrcFunc,
+      bool create_containers_if_install = true, bool offline = false, bool native_image_pull = false,
+      bool load_images_on_fetch = false,
+      std::chrono::milliseconds prune_time_budget = std::chrono::milliseconds::zero());
 
   Result fetch(const App& app) override;
   Result verify(const App& app) override;
@@ -105,6 +133,8 @@ class RestorableAppEngine : public AppEngine {
   Apps getInstalledApps() const override;
   Json::Value getRunningAppsInfo() const override;
   void prune(const Apps& app_shortlist) override;
+  void cancelFetches() override;
+  Result checkUpdateSize(const Apps& apps) override;
 
   static void removeTmpFiles(const boost::filesystem::path& apps_root);
   static bool areDockerAndSkopeoOnTheSameVolume(const boost::filesystem::path& skopeo_path,
@@ -115,7 +145,93 @@ class RestorableAppEngine : public AppEngine {
   const boost::filesystem::path& installRoot() const { return install_root_; }
   const std::string& dockerHost() const { return docker_host_; }
   Docker::DockerClient::Ptr& dockerClient() { return docker_client_; }
+  const Docker::DockerClient::Ptr& dockerClient() const { return docker_client_; }
   const StorageSpaceFunc& storageSpaceFunc() const { return storage_space_func_; }
+  const ExecPool::Ptr& execPool() const { return exec_pool_; }
+
+  // Storage space reserved for the time of an App fetch, it is released on destruction.
+  // Fetches may run concurrently, so a fetch has to count in the space that is going to be taken by the others.
+  class StorageReservation {
+   public:
+    StorageReservation() = default;
+    StorageReservation(const RestorableAppEngine* engine, uint64_t store_size, uint64_t docker_size,
+                       std::vector<std::string> blobs = {})
+        : engine_{engine}, store_size_{store_size}, docker_size_{docker_size}, blobs_{std::move(blobs)} {}
+    ~StorageReservation();
+    StorageReservation(StorageReservation&& other) noexcept
+        : engine_{other.engine_},
+          store_size_{other.store_size_},
+          docker_size_{other.docker_size_},
+          blobs_{std::move(other.blobs_)} {
+      other.engine_ = nullptr;
+    }
+    StorageReservation(const StorageReservation&) = delete;
+    StorageReservation& operator=(const StorageReservation&) = delete;
+    StorageReservation& operator=(StorageReservation&&) = delete;
+
+   private:
+    const RestorableAppEngine* engine_{nullptr};
+    uint64_t store_size_{0};
+    uint64_t docker_size_{0};
+    // the blobs the space is reserved for
+    std::vector<std::string> blobs_;
+  };
+
+  // The space required by a blob missing in the store, in the skopeo store and in the docker store
+  struct BlobUpdateSize {
+    uint64_t store{0};
+    uint64_t docker{0};
+  };
+  // The blobs missing in the store mapped by their hash
+  using UpdateBlobs = std::unordered_map<std::string, BlobUpdateSize>;
+
+  // Marks a fetch as being in progress for the lifetime of the object
+  class FetchInProgress {
+   public:
+    explicit FetchInProgress(const RestorableAppEngine* engine);
+    ~FetchInProgress();
+    FetchInProgress(const FetchInProgress&) = delete;
+    FetchInProgress(FetchInProgress&&) = delete;
+    FetchInProgress& operator=(const FetchInProgress&) = delete;
+    FetchInProgress& operator=(FetchInProgress&&) = delete;
+
+   private:
+    const RestorableAppEngine* engine_;
+  };
+
+  // Loads images to the docker store one by one in a background thread, so the images that have been pulled are
+  // loaded while the others are still being downloaded. A load failure is just logged, since the images are loaded
+  // again at App install, when the layers loaded already are skipped by dockerd.
+  class ImageLoadQueue {
+   public:
+    explicit ImageLoadQueue(RestorableAppEngine* engine);
+    ~ImageLoadQueue();
+    ImageLoadQueue(const ImageLoadQueue&) = delete;
+    ImageLoadQueue(ImageLoadQueue&&) = delete;
+    ImageLoadQueue& operator=(const ImageLoadQueue&) = delete;
+    ImageLoadQueue& operator=(ImageLoadQueue&&) = delete;
+
+    void push(const boost::filesystem::path& image_dir, const std::string& image_uri);
+    // Waits for the queued images to be loaded, or drops them if `discard` is set
+    void finish(bool discard = false);
+
+   private:
+    void work();
+
+    RestorableAppEngine* const engine_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::pair<boost::filesystem::path, std::string>> queue_;
+    bool finished_{false};
+    std::thread worker_;
+  };
+
+  // Checks whether the stores have room for the given App update, taking into account the space reserved by fetches
+  // in progress, and reserves the required space if so; throws InsufficientSpaceError otherwise
+  StorageReservation checkAvailableStorageInStores(const std::string& app_name, const uint64_t& skopeo_required_storage,
+                                                   const uint64_t& docker_required_storage) const;
+  // Does the same for the given blobs, the blobs reserved by other fetches in progress are not counted again
+  StorageReservation reserveBlobsStorage(const std::string& app_name, const UpdateBlobs& update_blobs) const;
 
   virtual bool isAppFetched(const App& app) const;
   virtual bool isAppInstalled(const App& app) const;
@@ -128,17 +244,37 @@ class RestorableAppEngine : public AppEngine {
   };
   // pull App&Images
   void pullApp(const Uri& uri, const boost::filesystem::path& app_dir);
-  void checkAppUpdateSize(const Uri& uri, const boost::filesystem::path& app_dir) const;
+  StorageReservation checkAppUpdateSize(const Uri& uri, const boost::filesystem::path& app_dir) const;
+  // Returns boost::none if the App update size cannot be determined
+  boost::optional<UpdateBlobs> getMissingAppBlobs(const Uri& uri, const Manifest& manifest,
+                                                  const boost::filesystem::path& app_dir) const;
+  StorageReservation reserveStorageLocked(const std::string& app_name, const uint64_t& skopeo_required_storage,
+                                          const uint64_t& docker_required_storage,
+                                          std::vector<std::string> blobs) const;
   void pullAppImages(const Uri& app_uri, const boost::filesystem::path& app_compose_file,
                      const boost::filesystem::path& dst_dir);
+  // Returns the hashes of the store blobs the App refers to, the image dirs with an invalid manifest are removed
+  BlobRefTable::Blobs getAppBlobs(const Uri& uri, const boost::filesystem::path& app_dir) const;
+  static std::string getAppRef(const Uri& uri) { return uri.app + "/" + uri.digest.hash(); }
 
   // install App&Images
   Result installAndCreateOrRunContainers(const App& app, bool run = false);
   Result installContainerless(const App& app);
-  static void installApp(const boost::filesystem::path& app_dir, const boost::filesystem::path& dst_dir);
+  void installApp(const boost::filesystem::path& app_dir, const boost::filesystem::path& dst_dir);
+  // The App archive extracted to the store, `<app_dir>/<archive_hash>.d`, is described by a manifest next to it, which
+  // maps the relative path of each file to its hash, or of each symlink to its target
+  static boost::filesystem::path getAppTreeManifestPath(const boost::filesystem::path& tree_dir);
+  Json::Value getAppTreeContent(const boost::filesystem::path& tree_dir) const;
+  // Returns true if the extracted tree still matches its manifest, the unchanged files are not read again
+  bool isAppTreeIntact(const boost::filesystem::path& tree_dir) const;
+  void extractAppTree(const boost::filesystem::path& archive_path, const boost::filesystem::path& tree_dir);
   void installAppImages(const boost::filesystem::path& app_dir);
 
+  // Returns the hash of the App compose file extracted from the App archive, the archive is decompressed only if the
+  // file hasn't been extracted yet or has been changed since then. Throws if the archive doesn't match its hash.
+  std::string extractVerifiedComposeFile(const boost::filesystem::path& app_dir, const std::string& archive_hash) const;
   bool areAppImagesFetched(const App& app) const;
+  bool isAppImageFetched(const App& app, const boost::filesystem::path& app_dir, const std::string& image) const;
 
   // check if App&Images are running
   static bool isRunning(const App& app, const std::string& compose_file,
@@ -150,9 +286,10 @@ class RestorableAppEngine : public AppEngine {
                                  const Docker::DockerClient::Ptr& docker_client, bool check_state = true);
 
   // functions specific to an image tranfer utility
-  static void pullImage(const std::string& client, const std::string& src, const boost::filesystem::path& dst_dir,
-                        const boost::filesystem::path& shared_blob_dir, int max_parallel_pulls = -1,
-                        const std::string& format = "v2s2");
+  static std::string getPullImageCmd(const std::string& client, const std::string& src,
+                                     const boost::filesystem::path& dst_dir,
+                                     const boost::filesystem::path& shared_blob_dir, int max_parallel_pulls = -1,
+                                     const std::string& format = "v2s2");
 
   static void installImage(const std::string& client, const boost::filesystem::path& image_dir,
                            const boost::filesystem::path& shared_blob_dir, const std::string& docker_host,
@@ -169,16 +306,12 @@ class RestorableAppEngine : public AppEngine {
                               const std::string& flags = "up --remove-orphans -d");
 
   static void stopComposeApp(const std::string& compose_cmd, const boost::filesystem::path& app_dir);
-  static std::string getContentHash(const boost::filesystem::path& path);
+  static std::string getComposeFileHash(const std::string& compose);
 
-  static uint64_t getAppUpdateSize(const Json::Value& app_layers, const boost::filesystem::path& blob_dir);
+  static UpdateBlobs getAppUpdateBlobs(const Json::Value& app_layers, const boost::filesystem::path& blob_dir);
   static uint64_t getDockerStoreSizeForAppUpdate(const uint64_t& compressed_update_size,
                                                  uint32_t average_compression_ratio);
-  static std::tuple<uint64_t, uint64_t> getPreciseAppUpdateSize(const Json::Value& app_layers,
-                                                                const boost::filesystem::path& blob_dir);
-
-  void checkAvailableStorageInStores(const std::string& app_name, const uint64_t& skopeo_required_storage,
-                                     const uint64_t& docker_required_storage) const;
+  static UpdateBlobs getPreciseAppUpdateBlobs(const Json::Value& app_layers, const boost::filesystem::path& blob_dir);
 
   static std::tuple<uint64_t, bool> getPathVolumeID(const boost::filesystem::path& path);
   static std::string extractComposeFile(const boost::filesystem::path& archive_path);
@@ -192,6 +325,10 @@ class RestorableAppEngine : public AppEngine {
   const std::string compose_cmd_;
   const boost::filesystem::path apps_root_{store_root_ / "apps"};
   const boost::filesystem::path blobs_root_{store_root_ / "blobs"};
+  // Spares re-hashing of the store files that haven't been changed since they were verified
+  mutable VerifiedBlobIndex blob_index_{store_root_ / VerifiedBlobIndex::FileName};
+  // The store blobs referred to by each App version, so the unused blobs are found without walking the App dirs
+  BlobRefTable blob_refs_{store_root_ / BlobRefTable::FileName};
   Docker::RegistryClient::Ptr registry_client_;
   Docker::DockerClient::Ptr docker_client_;
   StorageSpaceFunc storage_space_func_;
@@ -199,6 +336,22 @@ class RestorableAppEngine : public AppEngine {
   bool create_containers_if_install_;
   bool offline_;
   int max_parallel_pulls_{-1};
+  // Load App images to the docker store as soon as they are pulled instead of doing it at App install
+  bool load_images_on_fetch_{false};
+  // The time limit of the unused blob removal by a prune, the blobs left over are removed by the next prune
+  std::chrono::milliseconds prune_time_budget_{0};
+  ExecPool::Ptr exec_pool_;
+  // Installs the App files extracted to the store by cloning or hard-linking them if the file systems allow it
+  TreeInstaller tree_installer_;
+  // Pulls App images in-process instead of spawning `skopeo copy`, set only if the native pull is enabled
+  std::unique_ptr<ImagePuller> image_puller_;
+
+  mutable std::mutex fetch_mutex_;
+  mutable int fetches_in_progress_{0};
+  mutable uint64_t reserved_store_storage_{0};
+  mutable uint64_t reserved_docker_storage_{0};
+  // the number of reservations of each blob being downloaded by fetches in progress
+  mutable std::unordered_map<std::string, int> reserved_blobs_;
 };
 
 }  // namespace Docker
@@ -0,0 +1,168 @@
+#include "treeinstaller.h"
+
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+namespace Docker {
+
+bool TreeInstaller::canClone(const boost::filesystem::path& src_dir, const boost::filesystem::path& dst_dir) {
+  const auto volumes{getVolumes(src_dir, dst_dir)};
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    const auto found{can_clone_.find(volumes)};
+    if (found != can_clone_.end()) {
+      return found->second;
+    }
+  }
+  static const std::string ProbeFile{".aklite-clone-probe"};
+  const auto src{src_dir / ProbeFile};
+  const auto dst{dst_dir / ProbeFile};
+  boost::filesystem::remove(dst);
+  Utils::writeFile(src, std::string("probe"), false);
+  struct stat st {};
+  bool cloned{false};
+  try {
+    if (::stat(src.c_str(), &st) != 0) {
+      throw std::runtime_error("Failed to stat " + src.string() + ": " + std::strerror(errno));
+    }
+    cloned = cloneFile(src, dst, st);
+  } catch (...) {
+    boost::filesystem::remove(src);
+    throw;
+  }
+  boost::filesystem::remove(src);
+  boost::filesystem::remove(dst);
+  LOG_DEBUG << "Files " << (cloned ? "can" : "cannot") << " be cloned from " << src_dir << " to " << dst_dir;
+  setCanClone(volumes, cloned);
+  return cloned;
+}
+
+void TreeInstaller::install(const boost::filesystem::path& src_dir, const boost::filesystem::path& dst_dir) {
+  boost::filesystem::create_directories(dst_dir);
+  const auto volumes{getVolumes(src_dir, dst_dir)};
+
+  std::map<Method, int> installed;
+  std::vector<std::pair<boost::filesystem::path, struct stat>> dirs;
+  for (boost::filesystem::recursive_directory_iterator it{src_dir}, end; it != end; ++it) {
+    const auto& src{it->path()};
+    const auto dst{dst_dir / src.lexically_relative(src_dir)};
+    struct stat st {};
+    if (::lstat(src.c_str(), &st) != 0) {
+      throw std::runtime_error("Failed to stat " + src.string() + ": " + std::strerror(errno));
+    }
+    if (S_ISDIR(st.st_mode)) {
+      boost::filesystem::create_directories(dst);
+      dirs.emplace_back(dst, st);
+    } else if (S_ISLNK(st.st_mode)) {
+      boost::filesystem::remove(dst);
+      boost::filesystem::copy_symlink(src, dst);
+    } else if (S_ISREG(st.st_mode)) {
+      ++installed[installFile(src, dst, st, volumes)];
+    } else {
+      LOG_WARNING << "Skipping a special file: " << src;
+    }
+  }
+  // the directory attributes are set after their content is installed, so a read-only directory can be populated too
+  for (auto dir = dirs.rbegin(); dir != dirs.rend(); ++dir) {
+    setAttributes(dir->first, dir->second);
+  }
+  LOG_DEBUG << "Installed " << dst_dir << "; cloned: " << installed[Method::Clone]
+            << ", copied: " << installed[Method::Copy];
+}
+
+TreeInstaller::Volumes TreeInstaller::getVolumes(const boost::filesystem::path& src_dir,
+                                                 const boost::filesystem::path& dst_dir) {
+  struct stat src_dir_st {};
+  struct stat dst_dir_st {};
+  if (::stat(src_dir.c_str(), &src_dir_st) != 0 || ::stat(dst_dir.c_str(), &dst_dir_st) != 0) {
+    throw std::runtime_error("Failed to stat " + src_dir.string() + " or " + dst_dir.string() + ": " +
+                             std::strerror(errno));
+  }
+  return {src_dir_st.st_dev, dst_dir_st.st_dev};
+}
+
+TreeInstaller::Method TreeInstaller::installFile(const boost::filesystem::path& src,
+                                                 const boost::filesystem::path& dst, const struct stat& st,
+                                                 const Volumes& volumes) {
+  // the installed file is replaced rather than written to, like `tar` does it
+  boost::filesystem::remove(dst);
+
+  if (canClone(volumes)) {
+    if (cloneFile(src, dst, st)) {
+      return Method::Clone;
+    }
+    LOG_INFO << "Files cannot be cloned from " << src.parent_path() << " to " << dst.parent_path()
+             << ", falling back to copying them";
+    setCanClone(volumes, false);
+  }
+  copyFile(src, dst, st);
+  return Method::Copy;
+}
+
+bool TreeInstaller::canClone(const Volumes& volumes) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  const auto found{can_clone_.find(volumes)};
+  return found == can_clone_.end() || found->second;
+}
+
+void TreeInstaller::setCanClone(const Volumes& volumes, bool can_clone) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  can_clone_[volumes] = can_clone;
+}
+
+bool TreeInstaller::cloneFile(const boost::filesystem::path& src, const boost::filesystem::path& dst,
+                              const struct stat& st) {
+  const int src_fd{::open(src.c_str(), O_RDONLY | O_CLOEXEC)};
+  if (src_fd < 0) {
+    throw std::runtime_error("Failed to open " + src.string() + ": " + std::strerror(errno));
+  }
+  const int dst_fd{::open(dst.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 07777)};
+  if (dst_fd < 0) {
+    const auto err{errno};
+    ::close(src_fd);
+    throw std::runtime_error("Failed to create " + dst.string() + ": " + std::strerror(err));
+  }
+  const bool cloned{::ioctl(dst_fd, FICLONE, src_fd) == 0};
+  const auto err{errno};
+  ::close(src_fd);
+  if (!cloned) {
+    ::close(dst_fd);
+    ::unlink(dst.c_str());
+    // EXDEV, EOPNOTSUPP, EINVAL or ENOTTY if the file systems don't support cloning, anything else is a failure
+    if (err != EXDEV && err != EOPNOTSUPP && err != EINVAL && err != ENOTTY && err != ENOSYS) {
+      throw std::runtime_error("Failed to clone " + src.string() + ": " + std::strerror(err));
+    }
+    return false;
+  }
+  ::close(dst_fd);
+  setAttributes(dst, st);
+  return true;
+}
+
+void TreeInstaller::copyFile(const boost::filesystem::path& src, const boost::filesystem::path& dst,
+                             const struct stat& st) {
+  boost::filesystem::copy_file(src, dst);
+  setAttributes(dst, st);
+}
+
+void TreeInstaller::setAttributes(const boost::filesystem::path& file, const struct stat& st) {
+  // restore the attributes `tar` restores on extraction, the owner can be changed only by root, just like with `tar`
+  const struct timespec times[2]{st.st_atim, st.st_mtim};
+  if (::chown(file.c_str(), st.st_uid, st.st_gid) != 0 && geteuid() == 0) {
+    LOG_WARNING << "Failed to set the owner of " << file << ": " << std::strerror(errno);
+  }
+  if (::chmod(file.c_str(), st.st_mode & 07777) != 0 || ::utimensat(AT_FDCWD, file.c_str(), times, 0) != 0) {
+    throw std::runtime_error("Failed to set the attributes of " + file.string() + ": " + std::strerror(errno));
+  }
+}
+
+}  // namespace Docker
@@ -0,0 +1,55 @@
+#ifndef AKTUALIZR_LITE_DOCKER_TREE_INSTALLER_H_
+#define AKTUALIZR_LITE_DOCKER_TREE_INSTALLER_H_
+
+#include <sys/stat.h>
+
+#include <map>
+#include <mutex>
+#include <utility>
+
+#include <boost/filesystem.hpp>
+
+namespace Docker {
+
+/**
+ * @brief TreeInstaller, installs a file tree from the reset-apps store to the compose-apps dir with the least I/O
+ *
+ * A regular file is installed as a copy-on-write clone (FICLONE), no data is copied, and the installed file can be
+ * modified safely. The file is copied if it cannot be cloned. Whether the files can be cloned between two volumes is
+ * detected by a probe file or by the first file installed between them, the result is cached for the lifetime of the
+ * installer.
+ *
+ * The installed files are replaced, not written to. The files of the destination tree that are not in the source tree
+ * are kept intact, like `tar --overwrite`.
+ */
+class TreeInstaller {
+ public:
+  enum class Method { Clone, Copy };
+
+  // Returns true if the files can be cloned from `src_dir` to `dst_dir`, both dirs must exist. The first call for two
+  // volumes clones a probe file between the dirs. Throws std::runtime_error on failure.
+  bool canClone(const boost::filesystem::path& src_dir, const boost::filesystem::path& dst_dir);
+  // Throws boost::filesystem::filesystem_error or std::runtime_error on failure
+  void install(const boost::filesystem::path& src_dir, const boost::filesystem::path& dst_dir);
+
+ private:
+  using Volumes = std::pair<dev_t, dev_t>;
+
+  Method installFile(const boost::filesystem::path& src, const boost::filesystem::path& dst, const struct stat& st,
+                     const Volumes& volumes);
+  static Volumes getVolumes(const boost::filesystem::path& src_dir, const boost::filesystem::path& dst_dir);
+  // Returns false if it's known that the files cannot be cloned between the volumes
+  bool canClone(const Volumes& volumes);
+  void setCanClone(const Volumes& volumes, bool can_clone);
+  // Returns false if the file system doesn't support cloning
+  static bool cloneFile(const boost::filesystem::path& src, const boost::filesystem::path& dst, const struct stat& st);
+  static void copyFile(const boost::filesystem::path& src, const boost::filesystem::path& dst, const struct stat& st);
+  static void setAttributes(const boost::filesystem::path& file, const struct stat& st);
+
+  std::mutex mutex_;
+  std::map<Volumes, bool> can_clone_;
+};
+
+}  // namespace Docker
+
+#endif  // AKTUALIZR_LITE_DOCKER_TREE_INSTALLER_H_
@@ -0,0 +1,245 @@
+#include "downloadscheduler.h"
+
+#include <thread>
+
+#include "logging/logging.h"
+
+DownloadScheduler::Transfer::Transfer(DownloadScheduler& scheduler, Class cls)
+    : scheduler_{scheduler}, cls_{cls}, background_{scheduler.startTransfer(cls)} {}
+
+DownloadScheduler::Transfer::~Transfer() { scheduler_.finishTransfer(cls_, background_); }
+
+bool DownloadScheduler::Transfer::paused() const { return scheduler_.paused(cls_, background_); }
+
+void DownloadScheduler::Transfer::consume(std::size_t size) { std::this_thread::sleep_until(scheduler_.reserve(size)); }
+
+void DownloadScheduler::Transfer::wait() { scheduler_.waitWhilePaused(cls_, background_); }
+
+void DownloadScheduler::Transfer::account(std::size_t size) { scheduler_.reserve(size); }
+
+void DownloadScheduler::Transfer::refund(std::size_t size) { scheduler_.release(size); }
+
+CurlHandler* DownloadScheduler::CurlPause::handle() {
+  handle_.reset();
+  paused_ = false;
+  let_through_ = false;
+  return &handle_;
+}
+
+bool DownloadScheduler::CurlPause::pause() {
+  if (let_through_) {
+    let_through_ = false;
+    return false;
+  }
+  if (handle_ == nullptr || !transfer_.paused()) {
+    return false;
+  }
+  paused_ = true;
+  paused_at_ = std::chrono::steady_clock::now();
+  return true;
+}
+
+void DownloadScheduler::CurlPause::resume() {
+  if (!paused_) {
+    return;
+  }
+  const bool expired{std::chrono::steady_clock::now() - paused_at_ >= MaxPause};
+  if (!expired && transfer_.paused()) {
+    return;
+  }
+  if (expired) {
+    LOG_DEBUG << "A transfer has been paused for " << MaxPause.count() << " seconds, letting it through";
+    let_through_ = true;
+  }
+  paused_ = false;
+  // curl passes the held data to the write callback before it returns, which may pause the transfer again
+  curl_easy_pause(handle_.get(), CURLPAUSE_CONT);
+}
+
+DownloadScheduler::Session::Session(DownloadScheduler& scheduler, bool background)
+    : scheduler_{scheduler}, background_{background} {
+  scheduler_.startSession(background_);
+}
+
+DownloadScheduler::Session::~Session() { scheduler_.finishSession(background_); }
+
+DownloadScheduler& DownloadScheduler::instance() {
+  static DownloadScheduler scheduler;
+  return scheduler;
+}
+
+void DownloadScheduler::setMaxRate(uint64_t max_rate) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  max_rate_ = max_rate;
+}
+
+bool DownloadScheduler::startTransfer(Class cls) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  const bool background{background_sessions_ > 0 && foreground_sessions_ == 0};
+  ++(background ? background_transfers_ : foreground_transfers_)[static_cast<std::size_t>(cls)];
+  return background;
+}
+
+void DownloadScheduler::finishTransfer(Class cls, bool background) {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    --(background ? background_transfers_ : foreground_transfers_)[static_cast<std::size_t>(cls)];
+  }
+  cv_.notify_all();
+}
+
+void DownloadScheduler::startSession(bool background) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  ++(background ? background_sessions_ : foreground_sessions_);
+}
+
+void DownloadScheduler::finishSession(bool background) {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    --(background ? background_sessions_ : foreground_sessions_);
+  }
+  cv_.notify_all();
+}
+
+bool DownloadScheduler::isPaused(Class cls, bool background) const {
+  if (background && foreground_sessions_ > 0) {
+    return true;
+  }
+  for (std::size_t more_urgent = 0; more_urgent < static_cast<std::size_t>(cls); ++more_urgent) {
+    if (foreground_transfers_[more_urgent] > 0 ||
+        (foreground_sessions_ == 0 && background_transfers_[more_urgent] > 0)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool DownloadScheduler::paused(Class cls, bool background) const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  return isPaused(cls, background);
+}
+
+void DownloadScheduler::waitWhilePaused(Class cls, bool background) {
+  std::unique_lock<std::mutex> lock{mutex_};
+  if (!cv_.wait_for(lock, MaxPause, [this, cls, background]() { return !isPaused(cls, background); })) {
+    LOG_DEBUG << "A transfer has been paused for " << MaxPause.count() << " seconds, letting it through";
+  }
+}
+
+std::chrono::steady_clock::time_point DownloadScheduler::reserve(std::size_t size) {
+  const auto now{std::chrono::steady_clock::now()};
+  std::lock_guard<std::mutex> lock{mutex_};
+  if (max_rate_ == 0) {
+    return now;
+  }
+  // the data takes its time slot after the data of the previous transfers, the unused time is not saved up
+  next_slot_ = std::max(now, next_slot_) + transferTime(size);
+  return next_slot_;
+}
+
+void DownloadScheduler::release(std::size_t size) {
+  const auto now{std::chrono::steady_clock::now()};
+  std::lock_guard<std::mutex> lock{mutex_};
+  if (max_rate_ == 0 || next_slot_ <= now) {
+    return;
+  }
+  next_slot_ = std::max(now, next_slot_ - transferTime(size));
+}
+
+std::chrono::steady_clock::duration DownloadScheduler::transferTime(std::size_t size) const {
+  return std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double>(static_cast<double>(size) / static_cast<double>(max_rate_)));
+}
+
+namespace {
+
+struct ScheduledDownloadCtx {
+  ScheduledDownloadCtx(DownloadScheduler::Transfer& transfer_in, curl_write_callback write_cb_in,
+                       curl_xferinfo_callback progress_cb_in, void* userp_in)
+      : transfer{transfer_in}, write_cb{write_cb_in}, progress_cb{progress_cb_in}, userp{userp_in} {}
+
+  DownloadScheduler::Transfer& transfer;
+  DownloadScheduler::CurlPause pause{transfer};
+  curl_write_callback write_cb;
+  curl_xferinfo_callback progress_cb;
+  void* userp;
+};
+
+size_t ScheduledWriteHandler(char* data, size_t buf_size, size_t buf_numb, void* user_ctx) {
+  auto* ctx{reinterpret_cast<ScheduledDownloadCtx*>(user_ctx)};
+  if (ctx->pause.pause()) {
+    return CURL_WRITEFUNC_PAUSE;
+  }
+  ctx->transfer.consume(buf_size * buf_numb);
+  return ctx->write_cb(data, buf_size, buf_numb, ctx->userp);
+}
+
+int ScheduledProgressHandler(void* user_ctx, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal,
+                             curl_off_t ulnow) {
+  auto* ctx{reinterpret_cast<ScheduledDownloadCtx*>(user_ctx)};
+  ctx->pause.resume();
+  return ctx->progress_cb != nullptr ? ctx->progress_cb(ctx->userp, dltotal, dlnow, ultotal, ulnow) : 0;
+}
+
+}  // namespace
+
+ScheduledHttpClient::ScheduledHttpClient(std::shared_ptr<HttpInterface> client, DownloadScheduler::Class cls,
+                                         DownloadScheduler& scheduler)
+    : client_{std::move(client)}, cls_{cls}, scheduler_{scheduler} {}
+
+HttpResponse ScheduledHttpClient::get(const std::string& url, int64_t maxsize) {
+  return perform(0, [&]() { return client_->get(url, maxsize); });
+}
+
+HttpResponse ScheduledHttpClient::download(const std::string& url, curl_write_callback write_cb,
+                                           curl_xferinfo_callback progress_cb, void* userp, curl_off_t from) {
+  DownloadScheduler::Transfer transfer{scheduler_, cls_};
+  transfer.wait();
+  ScheduledDownloadCtx ctx{transfer, write_cb, progress_cb, userp};
+  // the download is started by `downloadAsync()` for its handle, so it can be paused once it is in progress
+  return client_->downloadAsync(url, ScheduledWriteHandler, ScheduledProgressHandler, &ctx, from, ctx.pause.handle())
+      .get();
+}
+
+// The transfer cannot be paused or cancelled by the curl handler, it just runs in another thread
+std::future<HttpResponse> ScheduledHttpClient::downloadAsync(const std::string& url, curl_write_callback write_cb,
+                                                             curl_xferinfo_callback progress_cb, void* userp,
+                                                             curl_off_t from, CurlHandler* easyp) {
+  (void)easyp;
+  auto self{shared_from_this()};
+  return std::async(std::launch::async, [self, url, write_cb, progress_cb, userp, from]() {
+    return self->download(url, write_cb, progress_cb, userp, from);
+  });
+}
+
+HttpResponse ScheduledHttpClient::post(const std::string& url, const std::string& content_type,
+                                       const std::string& data) {
+  return perform(data.size(), [&]() { return client_->post(url, content_type, data); });
+}
+
+HttpResponse ScheduledHttpClient::post(const std::string& url, const Json::Value& data) {
+  return perform(0, [&]() { return client_->post(url, data); });
+}
+
+HttpResponse ScheduledHttpClient::put(const std::string& url, const std::string& content_type,
+                                      const std::string& data) {
+  return perform(data.size(), [&]() { return client_->put(url, content_type, data); });
+}
+
+HttpResponse ScheduledHttpClient::put(const std::string& url, const Json::Value& data) {
+  return perform(0, [&]() { return client_->put(url, data); });
+}
+
+void ScheduledHttpClient::setCerts(const std::string& ca, CryptoSource ca_source, const std::string& cert,
+                                   CryptoSource cert_source, const std::string& pkey, CryptoSource pkey_source) {
+  client_->setCerts(ca, ca_source, cert, cert_source, pkey, pkey_source);
+}
+
+template <typename Request>
+HttpResponse ScheduledHttpClient::perform(std::size_t sent_size, Request&& request) {
+  DownloadScheduler::Transfer transfer{scheduler_, cls_};
+  transfer.wait();
+  auto resp{request()};
+  transfer.account(sent_size + resp.body.size());
+  return resp;
+}
@@ -0,0 +1,166 @@
+#ifndef AKTUALIZR_LITE_DOWNLOAD_SCHEDULER_H_
+#define AKTUALIZR_LITE_DOWNLOAD_SCHEDULER_H_
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+
+#include "http/httpinterface.h"
+
+/**
+ * @brief DownloadScheduler, shares the device's link among the transfers of the process by their priority
+ *
+ * Each transfer is registered with its class. A transfer yields to the transfers of the more urgent classes: it is
+ * paused while any of them is in progress, so on a constrained link the critical path completes first instead of
+ * sharing the bandwidth evenly. The transfers started by a background session, e.g. a prefetch, are paused while a
+ * foreground session is in progress, e.g. a user-initiated install. All transfers share the rate limit, if set.
+ *
+ * A download in progress is paused by curl, see `CurlPause`, so its callbacks are not blocked while it is held. The
+ * request-level transfers, e.g. a metadata fetch or a report upload, are held before they are sent and their size is
+ * accounted once they complete. A paused transfer is still let through once in a while, so it can't be held forever.
+ */
+class DownloadScheduler {
+ public:
+  // The transfer classes, from the most to the least urgent
+  enum class Class { Metadata = 0, Ostree, AppBlob, Report };
+  // The maximum time a transfer is paused for at once
+  static constexpr std::chrono::seconds MaxPause{30};
+
+  class Transfer {
+   public:
+    Transfer(DownloadScheduler& scheduler, Class cls);
+    ~Transfer();
+    Transfer(const Transfer&) = delete;
+    Transfer& operator=(const Transfer&) = delete;
+    Transfer(Transfer&&) = delete;
+    Transfer& operator=(Transfer&&) = delete;
+
+    // Returns whether the transfer is to be paused now
+    bool paused() const;
+    // Blocks until the rate limit allows for the received data.
+    // Called with the data already received, so it holds the receipt of the following data.
+    void consume(std::size_t size);
+    // Blocks while the transfer is paused, e.g. before a request is sent
+    void wait();
+    // Accounts the data transferred by a request, it delays the following transfers if the rate is limited
+    void account(std::size_t size);
+    // Gives back the rate taken by the consumed data that has been discarded, e.g. the body of an error response
+    void refund(std::size_t size);
+
+   private:
+    DownloadScheduler& scheduler_;
+    const Class cls_;
+    const bool background_;
+  };
+
+  // Pauses a curl transfer while the scheduler transfer is paused. The write callback asks whether to pause before it
+  // takes the data and returns CURL_WRITEFUNC_PAUSE then, so curl holds the data. The progress callback resumes the
+  // transfer once it is let through. The transfer whose handle is unknown is not paused once it is started.
+  // Its methods are called by the thread running the curl transfer, except `handle()`.
+  class CurlPause {
+   public:
+    explicit CurlPause(Transfer& transfer) : transfer_{transfer} {}
+
+    // The handle to be set by `HttpInterface::downloadAsync()` for the following request
+    CurlHandler* handle();
+    // Returns whether the write callback is to pause the transfer instead of taking the data
+    bool pause();
+    // Resumes the paused transfer if it is let through, called by the progress callback
+    void resume();
+
+   private:
+    Transfer& transfer_;
+    CurlHandler handle_;
+    bool paused_{false};
+    // the data held by a transfer let through after MaxPause is taken even if the transfer is still to be paused
+    bool let_through_{false};
+    std::chrono::steady_clock::time_point paused_at_;
+  };
+
+  // A download or installation, the transfers started while just the background sessions are in progress are
+  // background ones
+  class Session {
+   public:
+    Session(DownloadScheduler& scheduler, bool background);
+    ~Session();
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+    Session(Session&&) = delete;
+    Session& operator=(Session&&) = delete;
+
+   private:
+    DownloadScheduler& scheduler_;
+    const bool background_;
+  };
+
+  // The scheduler shared by all transfers of the process
+  static DownloadScheduler& instance();
+
+  DownloadScheduler() = default;
+  // The total rate of all transfers in bytes per second, 0 - unlimited
+  void setMaxRate(uint64_t max_rate);
+
+ private:
+  static constexpr std::size_t ClassNumber{static_cast<std::size_t>(Class::Report) + 1};
+
+  // Returns whether the transfer is a background one
+  bool startTransfer(Class cls);
+  void finishTransfer(Class cls, bool background);
+  void startSession(bool background);
+  void finishSession(bool background);
+  // Expects the mutex to be locked
+  bool isPaused(Class cls, bool background) const;
+  bool paused(Class cls, bool background) const;
+  void waitWhilePaused(Class cls, bool background);
+  // Returns the time the given data fits in the rate limit at
+  std::chrono::steady_clock::time_point reserve(std::size_t size);
+  void release(std::size_t size);
+  // Expects the mutex to be locked
+  std::chrono::steady_clock::duration transferTime(std::size_t size) const;
+
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  uint64_t max_rate_{0};
+  std::chrono::steady_clock::time_point next_slot_;
+  // the transfers in progress by class, the background ones don't count while they are paused
+  std::array<int, ClassNumber> foreground_transfers_{};
+  std::array<int, ClassNumber> background_transfers_{};
+  int foreground_sessions_{0};
+  int background_sessions_{0};
+};
+
+/**
+ * @brief ScheduledHttpClient, makes the requests of an HTTP client as the scheduler transfers of the given class
+ */
+class ScheduledHttpClient : public HttpInterface, public std::enable_shared_from_this<ScheduledHttpClient> {
+ public:
+  ScheduledHttpClient(std::shared_ptr<HttpInterface> client, DownloadScheduler::Class cls,
+                      DownloadScheduler& scheduler = DownloadScheduler::instance());
+
+  HttpResponse get(const std::string& url, int64_t maxsize) override;
+  HttpResponse download(const std::string& url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                        void* userp, curl_off_t from) override;
+  std::future<HttpResponse> downloadAsync(const std::string& url, curl_write_callback write_cb,
+                                          curl_xferinfo_callback progress_cb, void* userp, curl_off_t from,
+                                          CurlHandler* easyp) override;
+  HttpResponse post(const std::string& url, const std::string& content_type, const std::string& data) override;
+  HttpResponse post(const std::string& url, const Json::Value& data) override;
+  HttpResponse put(const std::string& url, const std::string& content_type, const std::string& data) override;
+  HttpResponse put(const std::string& url, const Json::Value& data) override;
+  void setCerts(const std::string& ca, CryptoSource ca_source, const std::string& cert, CryptoSource cert_source,
+                const std::string& pkey, CryptoSource pkey_source) override;
+
+ private:
+  template <typename Request>
+  HttpResponse perform(std::size_t sent_size, Request&& request);
+
+  const std::shared_ptr<HttpInterface> client_;
+  const DownloadScheduler::Class cls_;
+  DownloadScheduler& scheduler_;
+};
+
+#endif  // AKTUALIZR_LITE_DOWNLOAD_SCHEDULER_H_
@@ -1,73 +1,593 @@
 #include "exec.h"
 
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstring>
+
+#include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/format.hpp>
 
 #include "logging/logging.h"
 
-void exec(const std::string& cmd, const std::string& err_msg_prefix, const boost::filesystem::path& start_dir,
-          std::string* output, const std::string& timeout, bool print_output) {
-  std::string command;
+extern char** environ;
 
-  if (print_output) {
-    setvbuf(stdout, NULL, _IOLBF, 0);
+static std::vector<std::string> makeEnv(const std::vector<std::string>& extra) {
+  std::vector<std::string> env;
+  for (char** var = environ; var != nullptr && *var != nullptr; ++var) {
+    const std::string entry{*var};
+    const auto name{entry.substr(0, entry.find('='))};
+    const bool overridden{std::any_of(extra.begin(), extra.end(), [&name](const std::string& e) {
+      return e.size() > name.size() && e.compare(0, name.size(), name) == 0 && e[name.size()] == '=';
+    })};
+    if (!overridden) {
+      env.emplace_back(entry);
+    }
   }
+  env.insert(env.end(), extra.begin(), extra.end());
+  return env;
+}
 
-  if (print_output && isatty(STDOUT_FILENO)) {
-    command = "PARENT_HAS_TTY=1 ";
+static std::vector<char*> toCStrArray(const std::vector<std::string>& strs) {
+  std::vector<char*> res;
+  res.reserve(strs.size() + 1);
+  for (const auto& str : strs) {
+    res.push_back(const_cast<char*>(str.c_str()));
   }
+  res.push_back(nullptr);
+  return res;
+}
 
-  if (!timeout.empty()) {
-    command += "timeout " + timeout + " ";
+static int openPidFd(pid_t pid) {
+#ifdef SYS_pidfd_open
+  // pidfd_open(2) is available since Linux 5.3, the caller falls back to waitpid() polling if it fails
+  return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+  (void)pid;
+  return -1;
+#endif
+}
+
+Process::Process(std::vector<std::string> args, Options options)
+    : args_{std::move(args)}, options_{std::move(options)} {
+  if (args_.empty()) {
+    throw std::invalid_argument("cannot run a process, no command is specified");
+  }
+
+  // all pipes are created before the child is spawned, so a failure cannot leave the child running unattended
+  std::array<int, 2> out_pipe{-1, -1};
+  std::array<int, 2> err_pipe{-1, -1};
+  if (-1 == pipe2(out_pipe.data(), O_CLOEXEC) || -1 == pipe2(err_pipe.data(), O_CLOEXEC) ||
+      -1 == pipe2(wake_fds_, O_CLOEXEC | O_NONBLOCK)) {
+    const int err{errno};
+    for (const auto fd : {out_pipe[0], out_pipe[1], err_pipe[0], err_pipe[1]}) {
+      if (fd != -1) {
+        close(fd);
+      }
+    }
+    closeFds();
+    throw std::runtime_error(std::string("exec: pipe2() failed: ") + std::strerror(err));
   }
-  command += cmd + " 2>&1";
-  if (!start_dir.empty()) {
-    command = "cd " + start_dir.string() + " && " + command;
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDOUT_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, err_pipe[1], STDERR_FILENO);
+  if (!options_.start_dir.empty()) {
+    posix_spawn_file_actions_addchdir_np(&actions, options_.start_dir.c_str());
   }
 
-  LOG_DEBUG << "Running: `" << command << "`";
-  FILE* pipe = popen(command.c_str(), "r");
-  if (!pipe) {
-    throw std::runtime_error("exec: popen() failed!");
+  const auto env{makeEnv(options_.env)};
+  auto argv{toCStrArray(args_)};
+  auto envp{toCStrArray(env)};
+  // glibc's posix_spawn is implemented with clone(CLONE_VM | CLONE_VFORK), so no page tables are copied
+  const int err{posix_spawnp(&pid_, args_[0].c_str(), &actions, nullptr, argv.data(), envp.data())};
+  posix_spawn_file_actions_destroy(&actions);
+  close(out_pipe[1]);
+  close(err_pipe[1]);
+  if (err != 0) {
+    close(out_pipe[0]);
+    close(err_pipe[0]);
+    closeFds();
+    pid_ = -1;
+    const auto cmd{boost::algorithm::join(args_, " ")};
+    throw ExecError("failed to run command '" + args_[0] + "': " + std::strerror(err), cmd, std::strerror(err),
+                    err == ENOENT ? 127 : 126);
   }
-  std::string result;
-  try {
-    std::array<char, 128> buffer_array = {};
-    char* buffer = buffer_array.data();
-    while (std::fgets(buffer, sizeof(buffer_array), pipe) != nullptr) {
-      if (print_output) {
-        fputs(buffer, stdout);
+  out_fd_ = out_pipe[0];
+  err_fd_ = err_pipe[0];
+}
+
+Process::~Process() {
+  if (pid_ != -1) {
+    kill(pid_, SIGKILL);
+    waitpid(pid_, nullptr, 0);
+  }
+  closeFds();
+}
+
+void Process::terminate() {
+  terminate_requested_ = true;
+  if (wake_fds_[1] != -1) {
+    const char byte{0};
+    // the pipe is non-blocking, if it's full then wait() has been already woken up
+    (void)write(wake_fds_[1], &byte, 1);
+  }
+}
+
+void Process::closeFds() {
+  for (auto* fd : {&out_fd_, &err_fd_, &wake_fds_[0], &wake_fds_[1]}) {
+    if (*fd != -1) {
+      close(*fd);
+      *fd = -1;
+    }
+  }
+}
+
+int Process::wait() {
+  if (pid_ == -1) {
+    return exit_code_;
+  }
+
+  using Clock = std::chrono::steady_clock;
+  bool has_timeout{options_.timeout.count() > 0};
+  auto deadline{Clock::now() + options_.timeout};
+  bool terminated{false};
+  bool timed_out{false};
+  bool cancelled{false};
+  bool exited{false};
+  int status{0};
+
+  const int pid_fd{openPidFd(pid_)};
+  std::vector<char> buffer(ReadBufferSize);
+
+  const auto reap{[&](int flags) {
+    pid_t res;
+    while (-1 == (res = waitpid(pid_, &status, flags)) && errno == EINTR) {
+    }
+    if (res == pid_) {
+      exited = true;
+    }
+    return exited;
+  }};
+
+  // Reads one chunk from the given pipe, returns false on EOF
+  const auto read_chunk{[&](int fd, const OutputHandler& handler) {
+    const auto res{read(fd, buffer.data(), buffer.size())};
+    if (res < 0) {
+      return errno == EINTR || errno == EAGAIN;
+    }
+    if (res == 0) {
+      return false;
+    }
+    if (handler) {
+      handler(buffer.data(), static_cast<std::size_t>(res));
+    }
+    return true;
+  }};
+
+  while (!exited || out_fd_ != -1 || err_fd_ != -1) {
+    if (exited) {
+      // The child has exited, but its descendants may still hold the pipes; read what has already been written
+      // without waiting for them
+      for (auto* fd : {&out_fd_, &err_fd_}) {
+        if (*fd == -1) {
+          continue;
+        }
+        fcntl(*fd, F_SETFL, fcntl(*fd, F_GETFL) | O_NONBLOCK);
+        const auto& handler{fd == &out_fd_ ? options_.out_handler : options_.err_handler};
+        ssize_t res;
+        while ((res = read(*fd, buffer.data(), buffer.size())) > 0 || (res < 0 && errno == EINTR)) {
+          if (res > 0 && handler) {
+            handler(buffer.data(), static_cast<std::size_t>(res));
+          }
+        }
+        close(*fd);
+        *fd = -1;
+      }
+      break;
+    }
+
+    std::array<pollfd, 4> fds{};
+    nfds_t fds_num{0};
+    if (!terminated) {
+      fds[fds_num++] = {wake_fds_[0], POLLIN, 0};
+    }
+    if (out_fd_ != -1) {
+      fds[fds_num++] = {out_fd_, POLLIN, 0};
+    }
+    if (err_fd_ != -1) {
+      fds[fds_num++] = {err_fd_, POLLIN, 0};
+    }
+    if (pid_fd != -1) {
+      fds[fds_num++] = {pid_fd, POLLIN, 0};
+    }
+
+    int poll_timeout{-1};
+    if (has_timeout) {
+      const auto left{std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count()};
+      poll_timeout = static_cast<int>(std::max<int64_t>(left, 0));
+    }
+    if (pid_fd == -1 && out_fd_ == -1 && err_fd_ == -1) {
+      // no pidfd support and the child has closed its output, poll for its exit
+      poll_timeout = poll_timeout == -1 ? 100 : std::min(poll_timeout, 100);
+    }
+
+    const int poll_res{poll(fds.data(), fds_num, poll_timeout)};
+    if (poll_res < 0 && errno != EINTR) {
+      kill(pid_, SIGKILL);
+      reap(0);
+      throw std::runtime_error(std::string("exec: poll() failed: ") + std::strerror(errno));
+    }
+
+    if (!terminated && terminate_requested_) {
+      LOG_DEBUG << "Terminating child process on request; pid: " << pid_ << ", cmd: " << args_[0];
+      kill(pid_, SIGTERM);
+      terminated = cancelled = true;
+      has_timeout = true;
+      deadline = Clock::now() + KillGracePeriod;
+      continue;
+    }
+
+    if (has_timeout && Clock::now() >= deadline) {
+      if (!terminated) {
+        LOG_WARNING << "Child process has timed out, terminating it; pid: " << pid_ << ", cmd: " << args_[0];
+        kill(pid_, SIGTERM);
+        terminated = timed_out = true;
+        deadline = Clock::now() + KillGracePeriod;
+      } else {
+        kill(pid_, SIGKILL);
+        reap(0);
       }
-      result += buffer;
+      continue;
     }
 
-    if (output != nullptr) {
-      *output = result;
+    for (nfds_t ii = 0; poll_res > 0 && ii < fds_num; ++ii) {
+      if (fds[ii].revents == 0) {
+        continue;
+      }
+      if (fds[ii].fd == wake_fds_[0]) {
+        continue;
+      }
+      if (fds[ii].fd == pid_fd) {
+        reap(WNOHANG);
+      } else {
+        auto* fd{fds[ii].fd == out_fd_ ? &out_fd_ : &err_fd_};
+        if (!read_chunk(*fd, fd == &out_fd_ ? options_.out_handler : options_.err_handler)) {
+          close(*fd);
+          *fd = -1;
+        }
+      }
+    }
+    if (pid_fd == -1 && out_fd_ == -1 && err_fd_ == -1) {
+      reap(WNOHANG);
     }
-  } catch (const std::exception& e) {
-    pclose(pipe);
-    throw std::runtime_error(std::string("exec: ") + e.what());
   }
 
-  int status = pclose(pipe);
-  if (status == -1) {
-    throw std::runtime_error("exec: pclose() failed!");
+  if (pid_fd != -1) {
+    close(pid_fd);
   }
+  pid_ = -1;
 
-  int exit_code = WEXITSTATUS(status);
+  if (cancelled) {
+    throw ExecCancelledError();
+  }
+  if (timed_out) {
+    throw ExecTimeoutError();
+  }
+  exit_code_ = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+  return exit_code_;
+}
 
-  if (exit_code == 124) {
-    // `timeout` command return code indicating that a timeout has occured
-    throw std::runtime_error("Timeout occurred while waiting for a child process completion");
+std::chrono::milliseconds Process::parseTimeout(const std::string& timeout) {
+  if (timeout.empty()) {
+    return std::chrono::milliseconds{0};
+  }
+  std::size_t pos{0};
+  double value;
+  try {
+    value = std::stod(timeout, &pos);
+  } catch (const std::exception&) {
+    throw std::invalid_argument("invalid timeout value: " + timeout);
+  }
+  const auto suffix{timeout.substr(pos)};
+  double multiplier;
+  if (suffix.empty() || suffix == "s") {
+    multiplier = 1;
+  } else if (suffix == "m") {
+    multiplier = 60;
+  } else if (suffix == "h") {
+    multiplier = 3600;
+  } else if (suffix == "d") {
+    multiplier = 86400;
+  } else {
+    throw std::invalid_argument("invalid timeout value: " + timeout);
+  }
+  if (value < 0) {
+    throw std::invalid_argument("invalid timeout value: " + timeout);
+  }
+  return std::chrono::milliseconds{static_cast<int64_t>(value * multiplier * 1000)};
+}
+
+// Splits the command into arguments the way sh does it for a simple command: by whitespace, except inside single or
+// double quotes and after a backslash. The callers format the commands for the shell, e.g. boost::filesystem::path is
+// formatted in double quotes, so the quoting is honored. No expansion or redirection is done.
+static std::vector<std::string> splitCommand(const std::string& cmd) {
+  std::vector<std::string> args;
+  std::string arg;
+  bool in_arg{false};
+  for (std::size_t pos = 0; pos < cmd.size(); ++pos) {
+    const char ch{cmd[pos]};
+    if (ch == '\'') {
+      const auto end{cmd.find('\'', pos + 1)};
+      if (end == std::string::npos) {
+        throw std::invalid_argument("unterminated single quote in command: " + cmd);
+      }
+      arg.append(cmd, pos + 1, end - pos - 1);
+      pos = end;
+      in_arg = true;
+    } else if (ch == '"') {
+      for (++pos; pos < cmd.size() && cmd[pos] != '"'; ++pos) {
+        // inside double quotes a backslash escapes just the characters special to them
+        if (cmd[pos] == '\\' && pos + 1 < cmd.size() && std::strchr("\"\\$`", cmd[pos + 1]) != nullptr) {
+          ++pos;
+        }
+        arg.push_back(cmd[pos]);
+      }
+      if (pos == cmd.size()) {
+        throw std::invalid_argument("unterminated double quote in command: " + cmd);
+      }
+      in_arg = true;
+    } else if (ch == '\\' && pos + 1 < cmd.size()) {
+      arg.push_back(cmd[++pos]);
+      in_arg = true;
+    } else if (std::isspace(static_cast<unsigned char>(ch)) != 0) {
+      if (in_arg) {
+        args.emplace_back(std::move(arg));
+        arg.clear();
+        in_arg = false;
+      }
+    } else {
+      arg.push_back(ch);
+      in_arg = true;
+    }
+  }
+  if (in_arg) {
+    args.emplace_back(std::move(arg));
+  }
+  return args;
+}
+
+// `on_spawn` is called with the spawned process and with nullptr once it has been reaped,
+// `output_handler` is given stdout chunks as soon as they are read
+static void execCmd(std::vector<std::string> args, const std::string& err_msg_prefix,
+                    const boost::filesystem::path& start_dir, std::string* output, const std::string& timeout,
+                    bool print_output, const std::function<void(Process*)>& on_spawn = nullptr,
+                    const Process::OutputHandler& output_handler = nullptr) {
+  const auto cmd{boost::algorithm::join(args, " ")};
+
+  Process::Options options;
+  options.start_dir = start_dir;
+  options.timeout = Process::parseTimeout(timeout);
+  if (print_output && isatty(STDOUT_FILENO)) {
+    options.env.emplace_back("PARENT_HAS_TTY=1");
+  }
+
+  // The stdout and stderr data are merged in the order they are read, as a shell's `2>&1` does it, the callers get
+  // the diagnostic output along with the regular one, both in the output and in the error message
+  std::string out;
+  options.out_handler = [&out, print_output, &output_handler](const char* data, std::size_t size) {
+    if (print_output) {
+      fwrite(data, 1, size, stdout);
+      fflush(stdout);
+    }
+    if (output_handler) {
+      output_handler(data, size);
+    }
+    out.append(data, size);
+  };
+  options.err_handler = [&out, print_output](const char* data, std::size_t size) {
+    if (print_output) {
+      fwrite(data, 1, size, stderr);
+    }
+    out.append(data, size);
+  };
+
+  LOG_DEBUG << "Running: `" << cmd << "`" << (start_dir.empty() ? "" : " in " + start_dir.string());
+  Process proc{std::move(args), std::move(options)};
+  int exit_code;
+  if (on_spawn) {
+    on_spawn(&proc);
+    try {
+      exit_code = proc.wait();
+    } catch (...) {
+      on_spawn(nullptr);
+      throw;
+    }
+    on_spawn(nullptr);
+  } else {
+    exit_code = proc.wait();
   }
   LOG_DEBUG << "Command exited with code " << exit_code;
 
+  if (output != nullptr) {
+    *output = out;
+  }
   if (exit_code != EXIT_SUCCESS) {
-    throw ExecError(err_msg_prefix, cmd, result, exit_code);
+    throw ExecError(err_msg_prefix, cmd, out, exit_code);
   }
 }
 
+void exec(const std::string& cmd, const std::string& err_msg_prefix, const boost::filesystem::path& start_dir,
+          std::string* output, const std::string& timeout, bool print_output) {
+  execCmd(splitCommand(cmd), err_msg_prefix, start_dir, output, timeout, print_output);
+}
+
+void exec(const std::vector<std::string>& args, const std::string& err_msg_prefix,
+          const boost::filesystem::path& start_dir, std::string* output, const std::string& timeout,
+          bool print_output) {
+  execCmd(args, err_msg_prefix, start_dir, output, timeout, print_output);
+}
+
 void exec(const boost::format& cmd, const std::string& err_msg, const boost::filesystem::path& start_dir,
           std::string* output, const std::string& timeout, bool print_output) {
   exec(cmd.str(), err_msg, start_dir, output, timeout, print_output);
 }
+
+struct ExecPool::Job::State {
+  std::string cmd;
+  std::string err_msg_prefix;
+  boost::filesystem::path start_dir;
+  std::string timeout;
+  bool print_output;
+  Process::OutputHandler output_handler;
+  std::function<void()> done_handler;
+  std::promise<std::string> promise;
+
+  std::mutex mutex;
+  bool cancelled{false};
+  Process* proc{nullptr};
+
+  void cancel() {
+    std::lock_guard<std::mutex> lock{mutex};
+    cancelled = true;
+    if (proc != nullptr) {
+      proc->terminate();
+    }
+  }
+
+  void run() {
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      if (cancelled) {
+        setError(std::make_exception_ptr(ExecCancelledError()));
+        return;
+      }
+    }
+    try {
+      std::string output;
+      execCmd(
+          splitCommand(cmd), err_msg_prefix, start_dir, &output, timeout, print_output,
+          [this](Process* spawned) {
+            std::lock_guard<std::mutex> lock{mutex};
+            proc = spawned;
+            if (proc != nullptr && cancelled) {
+              proc->terminate();
+            }
+          },
+          output_handler);
+      promise.set_value(output);
+    } catch (...) {
+      promise.set_exception(std::current_exception());
+    }
+    if (done_handler) {
+      done_handler();
+    }
+  }
+
+  void setError(const std::exception_ptr& err) {
+    promise.set_exception(err);
+    if (done_handler) {
+      done_handler();
+    }
+  }
+};
+
+void ExecPool::Job::cancel() {
+  if (state_) {
+    state_->cancel();
+  }
+}
+
+ExecPool::ExecPool(std::size_t max_jobs) : max_jobs_{max_jobs} {
+  if (max_jobs == 0) {
+    throw std::invalid_argument("the maximum number of jobs must be greater than zero");
+  }
+  workers_.reserve(max_jobs);
+}
+
+ExecPool::~ExecPool() {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    stopped_ = true;
+  }
+  cancelAll();
+  cv_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+ExecPool::Job ExecPool::submit(std::string cmd, std::string err_msg_prefix, boost::filesystem::path start_dir,
+                               std::string timeout, bool print_output, Process::OutputHandler output_handler,
+                               std::function<void()> done_handler) {
+  auto state{std::make_shared<Job::State>()};
+  state->cmd = std::move(cmd);
+  state->err_msg_prefix = std::move(err_msg_prefix);
+  state->start_dir = std::move(start_dir);
+  state->timeout = std::move(timeout);
+  state->print_output = print_output;
+  state->output_handler = std::move(output_handler);
+  state->done_handler = std::move(done_handler);
+
+  Job job;
+  job.state_ = state;
+  job.result_ = state->promise.get_future().share();
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (stopped_) {
+      throw std::logic_error("cannot submit a command to the stopped exec pool");
+    }
+    queue_.emplace_back(std::move(state));
+    // worker threads are started on demand, an idle pool doesn't cost anything
+    if (workers_.size() < max_jobs_ && queue_.size() + running_.size() > workers_.size()) {
+      workers_.emplace_back(&ExecPool::work, this);
+    }
+  }
+  cv_.notify_one();
+  return job;
+}
+
+void ExecPool::cancelAll() {
+  std::deque<std::shared_ptr<Job::State>> queued;
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    queued.swap(queue_);
+    for (auto& state : running_) {
+      state->cancel();
+    }
+  }
+  for (auto& state : queued) {
+    state->setError(std::make_exception_ptr(ExecCancelledError()));
+  }
+}
+
+void ExecPool::work() {
+  while (true) {
+    std::shared_ptr<Job::State> state;
+    {
+      std::unique_lock<std::mutex> lock{mutex_};
+      cv_.wait(lock, [this]() { return stopped_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        return;
+      }
+      state = std::move(queue_.front());
+      queue_.pop_front();
+      running_.push_back(state);
+    }
+
+    state->run();
+
+    std::lock_guard<std::mutex> lock{mutex_};
+    running_.erase(std::find(running_.begin(), running_.end(), state));
+  }
+}
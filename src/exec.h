@@ -1,6 +1,20 @@
 #ifndef AKTUALIZR_LITE_EXEC_H_
 #define AKTUALIZR_LITE_EXEC_H_
 
+#include <sys/types.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include <boost/filesystem.hpp>
 #include <boost/format.hpp>
 
@@ -13,10 +27,141 @@ struct ExecError : std::runtime_error {
   const std::string StdErr;
 };
 
+struct ExecTimeoutError : std::runtime_error {
+  ExecTimeoutError() : std::runtime_error("Timeout occurred while waiting for a child process completion") {}
+};
+
+struct ExecCancelledError : std::runtime_error {
+  ExecCancelledError() : std::runtime_error("Child process execution has been cancelled") {}
+};
+
+/**
+ * @brief Process, a child process spawned directly from an argument vector
+ *
+ * No shell and no external `timeout` utility are involved. The child's stdout and stderr are read through separate
+ * pipes and each chunk is passed to the corresponding handler as soon as it is read. A timeout is enforced by the
+ * parent itself; on expiration the child gets SIGTERM and, if it doesn't exit within the grace period, SIGKILL.
+ * The same happens if terminate() is called from another thread while the child is running.
+ */
+class Process {
+ public:
+  using OutputHandler = std::function<void(const char* data, std::size_t size)>;
+
+  static constexpr const std::size_t ReadBufferSize{65536};
+  static constexpr const std::chrono::seconds KillGracePeriod{10};
+
+  struct Options {
+    boost::filesystem::path start_dir;
+    // zero means no timeout
+    std::chrono::milliseconds timeout{0};
+    OutputHandler out_handler;
+    OutputHandler err_handler;
+    // "NAME=value" entries to add to or override in the parent's environment
+    std::vector<std::string> env;
+  };
+
+  // Spawns the child, throws ExecError if it cannot be started, e.g. the executable is not found
+  Process(std::vector<std::string> args, Options options);
+  ~Process();
+  Process(const Process&) = delete;
+  Process(Process&&) = delete;
+  Process& operator=(const Process&) = delete;
+  Process& operator=(Process&&) = delete;
+
+  // Pumps the child's output until it exits and returns its exit code, throws ExecTimeoutError on timeout and
+  // ExecCancelledError if terminate() has been called
+  int wait();
+  // Thread-safe, makes wait() terminate the child and throw ExecCancelledError
+  void terminate();
+  pid_t pid() const { return pid_; }
+  const std::vector<std::string>& args() const { return args_; }
+
+  // Converts the timeout(1) style duration, e.g. "900s", "4h", "1.5m", to milliseconds
+  static std::chrono::milliseconds parseTimeout(const std::string& timeout);
+
+ private:
+  void closeFds();
+
+  const std::vector<std::string> args_;
+  const Options options_;
+  pid_t pid_{-1};
+  int out_fd_{-1};
+  int err_fd_{-1};
+  int wake_fds_[2]{-1, -1};
+  std::atomic_bool terminate_requested_{false};
+  int exit_code_{-1};
+};
+
+// Runs the command without a shell; it is split into arguments by whitespace, honoring the shell's quoting and
+// escaping. The command's stdout and stderr are merged into `output` and into the ExecError message, as with `2>&1`.
 void exec(const std::string& cmd, const std::string& err_msg_prefix, const boost::filesystem::path& start_dir = "",
           std::string* output = nullptr, const std::string& timeout = "900s", bool print_output = false);
 
 void exec(const boost::format& cmd, const std::string& err_msg, const boost::filesystem::path& start_dir = "",
           std::string* output = nullptr, const std::string& timeout = "900s", bool print_output = false);
 
+// Runs the command given as an argument vector, the arguments are passed as is, e.g. a path with spaces
+void exec(const std::vector<std::string>& args, const std::string& err_msg_prefix,
+          const boost::filesystem::path& start_dir = "", std::string* output = nullptr,
+          const std::string& timeout = "900s", bool print_output = false);
+
+/**
+ * @brief ExecPool, runs exec() commands asynchronously by a bounded number of worker threads
+ *
+ * At most `max_jobs` child processes run at the same time, the rest of the submitted commands wait in a FIFO queue.
+ * A submitted command can be cancelled: if it is still queued it is never started, if it is running the child is
+ * terminated. In both cases Job::get() throws ExecCancelledError.
+ */
+class ExecPool {
+ public:
+  using Ptr = std::shared_ptr<ExecPool>;
+
+  class Job {
+   public:
+    Job() = default;
+    // Blocks until the command completes, returns its output or rethrows its error, e.g. ExecError
+    std::string get() const { return result_.get(); }
+    void wait() const { result_.wait(); }
+    bool isDone() const { return result_.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }
+    void cancel();
+
+   private:
+    friend class ExecPool;
+    struct State;
+    std::shared_ptr<State> state_;
+    std::shared_future<std::string> result_;
+  };
+
+  explicit ExecPool(std::size_t max_jobs);
+  ~ExecPool();
+  ExecPool(const ExecPool&) = delete;
+  ExecPool(ExecPool&&) = delete;
+  ExecPool& operator=(const ExecPool&) = delete;
+  ExecPool& operator=(ExecPool&&) = delete;
+
+  // Takes the same parameters as exec(), the command's output is returned by Job::get(). If `output_handler` is set,
+  // it is also given the command's stdout chunks as soon as they are read, in the worker thread. The stderr chunks
+  // are not passed, so a line split across chunks is never interleaved with the other stream's data. If `done_handler`
+  // is set, it is called once the job result is ready, including a cancelled job, so the caller can process the jobs in
+  // the order they complete. It is called in the worker thread or in the thread cancelling the queued jobs, and must
+  // not throw.
+  Job submit(std::string cmd, std::string err_msg_prefix, boost::filesystem::path start_dir = "",
+             std::string timeout = "900s", bool print_output = false, Process::OutputHandler output_handler = nullptr,
+             std::function<void()> done_handler = nullptr);
+  // Cancels all queued and running commands
+  void cancelAll();
+  std::size_t maxJobs() const { return max_jobs_; }
+
+ private:
+  void work();
+
+  const std::size_t max_jobs_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stopped_{false};
+  std::deque<std::shared_ptr<Job::State>> queue_;
+  std::vector<std::shared_ptr<Job::State>> running_;
+  std::vector<std::thread> workers_;
+};
+
 #endif  // AKTUALIZR_LITE_EXEC_H_
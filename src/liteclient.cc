@@ -2,9 +2,14 @@
 
 #include <fcntl.h>
 #include <sys/file.h>
+#include <condition_variable>
 #include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <thread>
 
 #include <boost/algorithm/string.hpp>
+#include <boost/format.hpp>
 #include <boost/process.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
@@ -13,6 +18,7 @@
 #include "composeappmanager.h"
 #include "crypto/keymanager.h"
 #include "crypto/p11engine.h"
+#include "downloadscheduler.h"
 #include "helpers.h"
 #include "http/httpclient.h"
 #include "primary/reportqueue.h"
@@ -24,6 +30,69 @@
 
 static const size_t MaxDetailsSize{2048};
 
+// Runs the posted notifications one by one in its own thread. Just the latest not yet run notification is kept,
+// the progress it reports supersedes the previous ones.
+class DownloadProgressNotifier {
+ public:
+  DownloadProgressNotifier() : thread_{[this]() { run(); }} {}
+  ~DownloadProgressNotifier() {
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      stop_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+  }
+  DownloadProgressNotifier(const DownloadProgressNotifier&) = delete;
+  DownloadProgressNotifier(DownloadProgressNotifier&&) = delete;
+  DownloadProgressNotifier& operator=(const DownloadProgressNotifier&) = delete;
+  DownloadProgressNotifier& operator=(DownloadProgressNotifier&&) = delete;
+
+  void post(std::function<void()> notification) {
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      pending_ = std::move(notification);
+    }
+    cv_.notify_all();
+  }
+
+  // Waits until the posted notification, if any, is run
+  void flush() {
+    std::unique_lock<std::mutex> lock{mutex_};
+    cv_.wait(lock, [this]() { return !pending_ && !running_; });
+  }
+
+ private:
+  void run() {
+    std::unique_lock<std::mutex> lock{mutex_};
+    while (true) {
+      cv_.wait(lock, [this]() { return stop_ || pending_; });
+      if (!pending_) {
+        return;
+      }
+      auto notification{std::move(pending_)};
+      pending_ = nullptr;
+      running_ = true;
+      lock.unlock();
+      try {
+        notification();
+      } catch (const std::exception& exc) {
+        LOG_WARNING << "Failed to notify about the download progress: " << exc.what();
+      }
+      lock.lock();
+      running_ = false;
+      cv_.notify_all();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::function<void()> pending_;
+  bool running_{false};
+  bool stop_{false};
+  std::thread thread_;
+};
+
 class OfflineMetaFetcher : public Uptane::IMetadataFetcher {
  public:
   explicit OfflineMetaFetcher(boost::filesystem::path tuf_repo_path, Uptane::Version max_root_ver = Uptane::Version())
@@ -78,6 +147,20 @@ LiteClient::LiteClient(Config config_in, const AppEngine::Ptr& app_engine, const
       callback_program = "";
     }
   }
+  if (!callback_program.empty()) {
+    download_progress_notifier_ = std::make_unique<DownloadProgressNotifier>();
+  }
+
+  if (raw.count("download_rate_limit_kib") == 1) {
+    const std::string rate_limit_str{raw.at("download_rate_limit_kib")};
+    try {
+      DownloadScheduler::instance().setMaxRate(std::stoull(rate_limit_str) * 1024);
+    } catch (const std::exception& exc) {
+      LOG_ERROR << "Invalid sota.toml:pacman:download_rate_limit_kib value, should be an integer, got "
+                << rate_limit_str << ", err: " << exc.what();
+      throw;
+    }
+  }
 
   // figure out the Docker Registry Auth creds endpoint
   const auto& repo_endpoint = config.uptane.repo_server;
@@ -123,11 +206,14 @@ LiteClient::LiteClient(Config config_in, const AppEngine::Ptr& app_engine, const
   key_manager_->loadKeys();
   key_manager_->copyCertsToCurl(*http_client);
 
+  // the metadata fetches and report uploads share the link with the downloads, by their priority
   if (!uptane_fetcher_) {
-    uptane_fetcher_ = std::make_shared<Uptane::Fetcher>(config, http_client);
+    uptane_fetcher_ = std::make_shared<Uptane::Fetcher>(
+        config, std::make_shared<ScheduledHttpClient>(http_client, DownloadScheduler::Class::Metadata));
   }
-  report_queue = std_::make_unique<AkLiteReportQueue>(config, http_client, storage, report_queue_run_pause_s_,
-                                                      report_queue_event_limit_);
+  report_queue = std_::make_unique<AkLiteReportQueue>(
+      config, std::make_shared<ScheduledHttpClient>(http_client, DownloadScheduler::Class::Report), storage,
+      report_queue_run_pause_s_, report_queue_event_limit_);
 
   std::shared_ptr<RootfsTreeManager> basepacman;
   // Deduce a package manager type if not set explicitly by a user
@@ -178,6 +264,8 @@ LiteClient::LiteClient(Config config_in, const AppEngine::Ptr& app_engine, const
 }
 
 LiteClient::~LiteClient() {
+  // The pending download progress callback uses the client, so it's run before destroying it.
+  download_progress_notifier_.reset(nullptr);
   // Make sure all events drained before fully destroying the liteclient instance.
   report_queue.reset(nullptr);
 }  // NOLINT(modernize-use-equals-default, hicpp-use-equals-default)
@@ -441,11 +529,32 @@ void LiteClient::notifyDownloadStarted(const Uptane::Target& t, const std::strin
 }
 
 void LiteClient::notifyDownloadFinished(const Uptane::Target& t, bool success, const std::string& err_msg) {
+  if (download_progress_notifier_) {
+    // the progress callbacks precede the download-post one
+    download_progress_notifier_->flush();
+  }
   callback("download-post", t, success ? "OK" : "FAILED");
   notify(t,
          std_::make_unique<DetailedDownloadCompletedReport>(primary_ecu.first, t.correlation_id(), success, err_msg));
 }
 
+void LiteClient::notifyDownloadProgress(const Uptane::Target& t, const AppEngine::PullProgress& progress) {
+  // Running the callback program on each progress event would slow a pull down, so it's run once in a while,
+  // and not by the thread reporting the progress, which also reads the pull output.
+  // The progress events are serialized by an App engine, no need to guard the timestamp.
+  const auto now{std::chrono::steady_clock::now()};
+  if (!download_progress_notifier_ || now - last_download_progress_callback_ < download_progress_callback_interval_) {
+    return;
+  }
+  last_download_progress_callback_ = now;
+  download_progress_notifier_->post(
+      [this, target = t,
+       result = boost::str(boost::format("app=%s blob=%s done=%d total=%d rate=%d") % progress.app % progress.blob %
+                           progress.done % progress.total % progress.rate)]() {
+        callback("download-progress", target, result);
+      });
+}
+
 void LiteClient::notifyInstallStarted(const Uptane::Target& t) {
   callback("install-pre", t, "");
   notify(t, std_::make_unique<EcuInstallationStartedReport>(primary_ecu.first, t.correlation_id()));
@@ -712,13 +821,36 @@ void LiteClient::reportAppsState() {
   }
 }
 
-DownloadResult LiteClient::download(const Uptane::Target& target, const std::string& reason) {
+DownloadResult LiteClient::download(const Uptane::Target& target, const std::string& reason,
+                                    const AppEngine::PullProgressHandler& progress_handler) {
   notifyDownloadStarted(target, reason);
-  auto download_result{downloadImage(target)};
+  setPullProgressHandler([this, &target, &progress_handler](const AppEngine::PullProgress& progress) {
+    if (progress_handler) {
+      progress_handler(progress);
+    }
+    notifyDownloadProgress(target, progress);
+  });
+  DownloadResult download_result{DownloadResult::Status::DownloadFailed, ""};
+  try {
+    download_result = downloadImage(target);
+  } catch (...) {
+    setPullProgressHandler(nullptr);
+    throw;
+  }
+  setPullProgressHandler(nullptr);
   notifyDownloadFinished(target, download_result, download_result.description);
   return download_result;
 }
 
+void LiteClient::setPullProgressHandler(AppEngine::PullProgressHandler handler) {
+  if (package_manager_->name() == ComposeAppManager::Name) {
+    auto* compose_pacman = dynamic_cast<ComposeAppManager*>(package_manager_.get());
+    if (compose_pacman != nullptr) {
+      compose_pacman->setPullProgressHandler(std::move(handler));
+    }
+  }
+}
+
 data::InstallationResult LiteClient::install(const Uptane::Target& target, InstallMode install_mode) {
   notifyInstallStarted(target);
   auto iresult = installPackage(target, install_mode);
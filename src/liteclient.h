@@ -1,6 +1,8 @@
 #ifndef AKTUALIZR_LITE_CLIENT_H_
 #define AKTUALIZR_LITE_CLIENT_H_
 
+#include <chrono>
+
 #include "composeappmanager.h"
 #include "downloader.h"
 #include "gtest/gtest_prod.h"
@@ -19,6 +21,7 @@ class ReportEvent;
 class ReportQueue;
 class DownloadResult;
 class Downloader;
+class DownloadProgressNotifier;
 class Installer;
 
 class LiteClient {
@@ -50,7 +53,9 @@ class LiteClient {
   void checkForUpdatesEndWithFailure(const std::string& err);
   bool finalizeInstall(data::InstallationResult* ir = nullptr);
   Uptane::Target getRollbackTarget(bool allow_current = true);
-  DownloadResult download(const Uptane::Target& target, const std::string& reason);
+  // `progress_handler` is given the progress of App pulls, if the package manager reports it
+  DownloadResult download(const Uptane::Target& target, const std::string& reason,
+                          const AppEngine::PullProgressHandler& progress_handler = nullptr);
   data::InstallationResult install(const Uptane::Target& target, InstallMode install_mode = InstallMode::All);
   void notifyInstallFinished(const Uptane::Target& t, data::InstallationResult& ir);
   std::pair<bool, std::string> isRebootRequired() const {
@@ -83,6 +88,7 @@ class LiteClient {
   void notifyTufUpdateFinished(const std::string& err = "", const Uptane::Target& t = Uptane::Target::Unknown());
   void notifyDownloadStarted(const Uptane::Target& t, const std::string& reason);
   void notifyDownloadFinished(const Uptane::Target& t, bool success, const std::string& err_msg = "");
+  void notifyDownloadProgress(const Uptane::Target& t, const AppEngine::PullProgress& progress);
   std::tuple<bool, boost::filesystem::path> isRootMetaImportNeeded();
   bool importRootMeta(const boost::filesystem::path& src, Uptane::Version max_ver = Uptane::Version());
   void importRootMetaIfNeededAndPresent();
@@ -104,6 +110,7 @@ class LiteClient {
   void notify(const Uptane::Target& t, std::unique_ptr<ReportEvent> event) const;
   void notifyInstallStarted(const Uptane::Target& t);
   void writeCurrentTarget(const Uptane::Target& t) const;
+  void setPullProgressHandler(AppEngine::PullProgressHandler handler);
 
   data::InstallationResult installPackage(const Uptane::Target& target, InstallMode install_mode = InstallMode::All);
   DownloadResult downloadImage(const Uptane::Target& target, const api::FlowControlToken* token = nullptr);
@@ -133,6 +140,10 @@ class LiteClient {
   Json::Value apps_state_;
   const int report_queue_run_pause_s_{10};
   const int report_queue_event_limit_{6};
+  const std::chrono::seconds download_progress_callback_interval_{5};
+  std::chrono::steady_clock::time_point last_download_progress_callback_;
+  // Runs the download progress callbacks, so a slow callback program doesn't hold the App pull output reader
+  std::unique_ptr<DownloadProgressNotifier> download_progress_notifier_;
   Type type_{Type::Undefined};
 };
 
@@ -0,0 +1,57 @@
+#include "parallelfor.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+void parallelFor(std::size_t size, std::size_t parallelism, const std::function<void(std::size_t)>& func,
+                 const std::function<bool()>& stop) {
+  std::atomic<std::size_t> next{0};
+  std::atomic<bool> failed{false};
+  std::mutex err_mutex;
+  std::exception_ptr err;
+  const auto stopped{[&]() { return failed || (stop && stop()); }};
+  const auto work{[&]() {
+    for (auto indx{next++}; indx < size && !stopped(); indx = next++) {
+      try {
+        func(indx);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock{err_mutex};
+        if (!err) {
+          err = std::current_exception();
+        }
+        failed = true;
+      }
+    }
+  }};
+
+  const auto threads_number{std::min(parallelism, size)};
+  if (threads_number <= 1) {
+    work();
+  } else {
+    std::vector<std::thread> threads;
+    // the started threads are joined even if starting another one fails
+    struct ThreadsJoiner {
+      std::vector<std::thread>& threads;
+      ~ThreadsJoiner() {
+        for (auto& thread : threads) {
+          thread.join();
+        }
+      }
+    } joiner{threads};
+    try {
+      for (std::size_t ii = 0; ii < threads_number; ++ii) {
+        threads.emplace_back(work);
+      }
+    } catch (...) {
+      failed = true;
+      throw;
+    }
+  }
+  if (err) {
+    std::rethrow_exception(err);
+  }
+}
@@ -0,0 +1,18 @@
+#ifndef AKTUALIZR_LITE_PARALLEL_FOR_H_
+#define AKTUALIZR_LITE_PARALLEL_FOR_H_
+
+#include <cstddef>
+#include <functional>
+
+/**
+ * @brief Calls `func` for each index in [0, size) by up to `parallelism` threads
+ *
+ * The indices are handed out in the increasing order to the threads as they become free, so a slow item doesn't hold
+ * back the others. The calling thread runs the items by itself if one thread is enough. No new item is started once
+ * `stop` returns true or `func` throws. All the threads are joined before the function returns, then the first
+ * exception thrown by `func` is rethrown.
+ */
+void parallelFor(std::size_t size, std::size_t parallelism, const std::function<void(std::size_t)>& func,
+                 const std::function<bool()>& stop = nullptr);
+
+#endif  // AKTUALIZR_LITE_PARALLEL_FOR_H_
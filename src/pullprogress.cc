@@ -0,0 +1,116 @@
+#include "pullprogress.h"
+
+#include <cctype>
+#include <cmath>
+#include <regex>
+
+#include <boost/algorithm/string.hpp>
+
+// a long line without a delimiter is not a progress line, don't let it grow unbounded
+static constexpr const std::size_t MaxLineLength{4096};
+
+PullProgressParser::PullProgressParser(std::string app, AppEngine::PullProgressHandler handler)
+    : app_{std::move(app)}, handler_{std::move(handler)} {}
+
+void PullProgressParser::feed(const char* data, std::size_t size) {
+  for (std::size_t ii = 0; ii < size; ++ii) {
+    const char c{data[ii]};
+    if (c == '\n' || c == '\r') {
+      if (!line_.empty()) {
+        parseLine(line_);
+        line_.clear();
+      }
+    } else if (line_.size() < MaxLineLength) {
+      line_ += c;
+    }
+  }
+}
+
+uint64_t PullProgressParser::parseSize(const std::string& size) {
+  static const std::regex size_re{R"(^\s*([0-9]+(?:\.[0-9]+)?)\s*([kKMGT]?)(i?)B?\s*$)"};
+  std::smatch match;
+  if (!std::regex_match(size, match, size_re)) {
+    throw std::invalid_argument("invalid size value: " + size);
+  }
+  const double base{match[3].length() > 0 ? 1024.0 : 1000.0};
+  double multiplier{1};
+  switch (match[2].length() > 0 ? std::toupper(match[2].str()[0]) : 0) {
+    case 'K':
+      multiplier = base;
+      break;
+    case 'M':
+      multiplier = std::pow(base, 2);
+      break;
+    case 'G':
+      multiplier = std::pow(base, 3);
+      break;
+    case 'T':
+      multiplier = std::pow(base, 4);
+      break;
+    default:
+      break;
+  }
+  return static_cast<uint64_t>(std::stod(match[1].str()) * multiplier);
+}
+
+void PullProgressParser::parseLine(const std::string& line) {
+  static const std::regex ansi_escape_re{"\x1b\\[[0-9;?]*[A-Za-z]"};
+  static const std::regex sizes_re{R"(([0-9]+(?:\.[0-9]+)?\s*[kKMGT]?i?B)\s*/\s*([0-9]+(?:\.[0-9]+)?\s*[kKMGT]?i?B))"};
+  static const std::regex rate_re{R"(([0-9]+(?:\.[0-9]+)?\s*[kKMGT]?i?B)/s)"};
+  static const std::regex digest_re{R"((?:sha256:)?([0-9a-f]{12,64}))"};
+
+  const auto clean_line{std::regex_replace(line, ansi_escape_re, "")};
+  std::smatch sizes;
+  if (!std::regex_search(clean_line, sizes, sizes_re)) {
+    return;
+  }
+
+  std::string blob;
+  std::smatch digest;
+  if (std::regex_search(clean_line, digest, digest_re)) {
+    blob = digest[1].str();
+  } else {
+    const auto prefix{boost::trim_copy(sizes.prefix().str())};
+    blob = prefix.substr(0, prefix.find_first_of(" \t"));
+    boost::trim_right_if(blob, boost::is_any_of(":"));
+    // the blob ID ends up in the environment of the callback program, don't pass anything odd
+    if (!boost::all(blob, boost::is_alnum() || boost::is_any_of("._:@/-"))) {
+      blob.clear();
+    }
+  }
+
+  AppEngine::PullProgress progress{app_, blob};
+  try {
+    progress.done = parseSize(sizes[1].str());
+    progress.total = parseSize(sizes[2].str());
+  } catch (const std::exception&) {
+    return;
+  }
+
+  const auto now{std::chrono::steady_clock::now()};
+  auto blob_it{blobs_.find(blob)};
+  if (blob_it == blobs_.end()) {
+    blob_it = blobs_.emplace(blob, BlobState{0, 0, progress.done, now}).first;
+  } else if (blob_it->second.done == progress.done && blob_it->second.total == progress.total) {
+    // a redraw of the same state
+    return;
+  }
+  auto& state{blob_it->second};
+  state.done = progress.done;
+  state.total = progress.total;
+
+  const auto suffix{sizes.suffix().str()};
+  std::smatch rate;
+  if (std::regex_search(suffix, rate, rate_re)) {
+    progress.rate = parseSize(rate[1].str());
+  } else {
+    const std::chrono::duration<double> elapsed{now - state.first_seen};
+    if (elapsed.count() > 0 && progress.done > state.first_done) {
+      progress.rate = static_cast<uint64_t>(static_cast<double>(progress.done - state.first_done) / elapsed.count());
+    }
+  }
+
+  if (handler_) {
+    handler_(progress);
+  }
+}
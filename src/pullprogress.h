@@ -0,0 +1,44 @@
+#ifndef AKTUALIZR_LITE_PULL_PROGRESS_H_
+#define AKTUALIZR_LITE_PULL_PROGRESS_H_
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+
+#include "appengine.h"
+
+/**
+ * @brief PullProgressParser, turns the human-readable progress printed by a pull command into PullProgress events
+ *
+ * The output is consumed as it arrives, lines are delimited by '\n' or '\r' (progress bars redraw the same line).
+ * A progress line is recognized by a "<size>/<size>" pair, e.g. "12.3MiB / 45 MB", optionally followed by the
+ * throughput, e.g. "1.2 MiB/s". The blob is identified by the digest found in the line or by its first word.
+ * If the line doesn't tell the throughput, it is derived from the bytes done since the blob was seen for the first
+ * time. Lines that don't look like progress are ignored.
+ */
+class PullProgressParser {
+ public:
+  PullProgressParser(std::string app, AppEngine::PullProgressHandler handler);
+
+  void feed(const char* data, std::size_t size);
+
+  // Converts a size like "1024", "12.5 kB", "3MiB" to bytes, throws std::invalid_argument if it is malformed
+  static uint64_t parseSize(const std::string& size);
+
+ private:
+  struct BlobState {
+    uint64_t done{0};
+    uint64_t total{0};
+    uint64_t first_done{0};
+    std::chrono::steady_clock::time_point first_seen;
+  };
+
+  void parseLine(const std::string& line);
+
+  const std::string app_;
+  const AppEngine::PullProgressHandler handler_;
+  std::string line_;
+  std::unordered_map<std::string, BlobState> blobs_;
+};
+
+#endif  // AKTUALIZR_LITE_PULL_PROGRESS_H_
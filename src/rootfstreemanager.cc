@@ -4,6 +4,7 @@
 #include <boost/algorithm/string.hpp>
 
 #include "crypto/crypto.h"
+#include "downloadscheduler.h"
 #include "http/httpclient.h"
 #include "ostree/repo.h"
 #include "storage/invstorage.h"
@@ -85,8 +86,13 @@ DownloadResult RootfsTreeManager::Download(const TufTarget& target) {
     }
 
     LOG_INFO << "Fetching ostree commit " + target.Sha256Hash() + " from " + remote.baseUrl;
-    pull_err = OstreeManager::pull(config.sysroot, remote.baseUrl, keys_, Target::fromTufTarget(target), nullptr,
-                                   prog_cb, remote.isRemoteSet ? nullptr : remote.name.c_str(), remote.headers);
+    {
+      // libostree receives the data itself, so the pull cannot be paused, it just holds the less urgent transfers
+      DownloadScheduler::Transfer transfer{DownloadScheduler::instance(), DownloadScheduler::Class::Ostree};
+      transfer.wait();
+      pull_err = OstreeManager::pull(config.sysroot, remote.baseUrl, keys_, Target::fromTufTarget(target), nullptr,
+                                     prog_cb, remote.isRemoteSet ? nullptr : remote.name.c_str(), remote.headers);
+    }
 
     storage::Volume::UsageInfo post_pull_usage_info{getUsageInfo()};
     if (post_pull_usage_info.isOk()) {
@@ -6,6 +6,7 @@
 
 #include "akhttpsreposource.h"
 #include "crypto/p11engine.h"
+#include "downloadscheduler.h"
 
 #ifdef BUILD_P11
 static constexpr bool built_with_p11 = true;
@@ -66,7 +67,8 @@ void AkHttpsRepoSource::init(const std::string& name_in, boost::property_tree::p
   http_client->setCerts(tls_ca, config.tls.ca_source, tls_cert, config.tls.cert_source, tls_pkey,
                         config.tls.pkey_source);
 
-  meta_fetcher_ = std::make_shared<Uptane::Fetcher>(config, http_client);
+  meta_fetcher_ = std::make_shared<Uptane::Fetcher>(
+      config, std::make_shared<ScheduledHttpClient>(http_client, DownloadScheduler::Class::Metadata));
 }
 
 void AkHttpsRepoSource::fillConfig(Config& config, boost::property_tree::ptree& pt) {
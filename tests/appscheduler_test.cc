@@ -0,0 +1,129 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "appscheduler.h"
+
+static AppEngine::Apps makeApps(const std::vector<std::string>& names) {
+  AppEngine::Apps apps;
+  for (const auto& name : names) {
+    apps.emplace_back(AppEngine::App{name, "hub.io/factory/" + name + "@sha256:0123"});
+  }
+  return apps;
+}
+
+TEST(AppScheduler, Parallelism) {
+  const auto apps{makeApps({"app-01", "app-02", "app-03", "app-04", "app-05", "app-06"})};
+  std::atomic_int running{0};
+  std::atomic_int max_running{0};
+  const AppScheduler scheduler{3};
+  const auto results{scheduler.run(apps, [&](const AppEngine::App&) {
+    const auto cur{++running};
+    int prev{max_running};
+    while (cur > prev && !max_running.compare_exchange_weak(prev, cur)) {
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    --running;
+    return AppEngine::Result{true};
+  })};
+
+  ASSERT_EQ(results.size(), apps.size());
+  for (std::size_t ii = 0; ii < apps.size(); ++ii) {
+    ASSERT_EQ(results[ii].app, apps[ii]);
+    ASSERT_TRUE(results[ii].result);
+    ASSERT_TRUE(results[ii].started);
+    ASSERT_GE(results[ii].duration, std::chrono::milliseconds(100));
+  }
+  ASSERT_EQ(max_running, 3);
+}
+
+TEST(AppScheduler, Dependencies) {
+  const auto apps{makeApps({"app-03", "app-02", "app-01", "app-04"})};
+  std::mutex mutex;
+  std::vector<std::string> order;
+  const AppScheduler scheduler{4, AppScheduler::parseDeps("app-03:app-02 app-02:app-01 app-04:app-05")};
+  const auto results{scheduler.run(apps, [&](const AppEngine::App& app) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::lock_guard<std::mutex> lock{mutex};
+    order.push_back(app.name);
+    return AppEngine::Result{true};
+  })};
+
+  for (const auto& res : results) {
+    ASSERT_TRUE(res.result) << res.app.name;
+  }
+  ASSERT_EQ(order.size(), 4);
+  const auto pos{[&order](const std::string& name) { return std::find(order.begin(), order.end(), name); }};
+  ASSERT_LT(pos("app-01"), pos("app-02"));
+  ASSERT_LT(pos("app-02"), pos("app-03"));
+}
+
+TEST(AppScheduler, FailedDependency) {
+  const auto apps{makeApps({"app-03", "app-02", "app-01", "app-04"})};
+  const AppScheduler scheduler{2, AppScheduler::parseDeps("app-03:app-02 app-02:app-01")};
+  const auto results{scheduler.run(apps, [](const AppEngine::App& app) {
+    if (app.name == "app-01") {
+      throw std::runtime_error("failed to start");
+    }
+    return AppEngine::Result{true};
+  })};
+
+  ASSERT_FALSE(results[0].result);
+  ASSERT_FALSE(results[0].started);
+  ASSERT_FALSE(results[1].result);
+  ASSERT_FALSE(results[1].started);
+  ASSERT_FALSE(results[2].result);
+  ASSERT_TRUE(results[2].started);
+  ASSERT_EQ(results[2].result.err, "failed to start");
+  ASSERT_TRUE(results[3].result);
+}
+
+TEST(AppScheduler, Cycle) {
+  const auto apps{makeApps({"app-01", "app-02", "app-03"})};
+  const AppScheduler scheduler{2, AppScheduler::parseDeps("app-01:app-02 app-02:app-01")};
+  const auto results{scheduler.run(apps, [](const AppEngine::App&) { return AppEngine::Result{true}; })};
+
+  ASSERT_FALSE(results[0].result);
+  ASSERT_FALSE(results[0].started);
+  ASSERT_NE(results[0].result.err.find("cyclic"), std::string::npos);
+  ASSERT_FALSE(results[1].result);
+  ASSERT_TRUE(results[2].result);
+}
+
+TEST(AppScheduler, FailFast) {
+  const auto apps{makeApps({"app-01", "app-02", "app-03", "app-04"})};
+  std::atomic_int started{0};
+  const AppScheduler scheduler{1, {}, true};
+  const auto results{scheduler.run(apps, [&started](const AppEngine::App& app) {
+    ++started;
+    return AppEngine::Result{app.name != "app-02", "failed to start"};
+  })};
+
+  ASSERT_EQ(started, 2);
+  ASSERT_TRUE(results[0].result);
+  ASSERT_FALSE(results[1].result);
+  ASSERT_TRUE(results[1].started);
+  ASSERT_FALSE(results[2].started);
+  ASSERT_FALSE(results[3].started);
+}
+
+TEST(AppScheduler, ParseDeps) {
+  ASSERT_TRUE(AppScheduler::parseDeps("").empty());
+  ASSERT_TRUE(AppScheduler::parseDeps("  ").empty());
+  const auto deps{AppScheduler::parseDeps(" app-02:app-01  app-03:app-01,app-02 ")};
+  ASSERT_EQ(deps.size(), 2);
+  ASSERT_EQ(deps.at("app-02"), std::vector<std::string>({"app-01"}));
+  ASSERT_EQ(deps.at("app-03"), std::vector<std::string>({"app-01", "app-02"}));
+  ASSERT_THROW(AppScheduler::parseDeps("app-02"), std::invalid_argument);
+  ASSERT_THROW(AppScheduler::parseDeps(":app-01"), std::invalid_argument);
+  ASSERT_THROW(AppScheduler::parseDeps("app-02:"), std::invalid_argument);
+  ASSERT_THROW(AppScheduler(0), std::invalid_argument);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,127 @@
+#include <gtest/gtest.h>
+
+#include "docker/blobindex.h"
+#include "docker/docker.h"
+#include "utilities/utils.h"
+
+class VerifiedBlobIndexTest : public ::testing::Test {
+ protected:
+  boost::filesystem::path indexPath() const { return test_dir_ / Docker::VerifiedBlobIndex::FileName; }
+
+  TemporaryDirectory test_dir_;
+};
+
+TEST_F(VerifiedBlobIndexTest, GetHash) {
+  const auto blob{test_dir_ / "blob"};
+  Utils::writeFile(blob, std::string("some content"));
+  const auto hash{Docker::getFileHash(blob)};
+
+  Docker::VerifiedBlobIndex index{indexPath(), std::chrono::seconds(0)};
+  ASSERT_FALSE(index.isUnchanged(blob));
+  ASSERT_EQ(index.getHash(blob), hash);
+  ASSERT_TRUE(index.isUnchanged(blob));
+  ASSERT_EQ(index.getHash(blob), hash);
+
+  // the same size and mtime, still the file change must be detected
+  const auto mtime{boost::filesystem::last_write_time(blob)};
+  Utils::writeFile(blob, std::string("SOME CONTENT"));
+  boost::filesystem::last_write_time(blob, mtime);
+  ASSERT_FALSE(index.isUnchanged(blob));
+  ASSERT_NE(index.getHash(blob), hash);
+  ASSERT_EQ(index.getHash(blob), Docker::getFileHash(blob));
+
+  boost::filesystem::remove(blob);
+  ASSERT_FALSE(index.isUnchanged(blob));
+  ASSERT_THROW(index.getHash(blob), std::runtime_error);
+}
+
+TEST_F(VerifiedBlobIndexTest, RacyWindow) {
+  const auto blob{test_dir_ / "blob"};
+  Utils::writeFile(blob, std::string("some content"));
+  const auto mtime{boost::filesystem::last_write_time(blob)};
+
+  // the file has just been changed, so its entry is confirmed by hashing the file
+  Docker::VerifiedBlobIndex index{indexPath(), std::chrono::seconds(60)};
+  index.add(blob, Docker::getFileHash(blob));
+  ASSERT_TRUE(index.isUnchanged(blob));
+  index.add(blob, "foo");
+  ASSERT_FALSE(index.isUnchanged(blob));
+  ASSERT_EQ(index.getHash(blob), Docker::getFileHash(blob));
+
+  Utils::writeFile(blob, std::string("SOME CONTENT"));
+  boost::filesystem::last_write_time(blob, mtime);
+  ASSERT_FALSE(index.isUnchanged(blob));
+  ASSERT_EQ(index.getHash(blob), Docker::getFileHash(blob));
+}
+
+TEST_F(VerifiedBlobIndexTest, Persistence) {
+  const auto blob{test_dir_ / "blob"};
+  const auto removed_blob{test_dir_ / "removed-blob"};
+  const auto changed_blob{test_dir_ / "changed-blob"};
+  Utils::writeFile(blob, std::string("some content"));
+  Utils::writeFile(removed_blob, std::string("some other content"));
+  Utils::writeFile(changed_blob, std::string("yet another content"));
+  {
+    Docker::VerifiedBlobIndex index{indexPath(), std::chrono::seconds(0)};
+    index.save();
+    // nothing to save
+    ASSERT_FALSE(boost::filesystem::exists(indexPath()));
+    index.getHash(blob);
+    index.getHash(removed_blob);
+    // the hash is taken as is, it's up to the caller to make sure it's valid
+    index.add(changed_blob, "foo");
+    index.save();
+    ASSERT_TRUE(boost::filesystem::exists(indexPath()));
+  }
+  boost::filesystem::remove(removed_blob);
+  Utils::writeFile(changed_blob, std::string("changed content"));
+  {
+    Docker::VerifiedBlobIndex index{indexPath(), std::chrono::seconds(0)};
+    ASSERT_TRUE(index.isUnchanged(blob));
+    ASSERT_FALSE(index.isUnchanged(removed_blob));
+    ASSERT_FALSE(index.isUnchanged(changed_blob));
+    ASSERT_EQ(index.getHash(changed_blob), Docker::getFileHash(changed_blob));
+  }
+
+  // an invalid index is ignored
+  Utils::writeFile(indexPath(), std::string("foo"));
+  Docker::VerifiedBlobIndex index{indexPath(), std::chrono::seconds(0)};
+  ASSERT_FALSE(index.isUnchanged(blob));
+}
+
+TEST_F(VerifiedBlobIndexTest, Prune) {
+  const auto blob{test_dir_ / "blob"};
+  const auto removed_blob{test_dir_ / "removed-blob"};
+  Utils::writeFile(blob, std::string("some content"));
+  Utils::writeFile(removed_blob, std::string("some other content"));
+  {
+    Docker::VerifiedBlobIndex index{indexPath(), std::chrono::seconds(0)};
+    index.getHash(blob);
+    index.getHash(removed_blob);
+    index.save();
+    boost::filesystem::remove(removed_blob);
+    index.prune();
+    index.save();
+  }
+  const auto saved{Utils::parseJSONFile(indexPath())};
+  ASSERT_TRUE(saved["blobs"].isMember(blob.string()));
+  ASSERT_FALSE(saved["blobs"].isMember(removed_blob.string()));
+}
+
+TEST_F(VerifiedBlobIndexTest, OutsideStore) {
+  // a file that is not in the index's directory, e.g. an installed compose file, is hashed but not recorded
+  TemporaryDirectory other_dir;
+  const auto file{other_dir / "docker-compose.yml"};
+  Utils::writeFile(file, std::string("some content"));
+  Docker::VerifiedBlobIndex index{indexPath(), std::chrono::seconds(0)};
+  ASSERT_EQ(index.getHash(file), Docker::getFileHash(file));
+  index.add(file, Docker::getFileHash(file));
+  ASSERT_FALSE(index.isUnchanged(file));
+  index.save();
+  ASSERT_FALSE(boost::filesystem::exists(indexPath()));
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,137 @@
+#include <gtest/gtest.h>
+
+#include "docker/blobrefs.h"
+#include "utilities/utils.h"
+
+class BlobRefTableTest : public ::testing::Test {
+ protected:
+  BlobRefTableTest() : blob_dir_{test_dir_ / "blobs"} { boost::filesystem::create_directories(blob_dir_); }
+
+  boost::filesystem::path tablePath() const { return test_dir_ / Docker::BlobRefTable::FileName; }
+  void addBlobs(const Docker::BlobRefTable::Blobs& blobs) const {
+    for (const auto& blob : blobs) {
+      Utils::writeFile(blob_dir_ / blob, blob);
+    }
+  }
+  bool exists(const std::string& blob) const { return boost::filesystem::exists(blob_dir_ / blob); }
+
+  TemporaryDirectory test_dir_;
+  const boost::filesystem::path blob_dir_;
+};
+
+TEST_F(BlobRefTableTest, RefCount) {
+  addBlobs({"a", "b", "c", "d"});
+  Docker::BlobRefTable table{tablePath()};
+  table.rescan(blob_dir_);
+  ASSERT_EQ(table.sweep(blob_dir_), 4);
+
+  addBlobs({"a", "b", "c", "d"});
+  table.setAppBlobs("app-01/v1", {"a", "b"});
+  table.setAppBlobs("app-02/v1", {"b", "c"});
+  ASSERT_EQ(table.sweep(blob_dir_), 0);
+  ASSERT_TRUE(table.isReferenced("b"));
+  ASSERT_FALSE(table.isReferenced("d"));
+
+  // the blob shared with another App is kept
+  table.removeApp("app-01/v1");
+  ASSERT_EQ(table.garbageSize(), 1);
+  ASSERT_EQ(table.sweep(blob_dir_), 1);
+  ASSERT_FALSE(exists("a"));
+  ASSERT_TRUE(exists("b"));
+
+  // the blob referenced again before the sweep is not garbage anymore
+  table.setAppBlobs("app-02/v2", {"c"});
+  table.setAppBlobs("app-02/v1", {});
+  table.removeApp("app-02/v1");
+  ASSERT_EQ(table.getApps(), std::vector<std::string>{"app-02/v2"});
+  ASSERT_EQ(table.sweep(blob_dir_), 1);
+  ASSERT_FALSE(exists("b"));
+  ASSERT_TRUE(exists("c"));
+  // the blob never referenced is removed only after a rescan
+  ASSERT_TRUE(exists("d"));
+  table.requestRescan();
+  table.rescan(blob_dir_);
+  ASSERT_EQ(table.sweep(blob_dir_), 1);
+  ASSERT_FALSE(exists("d"));
+}
+
+TEST_F(BlobRefTableTest, Persistence) {
+  addBlobs({"a", "b", "c"});
+  {
+    Docker::BlobRefTable table{tablePath()};
+    // the store blobs may predate the table
+    ASSERT_TRUE(table.isRescanRequested());
+    table.setAppBlobs("app-01/v1", {"a", "b"});
+    table.setAppBlobs("app-02/v1", {"b", "c"});
+    table.rescan(blob_dir_);
+    ASSERT_FALSE(table.isRescanRequested());
+    table.save();
+  }
+  {
+    Docker::BlobRefTable table{tablePath()};
+    ASSERT_FALSE(table.isRescanRequested());
+    ASSERT_TRUE(table.hasApp("app-01/v1"));
+    ASSERT_TRUE(table.hasApp("app-02/v1"));
+    table.removeApp("app-01/v1");
+    table.removeApp("app-02/v1");
+    // the garbage not swept yet is kept for the next sweep
+    table.save();
+  }
+  {
+    Docker::BlobRefTable table{tablePath()};
+    ASSERT_EQ(table.garbageSize(), 3);
+    ASSERT_EQ(table.sweep(blob_dir_, std::chrono::milliseconds(1000)), 3);
+    table.save();
+  }
+  Docker::BlobRefTable table{tablePath()};
+  ASSERT_EQ(table.garbageSize(), 0);
+  ASSERT_TRUE(table.getApps().empty());
+
+  // a damaged table is rebuilt
+  Utils::writeFile(tablePath(), std::string("{foo"));
+  ASSERT_TRUE(Docker::BlobRefTable{tablePath()}.isRescanRequested());
+}
+
+TEST_F(BlobRefTableTest, InterruptedFetch) {
+  {
+    Docker::BlobRefTable table{tablePath()};
+    table.rescan(blob_dir_);
+    table.startFetch("app-01/v1");
+    table.save();
+    // the fetch downloads its blobs, then the process is killed before the fetch completes
+    addBlobs({"a", "b"});
+  }
+  {
+    Docker::BlobRefTable table{tablePath()};
+    ASSERT_TRUE(table.isRescanRequested());
+    table.rescan(blob_dir_);
+    ASSERT_EQ(table.sweep(blob_dir_), 2);
+    ASSERT_FALSE(exists("a"));
+    table.save();
+  }
+  {
+    // the record of the interrupted fetch has been dropped by the rescan, so the completed fetch doesn't request one
+    Docker::BlobRefTable table{tablePath()};
+    ASSERT_FALSE(table.isRescanRequested());
+    table.startFetch("app-01/v1");
+    table.save();
+    addBlobs({"a", "b"});
+    table.setAppBlobs("app-01/v1", {"a", "b"});
+    table.finishFetch("app-01/v1", true);
+    table.save();
+  }
+  {
+    Docker::BlobRefTable table{tablePath()};
+    ASSERT_FALSE(table.isRescanRequested());
+    ASSERT_TRUE(table.isReferenced("a"));
+    // a failed fetch requests a rescan in place
+    table.startFetch("app-02/v1");
+    table.finishFetch("app-02/v1", false);
+    ASSERT_TRUE(table.isRescanRequested());
+  }
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
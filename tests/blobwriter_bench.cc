@@ -0,0 +1,73 @@
+// Compares the blob writer with the former std::ofstream based blob sink by writing a blob in curl sized chunks.
+//
+// Usage: blobwriter-bench [<dir>] [<blob size in MiB>] [<chunk size in bytes>]
+//
+// The blob, 1 GiB by default, is written to <dir>, the current directory by default, so it should be run on the storage
+// the blobs are downloaded to. The chunk size is 16 KiB by default, the maximum size of the chunks passed by curl.
+// Each sink writes the blob and syncs it to the storage, as a completed download does.
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "docker/blobwriter.h"
+
+template <typename Func>
+static void measure(const std::string& name, std::size_t size, Func&& func) {
+  const auto started{std::chrono::steady_clock::now()};
+  func();
+  const std::chrono::duration<double> elapsed{std::chrono::steady_clock::now() - started};
+  std::cout << "  " << name << ": " << elapsed.count() * 1000 << " ms, " << size / (1024 * 1024) / elapsed.count()
+            << " MiB/s" << std::endl;
+}
+
+// The former sink: a write through std::ofstream and two tellp() calls per chunk, and a sync of the closed file
+static void writeByStream(const boost::filesystem::path& path, const std::vector<char>& chunk, std::size_t size) {
+  std::ofstream out_stream{path.string(), std::ios_base::out | std::ios_base::binary};
+  std::size_t written_size{0};
+  while (written_size < size) {
+    const auto start_pos{out_stream.tellp()};
+    out_stream.write(chunk.data(), static_cast<std::streamsize>(std::min(chunk.size(), size - written_size)));
+    const auto end_pos{out_stream.tellp()};
+    written_size += static_cast<std::size_t>(end_pos - start_pos);
+  }
+  out_stream.close();
+  const int fd{open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+  fdatasync(fd);
+  close(fd);
+}
+
+static void writeByBlobWriter(const boost::filesystem::path& path, const std::vector<char>& chunk, std::size_t size,
+                              bool direct_io) {
+  Docker::BlobWriter writer{path, size, 0, direct_io};
+  std::size_t written_size{0};
+  while (written_size < size) {
+    const auto chunk_size{std::min(chunk.size(), size - written_size)};
+    writer.write(chunk.data(), chunk_size);
+    written_size += chunk_size;
+  }
+  writer.sync();
+}
+
+int main(int argc, char** argv) {
+  const boost::filesystem::path dir{argc > 1 ? argv[1] : "."};
+  const std::size_t size{(argc > 2 ? std::stoul(argv[2]) : 1024) * 1024 * 1024};
+  const std::vector<char> chunk(argc > 3 ? std::stoul(argv[3]) : 16 * 1024, 'x');
+  const auto path{dir / "blobwriter-bench.blob"};
+
+  std::cout << "Writing a " << size / (1024 * 1024) << " MiB blob by " << chunk.size() << " byte chunks to " << dir
+            << std::endl;
+  measure("std::ofstream", size, [&]() { writeByStream(path, chunk, size); });
+  boost::filesystem::remove(path);
+  measure("BlobWriter", size, [&]() { writeByBlobWriter(path, chunk, size, false); });
+  boost::filesystem::remove(path);
+  measure("BlobWriter, direct I/O", size, [&]() { writeByBlobWriter(path, chunk, size, true); });
+  boost::filesystem::remove(path);
+  return 0;
+}
@@ -0,0 +1,98 @@
+#include <gtest/gtest.h>
+
+#include <limits>
+
+#include "docker/blobwriter.h"
+#include "utilities/utils.h"
+
+class BlobWriterTest : public ::testing::TestWithParam<bool> {
+ protected:
+  BlobWriterTest() : blob_path_{test_dir_ / "blob"} {
+    for (std::size_t ii = 0; ii < 5 * Docker::BlobWriter::Alignment + 123; ++ii) {
+      data_.push_back(static_cast<char>('a' + ii % 26));
+    }
+  }
+
+  // writes by the odd sized chunks, like the ones received by curl
+  static void write(Docker::BlobWriter& writer, const std::string& data) {
+    static const std::size_t ChunkSize{1000};
+    for (std::size_t pos = 0; pos < data.size(); pos += ChunkSize) {
+      writer.write(data.data() + pos, std::min(ChunkSize, data.size() - pos));
+    }
+  }
+
+  TemporaryDirectory test_dir_;
+  const boost::filesystem::path blob_path_;
+  std::string data_;
+};
+
+TEST_P(BlobWriterTest, Write) {
+  Docker::BlobWriter writer{blob_path_, data_.size(), 0, GetParam(), 2 * Docker::BlobWriter::Alignment};
+  write(writer, data_);
+  ASSERT_EQ(writer.size(), data_.size());
+  writer.sync();
+  ASSERT_EQ(Utils::readFile(blob_path_), data_);
+
+  // the writer truncates the existing file
+  Docker::BlobWriter rewriter{blob_path_, 10, 0, GetParam()};
+  write(rewriter, data_.substr(0, 10));
+  rewriter.sync();
+  ASSERT_EQ(Utils::readFile(blob_path_), data_.substr(0, 10));
+}
+
+TEST_P(BlobWriterTest, Resume) {
+  // the data written before the interruption is kept, the file size tells how much of it has been written
+  const std::size_t offset{Docker::BlobWriter::Alignment + 321};
+  {
+    Docker::BlobWriter writer{blob_path_, data_.size(), 0, GetParam(), 2 * Docker::BlobWriter::Alignment};
+    write(writer, data_.substr(0, offset));
+  }
+  ASSERT_EQ(boost::filesystem::file_size(blob_path_), offset);
+
+  // the resumed writes are unaligned until the first buffer is written out
+  Docker::BlobWriter writer{blob_path_, data_.size(), offset, GetParam(), 2 * Docker::BlobWriter::Alignment};
+  ASSERT_EQ(writer.size(), offset);
+  write(writer, data_.substr(offset));
+  ASSERT_EQ(writer.size(), data_.size());
+  writer.sync();
+  ASSERT_EQ(Utils::readFile(blob_path_), data_);
+}
+
+TEST_P(BlobWriterTest, Reset) {
+  Docker::BlobWriter writer{blob_path_, data_.size(), 0, GetParam(), 2 * Docker::BlobWriter::Alignment};
+  write(writer, data_.substr(0, 3 * Docker::BlobWriter::Alignment));
+  writer.reset();
+  ASSERT_EQ(writer.size(), 0);
+  const std::string data{data_.rbegin(), data_.rend()};
+  write(writer, data);
+  writer.sync();
+  ASSERT_EQ(Utils::readFile(blob_path_), data);
+}
+
+TEST_P(BlobWriterTest, ResetToOffset) {
+  // the data after the offset is dropped, whether it's still buffered or has been written out already
+  const std::size_t offset{Docker::BlobWriter::Alignment + 321};
+  Docker::BlobWriter writer{blob_path_, data_.size(), 0, GetParam(), 2 * Docker::BlobWriter::Alignment};
+  write(writer, data_.substr(0, offset));
+  write(writer, std::string(3 * Docker::BlobWriter::Alignment, 'x'));
+  writer.reset(offset);
+  ASSERT_EQ(writer.size(), offset);
+  ASSERT_EQ(boost::filesystem::file_size(blob_path_), offset);
+  ASSERT_THROW(writer.reset(offset + 1), std::invalid_argument);
+  write(writer, data_.substr(offset));
+  writer.sync();
+  ASSERT_EQ(Utils::readFile(blob_path_), data_);
+}
+
+INSTANTIATE_TEST_SUITE_P(DirectIo, BlobWriterTest, ::testing::Values(false, true));
+
+TEST(BlobWriter, InsufficientStorage) {
+  TemporaryDirectory test_dir;
+  // the storage for the whole blob is allocated before anything is written
+  ASSERT_THROW(Docker::BlobWriter(test_dir / "blob", std::numeric_limits<off_t>::max()), std::runtime_error);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
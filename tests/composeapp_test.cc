@@ -178,6 +178,28 @@ TEST(ComposeApp, Config) {
   config.pacman.extra["storage_watermark"] = "50";
   cfg = ComposeAppManager::Config(config.pacman);
   ASSERT_EQ(cfg.storage_watermark, 50);
+
+  ASSERT_EQ(cfg.apps_fetch_parallelism, 1);
+  config.pacman.extra["apps_fetch_parallelism"] = "0";
+  EXPECT_THROW(ComposeAppManager::Config(config.pacman), std::invalid_argument);
+  config.pacman.extra["apps_fetch_parallelism"] = "foobar";
+  EXPECT_THROW(ComposeAppManager::Config(config.pacman), std::invalid_argument);
+  config.pacman.extra["apps_fetch_parallelism"] = "4";
+  cfg = ComposeAppManager::Config(config.pacman);
+  ASSERT_EQ(cfg.apps_fetch_parallelism, 4);
+
+  ASSERT_EQ(cfg.apps_start_parallelism, 1);
+  ASSERT_TRUE(cfg.apps_start_deps.empty());
+  config.pacman.extra["apps_start_parallelism"] = "0";
+  EXPECT_THROW(ComposeAppManager::Config(config.pacman), std::invalid_argument);
+  config.pacman.extra["apps_start_parallelism"] = "3";
+  config.pacman.extra["apps_start_deps"] = "app-02";
+  EXPECT_THROW(ComposeAppManager::Config(config.pacman), std::invalid_argument);
+  config.pacman.extra["apps_start_deps"] = "app-02:app-01 app-03:app-01,app-02";
+  cfg = ComposeAppManager::Config(config.pacman);
+  ASSERT_EQ(cfg.apps_start_parallelism, 3);
+  ASSERT_EQ(cfg.apps_start_deps.size(), 2);
+  ASSERT_EQ(cfg.apps_start_deps.at("app-03"), std::vector<std::string>({"app-01", "app-02"}));
 }
 
 class TestSysroot: public OSTree::Sysroot {
@@ -0,0 +1,50 @@
+#!/usr/bin/python3
+
+import sys
+import os
+import json
+import logging
+import signal
+import time
+
+
+logger = logging.getLogger("Fake composectl worker")
+
+
+def handle(args):
+    cmd = args[0] if len(args) > 0 else ""
+    if cmd == "echo":
+        return 0, " ".join(args[1:]), ""
+    if cmd == "fail":
+        return int(args[1]), "", args[2]
+    if cmd == "pid":
+        return 0, str(os.getpid()), ""
+    if cmd == "crash-once":
+        # crash if the marker file doesn't exist, so the client has to respawn the worker and retry the request
+        if not os.path.exists(args[1]):
+            open(args[1], "w").close()
+            sys.exit(1)
+        return 0, "recovered", ""
+    if cmd == "hang":
+        time.sleep(3600)
+    if cmd == "hang-ignoring-term":
+        signal.signal(signal.SIGTERM, signal.SIG_IGN)
+        time.sleep(3600)
+    return 1, "", "Unknown command: " + " ".join(args)
+
+
+def main():
+    logging.basicConfig(format="%(asctime)s %(levelname)s: %(message)s", level=logging.INFO)
+    if len(sys.argv) < 2 or sys.argv[1] != "serve":
+        logger.error("Unsupported command: %s", sys.argv[1:])
+        sys.exit(1)
+
+    print(json.dumps({"version": 1}), flush=True)
+    for line in sys.stdin:
+        req = json.loads(line)
+        exit_code, out, err = handle(req["args"])
+        print(json.dumps({"id": req["id"], "exit_code": exit_code, "stdout": out, "stderr": err}), flush=True)
+
+
+if __name__ == "__main__":
+    main()
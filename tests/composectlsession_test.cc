@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+
+#include <signal.h>
+
+#include <boost/filesystem.hpp>
+
+#include "composeapp/session.h"
+#include "utilities/utils.h"
+
+static const std::string FakeWorker{"tests/composectl-worker_fake.py"};
+
+TEST(ComposectlSession, Run) {
+  composeapp::Session session{boost::filesystem::canonical(FakeWorker).string()};
+  {
+    const auto resp{session.run({"echo", "foo", "bar"})};
+    ASSERT_EQ(resp.exit_code, 0);
+    ASSERT_EQ(resp.out, "foo bar");
+    ASSERT_TRUE(resp.err.empty());
+  }
+  {
+    const auto resp{session.run({"fail", "100", "{\"path\": \"/var/sota\"}"})};
+    ASSERT_EQ(resp.exit_code, 100);
+    ASSERT_EQ(resp.err, "{\"path\": \"/var/sota\"}");
+  }
+}
+
+TEST(ComposectlSession, ReusesWorker) {
+  composeapp::Session session{boost::filesystem::canonical(FakeWorker).string()};
+  const auto first_pid{session.run({"pid"}).out};
+  for (int ii = 0; ii < 10; ++ii) {
+    ASSERT_EQ(session.run({"echo", std::to_string(ii)}).out, std::to_string(ii));
+  }
+  ASSERT_EQ(session.run({"pid"}).out, first_pid);
+}
+
+TEST(ComposectlSession, RespawnIfKilled) {
+  composeapp::Session session{boost::filesystem::canonical(FakeWorker).string()};
+  const auto first_pid{session.run({"pid"}).out};
+  ASSERT_EQ(kill(session.pid(), SIGKILL), 0);
+  const auto second_pid{session.run({"pid"}).out};
+  ASSERT_FALSE(second_pid.empty());
+  ASSERT_NE(first_pid, second_pid);
+}
+
+TEST(ComposectlSession, RespawnAndRetryIfCrashed) {
+  TemporaryDirectory dir;
+  composeapp::Session session{boost::filesystem::canonical(FakeWorker).string()};
+  const auto resp{session.run({"crash-once", (dir / "crashed").string()})};
+  ASSERT_EQ(resp.exit_code, 0);
+  ASSERT_EQ(resp.out, "recovered");
+}
+
+TEST(ComposectlSession, Timeout) {
+  composeapp::Session session{boost::filesystem::canonical(FakeWorker).string(), std::chrono::seconds(1)};
+  ASSERT_THROW(session.run({"hang"}), std::runtime_error);
+  // a new worker is started for the following request
+  ASSERT_EQ(session.run({"echo", "foo"}).out, "foo");
+}
+
+TEST(ComposectlSession, StopHungWorker) {
+  composeapp::Session session{boost::filesystem::canonical(FakeWorker).string(), std::chrono::seconds(1)};
+  const auto started{std::chrono::steady_clock::now()};
+  // the worker ignoring SIGTERM is killed once the grace period is over
+  ASSERT_THROW(session.run({"hang-ignoring-term"}), std::runtime_error);
+  ASSERT_LT(std::chrono::steady_clock::now() - started,
+            composeapp::Session::StopGracePeriod + std::chrono::seconds(5));
+  ASSERT_EQ(session.run({"echo", "foo"}).out, "foo");
+}
+
+TEST(ComposectlSession, UnsupportedWorker) {
+  // `ls serve` fails and doesn't print the protocol handshake
+  composeapp::Session session{"ls"};
+  ASSERT_THROW(session.run({"echo"}), composeapp::Session::StartError);
+  composeapp::Session non_existing_session{"non-existing-composectl"};
+  ASSERT_THROW(non_existing_session.run({"echo"}), composeapp::Session::StartError);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
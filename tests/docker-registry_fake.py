@@ -3,46 +3,104 @@
 import os
 import sys
 import argparse
+import hashlib
 import json
 import logging
+import re
 import ssl
+import threading
 
 from http.server import SimpleHTTPRequestHandler, HTTPServer
+from socketserver import ThreadingMixIn
 
 logger = logging.getLogger("Fake Docker Registry")
 
 
 class Handler(SimpleHTTPRequestHandler):
+    def setup(self):
+        super().setup()
+        self.server.count_connection()
+
     def do_GET(self):
         logger.info(">>> GET  %s" % self.path)
 
         if not self.path.startswith('/v2'):
-            self.send_response(404)
-            self.end_headers()
+            self.send_empty_response(404)
             return
 
         # ping call from a client
         if self.path == '/v2/':
-            self.send_response(200)
-            self.end_headers()
+            self.send_empty_response(200)
             return
 
         # /v2/<name>/manifests/<digest>
         # /v2/<name>/blobs/<digest>
         # <digest> = sha256:<hash>
+        full_path = self.get_resource_path()
+        if not full_path:
+            return
+        if not os.path.exists(full_path):
+            self.send_empty_response(404)
+            return
+
+        size = os.path.getsize(full_path)
+        offset = 0
+        range_match = re.match(r'bytes=(\d+)-$', self.headers.get('Range', ''))
+        if range_match and int(range_match.group(1)) < size:
+            offset = int(range_match.group(1))
+            self.send_response(206)
+            self.send_header('Content-Range', 'bytes {}-{}/{}'.format(offset, size - 1, size))
+        else:
+            self.send_response(200)
+        self.send_header('Content-type', 'application/vnd.docker.distribution.manifest.v2+json')
+        self.send_header('Content-Length', str(size - offset))
+        self.end_headers()
+        with open(full_path, 'rb') as f:
+            f.seek(offset)
+            while True:
+                data = f.read(1024)
+                if not data:
+                    break
+                self.wfile.write(data)
+
+    # a monolithic upload of a resource, stored if its content matches its digest
+    def do_PUT(self):
+        logger.info(">>> PUT  %s" % self.path)
+        data = self.rfile.read(int(self.headers.get('Content-Length', 0)))
+        full_path = self.get_resource_path()
+        if not full_path:
+            return
+        if hashlib.sha256(data).hexdigest() != os.path.basename(full_path):
+            self.send_empty_response(400)
+            return
+        os.makedirs(os.path.dirname(full_path), exist_ok=True)
+        with open(full_path, 'wb') as f:
+            f.write(data)
+        self.send_empty_response(201)
+
+    def do_POST(self):
+        self.do_PUT()
+
+    def send_empty_response(self, code):
+        self.send_response(code)
+        self.send_header('Content-Length', '0')
+        self.end_headers()
+
+    def get_resource_path(self):
         digest_indx = self.path.find('sha256')
         if digest_indx == -1:
-            self.send_response(404)
-            self.end_headers()
-            return
+            self.send_empty_response(404)
+            return None
 
         digest = self.path[digest_indx:]
         if not digest.startswith('sha256:'):
+            body = json.dumps({'err': 'Invalid resource hash: ' + digest}).encode()
             self.send_response(400)
             self.send_header('Content-type', 'application/json')
+            self.send_header('Content-Length', str(len(body)))
             self.end_headers()
-            self.wfile.write(json.dumps({'err': 'Invalid resource hash: ' + digest}).encode())
-            return
+            self.wfile.write(body)
+            return None
 
         hash = digest[len('sha256:'):]
         path = self.path[len('/v2/'):digest_indx - 1]
@@ -54,38 +112,43 @@ class Handler(SimpleHTTPRequestHandler):
         # artifact_type = path_elements[4]
         # digest = path_elements[5]
         logger.info(">>> Path: {}; Digest: {}".format(path, digest))
+        return os.path.join(self.server.root_dir, path, hash)
 
-        full_path = os.path.join(self.server.root_dir, path, hash)
-        if not os.path.exists(full_path):
-            self.send_response(404)
-            self.end_headers()
 
-        self.send_response(200)
-        self.send_header('Content-type', 'application/vnd.docker.distribution.manifest.v2+json')
-        self.end_headers()
-        with open(full_path, 'rb') as f:
-            while True:
-                data = f.read(1024)
-                if not data:
-                    break
-                self.wfile.write(data)
+class KeepAliveHandler(Handler):
+    protocol_version = 'HTTP/1.1'
 
 
-class FakeDockerRegistry(HTTPServer):
-    def __init__(self, addr, root_dir):
-        super(HTTPServer, self).__init__(server_address=addr, RequestHandlerClass=Handler)
+class FakeDockerRegistry(ThreadingMixIn, HTTPServer):
+    daemon_threads = True
+
+    def __init__(self, addr, root_dir, keep_alive=False, connections_file=None):
+        super().__init__(addr, KeepAliveHandler if keep_alive else Handler)
         self.root_dir = root_dir
+        self.connections_file = connections_file
+        self.connections = 0
+        self.lock = threading.Lock()
+
+    # the number of the connections accepted so far is written to the file, so a test can check their reuse
+    def count_connection(self):
+        with self.lock:
+            self.connections += 1
+            if self.connections_file:
+                with open(self.connections_file, 'w') as f:
+                    f.write(str(self.connections))
 
 
 def main():
     parser = argparse.ArgumentParser(description='Run a fake Docker Registry')
     parser.add_argument('-p', '--port', type=int, help='server port')
     parser.add_argument('-d', '--dir', type=str, help='registry root dir')
+    parser.add_argument('-k', '--keep-alive', action='store_true', help='keep the connections open between requests')
+    parser.add_argument('-c', '--connections-file', type=str, help='file to write the number of connections to')
 
     args = parser.parse_args()
 
     try:
-        httpd = FakeDockerRegistry(('', args.port), args.dir)
+        httpd = FakeDockerRegistry(('', args.port), args.dir, args.keep_alive, args.connections_file)
         httpd.serve_forever()
     except KeyboardInterrupt:
         httpd.server_close()
@@ -1,8 +1,20 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <future>
+#include <limits>
+#include <thread>
+
+#include <boost/algorithm/hex.hpp>
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/predicate.hpp>
 #include <boost/format.hpp>
 #include "boost/format.hpp"
 
+#include "crypto/crypto.h"
+
 #include "docker/docker.h"
 #include "docker/dockerclient.h"
 #include "test_utils.h"
@@ -102,6 +114,23 @@ TEST(Docker, ParseUriNegative) {
       std::invalid_argument);
 }
 
+TEST(Docker, GetFileHash) {
+  TemporaryDirectory dir;
+  Utils::writeFile(dir / "empty", std::string());
+  ASSERT_EQ(Docker::getFileHash(dir / "empty"), "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+
+  // bigger than the read buffer and not aligned to its size
+  std::string content;
+  while (content.size() < 200 * 1024 + 13) {
+    content += Utils::randomUuid();
+  }
+  Utils::writeFile(dir / "blob", content);
+  ASSERT_EQ(Docker::getFileHash(dir / "blob"),
+            boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(content))));
+
+  ASSERT_THROW(Docker::getFileHash(dir / "non-existing"), std::runtime_error);
+}
+
 TEST(Docker, BearerAuth) {
   {
     const auto auth{
@@ -174,6 +203,413 @@ TEST(Docker, BearerAuthNegative) {
   }
 }
 
+// Serves one manifest, challenges the requests without a token, and counts the credential and token requests
+struct AuthServer {
+  static constexpr const char* const CredsUrl{"https://ota-lite/hub-creds/"};
+  static constexpr const char* const TokenUrl{"https://hub-auth.foundries.io/token-auth/"};
+
+  Docker::Uri uri(const std::string& repo) const {
+    const auto hash{boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(manifest)))};
+    return Docker::Uri::parseUri("hub.foundries.io/factory/" + repo + "@sha256:" + hash);
+  }
+
+  std::string manifest{"{\"schemaVersion\":2}"};
+  int expires_in{300};
+  std::atomic<int> creds_requests{0};
+  std::atomic<int> token_requests{0};
+  std::atomic<int> token{0};
+};
+
+class AuthHttpClient : public fixtures::BaseHttpClient {
+ public:
+  AuthHttpClient(AuthServer& server, const std::vector<std::string>* headers) : server_{server}, headers_{headers} {}
+
+  HttpResponse get(const std::string& url, int64_t maxsize) override {
+    (void)maxsize;
+    if (url == AuthServer::CredsUrl) {
+      ++server_.creds_requests;
+      return HttpResponse("{\"Secret\":\"secret\",\"Username\":\"test-user\"}", 200, CURLE_OK, "");
+    }
+    if (boost::starts_with(url, AuthServer::TokenUrl)) {
+      ++server_.token_requests;
+      Json::Value token;
+      token["token"] = std::to_string(++server_.token);
+      token["expires_in"] = server_.expires_in;
+      return HttpResponse(Utils::jsonToCanonicalStr(token), 200, CURLE_OK, "");
+    }
+    const auto repo{url.substr(url.find("factory/") + 8, url.find("/manifests/") - url.find("factory/") - 8)};
+    for (const auto& header : *headers_) {
+      if (header == "authorization: bearer " + std::to_string(server_.token)) {
+        return HttpResponse(server_.manifest, 200, CURLE_OK, "");
+      }
+    }
+    return HttpResponse("", 401, CURLE_OK, "Unauthorized",
+                        {{"www-authenticate", std::string("bearer realm=\"") + AuthServer::TokenUrl +
+                                                  "\",service=\"registry\",scope=\"repository:factory/" + repo +
+                                                  ":pull\""}});
+  }
+
+ private:
+  AuthServer& server_;
+  const std::vector<std::string>* headers_;
+};
+
+TEST(Docker, AuthTokenCache) {
+  AuthServer server;
+  auto ota_lite_client{std::make_shared<AuthHttpClient>(server, nullptr)};
+  Docker::RegistryClient client{ota_lite_client, AuthServer::CredsUrl,
+                                [&server](const std::vector<std::string>* headers, const std::set<std::string>*) {
+                                  return std::make_shared<AuthHttpClient>(server, headers);
+                                }};
+
+  // the token is requested once per scope, the credentials just once
+  for (int ii = 0; ii < 3; ++ii) {
+    ASSERT_EQ(client.getAppManifest(server.uri("app-01"), Docker::ImageManifest::Format), server.manifest);
+  }
+  ASSERT_EQ(server.creds_requests, 1);
+  ASSERT_EQ(server.token_requests, 1);
+  ASSERT_EQ(client.getAppManifest(server.uri("app-02"), Docker::ImageManifest::Format), server.manifest);
+  ASSERT_EQ(server.creds_requests, 1);
+  ASSERT_EQ(server.token_requests, 2);
+
+  // the token expiring before the next request can complete is not reused
+  server.expires_in = Docker::RegistryClient::TokenExpiryMargin.count();
+  Docker::RegistryClient expiring_client{ota_lite_client, AuthServer::CredsUrl,
+                                         [&server](const std::vector<std::string>* headers,
+                                                   const std::set<std::string>*) {
+                                           return std::make_shared<AuthHttpClient>(server, headers);
+                                         }};
+  for (int ii = 0; ii < 2; ++ii) {
+    ASSERT_EQ(expiring_client.getAppManifest(server.uri("app-01"), Docker::ImageManifest::Format), server.manifest);
+  }
+  ASSERT_EQ(server.creds_requests, 2);
+  ASSERT_EQ(server.token_requests, 4);
+}
+
+// Serves one blob, supports Range requests and resuming a download unless told otherwise
+struct BlobServer {
+  explicit BlobServer(std::size_t size) {
+    while (blob.size() < size) {
+      blob += Utils::randomUuid();
+    }
+  }
+  Docker::Uri uri() const {
+    return Docker::Uri::parseUri("hub.foundries.io/factory/app@sha256:" +
+                                 boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(blob))));
+  }
+
+  std::string blob;
+  bool ranges_supported{true};
+  // the connection breaks once this number of bytes is served
+  std::size_t max_served{std::numeric_limits<std::size_t>::max()};
+  std::atomic<int> requests{0};
+  std::atomic<std::size_t> served{0};
+  // the requests without the current token are challenged, the token is revoked once it authorizes this many requests
+  bool auth_required{false};
+  int revoke_token_after{0};
+  std::atomic<int> token{0};
+  std::atomic<int> token_requests{0};
+  std::atomic<int> authorized_requests{0};
+};
+
+class BlobHttpClient : public fixtures::BaseHttpClient {
+ public:
+  BlobHttpClient(BlobServer& server, const std::vector<std::string>* headers) : server_{server}, headers_{headers} {}
+
+  HttpResponse get(const std::string& url, int64_t maxsize) override {
+    (void)maxsize;
+    if (url == AuthServer::CredsUrl) {
+      return HttpResponse("{\"Secret\":\"secret\",\"Username\":\"test-user\"}", 200, CURLE_OK, "");
+    }
+    ++server_.token_requests;
+    Json::Value token;
+    token["token"] = std::to_string(++server_.token);
+    return HttpResponse(Utils::jsonToCanonicalStr(token), 200, CURLE_OK, "");
+  }
+
+  HttpResponse download(const std::string& url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                        void* userp, curl_off_t from) override {
+    ++server_.requests;
+    if (server_.auth_required && !isAuthorized()) {
+      // the error body is received by the write callback as any other
+      std::string error{"{\"errors\":[{\"code\":\"UNAUTHORIZED\",\"message\":\"authentication required\"}]}"};
+      write_cb(&error[0], error.size(), 1, userp);
+      return HttpResponse("", 401, CURLE_OK, "Unauthorized",
+                          {{"www-authenticate", std::string("bearer realm=\"") + AuthServer::TokenUrl +
+                                                    "\",service=\"registry\",scope=\"repository:factory/app:pull\""}});
+    }
+    std::string data{server_.blob};
+    long status{200};
+    if (server_.ranges_supported && from > 0) {
+      data = server_.blob.substr(static_cast<std::size_t>(from));
+      status = 206;
+    }
+    for (const auto& header : *headers_) {
+      std::size_t first;
+      std::size_t last;
+      if (server_.ranges_supported && std::sscanf(header.c_str(), "range: bytes=%zu-%zu", &first, &last) == 2) {
+        data = server_.blob.substr(first, last - first + 1);
+        status = 206;
+      }
+    }
+    const auto served{server_.served.fetch_add(data.size())};
+    const bool broken{served + data.size() > server_.max_served};
+    if (broken) {
+      data.resize(served < server_.max_served ? server_.max_served - served : 0);
+    }
+    if (write_cb(const_cast<char*>(data.c_str()), data.size(), 1, userp) != data.size()) {
+      return HttpResponse("", status, CURLE_WRITE_ERROR, "Failed writing received data");
+    }
+    if (broken) {
+      return HttpResponse("", status, CURLE_RECV_ERROR, "Connection reset by peer");
+    }
+    return HttpResponse("", status, CURLE_OK, "");
+  }
+
+ private:
+  bool isAuthorized() {
+    for (const auto& header : *headers_) {
+      if (header == "authorization: bearer " + std::to_string(server_.token)) {
+        if (++server_.authorized_requests == server_.revoke_token_after) {
+          // the token is revoked, e.g. it has expired earlier than the client has been told
+          ++server_.token;
+        }
+        return true;
+      }
+    }
+    return false;
+  }
+
+  BlobServer& server_;
+  const std::vector<std::string>* headers_;
+};
+
+static Docker::RegistryClient::HttpClientFactory getBlobClientFactory(BlobServer& server) {
+  return [&server](const std::vector<std::string>* headers, const std::set<std::string>*) {
+    return std::make_shared<BlobHttpClient>(server, headers);
+  };
+}
+
+TEST(Docker, DownloadBlobByRanges) {
+  TemporaryDirectory dir;
+  Docker::RangeDownloadConfig cfg;
+  cfg.min_blob_size = 64 * 1024;
+  cfg.min_range_size = 64 * 1024;
+  cfg.max_range_size = 128 * 1024;
+
+  for (const bool ranges_supported : {true, false}) {
+    BlobServer server{1024 * 1024 + 13};
+    server.ranges_supported = ranges_supported;
+    const auto uri{server.uri()};
+    Docker::RegistryClient client{nullptr, "", getBlobClientFactory(server), cfg};
+    client.downloadBlob(uri, dir / "blob", server.blob.size());
+    ASSERT_EQ(Utils::readFile(dir / "blob"), server.blob);
+    if (ranges_supported) {
+      // at least a range of the minimum size and the ones of the maximum size
+      ASSERT_GE(server.requests, 1 + (server.blob.size() - cfg.min_range_size) / cfg.max_range_size);
+    } else {
+      // the probe for ranges and the whole blob download
+      ASSERT_EQ(server.requests, 2);
+    }
+
+    // the registry not supporting ranges is not probed again
+    server.requests = 0;
+    client.downloadBlob(uri, dir / "blob", server.blob.size());
+    ASSERT_EQ(Utils::readFile(dir / "blob"), server.blob);
+    ASSERT_EQ(server.requests > 1, ranges_supported);
+
+    const auto wrong_uri{uri.createUri(
+        Docker::HashedDigest{"sha256:e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"})};
+    ASSERT_THROW(client.downloadBlob(wrong_uri, dir / "wrong-blob", server.blob.size()), std::runtime_error);
+    ASSERT_FALSE(boost::filesystem::exists(dir / "wrong-blob"));
+  }
+}
+
+TEST(Docker, DownloadBlobByRangesAuth) {
+  TemporaryDirectory dir;
+  Docker::RangeDownloadConfig cfg;
+  cfg.min_blob_size = 64 * 1024;
+  cfg.min_range_size = 64 * 1024;
+  cfg.max_range_size = 64 * 1024;
+
+  BlobServer server{1024 * 1024 + 13};
+  server.auth_required = true;
+  server.revoke_token_after = 5;
+  Docker::RegistryClient client{std::make_shared<BlobHttpClient>(server, nullptr), AuthServer::CredsUrl,
+                                getBlobClientFactory(server), cfg};
+  // the 401 response's body received for the first range is discarded, and the token revoked in the middle of the
+  // blob is renewed, the challenged ranges are requested again
+  client.downloadBlob(server.uri(), dir / "blob", server.blob.size());
+  ASSERT_EQ(Utils::readFile(dir / "blob"), server.blob);
+  ASSERT_EQ(server.token_requests, 2);
+}
+
+TEST(Docker, ResumeBlobDownload) {
+  TemporaryDirectory dir;
+  Docker::RangeDownloadConfig cfg;
+  cfg.min_blob_size = 512 * 1024;
+  cfg.min_range_size = 64 * 1024;
+  cfg.max_range_size = 64 * 1024;
+
+  // downloaded by one stream and by ranges
+  for (const std::size_t size : {256 * 1024 + 13, 1024 * 1024 + 13}) {
+    BlobServer server{size};
+    const auto uri{server.uri()};
+    const auto blob_path{dir / std::to_string(size)};
+    server.max_served = server.blob.size() / 2;
+    {
+      Docker::RegistryClient client{nullptr, "", getBlobClientFactory(server), cfg, dir / "partial"};
+      ASSERT_THROW(client.downloadBlob(uri, blob_path, server.blob.size()), std::runtime_error);
+      ASSERT_FALSE(boost::filesystem::exists(blob_path));
+    }
+
+    // a new client, like after a restart, downloads just the rest of the blob
+    server.max_served = std::numeric_limits<std::size_t>::max();
+    server.served = 0;
+    Docker::RegistryClient client{nullptr, "", getBlobClientFactory(server), cfg, dir / "partial"};
+    client.downloadBlob(uri, blob_path, server.blob.size());
+    ASSERT_EQ(Utils::readFile(blob_path), server.blob);
+    // a range being downloaded when the connection broke is downloaded again
+    const auto redownloaded{cfg.max_range_size * cfg.max_parallel_ranges};
+    ASSERT_LE(server.served, server.blob.size() - server.blob.size() / 2 + redownloaded);
+    ASSERT_TRUE(boost::filesystem::is_empty(dir / "partial"));
+  }
+
+  // the 401 response's body received by the resumed download is discarded, the download is not started over
+  for (const bool batch : {false, true}) {
+    BlobServer server{256 * 1024 + 13};
+    server.auth_required = true;
+    const auto blob_path{dir / ("auth-blob-" + std::to_string(batch))};
+    auto download{[&]() {
+      Docker::RegistryClient client{std::make_shared<BlobHttpClient>(server, nullptr), AuthServer::CredsUrl,
+                                    getBlobClientFactory(server), cfg, dir / "partial"};
+      if (batch) {
+        client.downloadBlobs({{server.uri(), blob_path, server.blob.size()}});
+      } else {
+        client.downloadBlob(server.uri(), blob_path, server.blob.size());
+      }
+    }};
+    server.max_served = server.blob.size() / 2;
+    ASSERT_THROW(download(), std::runtime_error);
+    server.max_served = std::numeric_limits<std::size_t>::max();
+    server.served = 0;
+    download();
+    ASSERT_EQ(Utils::readFile(blob_path), server.blob);
+    ASSERT_EQ(server.served, server.blob.size() - server.blob.size() / 2);
+    ASSERT_EQ(server.token_requests, 2);
+    ASSERT_TRUE(boost::filesystem::is_empty(dir / "partial"));
+  }
+
+  // the partial blob is not resumed if the registry cannot do it
+  BlobServer server{256 * 1024 + 13};
+  server.ranges_supported = false;
+  server.max_served = server.blob.size() / 2;
+  Docker::RegistryClient client{nullptr, "", getBlobClientFactory(server), cfg, dir / "partial"};
+  ASSERT_THROW(client.downloadBlob(server.uri(), dir / "blob", server.blob.size()), std::runtime_error);
+  server.max_served = std::numeric_limits<std::size_t>::max();
+  client.downloadBlob(server.uri(), dir / "blob", server.blob.size());
+  ASSERT_EQ(Utils::readFile(dir / "blob"), server.blob);
+
+  // the partial blobs are removed on request, e.g. by the App store prune
+  server.max_served = server.served + server.blob.size() / 2;
+  ASSERT_THROW(client.downloadBlob(server.uri(), dir / "blob", server.blob.size()), std::runtime_error);
+  ASSERT_FALSE(boost::filesystem::is_empty(dir / "partial"));
+  client.removePartialBlobs();
+  ASSERT_TRUE(boost::filesystem::is_empty(dir / "partial"));
+}
+
+// Serves the blobs of the given servers, the downloads started by `downloadAsync()` run concurrently
+class BlobsHttpClient : public fixtures::BaseHttpClient {
+ public:
+  BlobsHttpClient(std::vector<std::unique_ptr<BlobServer>>& servers, const std::vector<std::string>* headers,
+                  std::atomic<int>& in_flight, std::atomic<int>& max_in_flight)
+      : servers_{servers}, headers_{headers}, in_flight_{in_flight}, max_in_flight_{max_in_flight} {}
+
+  HttpResponse download(const std::string& url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                        void* userp, curl_off_t from) override {
+    for (auto& server : servers_) {
+      if (boost::ends_with(url, server->uri().digest())) {
+        return BlobHttpClient{*server, headers_}.download(url, write_cb, progress_cb, userp, from);
+      }
+    }
+    return HttpResponse("", 404, CURLE_OK, "Not Found");
+  }
+
+  std::future<HttpResponse> downloadAsync(const std::string& url, curl_write_callback write_cb,
+                                          curl_xferinfo_callback progress_cb, void* userp, curl_off_t from,
+                                          CurlHandler*) override {
+    // the range requests are made by the blob's transfer, so they are not counted
+    const bool is_range{headers_ != nullptr &&
+                        std::any_of(headers_->begin(), headers_->end(),
+                                    [](const std::string& header) { return boost::starts_with(header, "range:"); })};
+    if (is_range) {
+      return std::async(std::launch::async, [this, url, write_cb, progress_cb, userp, from]() {
+        return download(url, write_cb, progress_cb, userp, from);
+      });
+    }
+    return std::async(std::launch::async, [this, url, write_cb, progress_cb, userp, from]() {
+      const auto in_flight{++in_flight_};
+      for (auto max{max_in_flight_.load()}; in_flight > max && !max_in_flight_.compare_exchange_weak(max, in_flight);) {
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      auto resp{download(url, write_cb, progress_cb, userp, from)};
+      --in_flight_;
+      return resp;
+    });
+  }
+
+ private:
+  std::vector<std::unique_ptr<BlobServer>>& servers_;
+  const std::vector<std::string>* headers_;
+  std::atomic<int>& in_flight_;
+  std::atomic<int>& max_in_flight_;
+};
+
+TEST(Docker, DownloadBlobs) {
+  TemporaryDirectory dir;
+  Docker::RangeDownloadConfig cfg;
+  cfg.min_blob_size = 512 * 1024;
+  cfg.min_range_size = 64 * 1024;
+  cfg.max_range_size = 128 * 1024;
+  std::vector<std::unique_ptr<BlobServer>> servers;
+  // the largest one is downloaded by ranges
+  for (const std::size_t size : {1024, 16 * 1024 + 7, 64 * 1024, 100 * 1024 + 3, 1024 * 1024 + 13}) {
+    servers.emplace_back(std::make_unique<BlobServer>(size));
+  }
+  std::atomic<int> in_flight{0};
+  std::atomic<int> max_in_flight{0};
+  Docker::RegistryClient client{
+      nullptr, "",
+      [&](const std::vector<std::string>* headers, const std::set<std::string>*) {
+        return std::make_shared<BlobsHttpClient>(servers, headers, in_flight, max_in_flight);
+      },
+      cfg, dir / "partial"};
+
+  std::vector<Docker::BlobDownload> blobs;
+  for (std::size_t ii = 0; ii < servers.size(); ++ii) {
+    blobs.push_back({servers[ii]->uri(), dir / std::to_string(ii), servers[ii]->blob.size()});
+  }
+  // a blob listed twice is downloaded once
+  blobs.push_back({servers.front()->uri(), dir / "copy", servers.front()->blob.size()});
+  client.downloadBlobs(blobs, 2);
+  for (std::size_t ii = 0; ii < servers.size(); ++ii) {
+    ASSERT_EQ(Utils::readFile(dir / std::to_string(ii)), servers[ii]->blob);
+  }
+  ASSERT_EQ(Utils::readFile(dir / "copy"), servers.front()->blob);
+  ASSERT_EQ(servers.front()->requests, 1);
+  ASSERT_GE(max_in_flight, 1);
+  ASSERT_LE(max_in_flight, 2);
+  ASSERT_TRUE(boost::filesystem::is_empty(dir / "partial"));
+
+  // the blob of unexpected size is removed, and the blobs following the failure are not downloaded
+  const std::vector<Docker::BlobDownload> failing_blobs{
+      {servers[1]->uri(), dir / "wrong-size", servers[1]->blob.size() + 1},
+      {servers[2]->uri(), dir / "not-started", servers[2]->blob.size()}};
+  ASSERT_THROW(client.downloadBlobs(failing_blobs, 1), std::runtime_error);
+  ASSERT_FALSE(boost::filesystem::exists(dir / "wrong-size"));
+  ASSERT_FALSE(boost::filesystem::exists(dir / "not-started"));
+}
+
 class ImageTest : virtual public ::testing::Test {
  protected:
   void SetUp() override {
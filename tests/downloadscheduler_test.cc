@@ -0,0 +1,158 @@
+#include <gtest/gtest.h>
+
+#include <future>
+#include <thread>
+
+#include "downloadscheduler.h"
+
+#include "fixtures/basehttpclient.cc"
+
+using Class = DownloadScheduler::Class;
+
+static bool isBlocked(std::future<void>& waited) {
+  return waited.wait_for(std::chrono::milliseconds(200)) == std::future_status::timeout;
+}
+
+TEST(DownloadScheduler, Priority) {
+  DownloadScheduler scheduler;
+  {
+    // the less urgent and same class transfers don't hold the transfer
+    DownloadScheduler::Transfer blob{scheduler, Class::AppBlob};
+    DownloadScheduler::Transfer report{scheduler, Class::Report};
+    DownloadScheduler::Transfer other_blob{scheduler, Class::AppBlob};
+    ASSERT_FALSE(blob.paused());
+
+    // the more urgent transfer pauses it until the urgent one completes
+    auto metadata{std::make_unique<DownloadScheduler::Transfer>(scheduler, Class::Metadata)};
+    ASSERT_TRUE(blob.paused());
+    ASSERT_FALSE(metadata->paused());
+    metadata.reset();
+    ASSERT_FALSE(blob.paused());
+  }
+
+  // a request-level transfer is held before it is sent
+  auto ostree{std::make_unique<DownloadScheduler::Transfer>(scheduler, Class::Ostree)};
+  DownloadScheduler::Transfer report{scheduler, Class::Report};
+  auto waited{std::async(std::launch::async, [&report]() { report.wait(); })};
+  ASSERT_TRUE(isBlocked(waited));
+  ostree.reset();
+  ASSERT_FALSE(isBlocked(waited));
+}
+
+TEST(DownloadScheduler, Background) {
+  DownloadScheduler scheduler;
+  auto prefetch{std::make_unique<DownloadScheduler::Session>(scheduler, true)};
+  DownloadScheduler::Transfer prefetch_blob{scheduler, Class::AppBlob};
+  {
+    // the background transfers are prioritized among themselves
+    auto prefetch_ostree{std::make_unique<DownloadScheduler::Transfer>(scheduler, Class::Ostree)};
+    ASSERT_TRUE(prefetch_blob.paused());
+    prefetch_ostree.reset();
+    ASSERT_FALSE(prefetch_blob.paused());
+  }
+
+  // a foreground session pauses the background transfers, its transfers are not held by the paused ones
+  DownloadScheduler::Transfer prefetch_ostree{scheduler, Class::Ostree};
+  std::future<void> prefetch_waited;
+  {
+    DownloadScheduler::Session install{scheduler, false};
+    DownloadScheduler::Transfer install_blob{scheduler, Class::AppBlob};
+    ASSERT_FALSE(install_blob.paused());
+    ASSERT_TRUE(prefetch_ostree.paused());
+    prefetch_waited = std::async(std::launch::async, [&prefetch_ostree]() { prefetch_ostree.wait(); });
+    ASSERT_TRUE(isBlocked(prefetch_waited));
+  }
+  ASSERT_FALSE(isBlocked(prefetch_waited));
+
+  // the transfers started once the prefetch is over are foreground ones
+  prefetch.reset();
+  DownloadScheduler::Transfer blob{scheduler, Class::AppBlob};
+  DownloadScheduler::Session install{scheduler, false};
+  ASSERT_FALSE(blob.paused());
+}
+
+TEST(DownloadScheduler, MaxRate) {
+  DownloadScheduler scheduler;
+  scheduler.setMaxRate(1024 * 1024);
+  DownloadScheduler::Transfer metadata{scheduler, Class::Metadata};
+
+  const auto started{std::chrono::steady_clock::now()};
+  // the request-level transfers delay the following transfers by their size
+  metadata.account(256 * 1024);
+  ASSERT_LT(std::chrono::steady_clock::now() - started, std::chrono::milliseconds(100));
+  std::vector<std::thread> threads;
+  for (int ii = 0; ii < 3; ++ii) {
+    threads.emplace_back([&metadata]() { metadata.consume(256 * 1024); });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  // all transfers share the rate
+  ASSERT_GE(std::chrono::steady_clock::now() - started, std::chrono::milliseconds(950));
+
+  // the refunded data, e.g. a discarded error response, doesn't delay the following transfers
+  const auto refunded_started{std::chrono::steady_clock::now()};
+  metadata.account(1024 * 1024);
+  metadata.refund(1024 * 1024);
+  metadata.consume(1024);
+  ASSERT_LT(std::chrono::steady_clock::now() - refunded_started, std::chrono::milliseconds(100));
+
+  scheduler.setMaxRate(0);
+  const auto unlimited_started{std::chrono::steady_clock::now()};
+  metadata.consume(1024 * 1024 * 1024);
+  ASSERT_LT(std::chrono::steady_clock::now() - unlimited_started, std::chrono::milliseconds(100));
+}
+
+class ChunkedHttpClient : public fixtures::BaseHttpClient {
+ public:
+  HttpResponse get(const std::string& url, int64_t maxsize) override {
+    (void)url;
+    (void)maxsize;
+    return HttpResponse("body", 200, CURLE_OK, "");
+  }
+  HttpResponse download(const std::string& url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                        void* userp, curl_off_t from) override {
+    (void)url;
+    (void)progress_cb;
+    (void)from;
+    std::string data{"chunk"};
+    for (int ii = 0; ii < 3; ++ii) {
+      if (write_cb(&data[0], 1, data.size(), userp) != data.size()) {
+        return HttpResponse("", 200, CURLE_WRITE_ERROR, "");
+      }
+    }
+    return HttpResponse("", 200, CURLE_OK, "");
+  }
+};
+
+static size_t WriteHandler(char* data, size_t buf_size, size_t buf_numb, void* user_ctx) {
+  reinterpret_cast<std::string*>(user_ctx)->append(data, buf_size * buf_numb);
+  return buf_size * buf_numb;
+}
+
+TEST(DownloadScheduler, HttpClient) {
+  DownloadScheduler scheduler;
+  auto client{std::make_shared<ScheduledHttpClient>(std::make_shared<ChunkedHttpClient>(), Class::AppBlob, scheduler)};
+
+  // the data is passed through to the caller's handler
+  std::string data;
+  ASSERT_TRUE(client->download("https://hub.foundries.io/v2/blob", WriteHandler, nullptr, &data, 0).isOk());
+  ASSERT_EQ(data, "chunkchunkchunk");
+  data.clear();
+  ASSERT_TRUE(client->downloadAsync("https://hub.foundries.io/v2/blob", WriteHandler, nullptr, &data, 0, nullptr)
+                  .get()
+                  .isOk());
+  ASSERT_EQ(data, "chunkchunkchunk");
+
+  // the requests are held by the more urgent transfers
+  auto metadata{std::make_unique<DownloadScheduler::Transfer>(scheduler, Class::Metadata)};
+  auto resp{std::async(std::launch::async, [&client]() { return client->get("https://ota-lite/", 0); })};
+  ASSERT_EQ(resp.wait_for(std::chrono::milliseconds(200)), std::future_status::timeout);
+  metadata.reset();
+  ASSERT_EQ(resp.get().body, "body");
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,97 @@
+// Compares the posix_spawn based exec() with the former popen/shell based implementation.
+//
+// Usage: exec-bench [<iterations>]
+//
+// Two workloads are measured:
+//  - spawn: many short-lived processes producing little output, e.g. `composectl ps`, `tar -tf`;
+//  - output: a single process producing a lot of output, e.g. `skopeo copy` or `composectl pull` progress.
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+
+#include "exec.h"
+
+// The former implementation, kept verbatim (apart from logging) for the sake of comparison
+static void legacyExec(const std::string& cmd, const std::string& err_msg_prefix,
+                       const boost::filesystem::path& start_dir = "", std::string* output = nullptr,
+                       const std::string& timeout = "900s") {
+  std::string command;
+  if (!timeout.empty()) {
+    command += "timeout " + timeout + " ";
+  }
+  command += cmd + " 2>&1";
+  if (!start_dir.empty()) {
+    command = "cd " + start_dir.string() + " && " + command;
+  }
+
+  FILE* pipe = popen(command.c_str(), "r");
+  if (!pipe) {
+    throw std::runtime_error("exec: popen() failed!");
+  }
+  std::string result;
+  std::array<char, 128> buffer_array = {};
+  char* buffer = buffer_array.data();
+  while (std::fgets(buffer, sizeof(buffer_array), pipe) != nullptr) {
+    result += buffer;
+  }
+  if (output != nullptr) {
+    *output = result;
+  }
+  const int exit_code = WEXITSTATUS(pclose(pipe));
+  if (exit_code == 124) {
+    throw std::runtime_error("Timeout occurred while waiting for a child process completion");
+  }
+  if (exit_code != EXIT_SUCCESS) {
+    throw ExecError(err_msg_prefix, cmd, result, exit_code);
+  }
+}
+
+template <typename Func>
+static double measure(const std::string& name, int iterations, Func&& func) {
+  const auto started{std::chrono::steady_clock::now()};
+  for (int ii = 0; ii < iterations; ++ii) {
+    func();
+  }
+  const std::chrono::duration<double, std::milli> elapsed{std::chrono::steady_clock::now() - started};
+  std::cout << "  " << name << ": " << elapsed.count() << " ms total, " << elapsed.count() / iterations
+            << " ms per run" << std::endl;
+  return elapsed.count();
+}
+
+int main(int argc, char** argv) {
+  const int iterations{argc > 1 ? std::stoi(argv[1]) : 200};
+  const auto start_dir{boost::filesystem::temp_directory_path()};
+
+  std::cout << "spawn, `true` x " << iterations << std::endl;
+  const auto legacy_spawn{measure("popen", iterations, [&]() { legacyExec("true", "failed", start_dir); })};
+  const auto new_spawn{measure("posix_spawn", iterations, [&]() { exec("true", "failed", start_dir); })};
+
+  const int output_iterations{std::max(iterations / 20, 1)};
+  std::cout << "output, 64MiB of 80 column lines x " << output_iterations << std::endl;
+  std::string out;
+  const auto legacy_output{measure("popen", output_iterations, [&]() {
+    legacyExec("sh -c 'yes 0123456789012345678901234567890123456789012345678901234567890123456789012345678 | head "
+               "-c 67108864'",
+               "failed", start_dir, &out);
+  })};
+  const auto new_output{measure("posix_spawn", output_iterations, [&]() {
+    out.clear();
+    Process::Options options;
+    options.start_dir = start_dir;
+    options.out_handler = [&out](const char* data, std::size_t size) { out.append(data, size); };
+    Process proc{{"sh", "-c",
+                  "yes 0123456789012345678901234567890123456789012345678901234567890123456789012345678 | head -c "
+                  "67108864"},
+                 options};
+    proc.wait();
+  })};
+
+  std::cout << "speedup: spawn x" << legacy_spawn / new_spawn << ", output x" << legacy_output / new_output
+            << std::endl;
+  return 0;
+}
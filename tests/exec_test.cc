@@ -41,6 +41,216 @@ TEST(Exec, SuccessfulExecFailedExecutable) {
   }
 }
 
+TEST(Exec, Output) {
+  std::string output;
+  exec("echo -n foo", "echo failed", "", &output);
+  ASSERT_EQ("foo", output);
+  // stderr is merged into the output and the error message
+  exec(std::vector<std::string>{"sh", "-c", "echo -n foo >&2"}, "echo failed", "", &output);
+  ASSERT_EQ("foo", output);
+  try {
+    exec(std::vector<std::string>{"sh", "-c", "echo -n out; sleep 0.2; echo -n err >&2; exit 3"}, "sh failed", "",
+         &output);
+    FAIL() << "the failed command must throw";
+  } catch (const ExecError& exc) {
+    ASSERT_EQ("outerr", output);
+    ASSERT_EQ("outerr", exc.StdErr);
+    ASSERT_EQ(3, exc.ExitCode);
+  }
+}
+
+TEST(Exec, PathArgument) {
+  TemporaryDirectory test_dir;
+  // boost::filesystem::path is formatted in double quotes, they are removed as the shell does it
+  const auto test_file{test_dir / "test file"};
+  exec(boost::format{"touch %s"} % test_file, "touch failed");
+  ASSERT_TRUE(boost::filesystem::exists(test_file));
+  std::string output;
+  exec(boost::format{"ls %s"} % test_dir.Path(), "ls failed", "", &output);
+  ASSERT_EQ("test file\n", output);
+}
+
+TEST(Exec, Quoting) {
+  std::string output;
+  exec(R"(printf %s|%s|%s|%s 'single "quoted"' "double \"quoted\" \$" back\ slash "")", "printf failed", "", &output);
+  ASSERT_EQ(R"(single "quoted"|double "quoted" $|back slash|)", output);
+  ASSERT_THROW(exec("echo 'unterminated", "echo failed"), std::invalid_argument);
+}
+
+TEST(Exec, ArgumentVector) {
+  // the arguments are passed as is, neither split nor unquoted
+  std::string output;
+  exec(std::vector<std::string>{"printf", "%s|%s", "a path/with spaces", "\"quoted\""}, "printf failed", "", &output);
+  ASSERT_EQ(R"(a path/with spaces|"quoted")", output);
+}
+
+TEST(Exec, Timeout) {
+  const auto started{std::chrono::steady_clock::now()};
+  ASSERT_THROW(exec("sleep 10", "sleep failed", "", nullptr, "1s"), ExecTimeoutError);
+  ASSERT_LT(std::chrono::steady_clock::now() - started, std::chrono::seconds(5));
+}
+
+TEST(Process, SeparateOutputs) {
+  std::string out;
+  std::string err;
+  Process::Options options;
+  options.out_handler = [&out](const char* data, std::size_t size) { out.append(data, size); };
+  options.err_handler = [&err](const char* data, std::size_t size) { err.append(data, size); };
+  Process proc{{"sh", "-c", "echo -n out; echo -n err >&2; exit 3"}, options};
+  ASSERT_EQ(3, proc.wait());
+  ASSERT_EQ("out", out);
+  ASSERT_EQ("err", err);
+}
+
+TEST(Process, StreamOutput) {
+  // make sure the output is delivered as soon as it is written, not after the child exits
+  std::string out;
+  std::chrono::steady_clock::time_point first_received;
+  Process::Options options;
+  options.out_handler = [&out, &first_received](const char* data, std::size_t size) {
+    if (out.empty()) {
+      first_received = std::chrono::steady_clock::now();
+    }
+    out.append(data, size);
+  };
+  Process proc{{"sh", "-c", "echo 1; sleep 1; echo 2"}, options};
+  ASSERT_EQ(0, proc.wait());
+  ASSERT_EQ("1\n2\n", out);
+  ASSERT_GE(std::chrono::steady_clock::now() - first_received, std::chrono::milliseconds(500));
+}
+
+TEST(Process, LargeOutput) {
+  std::size_t received{0};
+  Process::Options options;
+  options.out_handler = [&received](const char*, std::size_t size) { received += size; };
+  Process proc{{"head", "-c", "10000000", "/dev/zero"}, options};
+  ASSERT_EQ(0, proc.wait());
+  ASSERT_EQ(10000000, received);
+}
+
+TEST(Process, StartDirAndEnv) {
+  TemporaryDirectory test_dir;
+  std::string out;
+  Process::Options options;
+  options.start_dir = test_dir.Path();
+  options.env = {"AKLITE_TEST_VAR=foo"};
+  options.out_handler = [&out](const char* data, std::size_t size) { out.append(data, size); };
+  Process proc{{"sh", "-c", "echo -n $(pwd):$AKLITE_TEST_VAR"}, options};
+  ASSERT_EQ(0, proc.wait());
+  ASSERT_EQ(boost::filesystem::canonical(test_dir.Path()).string() + ":foo", out);
+}
+
+TEST(Process, TimeoutIgnoringSigterm) {
+  Process::Options options;
+  options.timeout = std::chrono::milliseconds(200);
+  Process proc{{"sh", "-c", "trap '' TERM; sleep 30"}, options};
+  const auto started{std::chrono::steady_clock::now()};
+  ASSERT_THROW(proc.wait(), ExecTimeoutError);
+  ASSERT_LT(std::chrono::steady_clock::now() - started, Process::KillGracePeriod + std::chrono::seconds(5));
+}
+
+TEST(Process, ParseTimeout) {
+  ASSERT_EQ(std::chrono::milliseconds(0), Process::parseTimeout(""));
+  ASSERT_EQ(std::chrono::seconds(900), Process::parseTimeout("900s"));
+  ASSERT_EQ(std::chrono::seconds(30), Process::parseTimeout("30"));
+  ASSERT_EQ(std::chrono::seconds(90), Process::parseTimeout("1.5m"));
+  ASSERT_EQ(std::chrono::hours(4), Process::parseTimeout("4h"));
+  ASSERT_THROW(Process::parseTimeout("4x"), std::invalid_argument);
+  ASSERT_THROW(Process::parseTimeout("foo"), std::invalid_argument);
+}
+
+TEST(ExecPool, Run) {
+  ExecPool pool{2};
+  auto job{pool.submit("echo -n foo", "echo failed")};
+  ASSERT_EQ("foo", job.get());
+  auto failed_job{pool.submit("ls --foobar", "ls failed")};
+  ASSERT_THROW(failed_job.get(), ExecError);
+}
+
+TEST(ExecPool, MaxJobs) {
+  // each job sleeps 1 second, 4 jobs run by 2 workers must take at least 2 seconds but less than 4
+  ExecPool pool{2};
+  const auto started{std::chrono::steady_clock::now()};
+  std::vector<ExecPool::Job> jobs;
+  for (int ii = 0; ii < 4; ++ii) {
+    jobs.emplace_back(pool.submit("sleep 1", "sleep failed"));
+  }
+  for (auto& job : jobs) {
+    job.get();
+  }
+  const auto elapsed{std::chrono::steady_clock::now() - started};
+  ASSERT_GE(elapsed, std::chrono::seconds(2));
+  ASSERT_LT(elapsed, std::chrono::seconds(4));
+}
+
+TEST(ExecPool, Cancel) {
+  ExecPool pool{1};
+  auto running_job{pool.submit("sleep 30", "sleep failed")};
+  auto queued_job{pool.submit("sleep 30", "sleep failed")};
+  const auto started{std::chrono::steady_clock::now()};
+  queued_job.cancel();
+  running_job.cancel();
+  ASSERT_THROW(running_job.get(), ExecCancelledError);
+  ASSERT_THROW(queued_job.get(), ExecCancelledError);
+  ASSERT_LT(std::chrono::steady_clock::now() - started, std::chrono::seconds(5));
+}
+
+TEST(ExecPool, OutputHandler) {
+  ExecPool pool{1};
+  std::string streamed;
+  // just stdout is streamed, its lines are not mixed with the stderr ones, while the output has both
+  auto job{pool.submit("sh -c 'echo some output; sleep 0.2; echo some error >&2'", "echo failed", "", "900s", false,
+                       [&streamed](const char* data, std::size_t size) { streamed.append(data, size); })};
+  ASSERT_EQ(job.get(), "some output\nsome error\n");
+  ASSERT_EQ(streamed, "some output\n");
+}
+
+TEST(ExecPool, CancelAll) {
+  ExecPool pool{2};
+  std::vector<ExecPool::Job> jobs;
+  for (int ii = 0; ii < 4; ++ii) {
+    jobs.emplace_back(pool.submit("sleep 30", "sleep failed"));
+  }
+  const auto started{std::chrono::steady_clock::now()};
+  pool.cancelAll();
+  for (auto& job : jobs) {
+    ASSERT_THROW(job.get(), ExecCancelledError);
+  }
+  ASSERT_LT(std::chrono::steady_clock::now() - started, std::chrono::seconds(5));
+}
+
+TEST(ExecPool, DoneHandler) {
+  ExecPool pool{3};
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::vector<int> done;
+  const auto on_done{[&](int indx) {
+    return [&, indx]() {
+      std::lock_guard<std::mutex> lock{mutex};
+      done.push_back(indx);
+      cv.notify_one();
+    };
+  }};
+  // the jobs are reported in the order they complete, not in the order they are submitted
+  std::vector<ExecPool::Job> jobs;
+  jobs.emplace_back(pool.submit("sleep 0.6", "sleep failed", "", "900s", false, nullptr, on_done(0)));
+  jobs.emplace_back(pool.submit("sleep 0.1", "sleep failed", "", "900s", false, nullptr, on_done(1)));
+  jobs.emplace_back(pool.submit("false", "false failed", "", "900s", false, nullptr, on_done(2)));
+  // a queued job cancelled by cancelAll() is reported as well
+  ExecPool busy_pool{1};
+  auto running_job{busy_pool.submit("sleep 30", "sleep failed")};
+  jobs.emplace_back(busy_pool.submit("sleep 30", "sleep failed", "", "900s", false, nullptr, on_done(3)));
+  busy_pool.cancelAll();
+  {
+    std::unique_lock<std::mutex> lock{mutex};
+    ASSERT_TRUE(cv.wait_for(lock, std::chrono::seconds(10), [&done]() { return done.size() == 4; }));
+  }
+  ASSERT_EQ(done.back(), 0);
+  ASSERT_NO_THROW(jobs[1].get());
+  ASSERT_THROW(jobs[2].get(), ExecError);
+  ASSERT_THROW(jobs[3].get(), ExecCancelledError);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -0,0 +1,74 @@
+#include <gtest/gtest.h>
+
+#include "composeapp/fetchindex.h"
+#include "utilities/utils.h"
+
+class FetchIndexTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    boost::filesystem::create_directories(store_root_ / "blobs" / "sha256");
+    boost::filesystem::create_directories(store_root_ / "apps");
+  }
+
+  TemporaryDirectory test_dir_;
+  const boost::filesystem::path store_root_{test_dir_ / "store"};
+  const boost::filesystem::path index_path_{test_dir_ / "store-state" / composeapp::FetchIndex::FileName};
+  const std::set<std::string> app_uris_{"hub.io/factory/app-01@sha256:01", "hub.io/factory/app-02@sha256:02"};
+};
+
+TEST_F(FetchIndexTest, SaveAndLoad) {
+  composeapp::FetchIndex index{store_root_, index_path_};
+  ASSERT_TRUE(index.load().empty());
+  index.save(app_uris_);
+  ASSERT_EQ(index.load(), app_uris_);
+  // the index is kept out of the store
+  ASSERT_TRUE(boost::filesystem::exists(index_path_));
+  ASSERT_FALSE(boost::filesystem::exists(store_root_ / composeapp::FetchIndex::FileName));
+  // the index survives a restart
+  ASSERT_EQ(composeapp::FetchIndex(store_root_, index_path_).load(), app_uris_);
+  index.save({});
+  ASSERT_TRUE(index.load().empty());
+}
+
+TEST_F(FetchIndexTest, StoreChanged) {
+  composeapp::FetchIndex index{store_root_, index_path_};
+  index.save(app_uris_);
+  Utils::writeFile(store_root_ / "blobs" / "sha256" / "0123", std::string("blob"));
+  ASSERT_TRUE(index.load().empty());
+
+  index.save(app_uris_);
+  boost::filesystem::remove(store_root_ / "blobs" / "sha256" / "0123");
+  ASSERT_TRUE(index.load().empty());
+
+  index.save(app_uris_);
+  boost::filesystem::create_directories(store_root_ / "apps" / "app-03");
+  ASSERT_TRUE(index.load().empty());
+
+  // an App version added to or removed from an existing App directory
+  index.save(app_uris_);
+  boost::filesystem::create_directories(store_root_ / "apps" / "app-03" / "03");
+  ASSERT_TRUE(index.load().empty());
+  index.save(app_uris_);
+  boost::filesystem::remove_all(store_root_ / "apps" / "app-03" / "03");
+  ASSERT_TRUE(index.load().empty());
+
+  index.save(app_uris_);
+  boost::filesystem::remove_all(store_root_ / "blobs");
+  ASSERT_TRUE(index.load().empty());
+}
+
+TEST_F(FetchIndexTest, InvalidIndex) {
+  composeapp::FetchIndex index{store_root_, index_path_};
+  Utils::writeFile(index_path_, std::string("{not json"));
+  ASSERT_TRUE(index.load().empty());
+  const composeapp::FetchIndex no_store_index{test_dir_ / "no-store", test_dir_ / "no-store-state" / "index.json"};
+  ASSERT_TRUE(no_store_index.load().empty());
+  // nothing is saved if there is no store
+  no_store_index.save(app_uris_);
+  ASSERT_FALSE(boost::filesystem::exists(test_dir_ / "no-store-state"));
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -11,9 +11,9 @@ class BaseHttpClient: public HttpInterface {
   HttpResponse download(const std::string &url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb, void *userp, curl_off_t from) override {
     return HttpResponse("resp", 200, CURLE_OK, "not supported");
   }
-  std::future<HttpResponse> downloadAsync(const std::string&, curl_write_callback, curl_xferinfo_callback, void*, curl_off_t, CurlHandler*) override {
+  std::future<HttpResponse> downloadAsync(const std::string& url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb, void* userp, curl_off_t from, CurlHandler*) override {
     std::promise<HttpResponse> resp_promise;
-    resp_promise.set_value(HttpResponse("", 500, CURLE_OK, ""));
+    resp_promise.set_value(download(url, write_cb, progress_cb, userp, from));
     return resp_promise.get_future();
   }
   void setCerts(const std::string&, CryptoSource, const std::string&, CryptoSource, const std::string&, CryptoSource) override {}
@@ -93,6 +93,27 @@ class ComposeApp {
     return app;
   }
 
+  // Creates an App with one service per image, so each service runs a distinct image
+  static Ptr createWithImages(const std::string& name, const std::vector<std::string>& image_names) {
+    Ptr app{new ComposeApp(name, Docker::ComposeAppEngine::ComposeFile, image_names)};
+    std::string services;
+    for (std::size_t ii = 0; ii < app->images_.size(); ++ii) {
+      char service_content[1024];
+      sprintf(service_content, ServiceTemplate, ("service-0" + std::to_string(ii + 1)).c_str(),
+              app->images_[ii].uri().c_str());
+      services += service_content;
+    }
+    auto services_hash = boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(services)));
+    sprintf(app->content_, DefaultTemplate, services.c_str(), services_hash.c_str(), "none");
+    Json::Value layers_json;
+    for (int ii = 0; ii < 3; ++ii) {
+      layers_json["layers"][ii]["digest"] = "sha256:" + boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(Utils::randomUuid())));
+      layers_json["layers"][ii]["size"] = 1024 * (ii + 1);
+    }
+    app->update(layers_json);
+    return app;
+  }
+
   static Ptr createAppWithCustomeLayers(const std::string& name, const Json::Value& layers,
                                         boost::optional<std::size_t> layer_man_size = boost::none,
                                         const std::string& failure = "none") {
@@ -115,6 +136,7 @@ class ComposeApp {
   const std::string& archive() const { return arch_; }
   const std::string& manifest() const { return manifest_; }
   const Image& image() const { return image_; }
+  const std::vector<Image>& images() const { return images_; }
   const std::string& layersManifest() const { return layers_manifest_; }
   const std::string& layersHash() const { return layers_hash_; }
   const std::string& layersMeta() const { return layers_meta_; }
@@ -122,7 +144,16 @@ class ComposeApp {
 
 
  private:
-  ComposeApp(const std::string& name, const std::string& compose_file, const std::string& image_name):compose_file_{compose_file}, name_{name}, image_{image_name} {}
+  ComposeApp(const std::string& name, const std::string& compose_file, const std::string& image_name):compose_file_{compose_file}, name_{name}, image_{image_name}, images_{image_} {}
+  ComposeApp(const std::string& name, const std::string& compose_file, const std::vector<std::string>& image_names):compose_file_{compose_file}, name_{name}, image_{image_names.at(0)}, images_{makeImages(image_, image_names)} {}
+
+  static std::vector<Image> makeImages(const Image& first, const std::vector<std::string>& image_names) {
+    std::vector<Image> images{first};
+    for (std::size_t ii = 1; ii < image_names.size(); ++ii) {
+      images.emplace_back(image_names[ii]);
+    }
+    return images;
+  }
 
   const std::string& update(const Json::Value& layers = Json::Value(), boost::optional<std::size_t> layer_man_size = boost::none) {
     TemporaryDirectory app_dir;
@@ -207,6 +238,8 @@ class ComposeApp {
   const std::string compose_file_;
   const std::string name_;
   const Image image_;
+  // the first one is `image_`
+  const std::vector<Image> images_;
   char content_[4096];
 
   std::string arch_;
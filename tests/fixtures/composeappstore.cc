@@ -0,0 +1,104 @@
+#include <boost/algorithm/hex.hpp>
+#include <boost/algorithm/string.hpp>
+
+#include "crypto/crypto.h"
+#include "exec.h"
+#include "utilities/utils.h"
+
+namespace fixtures {
+
+// Populates a store with Apps laid out the same way as composectl does it, all blobs are in <store>/blobs/sha256
+class ComposeAppStore {
+ public:
+  explicit ComposeAppStore(boost::filesystem::path root, std::string arch = "amd64")
+      : root_{std::move(root)}, arch_{std::move(arch)} {
+    boost::filesystem::create_directories(root_ / "blobs" / "sha256");
+    boost::filesystem::create_directories(root_ / "apps");
+  }
+
+  // Returns the App URI
+  std::string addApp(const std::string& name, int image_number = 2, int layer_number = 3,
+                     std::size_t layer_size = 1024) {
+    std::string compose{"services:\n"};
+    for (int ii = 0; ii < image_number; ++ii) {
+      compose += "  service-" + std::to_string(ii) + ":\n";
+      compose += "    image: hub.io/factory/" + name + "-image-" + std::to_string(ii) + "@" +
+                 addImage(layer_number, layer_size) + "\n";
+    }
+
+    TemporaryDirectory bundle_dir;
+    Utils::writeFile(bundle_dir / "docker-compose.yml", compose);
+    exec("tar -czf bundle.tgz docker-compose.yml", "failed to create app bundle", bundle_dir.Path());
+    const auto bundle{Utils::readFile(bundle_dir / "bundle.tgz")};
+
+    Json::Value manifest;
+    manifest["mediaType"] = "application/vnd.oci.image.manifest.v1+json";
+    manifest["schemaVersion"] = 2;
+    manifest["annotations"]["compose-app"] = "v1";
+    manifest["layers"][0]["mediaType"] = "application/octet-stream";
+    manifest["layers"][0]["digest"] = addBlob(bundle);
+    manifest["layers"][0]["size"] = static_cast<Json::UInt64>(bundle.size());
+    const auto digest{addBlob(Utils::jsonToCanonicalStr(manifest))};
+    boost::filesystem::create_directories(root_ / "apps" / name / hash(digest));
+    return "hub.io/factory/" + name + "@" + digest;
+  }
+
+  std::string addImage(int layer_number, std::size_t layer_size) {
+    Json::Value manifest;
+    manifest["mediaType"] = "application/vnd.oci.image.manifest.v1+json";
+    manifest["schemaVersion"] = 2;
+    const std::string config{"{\"architecture\":\"" + arch_ + "\",\"rnd\":\"" + Utils::randomUuid() + "\"}"};
+    manifest["config"]["mediaType"] = "application/vnd.oci.image.config.v1+json";
+    manifest["config"]["digest"] = addBlob(config);
+    manifest["config"]["size"] = static_cast<Json::UInt64>(config.size());
+    for (int ii = 0; ii < layer_number; ++ii) {
+      std::string layer;
+      while (layer.size() < layer_size) {
+        layer += Utils::randomUuid();
+      }
+      layer.resize(layer_size);
+      manifest["layers"][ii]["mediaType"] = "application/vnd.oci.image.layer.v1.tar+gzip";
+      manifest["layers"][ii]["digest"] = addBlob(layer);
+      manifest["layers"][ii]["size"] = static_cast<Json::UInt64>(layer.size());
+    }
+    const auto manifest_str{Utils::jsonToCanonicalStr(manifest)};
+
+    // the index refers to a manifest of another architecture too, it is not fetched
+    Json::Value index;
+    index["mediaType"] = "application/vnd.oci.image.index.v1+json";
+    index["schemaVersion"] = 2;
+    index["manifests"][0]["mediaType"] = "application/vnd.oci.image.manifest.v1+json";
+    index["manifests"][0]["digest"] = "sha256:" + sha256(Utils::randomUuid());
+    index["manifests"][0]["size"] = 1024;
+    index["manifests"][0]["platform"]["architecture"] = "other";
+    index["manifests"][1]["mediaType"] = "application/vnd.oci.image.manifest.v1+json";
+    index["manifests"][1]["digest"] = addBlob(manifest_str);
+    index["manifests"][1]["size"] = static_cast<Json::UInt64>(manifest_str.size());
+    index["manifests"][1]["platform"]["architecture"] = arch_;
+    return addBlob(Utils::jsonToCanonicalStr(index));
+  }
+
+  // Returns the blob digest
+  std::string addBlob(const std::string& content) {
+    const auto digest{"sha256:" + sha256(content)};
+    Utils::writeFile(blobPath(digest), content);
+    return digest;
+  }
+
+  boost::filesystem::path blobPath(const std::string& digest) const {
+    return root_ / "blobs" / "sha256" / hash(digest);
+  }
+  const boost::filesystem::path& root() const { return root_; }
+  const std::string& arch() const { return arch_; }
+
+  static std::string sha256(const std::string& content) {
+    return boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(content)));
+  }
+  static std::string hash(const std::string& digest) { return digest.substr(digest.find(':') + 1); }
+
+ private:
+  const boost::filesystem::path root_;
+  const std::string arch_;
+};
+
+}  // namespace fixtures
@@ -56,9 +56,11 @@ class DockerRegistry {
       blob2app_.emplace("sha256:" + app->layersMetaHash(), app->layersMeta());
     }
 
-    Utils::writeFile(dir_ / app->image().name() / "blobs" / app->image().layerBlob().hash, app->image().layerBlob().data);
-    Utils::writeFile(dir_ / app->image().name() / "blobs" / app->image().config().hash, app->image().config().data);
-    Utils::writeFile(dir_ / app->image().name() / "manifests" / app->image().manifest().hash, app->image().manifest().data);
+    for (const auto& image : app->images()) {
+      Utils::writeFile(dir_ / image.name() / "blobs" / image.layerBlob().hash, image.layerBlob().data);
+      Utils::writeFile(dir_ / image.name() / "blobs" / image.config().hash, image.config().data);
+      Utils::writeFile(dir_ / image.name() / "manifests" / image.manifest().hash, image.manifest().data);
+    }
     return {app->name(), app_uri};
   }
 
@@ -87,6 +89,20 @@ class DockerRegistry {
     return blob2app_.at(digest);
   }
 
+  // Serves the image files stored for the fake registry, so an image can be pulled by RegistryClient too, e.g.
+  // https://localhost/v2/factory/image-01/blobs/sha256:e723bc71a139ad7e1f6cbc117178c74b821a65afec5b
+  std::string getImageFile(const std::string &url, const std::string& endpoint) const {
+    static const std::string prefix{"https://localhost/v2/"};
+    const auto endpoint_pos = url.find("/" + endpoint + "/sha256:");
+    if (url.rfind(prefix, 0) != 0 || endpoint_pos == std::string::npos) {
+      return "";
+    }
+    const auto name = url.substr(prefix.size(), endpoint_pos - prefix.size());
+    const auto hash = url.substr(endpoint_pos + endpoint.size() + 9);
+    const auto file = dir_ / name / endpoint / hash;
+    return boost::filesystem::exists(file) ? Utils::readFile(file) : "";
+  }
+
   const std::string& authURL() const { return auth_url_; }
   std::string getWwwAuthHeader(const std::string &url) const {
     if (www_auth_func_ != nullptr) {
@@ -137,6 +153,12 @@ class DockerRegistry {
           // manifest hasn't been found
           return HttpResponse(resp, 404, CURLE_OK, "Not Found");
         }
+      } else if (boost::starts_with(url, "https://localhost/v2/")) {
+        // request for an image manifest
+        resp = registry_.getImageFile(url, "manifests");
+        if (resp.size() == 0) {
+          return HttpResponse(resp, 404, CURLE_OK, "Not Found");
+        }
       } else if (url == registry_.auth_url_) {
         // request for a basic auth to Device Gateway
         resp = "{\"Secret\":\"secret\",\"Username\":\"test-user\"}";
@@ -151,6 +173,16 @@ class DockerRegistry {
       (void)progress_cb;
       (void)from;
 
+      if (boost::starts_with(url, "https://localhost/v2/")) {
+        // request for an image blob
+        std::string data{registry_.getImageFile(url, "blobs")};
+        if (data.empty()) {
+          return HttpResponse("", 404, CURLE_OK, "Not Found");
+        }
+        write_cb(const_cast<char*>(data.c_str()), data.size(), 1, userp);
+        return HttpResponse("resp", 200, CURLE_OK, "");
+      }
+
       if (registry_.auth()) {
           if (headers_in_ == nullptr || headers_in_->size() == 0) {
             return HttpResponse("", 401, CURLE_OK, "Unauthorized", {{"www-authenticate", registry_.getWwwAuthHeader(url)}});
@@ -0,0 +1,203 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <future>
+#include <thread>
+
+#include <boost/algorithm/hex.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/process.hpp>
+
+#include "crypto/crypto.h"
+#include "docker/httpclientpool.h"
+#include "downloadscheduler.h"
+#include "test_utils.h"
+#include "utilities/utils.h"
+
+// Runs the fake Registry keeping the connections alive between the requests, it counts the connections accepted
+class RegistryServer {
+ public:
+  static std::string RunCmd;
+
+  RegistryServer()
+      : port_{TestUtils::getFreePort()},
+        process_{RunCmd, "--port", port_, "--dir", dir_.Path().string(), "--keep-alive", "--connections-file",
+                 connectionsFile().string()} {
+    TestUtils::waitForServer(url() + "/v2/");
+    // the connections made while waiting for the server are not counted
+    initial_connections_ = readConnections();
+  }
+  ~RegistryServer() {
+    process_.terminate();
+    process_.wait_for(std::chrono::seconds(10));
+  }
+  RegistryServer(const RegistryServer&) = delete;
+  RegistryServer& operator=(const RegistryServer&) = delete;
+  RegistryServer(RegistryServer&&) = delete;
+  RegistryServer& operator=(RegistryServer&&) = delete;
+
+  std::string url() const { return "http://localhost:" + port_; }
+  std::string blobUrl(const std::string& data) const {
+    return url() + "/v2/factory/app/blobs/sha256:" +
+           boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(data)));
+  }
+  std::string addBlob(const std::string& data) const {
+    const auto blob_url{blobUrl(data)};
+    const auto blob_dir{dir_ / "factory" / "app" / "blobs"};
+    boost::filesystem::create_directories(blob_dir);
+    Utils::writeFile(blob_dir / blob_url.substr(blob_url.rfind(':') + 1), data);
+    return blob_url;
+  }
+  int connections() const { return readConnections() - initial_connections_; }
+
+ private:
+  boost::filesystem::path connectionsFile() const { return conn_dir_ / "connections"; }
+  int readConnections() const {
+    return boost::filesystem::exists(connectionsFile()) ? std::stoi(Utils::readFile(connectionsFile())) : 0;
+  }
+
+  TemporaryDirectory dir_;
+  TemporaryDirectory conn_dir_;
+  const std::string port_;
+  boost::process::child process_;
+  int initial_connections_{0};
+};
+
+std::string RegistryServer::RunCmd{"./tests/docker-registry_fake.py"};
+
+static size_t WriteHandler(char* data, size_t buf_size, size_t buf_numb, void* user_ctx) {
+  reinterpret_cast<std::string*>(user_ctx)->append(data, buf_size * buf_numb);
+  return buf_size * buf_numb;
+}
+
+TEST(HttpClientPool, ReuseConnection) {
+  RegistryServer server;
+  const auto blob_url{server.addBlob("foobar")};
+  auto pool{Docker::HttpClientPool::create()};
+
+  // each request is made by a new client, while all of them go through one connection
+  for (int ii = 0; ii < 3; ++ii) {
+    std::vector<std::string> headers{"accept: application/octet-stream"};
+    const auto resp{pool->createClient(&headers, nullptr)->get(blob_url, HttpInterface::kNoLimit)};
+    ASSERT_TRUE(resp.isOk()) << resp.getStatusStr();
+    ASSERT_EQ(resp.body, "foobar");
+  }
+  ASSERT_EQ(server.connections(), 1);
+
+  // the headers can be changed between the requests of a client, the requested response headers are returned
+  std::vector<std::string> headers;
+  const std::set<std::string> header_to_get{"content-range"};
+  auto client{pool->createClient(&headers, &header_to_get)};
+  auto resp{client->get(blob_url, HttpInterface::kNoLimit)};
+  ASSERT_EQ(resp.http_status_code, 200);
+  ASSERT_EQ(resp.headers.count("content-range"), 0);
+  headers.emplace_back("range: bytes=2-");
+  resp = client->get(blob_url, HttpInterface::kNoLimit);
+  ASSERT_EQ(resp.http_status_code, 206);
+  ASSERT_EQ(resp.body, "obar");
+  ASSERT_EQ(resp.headers["content-range"], "bytes 2-5/6");
+  headers.clear();
+  std::string data;
+  resp = client->download(blob_url, WriteHandler, nullptr, &data, 3);
+  ASSERT_TRUE(resp.isOk()) << resp.getStatusStr();
+  ASSERT_EQ(data, "bar");
+  data.clear();
+  resp = client->downloadAsync(blob_url, WriteHandler, nullptr, &data, 0, nullptr).get();
+  ASSERT_TRUE(resp.isOk()) << resp.getStatusStr();
+  ASSERT_EQ(data, "foobar");
+  ASSERT_EQ(client->get(server.url() + "/v2/factory/app/blobs/sha256:foo", HttpInterface::kNoLimit).http_status_code,
+            404);
+  ASSERT_EQ(server.connections(), 1);
+
+  // the response exceeding the maximum size is rejected
+  ASSERT_FALSE(client->get(blob_url, 2).isOk());
+}
+
+TEST(HttpClientPool, Upload) {
+  RegistryServer server;
+  auto pool{Docker::HttpClientPool::create()};
+  auto client{pool->createClient(nullptr, nullptr)};
+
+  const std::string blob{"some blob"};
+  ASSERT_EQ(client->put(server.blobUrl(blob), "application/octet-stream", blob).http_status_code, 201);
+  ASSERT_EQ(client->get(server.blobUrl(blob), HttpInterface::kNoLimit).body, blob);
+  Json::Value json;
+  json["foo"] = "bar";
+  ASSERT_EQ(client->post(server.blobUrl(Utils::jsonToStr(json)), json).http_status_code, 201);
+  ASSERT_EQ(client->get(server.blobUrl(Utils::jsonToStr(json)), HttpInterface::kNoLimit).body,
+            Utils::jsonToStr(json));
+  // the data is sent as is, so the registry rejects the one not matching the digest
+  ASSERT_EQ(client->put(server.blobUrl(blob), "application/octet-stream", blob + "foo").http_status_code, 400);
+  ASSERT_EQ(server.connections(), 1);
+}
+
+TEST(HttpClientPool, ConcurrentRequests) {
+  RegistryServer server;
+  const auto blob_url{server.addBlob("bar")};
+  auto pool{Docker::HttpClientPool::create()};
+  const int parallelism{4};
+
+  for (int round = 0; round < 3; ++round) {
+    std::atomic<int> failed{0};
+    std::vector<std::thread> threads;
+    for (int ii = 0; ii < parallelism; ++ii) {
+      threads.emplace_back([&]() {
+        if (pool->createClient(nullptr, nullptr)->get(blob_url, HttpInterface::kNoLimit).body != "bar") {
+          ++failed;
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    ASSERT_EQ(failed, 0);
+  }
+  // the concurrent requests take their own connections, which are reused by the following rounds
+  ASSERT_LE(server.connections(), parallelism);
+}
+
+// Holds the first chunk until the test has started a more urgent transfer
+struct PausedDownloadCtx {
+  std::promise<void> started;
+  std::future<void> urgent_started;
+  std::atomic<std::size_t> received{0};
+};
+
+static size_t PausedWriteHandler(char* data, size_t buf_size, size_t buf_numb, void* user_ctx) {
+  (void)data;
+  auto* ctx{reinterpret_cast<PausedDownloadCtx*>(user_ctx)};
+  if (ctx->received == 0) {
+    ctx->started.set_value();
+    ctx->urgent_started.wait();
+  }
+  ctx->received += buf_size * buf_numb;
+  return buf_size * buf_numb;
+}
+
+TEST(HttpClientPool, PauseTransfer) {
+  RegistryServer server;
+  const std::string blob(4 * 1024 * 1024, 'x');
+  const auto blob_url{server.addBlob(blob)};
+  DownloadScheduler scheduler;
+  auto client{std::make_shared<ScheduledHttpClient>(Docker::HttpClientPool::create()->createClient(nullptr, nullptr),
+                                                    DownloadScheduler::Class::AppBlob, scheduler)};
+
+  // the more urgent transfer started in the middle of the download pauses it until the urgent one completes
+  PausedDownloadCtx ctx;
+  std::promise<void> urgent_started;
+  ctx.urgent_started = urgent_started.get_future();
+  auto resp{client->downloadAsync(blob_url, PausedWriteHandler, nullptr, &ctx, 0, nullptr)};
+  ctx.started.get_future().wait();
+  auto metadata{std::make_unique<DownloadScheduler::Transfer>(scheduler, DownloadScheduler::Class::Metadata)};
+  urgent_started.set_value();
+  ASSERT_EQ(resp.wait_for(std::chrono::seconds(2)), std::future_status::timeout);
+  ASSERT_LT(ctx.received, blob.size());
+  metadata.reset();
+  ASSERT_TRUE(resp.get().isOk());
+  ASSERT_EQ(ctx.received, blob.size());
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
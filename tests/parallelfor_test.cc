@@ -0,0 +1,70 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
+
+#include "parallelfor.h"
+
+TEST(ParallelFor, Parallelism) {
+  std::atomic_int running{0};
+  std::atomic_int max_running{0};
+  std::mutex mutex;
+  std::multiset<std::size_t> done;
+  parallelFor(6, 3, [&](std::size_t indx) {
+    const auto cur{++running};
+    int prev{max_running};
+    while (cur > prev && !max_running.compare_exchange_weak(prev, cur)) {
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    --running;
+    std::lock_guard<std::mutex> lock{mutex};
+    done.insert(indx);
+  });
+  ASSERT_EQ(max_running, 3);
+  ASSERT_EQ(done, (std::multiset<std::size_t>{0, 1, 2, 3, 4, 5}));
+}
+
+TEST(ParallelFor, CallingThread) {
+  const auto caller{std::this_thread::get_id()};
+  std::size_t count{0};
+  parallelFor(3, 1, [&](std::size_t indx) {
+    ASSERT_EQ(std::this_thread::get_id(), caller);
+    ASSERT_EQ(indx, count++);
+  });
+  ASSERT_EQ(count, 3);
+  parallelFor(0, 4, [](std::size_t) { FAIL(); });
+}
+
+TEST(ParallelFor, Exception) {
+  std::atomic_int started{0};
+  try {
+    parallelFor(10, 2, [&](std::size_t indx) {
+      ++started;
+      if (indx == 1) {
+        throw std::runtime_error("item 1 failed");
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    });
+    FAIL() << "the exception hasn't been rethrown";
+  } catch (const std::runtime_error& exc) {
+    ASSERT_STREQ(exc.what(), "item 1 failed");
+  }
+  // no new item is started after the failure, the one in progress completes
+  ASSERT_LE(started, 3);
+}
+
+TEST(ParallelFor, Stop) {
+  std::atomic_int started{0};
+  parallelFor(
+      10, 2, [&](std::size_t) { ++started; }, [&started]() { return started >= 4; });
+  ASSERT_GE(started, 4);
+  ASSERT_LE(started, 5);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
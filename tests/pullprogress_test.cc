@@ -0,0 +1,76 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "pullprogress.h"
+
+class PullProgressTest : public ::testing::Test {
+ protected:
+  void feed(const std::string& output) { parser_.feed(output.data(), output.size()); }
+
+  std::vector<AppEngine::PullProgress> events_;
+  PullProgressParser parser_{"app-01", [this](const AppEngine::PullProgress& progress) { events_.push_back(progress); }};
+};
+
+TEST(PullProgress, ParseSize) {
+  ASSERT_EQ(PullProgressParser::parseSize("1024"), 1024);
+  ASSERT_EQ(PullProgressParser::parseSize("100B"), 100);
+  ASSERT_EQ(PullProgressParser::parseSize("1.5 kB"), 1500);
+  ASSERT_EQ(PullProgressParser::parseSize("2KiB"), 2048);
+  ASSERT_EQ(PullProgressParser::parseSize("3 MB"), 3000000);
+  ASSERT_EQ(PullProgressParser::parseSize("1.5MiB"), 1572864);
+  ASSERT_EQ(PullProgressParser::parseSize("1GiB"), 1073741824);
+  ASSERT_THROW(PullProgressParser::parseSize(""), std::invalid_argument);
+  ASSERT_THROW(PullProgressParser::parseSize("MiB"), std::invalid_argument);
+  ASSERT_THROW(PullProgressParser::parseSize("1 XB"), std::invalid_argument);
+}
+
+TEST_F(PullProgressTest, BlobProgress) {
+  const std::string digest{"sha256:3b18e512dba79e4c8300dd08aeb37f8e728b8dad5b8b9e8d3b7d34e3a9f3c7d1"};
+  feed("Fetching app-01...\n");
+  feed(digest + " [====>     ] 1.5 MiB / 3 MiB 512 KiB/s\r");
+  // the same state redrawn
+  feed(digest + " [====>     ] 1.5 MiB / 3 MiB 512 KiB/s\r");
+  // chunks don't have to be aligned with lines
+  feed("\x1b[2K" + digest.substr(0, 20));
+  feed(digest.substr(20) + " [==========] 3 MiB / 3 MiB 1 MiB/s\n");
+
+  ASSERT_EQ(events_.size(), 2);
+  ASSERT_EQ(events_[0].app, "app-01");
+  ASSERT_EQ(events_[0].blob, digest.substr(7));
+  ASSERT_EQ(events_[0].done, 1572864);
+  ASSERT_EQ(events_[0].total, 3145728);
+  ASSERT_EQ(events_[0].rate, 524288);
+  ASSERT_EQ(events_[1].blob, digest.substr(7));
+  ASSERT_EQ(events_[1].done, 3145728);
+  ASSERT_EQ(events_[1].rate, 1048576);
+}
+
+TEST_F(PullProgressTest, NoRateAndNoDigest) {
+  feed("layer-1: 100B/1kB\n");
+  feed("layer-2: 200B/1kB\n");
+  feed("layer-1: 1kB/1kB\n");
+  feed("done, total 2kB\n");
+
+  ASSERT_EQ(events_.size(), 3);
+  ASSERT_EQ(events_[0].blob, "layer-1");
+  ASSERT_EQ(events_[0].rate, 0);
+  ASSERT_EQ(events_[1].blob, "layer-2");
+  ASSERT_EQ(events_[1].done, 200);
+  ASSERT_EQ(events_[2].blob, "layer-1");
+  ASSERT_EQ(events_[2].done, 1000);
+  ASSERT_EQ(events_[2].total, 1000);
+  // derived from the bytes done since the blob has been seen for the first time
+  ASSERT_GT(events_[2].rate, 0);
+}
+
+TEST_F(PullProgressTest, OddBlobName) {
+  feed("$(reboot) 100B/1kB\n");
+  ASSERT_EQ(events_.size(), 1);
+  ASSERT_TRUE(events_[0].blob.empty());
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -2,7 +2,10 @@
 
 #include <boost/filesystem.hpp>
 #include <boost/format.hpp>
+#include <filesystem>
 #include <limits>
+#include <set>
+#include <thread>
 
 #include "crypto/crypto.h"
 #include "logging/logging.h"
@@ -11,6 +14,7 @@
 #include "docker/composeappengine.h"
 #include "docker/composeinfo.h"
 #include "docker/restorableappengine.h"
+#include "docker/treeinstaller.h"
 
 #include "fixtures/composeappenginetest.cc"
 
@@ -69,6 +73,31 @@ class RestorableAppEngineTestParameterized : public RestorableAppEngineTest,
   }
 };
 
+class RestorableAppEngineNativePullTest : public RestorableAppEngineTest {
+ protected:
+  void SetUp() override {
+    fixtures::AppEngineTest::SetUp();
+
+    app_engine = std::make_shared<Docker::RestorableAppEngine>(
+        skopeo_store_root_, apps_root_dir, daemon_.dataRoot(), registry_client_, docker_client_, "/non-existing/skopeo",
+        daemon_.getUrl(), compose_cmd, getTestStorageSpaceFunc(), Docker::RestorableAppEngine::DefClientImageSrcFunc,
+        true, false, true);
+  }
+};
+
+class RestorableAppEngineLoadOnFetchTest : public RestorableAppEngineTest,
+                                          public ::testing::WithParamInterface<bool> {
+ protected:
+  void SetUp() override {
+    fixtures::AppEngineTest::SetUp();
+
+    app_engine = std::make_shared<Docker::RestorableAppEngine>(
+        skopeo_store_root_, apps_root_dir, daemon_.dataRoot(), registry_client_, docker_client_,
+        registry.getSkopeoClient(), daemon_.getUrl(), compose_cmd, getTestStorageSpaceFunc(),
+        Docker::RestorableAppEngine::DefClientImageSrcFunc, true, false, GetParam(), true);
+  }
+};
+
 TEST_F(RestorableAppEngineTest, InitDeinit) {}
 
 TEST_F(RestorableAppEngineTest, Fetch) {
@@ -269,6 +298,55 @@ TEST_F(RestorableAppEngineTest, FetchCheckAndRefetch) {
   }
 }
 
+TEST_F(RestorableAppEngineTest, FetchCheckMultipleServices) {
+  // the images of the App services are checked concurrently, a missing or damaged image is detected whichever it is
+  auto app = registry.addApp(fixtures::ComposeApp::createWithImages(
+      "app-01", {"factory/image-01", "factory/image-02", "factory/image-03", "factory/image-04", "factory/image-05"}));
+  ASSERT_TRUE(app_engine->fetch(app));
+  ASSERT_TRUE(app_engine->isFetched(app));
+  ASSERT_TRUE(app_engine->verify(app));
+
+  const Docker::Uri uri{Docker::Uri::parseUri(app.uri)};
+  const auto app_dir{storeRoot() / "apps" / uri.app / uri.digest.hash()};
+  Docker::ComposeInfo compose{(app_dir / Docker::RestorableAppEngine::ComposeFile).string()};
+  const auto services{compose.getServices()};
+  ASSERT_EQ(services.size(), 5);
+  std::set<std::string> images;
+  for (const auto& service : services) {
+    images.insert(compose.getImage(service));
+  }
+  ASSERT_EQ(images.size(), 5);
+
+  const auto blob_dir{storeRoot() / "blobs" / "sha256"};
+  const auto getImageManifestPath{[&](const Json::Value& service) {
+    const Docker::Uri image_uri{Docker::Uri::parseUri(compose.getImage(service), false)};
+    const auto image_root{app_dir / "images" / image_uri.registryHostname / image_uri.repo / image_uri.digest.hash()};
+    const auto manifest_desc{Utils::parseJSONFile(image_root / "index.json")};
+    return blob_dir / Docker::HashedDigest(manifest_desc["manifests"][0]["digest"].asString()).hash();
+  }};
+  {
+    // remove the layer blob of one image
+    const auto image_manifest{Utils::parseJSONFile(getImageManifestPath(services[3]))};
+    boost::filesystem::remove(blob_dir / Docker::HashedDigest(image_manifest["layers"][0]["digest"].asString()).hash());
+    ASSERT_FALSE(app_engine->isFetched(app));
+
+    ASSERT_TRUE(app_engine->fetch(app));
+    ASSERT_TRUE(app_engine->isFetched(app));
+    ASSERT_TRUE(app_engine->verify(app));
+  }
+  {
+    // damage the layer blob of another image
+    const auto image_manifest{Utils::parseJSONFile(getImageManifestPath(services[1]))};
+    Utils::writeFile(blob_dir / Docker::HashedDigest(image_manifest["layers"][0]["digest"].asString()).hash(),
+                     std::string("foo bar"));
+    ASSERT_FALSE(app_engine->isFetched(app));
+
+    ASSERT_TRUE(app_engine->fetch(app));
+    ASSERT_TRUE(app_engine->isFetched(app));
+    ASSERT_TRUE(app_engine->verify(app));
+  }
+}
+
 TEST_F(RestorableAppEngineTest, FetchAndInstall) {
   auto app = registry.addApp(fixtures::ComposeApp::create("app-02"));
   ASSERT_TRUE(app_engine->fetch(app));
@@ -282,6 +360,48 @@ TEST_F(RestorableAppEngineTest, FetchAndInstall) {
   ASSERT_EQ(install_res, true) << install_res.err;
   ASSERT_TRUE(app_engine->getInstalledApps() & app);
   ASSERT_FALSE(app_engine->isRunning(app));
+
+  // the App archive is extracted to the store only if the App files can be cloned from there
+  const Docker::Uri uri{Docker::Uri::parseUri(app.uri)};
+  const auto app_dir{storeRoot() / "apps" / uri.app / uri.digest.hash()};
+  const auto can_clone{Docker::TreeInstaller().canClone(app_dir, apps_root_dir / app.name)};
+  bool has_tree{false};
+  for (const auto& entry : boost::filesystem::directory_iterator(app_dir)) {
+    has_tree = has_tree || entry.path().extension() == ".d";
+  }
+  ASSERT_EQ(has_tree, can_clone);
+}
+
+TEST_F(RestorableAppEngineTest, InstalledComposeFileCheck) {
+  auto app = registry.addApp(fixtures::ComposeApp::create("app-02"));
+  ASSERT_TRUE(app_engine->fetch(app));
+  const auto install_res{app_engine->install(app)};
+  ASSERT_EQ(install_res, true) << install_res.err;
+  ASSERT_TRUE(app_engine->getInstalledApps() & app);
+
+  const Docker::Uri uri{Docker::Uri::parseUri(app.uri)};
+  const auto fetched_compose_file{storeRoot() / "apps" / uri.app / uri.digest.hash() /
+                                  Docker::RestorableAppEngine::ComposeFile};
+  const auto fetched_compose{Utils::readFile(fetched_compose_file)};
+  {
+    // the intact fetched compose file is not rewritten by the checks
+    const auto modified_at{std::filesystem::last_write_time(fetched_compose_file.string())};
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    ASSERT_TRUE(app_engine->getInstalledApps() & app);
+    ASSERT_TRUE(app_engine->getInstalledApps() & app);
+    ASSERT_EQ(std::filesystem::last_write_time(fetched_compose_file.string()), modified_at);
+  }
+  {
+    // the altered fetched compose file is extracted from the App archive again
+    Utils::writeFile(fetched_compose_file, std::string("foo bar"));
+    ASSERT_TRUE(app_engine->getInstalledApps() & app);
+    ASSERT_EQ(Utils::readFile(fetched_compose_file), fetched_compose);
+  }
+  {
+    // the altered installed compose file is detected
+    Utils::writeFile(apps_root_dir / app.name / Docker::RestorableAppEngine::ComposeFile, std::string("foo bar"));
+    ASSERT_FALSE(app_engine->getInstalledApps() & app);
+  }
 }
 
 TEST_F(RestorableAppEngineTest, FetchAndRun) {
@@ -299,6 +419,70 @@ TEST_F(RestorableAppEngineTest, FetchAndRun) {
   ASSERT_TRUE(app_engine->isRunning(app));
 }
 
+TEST_F(RestorableAppEngineNativePullTest, FetchAndInstall) {
+  auto app = registry.addApp(fixtures::ComposeApp::create("app-01"));
+  ASSERT_TRUE(app_engine->fetch(app));
+  ASSERT_TRUE(app_engine->isFetched(app));
+  ASSERT_TRUE(app_engine->verify(app));
+
+  const Docker::Uri uri{Docker::Uri::parseUri(app.uri)};
+  const auto app_dir{storeRoot() / "apps" / uri.app / uri.digest.hash()};
+  Docker::ComposeInfo compose{(app_dir / Docker::RestorableAppEngine::ComposeFile).string()};
+  const Docker::Uri image_uri{Docker::Uri::parseUri(compose.getImage(compose.getServices()[0]), false)};
+  const auto image_root{app_dir / "images" / image_uri.registryHostname / image_uri.repo / image_uri.digest.hash()};
+  ASSERT_TRUE(boost::filesystem::exists(image_root / "oci-layout"));
+  const auto index{Utils::parseJSONFile(image_root / "index.json")};
+  ASSERT_EQ(index["manifests"][0]["digest"].asString(), image_uri.digest());
+  {
+    // remove App image blob, only the missing blob is pulled again
+    const auto blob_dir{storeRoot() / "blobs" / "sha256"};
+    const auto image_manifest{Utils::parseJSONFile(blob_dir / image_uri.digest.hash())};
+    boost::filesystem::remove(blob_dir /
+                              Docker::HashedDigest(image_manifest["layers"][0]["digest"].asString()).hash());
+    ASSERT_FALSE(app_engine->isFetched(app));
+    ASSERT_TRUE(app_engine->fetch(app));
+    ASSERT_TRUE(app_engine->isFetched(app));
+  }
+
+  const auto install_res{app_engine->install(app)};
+  ASSERT_EQ(install_res, true) << install_res.err;
+  ASSERT_TRUE(app_engine->getInstalledApps() & app);
+  ASSERT_FALSE(app_engine->isRunning(app));
+}
+
+TEST_F(RestorableAppEngineNativePullTest, FetchSharedBlobs) {
+  // all services refer to the same image, so its blobs are pulled just once
+  static constexpr const char* const ServicesTemplate = R"(
+      %1$s-01:
+        image: %2$s
+      %1$s-02:
+        image: %2$s)";
+  auto app = registry.addApp(fixtures::ComposeApp::create("app-01", "service", "factory/image-01", ServicesTemplate));
+  ASSERT_TRUE(app_engine->fetch(app));
+  ASSERT_TRUE(app_engine->isFetched(app));
+  ASSERT_TRUE(app_engine->verify(app));
+}
+
+TEST_P(RestorableAppEngineLoadOnFetchTest, FetchAndInstall) {
+  auto app = registry.addApp(fixtures::ComposeApp::create("app-01"));
+  ASSERT_TRUE(app_engine->fetch(app));
+  ASSERT_TRUE(app_engine->isFetched(app));
+
+  // the App image has been loaded to the docker store by the fetch
+  const Docker::Uri uri{Docker::Uri::parseUri(app.uri)};
+  Docker::ComposeInfo compose{
+      (storeRoot() / "apps" / uri.app / uri.digest.hash() / Docker::RestorableAppEngine::ComposeFile).string()};
+  const auto loaded_images{Utils::parseJSONFile(daemon_.dir() / "images.json")};
+  ASSERT_TRUE(loaded_images.isMember(compose.getImage(compose.getServices()[0])));
+
+  const auto install_res{app_engine->install(app)};
+  ASSERT_EQ(install_res, true) << install_res.err;
+  ASSERT_TRUE(app_engine->getInstalledApps() & app);
+}
+
+// Load App images on fetch for both the skopeo and the native image pulls
+INSTANTIATE_TEST_SUITE_P(LoadOnFetchTests, RestorableAppEngineLoadOnFetchTest, ::testing::Values(false, true));
+
 TEST_F(RestorableAppEngineTest, FetchAndCheckSizeNoManifest) {
   // If a manifest with a layer list is not present an update should succeed anyway, so
   // the "size-aware" aklite can download Targets created before the "size-aware" compose-publish is deployed.
@@ -368,6 +552,106 @@ TEST_P(RestorableAppEngineTestParameterized, FetchAndCheckSizeInsufficientSpace)
 INSTANTIATE_TEST_SUITE_P(CheckSizeTests, RestorableAppEngineTestParameterized,
                          ::testing::Values("", "/var/non-existing-dir/docker"));
 
+TEST_F(RestorableAppEngineTest, CheckUpdateSizeOfApps) {
+  const auto layer_size{1024};
+  Json::Value layers;
+  layers["layers"][0]["digest"] =
+      "sha256:" + boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(Utils::randomUuid())));
+  layers["layers"][0]["size"] = layer_size;
+  const auto app_01_fixture{fixtures::ComposeApp::createAppWithCustomeLayers("app-01", layers)};
+  auto app_01 = registry.addApp(app_01_fixture);
+  auto app_02 = registry.addApp(fixtures::ComposeApp::createAppWithCustomeLayers("app-02", layers));
+  layers["layers"][1]["digest"] =
+      "sha256:" + boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(Utils::randomUuid())));
+  layers["layers"][1]["size"] = layer_size;
+  auto app_03 = registry.addApp(fixtures::ComposeApp::createAppWithCustomeLayers("app-03", layers));
+
+  // storage size sufficient to accommodate just one layer
+  setAvailableStorageSpace(6144);
+  // the layer shared by the Apps is counted once
+  ASSERT_TRUE(app_engine->checkUpdateSize({app_01, app_02}));
+  ASSERT_TRUE(app_engine->checkUpdateSize({app_01, app_03}).noSpace());
+  // the check keeps the verified layers metadata for the following fetch, the Apps are not fetched by it
+  const Docker::Uri app_01_uri{Docker::Uri::parseUri(app_01.uri)};
+  const auto layers_meta{storeRoot() / "apps" / app_01_uri.app / app_01_uri.digest.hash() /
+                         app_01_fixture->layersMetaHash()};
+  ASSERT_EQ(Utils::readFile(layers_meta), app_01_fixture->layersMeta());
+  for (const auto& app : {app_01, app_02, app_03}) {
+    ASSERT_FALSE(app_engine->isFetched(app));
+  }
+  // the App dir holding just the layers metadata doesn't break the prune
+  app_engine->prune({app_01});
+  ASSERT_TRUE(boost::filesystem::exists(layers_meta));
+  ASSERT_TRUE(app_engine->fetch(app_01));
+  ASSERT_TRUE(app_engine->isFetched(app_01));
+}
+
+TEST_F(RestorableAppEngineTest, PruneUnusedBlobs) {
+  auto app_01 = registry.addApp(fixtures::ComposeApp::create("app-01"));
+  auto app_02 = registry.addApp(fixtures::ComposeApp::create("app-02"));
+  ASSERT_TRUE(app_engine->fetch(app_01));
+  ASSERT_TRUE(app_engine->fetch(app_02));
+
+  const auto blob_dir{storeRoot() / "blobs" / "sha256"};
+  auto list_blobs{[&blob_dir]() {
+    std::set<std::string> blobs;
+    for (const auto& entry : boost::filesystem::directory_iterator(blob_dir)) {
+      blobs.insert(entry.path().filename().string());
+    }
+    return blobs;
+  }};
+  const auto all_blobs{list_blobs()};
+  // a blob left behind by an interrupted fetch is not referenced by any App
+  Utils::writeFile(blob_dir / "orphan", std::string("foo"));
+
+  app_engine->prune({app_02});
+  const auto app_01_uri{Docker::Uri::parseUri(app_01.uri)};
+  ASSERT_FALSE(boost::filesystem::exists(storeRoot() / "apps" / app_01_uri.app));
+  ASSERT_TRUE(app_engine->isFetched(app_02));
+  const auto app_02_blobs{list_blobs()};
+  ASSERT_LT(app_02_blobs.size(), all_blobs.size());
+  ASSERT_EQ(app_02_blobs.count("orphan"), 0);
+  ASSERT_EQ(app_02_blobs.count(app_01_uri.digest.hash()), 0);
+
+  // the references are persisted, so a new engine instance prunes by them as well
+  app_engine = std::make_shared<Docker::RestorableAppEngine>(
+      skopeo_store_root_, apps_root_dir, daemon_.dataRoot(), registry_client_, docker_client_,
+      registry.getSkopeoClient(), daemon_.getUrl(), compose_cmd, getTestStorageSpaceFunc());
+  app_engine->prune({app_02});
+  ASSERT_EQ(list_blobs(), app_02_blobs);
+  ASSERT_TRUE(app_engine->isFetched(app_02));
+  app_engine->prune({});
+  ASSERT_TRUE(list_blobs().empty());
+}
+
+TEST_F(RestorableAppEngineTest, PruneBlobsOfInterruptedFetch) {
+  auto app_01 = registry.addApp(fixtures::ComposeApp::create("app-01"));
+  auto app_02 = registry.addApp(fixtures::ComposeApp::create("app-02"));
+  ASSERT_TRUE(app_engine->fetch(app_01));
+  app_engine->prune({app_01});
+
+  // the process is killed while fetching App, after the fetch has been recorded and some of its blobs downloaded
+  const auto blob_dir{storeRoot() / "blobs" / "sha256"};
+  {
+    Docker::BlobRefTable table{storeRoot() / Docker::BlobRefTable::FileName};
+    ASSERT_FALSE(table.isRescanRequested());
+    const Docker::Uri uri{Docker::Uri::parseUri(app_02.uri)};
+    table.startFetch(uri.app + "/" + uri.digest.hash());
+    table.save();
+  }
+  Utils::writeFile(blob_dir / "partial-fetch-blob", std::string("foo"));
+
+  app_engine = std::make_shared<Docker::RestorableAppEngine>(
+      skopeo_store_root_, apps_root_dir, daemon_.dataRoot(), registry_client_, docker_client_,
+      registry.getSkopeoClient(), daemon_.getUrl(), compose_cmd, getTestStorageSpaceFunc());
+  app_engine->prune({app_01});
+  ASSERT_FALSE(boost::filesystem::exists(blob_dir / "partial-fetch-blob"));
+  ASSERT_TRUE(app_engine->isFetched(app_01));
+  // the App fetched after the restart is not affected
+  ASSERT_TRUE(app_engine->fetch(app_02));
+  ASSERT_TRUE(app_engine->isFetched(app_02));
+}
+
 TEST_F(RestorableAppEngineTest, FetchAndCheckSizeNoLayersMeta) {
   // Check App update if the layers metadata containing precise size/usage are missing.
   // The restorableappengine is supposed to fallback to the estimated App update size calculation
@@ -0,0 +1,75 @@
+// Compares the in-process store check with `composectl check --local` on a synthetic store.
+//
+// Usage: storecheck-bench [<composectl path>] [<app number>] [<iterations>]
+//
+// The store contains <app number> Apps, 20 by default, each with two images of three layers. If the composectl path
+// is not specified, only the in-process check is measured.
+
+#include <chrono>
+#include <iostream>
+
+#include "composeapp/storechecker.h"
+#include "exec.h"
+
+#include "fixtures/composeappstore.cc"
+
+template <typename Func>
+static double measure(const std::string& name, int iterations, Func&& func) {
+  const auto started{std::chrono::steady_clock::now()};
+  for (int ii = 0; ii < iterations; ++ii) {
+    func();
+  }
+  const std::chrono::duration<double, std::milli> elapsed{std::chrono::steady_clock::now() - started};
+  std::cout << "  " << name << ": " << elapsed.count() << " ms total, " << elapsed.count() / iterations
+            << " ms per run" << std::endl;
+  return elapsed.count();
+}
+
+int main(int argc, char** argv) {
+  const std::string composectl{argc > 1 ? argv[1] : ""};
+  const int app_number{argc > 2 ? std::stoi(argv[2]) : 20};
+  const int iterations{argc > 3 ? std::stoi(argv[3]) : 10};
+
+  TemporaryDirectory store_dir;
+  fixtures::ComposeAppStore store{store_dir.Path()};
+  std::vector<std::string> app_uris;
+  for (int ii = 0; ii < app_number; ++ii) {
+    app_uris.emplace_back(store.addApp("app-" + std::to_string(ii)));
+  }
+
+  const composeapp::StoreChecker checker{store.root()};
+  std::cout << "check of " << app_number << " apps x " << iterations << std::endl;
+  const auto in_process{measure("in-process", iterations, [&]() {
+    for (const auto& uri : app_uris) {
+      if (!checker.check(uri, store.arch()).fetched()) {
+        throw std::runtime_error("app is not fetched: " + uri);
+      }
+    }
+  })};
+  if (composectl.empty()) {
+    return 0;
+  }
+
+  // AppEngine::isAppFetched() used to run composectl for each App
+  const auto composectl_per_app{measure("composectl per app", iterations, [&]() {
+    for (const auto& uri : app_uris) {
+      std::string output;
+      exec(composectl + " --store " + store.root().string() + " check " + uri + " --local --format json",
+           "composectl check failed", "", &output);
+    }
+  })};
+  // AppEngine::getAppsStatus() runs composectl once for all Apps
+  std::string cmd{composectl + " --store " + store.root().string() + " check"};
+  for (const auto& uri : app_uris) {
+    cmd += " " + uri;
+  }
+  cmd += " --local --format json";
+  const auto composectl_all{measure("composectl all apps", iterations, [&]() {
+    std::string output;
+    exec(cmd, "composectl check failed", "", &output);
+  })};
+
+  std::cout << "speedup: per app x" << composectl_per_app / in_process << ", all apps x" << composectl_all / in_process
+            << std::endl;
+  return 0;
+}
@@ -0,0 +1,95 @@
+#include <gtest/gtest.h>
+
+#include "composeapp/storechecker.h"
+#include "utilities/utils.h"
+
+#include "fixtures/composeappstore.cc"
+
+class StoreCheckerTest : public ::testing::Test {
+ protected:
+  Json::Value readBlobJson(const std::string& digest) const {
+    return Utils::parseJSONFile(store_.blobPath(digest));
+  }
+  // Returns the descriptors of the image manifest of the first App image
+  Json::Value getImageManifest(const std::string& app_uri) const {
+    const auto manifest{readBlobJson(app_uri.substr(app_uri.find('@') + 1))};
+    std::istringstream bundle{Utils::readFile(store_.blobPath(manifest["layers"][0]["digest"].asString()))};
+    const auto images{
+        composeapp::StoreChecker::getComposeImages(Utils::readFileFromArchive(bundle, "docker-compose.yml"))};
+    const auto index{readBlobJson(images.front().substr(images.front().find('@') + 1))};
+    return readBlobJson(index["manifests"][1]["digest"].asString());
+  }
+
+  TemporaryDirectory test_dir_;
+  fixtures::ComposeAppStore store_{test_dir_ / "store"};
+  composeapp::StoreChecker checker_{store_.root()};
+};
+
+TEST_F(StoreCheckerTest, Fetched) {
+  const auto app_uri{store_.addApp("app-01")};
+  ASSERT_TRUE(checker_.check(app_uri, store_.arch()).fetched());
+}
+
+TEST_F(StoreCheckerTest, MissingBlobs) {
+  const auto app_uri{store_.addApp("app-01")};
+  const auto image_manifest{getImageManifest(app_uri)};
+
+  const auto layer_digest{image_manifest["layers"][1]["digest"].asString()};
+  boost::filesystem::remove(store_.blobPath(layer_digest));
+  auto res{checker_.check(app_uri, store_.arch())};
+  ASSERT_EQ(res.missing_blobs.size(), 1);
+  ASSERT_EQ(res.missing_blobs[0].digest, layer_digest);
+  ASSERT_EQ(res.missing_blobs[0].size, image_manifest["layers"][1]["size"].asUInt64());
+
+  // a partially downloaded blob
+  const auto config_digest{image_manifest["config"]["digest"].asString()};
+  boost::filesystem::resize_file(store_.blobPath(config_digest), 1);
+  res = checker_.check(app_uri, store_.arch());
+  ASSERT_EQ(res.missing_blobs.size(), 2);
+  ASSERT_EQ(res.missing_blobs[0].digest, config_digest);
+
+  boost::filesystem::remove(store_.blobPath(app_uri.substr(app_uri.find('@') + 1)));
+  res = checker_.check(app_uri, store_.arch());
+  ASSERT_EQ(res.missing_blobs.size(), 1);
+  ASSERT_EQ(res.missing_blobs[0].digest, app_uri.substr(app_uri.find('@') + 1));
+}
+
+TEST_F(StoreCheckerTest, InvalidStore) {
+  const auto app_uri{store_.addApp("app-01")};
+  // no manifest for the given architecture in the image index
+  ASSERT_THROW(checker_.check(app_uri, "arm64"), std::runtime_error);
+
+  // the manifest content doesn't match its digest
+  Utils::writeFile(store_.blobPath(app_uri.substr(app_uri.find('@') + 1)), std::string("{}"));
+  ASSERT_THROW(checker_.check(app_uri, store_.arch()), std::runtime_error);
+}
+
+TEST(StoreChecker, GetComposeImages) {
+  const auto images{composeapp::StoreChecker::getComposeImages(R"(
+services:
+  srv-01:
+    image: hub.io/factory/image-01@sha256:01
+  srv-02:
+    image: "hub.io/factory/image-02@sha256:02"  # pinned
+    labels:
+      io.compose-spec.config-hash: 1234
+  srv-03: {image: 'hub.io/factory/image-03@sha256:03'}
+  srv-04:
+    image: >-
+      hub.io/factory/image-04@sha256:04
+)")};
+  ASSERT_EQ(images,
+            std::vector<std::string>({"hub.io/factory/image-01@sha256:01", "hub.io/factory/image-02@sha256:02",
+                                      "hub.io/factory/image-03@sha256:03", "hub.io/factory/image-04@sha256:04"}));
+  ASSERT_THROW(composeapp::StoreChecker::getComposeImages("services:\n  srv:\n    image: nginx:latest\n"),
+               std::runtime_error);
+  // a service without an image, e.g. built locally, cannot be checked
+  ASSERT_THROW(composeapp::StoreChecker::getComposeImages(
+                   "services:\n  srv-01:\n    image: hub.io/factory/image-01@sha256:01\n  srv-02:\n    build: .\n"),
+               std::runtime_error);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+
+#include <sys/stat.h>
+
+#include "docker/treeinstaller.h"
+#include "utilities/utils.h"
+
+class TreeInstallerTest : public ::testing::Test {
+ protected:
+  TreeInstallerTest() : src_dir_{test_dir_ / "src"}, dst_dir_{test_dir_ / "dst"} {
+    Utils::writeFile(src_dir_ / "docker-compose.yml", std::string("services:"));
+    Utils::writeFile(src_dir_ / "config" / "app.conf", std::string("foo: bar"));
+    Utils::writeFile(src_dir_ / "config" / "readonly.conf", std::string("bar: foo"));
+    boost::filesystem::permissions(src_dir_ / "config" / "readonly.conf", boost::filesystem::owner_read);
+    boost::filesystem::create_symlink("app.conf", src_dir_ / "config" / "link.conf");
+  }
+
+  static struct stat getStat(const boost::filesystem::path& file) {
+    struct stat st {};
+    EXPECT_EQ(::lstat(file.c_str(), &st), 0) << file;
+    return st;
+  }
+
+  TemporaryDirectory test_dir_;
+  const boost::filesystem::path src_dir_;
+  const boost::filesystem::path dst_dir_;
+};
+
+TEST_F(TreeInstallerTest, Install) {
+  Docker::TreeInstaller installer;
+  installer.install(src_dir_, dst_dir_);
+
+  ASSERT_EQ(Utils::readFile(dst_dir_ / "docker-compose.yml"), "services:");
+  ASSERT_EQ(Utils::readFile(dst_dir_ / "config" / "app.conf"), "foo: bar");
+  ASSERT_EQ(Utils::readFile(dst_dir_ / "config" / "readonly.conf"), "bar: foo");
+  ASSERT_EQ(boost::filesystem::read_symlink(dst_dir_ / "config" / "link.conf"), "app.conf");
+  ASSERT_EQ(getStat(dst_dir_ / "config" / "readonly.conf").st_mode,
+            getStat(src_dir_ / "config" / "readonly.conf").st_mode);
+  ASSERT_EQ(getStat(dst_dir_ / "config" / "app.conf").st_mtim.tv_sec,
+            getStat(src_dir_ / "config" / "app.conf").st_mtim.tv_sec);
+  // no file is hard-linked, so changing the installed file doesn't alter the store
+  ASSERT_NE(getStat(dst_dir_ / "config" / "app.conf").st_ino, getStat(src_dir_ / "config" / "app.conf").st_ino);
+  ASSERT_NE(getStat(dst_dir_ / "config" / "readonly.conf").st_ino,
+            getStat(src_dir_ / "config" / "readonly.conf").st_ino);
+  Utils::writeFile(dst_dir_ / "config" / "app.conf", std::string("changed"));
+  ASSERT_EQ(Utils::readFile(src_dir_ / "config" / "app.conf"), "foo: bar");
+}
+
+TEST_F(TreeInstallerTest, Reinstall) {
+  Docker::TreeInstaller installer;
+  Utils::writeFile(dst_dir_ / "docker-compose.yml", std::string("changed"));
+  Utils::writeFile(dst_dir_ / "data" / "volume", std::string("app data"));
+  installer.install(src_dir_, dst_dir_);
+  installer.install(src_dir_, dst_dir_);
+
+  // the installed files are replaced, the other ones are kept intact
+  ASSERT_EQ(Utils::readFile(dst_dir_ / "docker-compose.yml"), "services:");
+  ASSERT_EQ(Utils::readFile(dst_dir_ / "data" / "volume"), "app data");
+  ASSERT_EQ(Utils::readFile(dst_dir_ / "config" / "readonly.conf"), "bar: foo");
+  ASSERT_EQ(Utils::readFile(src_dir_ / "config" / "readonly.conf"), "bar: foo");
+}
+
+TEST_F(TreeInstallerTest, CanClone) {
+  Docker::TreeInstaller installer;
+  boost::filesystem::create_directories(dst_dir_);
+  const auto can_clone{installer.canClone(src_dir_, dst_dir_)};
+  // the probe files are removed and the result is cached
+  ASSERT_FALSE(boost::filesystem::exists(src_dir_ / ".aklite-clone-probe"));
+  ASSERT_FALSE(boost::filesystem::exists(dst_dir_ / ".aklite-clone-probe"));
+  ASSERT_EQ(installer.canClone(src_dir_, dst_dir_), can_clone);
+  ASSERT_THROW(installer.canClone(src_dir_, test_dir_ / "no-dir"), std::runtime_error);
+
+  installer.install(src_dir_, dst_dir_);
+  ASSERT_EQ(Utils::readFile(dst_dir_ / "config" / "app.conf"), "foo: bar");
+  ASSERT_FALSE(boost::filesystem::exists(dst_dir_ / ".aklite-clone-probe"));
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}